@@ -0,0 +1,569 @@
+/*
+ * Benchmark for dictionary backends.
+ *
+ * The file is compiled once per backend: `BENCH_BACKEND_HEADER' names the
+ * header of the backend under test and `BENCH_BACKEND' its name (see
+ * Makefile). For every size from `-m' to `-n' keys (multiplied by 10 at each
+ * step) a child process runs insert (or build with `-b'), get-hit, get-miss,
+ * get-many, mixed and delete workloads and reports ns/op, p50/p99/p999
+ * latency, peak RSS and bytes per live entry. With `-p' the dictionary is
+ * resized on a thread pool.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#ifndef BENCH_BACKEND_HEADER
+#define BENCH_BACKEND_HEADER "compact_dict.h"
+#define BENCH_BACKEND "compact_dict"
+#endif
+
+#include BENCH_BACKEND_HEADER
+#include "dict_hash.h"
+
+// Backend flags for `dict_init_flags', e.g. `DICT_ROBIN_HOOD'.
+#ifdef BENCH_DICT_FLAGS
+#define BENCH_DICT_INIT(hash_function) \
+    dict_init_flags((hash_function), BENCH_DICT_FLAGS)
+#define BENCH_DICT_BUILD(hash_function, keys, values, n, pool) \
+    dict_build((hash_function), BENCH_DICT_FLAGS, (keys), (values), (n), (pool))
+#else
+#define BENCH_DICT_INIT(hash_function) dict_init(hash_function)
+#define BENCH_DICT_BUILD(hash_function, keys, values, n, pool) \
+    dict_build((hash_function), 0, (keys), (values), (n), (pool))
+#endif
+
+
+// Every `BENCH_SAMPLE_EVERY'th operation is timed individually for latency
+// percentiles. The rest run back to back, so ns/op is not dominated by clock
+// reads.
+#define BENCH_SAMPLE_EVERY 8
+
+// Latency histogram: values below 2^BENCH_HIST_SUB_BITS ns are exact, larger
+// values are grouped into 2^BENCH_HIST_SUB_BITS buckets per power of two.
+#define BENCH_HIST_SUB_BITS 4
+#define BENCH_HIST_SUB (1 << BENCH_HIST_SUB_BITS)
+#define BENCH_HIST_SIZE (64 * BENCH_HIST_SUB)
+
+// Keys per `dict_get_many' call of the get-many workload.
+#define BENCH_GET_MANY_BATCH 64
+
+// Share of each operation in the mixed workload, in percents.
+#define BENCH_MIXED_GET 80
+#define BENCH_MIXED_SET 10
+
+
+/**
+ * Latency histogram.
+ */
+struct bench_hist
+{
+    uint64_t buckets[BENCH_HIST_SIZE];
+    uint64_t count;
+};
+
+
+/**
+ * Keys used by one benchmark run.
+ */
+struct bench_keys
+{
+    size_t n;
+    // Keys inserted into dictionary.
+    char **hit;
+    // Keys never inserted by insert workload.
+    char **miss;
+    // Random permutation of [0, n).
+    uint32_t *order;
+    char *hit_buffer;
+    char *miss_buffer;
+};
+
+
+// Sink for looked up values, so lookups are not optimized out.
+static volatile uintptr_t bench_sink;
+
+
+/**
+ * Malloc. Exit on failure.
+ */
+static inline void *
+safe_malloc(size_t size)
+{
+    void *ptr = malloc(size);
+    if (ptr == NULL) {
+        printf("fatal: Memory allocation failed\n");
+        exit(1);
+    }
+
+    return ptr;
+}
+
+
+/**
+ * Xorshift64* pseudo-random generator.
+ */
+static inline uint64_t
+_rand_next(uint64_t *state)
+{
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+
+/**
+ * Monotonic time in nanoseconds.
+ */
+static inline uint64_t
+_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+/**
+ * Current resident set size in bytes (0 if unknown).
+ */
+static size_t
+_current_rss(void)
+{
+    size_t pages = 0;
+    size_t resident = 0;
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (f != NULL) {
+        if (fscanf(f, "%zu %zu", &pages, &resident) != 2) {
+            resident = 0;
+        }
+        fclose(f);
+    }
+
+    return resident * (size_t) sysconf(_SC_PAGESIZE);
+}
+
+
+/**
+ * Peak resident set size in bytes.
+ */
+static size_t
+_peak_rss(void)
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    // Linux reports kilobytes.
+    return (size_t) usage.ru_maxrss * 1024;
+}
+
+
+/**
+ * Histogram bucket for given latency.
+ */
+static inline size_t
+_hist_bucket(uint64_t ns)
+{
+    if (ns < BENCH_HIST_SUB) {
+        return ns;
+    }
+
+    int msb = 63 - __builtin_clzll(ns);
+    int shift = msb - BENCH_HIST_SUB_BITS;
+    size_t sub = (ns >> shift) & (BENCH_HIST_SUB - 1);
+
+    return (size_t) (shift + 1) * BENCH_HIST_SUB + sub;
+}
+
+
+/**
+ * Lowest latency falling into given histogram bucket.
+ */
+static inline uint64_t
+_hist_bucket_value(size_t bucket)
+{
+    if (bucket < BENCH_HIST_SUB) {
+        return bucket;
+    }
+
+    int shift = (int) (bucket / BENCH_HIST_SUB) - 1;
+    uint64_t sub = bucket % BENCH_HIST_SUB;
+
+    return (BENCH_HIST_SUB + sub) << shift;
+}
+
+
+/**
+ * Add latency to histogram.
+ */
+static inline void
+_hist_add(struct bench_hist *h, uint64_t ns)
+{
+    ++h->buckets[_hist_bucket(ns)];
+    ++h->count;
+}
+
+
+/**
+ * Return latency percentile (0 < p < 1) from histogram.
+ */
+static uint64_t
+_hist_percentile(struct bench_hist *h, double p)
+{
+    uint64_t rank = (uint64_t) (p * h->count);
+    uint64_t seen = 0;
+    for (size_t i = 0; i < BENCH_HIST_SIZE; ++i) {
+        seen += h->buckets[i];
+        if (seen > rank) {
+            return _hist_bucket_value(i);
+        }
+    }
+
+    return 0;
+}
+
+
+/**
+ * Fill `count' fixed-width keys "<prefix><number>" into one buffer.
+ */
+static char *
+_make_keys(char **keys, size_t count, char prefix, size_t stride)
+{
+    char *buffer = safe_malloc(count * stride);
+    for (size_t i = 0; i < count; ++i) {
+        keys[i] = buffer + i * stride;
+        snprintf(keys[i], stride, "%c%zu", prefix, i);
+    }
+
+    return buffer;
+}
+
+
+/**
+ * Generate keys and random access order for `n' keys.
+ */
+static void
+_keys_init(struct bench_keys *k, size_t n, uint64_t *rng)
+{
+    // Prefix, decimal digits and terminating zero.
+    char tmp[32];
+    size_t stride = snprintf(tmp, sizeof(tmp), "%zu", n) + 2;
+
+    k->n = n;
+    k->hit = safe_malloc(sizeof(char *) * n);
+    k->miss = safe_malloc(sizeof(char *) * n);
+    k->hit_buffer = _make_keys(k->hit, n, 'h', stride);
+    k->miss_buffer = _make_keys(k->miss, n, 'm', stride);
+
+    k->order = safe_malloc(sizeof(uint32_t) * n);
+    for (size_t i = 0; i < n; ++i) {
+        k->order[i] = i;
+    }
+    for (size_t i = n - 1; i > 0; --i) {
+        size_t j = _rand_next(rng) % (i + 1);
+        uint32_t tmp_idx = k->order[i];
+        k->order[i] = k->order[j];
+        k->order[j] = tmp_idx;
+    }
+}
+
+
+/**
+ * Free keys.
+ */
+static void
+_keys_destroy(struct bench_keys *k)
+{
+    free(k->hit);
+    free(k->miss);
+    free(k->hit_buffer);
+    free(k->miss_buffer);
+    free(k->order);
+}
+
+
+/**
+ * Print one result row.
+ */
+static void
+_report(
+    const char *workload,
+    size_t n,
+    uint64_t elapsed_ns,
+    size_t ops,
+    struct bench_hist *h,
+    size_t rss_base,
+    size_t live)
+{
+    size_t rss = _current_rss();
+    double bytes_per_entry = 0.0;
+    if (live > 0 && rss > rss_base) {
+        bytes_per_entry = (double) (rss - rss_base) / live;
+    }
+
+    printf(
+        "%-22s %-9s %10zu %9.1f %8" PRIu64 " %8" PRIu64 " %8" PRIu64
+        " %10.1f %9.1f\n",
+        BENCH_BACKEND,
+        workload,
+        n,
+        (double) elapsed_ns / ops,
+        _hist_percentile(h, 0.50),
+        _hist_percentile(h, 0.99),
+        _hist_percentile(h, 0.999),
+        (double) _peak_rss() / (1024 * 1024),
+        bytes_per_entry);
+    fflush(stdout);
+}
+
+
+// Run `OP' (which uses loop variable `i') `N' times, timing every
+// `BENCH_SAMPLE_EVERY'th call into histogram `H'. Total time goes to
+// `ELAPSED'.
+#define BENCH_LOOP(N, H, ELAPSED, OP)                                       \
+    do {                                                                    \
+        uint64_t _start = _now_ns();                                        \
+        for (size_t i = 0; i < (N); ++i) {                                  \
+            if (i % BENCH_SAMPLE_EVERY == 0) {                              \
+                uint64_t _t0 = _now_ns();                                   \
+                OP;                                                         \
+                _hist_add((H), _now_ns() - _t0);                            \
+            } else {                                                        \
+                OP;                                                         \
+            }                                                               \
+        }                                                                   \
+        (ELAPSED) = _now_ns() - _start;                                     \
+    } while (0)
+
+
+/**
+ * Run one random operation of mixed workload.
+ */
+static inline void
+_mixed_op(struct dict *d, struct bench_keys *k, uint64_t *rng)
+{
+    uint64_t r = _rand_next(rng);
+    // Keys are taken from both hit and miss sets, so about a half of
+    // operations target absent keys.
+    size_t idx = (r >> 17) % k->n;
+    const char *key = ((r >> 16) & 1) ? k->hit[idx] : k->miss[idx];
+    unsigned int op = (r & 0xffff) % 100;
+
+    if (op < BENCH_MIXED_GET) {
+        bench_sink += (uintptr_t) dict_get(d, key);
+    } else if (op < BENCH_MIXED_GET + BENCH_MIXED_SET) {
+        dict_set(d, key, key);
+    } else {
+        dict_del(d, key);
+    }
+}
+
+
+/**
+ * Run all workloads for `n' keys. With `reserve', room for the keys is
+ * reserved before inserting them. With `build_threads' above 0, keys are
+ * loaded by `dict_build' on that many threads instead. With `resize_threads'
+ * above 1, the dictionary is resized on a pool of that many threads.
+ */
+static void
+_run_size(size_t n, bool reserve, size_t build_threads, size_t resize_threads)
+{
+    uint64_t rng = 0x9E3779B97F4A7C15ULL ^ n;
+    struct bench_keys k;
+    _keys_init(&k, n, &rng);
+
+    size_t rss_base = _current_rss();
+    struct bench_hist *h = safe_malloc(sizeof(struct bench_hist));
+    uint64_t elapsed;
+
+    struct dict_pool *resize_pool = (
+        resize_threads > 1 ? dict_pool_create(resize_threads) : NULL);
+    struct dict *d;
+    memset(h, 0, sizeof(*h));
+    if (build_threads > 0) {
+        struct dict_pool *pool = (
+            build_threads > 1 ? dict_pool_create(build_threads) : NULL);
+        const char *const *keys = (const char *const *) k.hit;
+
+        uint64_t start = _now_ns();
+        d = BENCH_DICT_BUILD(&dict_hash, keys, keys, n, pool);
+        elapsed = _now_ns() - start;
+        _hist_add(h, elapsed);
+        _report("build", n, elapsed, n, h, rss_base, d->len);
+        dict_set_pool(d, resize_pool);
+
+        if (pool != NULL) {
+            dict_pool_destroy(pool);
+        }
+    } else {
+        d = BENCH_DICT_INIT(&dict_hash);
+        dict_set_pool(d, resize_pool);
+        if (reserve) {
+            dict_reserve(d, n);
+        }
+
+        BENCH_LOOP(n, h, elapsed, dict_set(d, k.hit[i], k.hit[i]));
+        _report("insert", n, elapsed, n, h, rss_base, d->len);
+    }
+
+    memset(h, 0, sizeof(*h));
+    BENCH_LOOP(n, h, elapsed,
+        bench_sink += (uintptr_t) dict_get(d, k.hit[k.order[i]]));
+    _report("get-hit", n, elapsed, n, h, rss_base, d->len);
+
+    memset(h, 0, sizeof(*h));
+    BENCH_LOOP(n, h, elapsed,
+        bench_sink += (uintptr_t) dict_get(d, k.miss[k.order[i]]));
+    _report("get-miss", n, elapsed, n, h, rss_base, d->len);
+
+    // Same keys as get-hit, looked up in batches. Latency is per key.
+    const char **batch_keys = safe_malloc(sizeof(char *) * n);
+    const char *batch_values[BENCH_GET_MANY_BATCH];
+    for (size_t i = 0; i < n; ++i) {
+        batch_keys[i] = k.hit[k.order[i]];
+    }
+    memset(h, 0, sizeof(*h));
+    uint64_t start = _now_ns();
+    for (size_t i = 0; i < n; i += BENCH_GET_MANY_BATCH) {
+        size_t count = n - i;
+        if (count > BENCH_GET_MANY_BATCH) {
+            count = BENCH_GET_MANY_BATCH;
+        }
+
+        uint64_t t0 = _now_ns();
+        dict_get_many(d, batch_keys + i, count, batch_values);
+        _hist_add(h, (_now_ns() - t0) / count);
+        bench_sink += (uintptr_t) batch_values[0];
+    }
+    elapsed = _now_ns() - start;
+    _report("get-many", n, elapsed, n, h, rss_base, d->len);
+    free(batch_keys);
+
+    memset(h, 0, sizeof(*h));
+    BENCH_LOOP(n, h, elapsed, _mixed_op(d, &k, &rng));
+    _report("mixed", n, elapsed, n, h, rss_base, d->len);
+
+    // Miss keys added by mixed workload stay in dictionary until
+    // `dict_destroy'.
+    memset(h, 0, sizeof(*h));
+    BENCH_LOOP(n, h, elapsed, dict_del(d, k.hit[k.order[i]]));
+    _report("delete", n, elapsed, n, h, rss_base, d->len);
+
+    dict_destroy(d);
+    if (resize_pool != NULL) {
+        dict_pool_destroy(resize_pool);
+    }
+    free(h);
+    _keys_destroy(&k);
+}
+
+
+/**
+ * Print usage and exit.
+ */
+static void
+_usage(const char *prog)
+{
+    fprintf(
+        stderr,
+        "usage: %s [-m MIN_KEYS] [-n MAX_KEYS] [-r] [-b THREADS]"
+        " [-p THREADS] [-H]\n"
+        "  -m  smallest dictionary size (default 1000)\n"
+        "  -n  largest dictionary size (default 100000000)\n"
+        "  -r  reserve room for all keys before inserting them\n"
+        "  -b  load keys with dict_build on THREADS threads instead of\n"
+        "      inserting them one by one\n"
+        "  -p  resize dictionary on THREADS threads\n"
+        "  -H  do not print header\n",
+        prog);
+    exit(2);
+}
+
+
+int main(int argc, char **argv)
+{
+    size_t min_keys = 1000;
+    size_t max_keys = 100000000;
+    bool reserve = false;
+    size_t build_threads = 0;
+    size_t resize_threads = 0;
+    bool header = true;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "m:n:rb:p:H")) != -1) {
+        switch (opt) {
+        case 'm':
+            min_keys = strtoull(optarg, NULL, 10);
+            break;
+        case 'n':
+            max_keys = strtoull(optarg, NULL, 10);
+            break;
+        case 'r':
+            reserve = true;
+            break;
+        case 'b':
+            build_threads = strtoull(optarg, NULL, 10);
+            if (build_threads == 0) {
+                _usage(argv[0]);
+            }
+            break;
+        case 'p':
+            resize_threads = strtoull(optarg, NULL, 10);
+            if (resize_threads == 0) {
+                _usage(argv[0]);
+            }
+            break;
+        case 'H':
+            header = false;
+            break;
+        default:
+            _usage(argv[0]);
+        }
+    }
+    if (min_keys == 0 || max_keys < min_keys || max_keys > UINT32_MAX) {
+        _usage(argv[0]);
+    }
+
+    if (header) {
+        printf(
+            "%-22s %-9s %10s %9s %8s %8s %8s %10s %9s\n",
+            "backend", "workload", "keys", "ns/op", "p50", "p99", "p999",
+            "peak_MiB", "B/entry");
+        fflush(stdout);
+    }
+
+    for (size_t n = min_keys; n <= max_keys; n *= 10) {
+        // Every size runs in its own process, so peak RSS is not inherited
+        // from bigger runs.
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            return 1;
+        } else if (pid == 0) {
+            _run_size(n, reserve, build_threads, resize_threads);
+            exit(0);
+        }
+
+        int status;
+        waitpid(pid, &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            fprintf(stderr, "%s: run with %zu keys failed\n", argv[0], n);
+            return 1;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,303 @@
+/*
+ * Scalability benchmark for sharded dictionary.
+ *
+ * Compiled once per backend like bench.c (see Makefile). A dictionary of
+ * `-n' keys is shared by 1, 2, 4, ... up to `-t' threads running a mixed
+ * get/set workload, once with a single shard (one lock for the whole
+ * dictionary) and once with `-s' shards. Backends which are thread-safe by
+ * themselves (`DICT_THREAD_SAFE', or with `DICT_CONCURRENT' flag) are also
+ * run without shards, reported as 0 shards. Reports total throughput and
+ * speedup over one thread.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#ifndef BENCH_BACKEND_HEADER
+#define BENCH_BACKEND_HEADER "compact_dict.h"
+#define BENCH_BACKEND "compact_dict"
+#endif
+
+#include BENCH_BACKEND_HEADER
+#include "dict_hash.h"
+#include "sharded_dict.h"
+
+
+// Share of gets in the workload, in percents. The rest are sets.
+#define BENCH_GET_PERCENT 90
+
+
+// Flags making the backend thread-safe without shards, if it has any.
+#if defined(DICT_THREAD_SAFE)
+#define BENCH_UNSHARDED_FLAGS 0
+#elif defined(DICT_CONCURRENT)
+#define BENCH_UNSHARDED_FLAGS DICT_CONCURRENT
+#endif
+
+
+/**
+ * State of one benchmark thread.
+ */
+struct bench_thread
+{
+    pthread_t thread;
+    struct sharded_dict *sd;
+    // Dictionary used directly instead of `sd', if not NULL.
+    struct dict *d;
+    char **keys;
+    size_t n;
+    size_t ops;
+    uint64_t seed;
+};
+
+
+static volatile uintptr_t bench_sink;
+
+
+/**
+ * Malloc. Exit on failure.
+ */
+static inline void *
+safe_malloc(size_t size)
+{
+    void *ptr = malloc(size);
+    if (ptr == NULL) {
+        printf("fatal: Memory allocation failed\n");
+        exit(1);
+    }
+
+    return ptr;
+}
+
+
+/**
+ * Monotonic time in nanoseconds.
+ */
+static inline uint64_t
+_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+/**
+ * xorshift64* generator.
+ */
+static inline uint64_t
+_rand_next(uint64_t *state)
+{
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+
+/**
+ * Run workload of one thread.
+ */
+static void *
+_run_thread(void *arg)
+{
+    struct bench_thread *t = arg;
+    uint64_t rng = t->seed;
+    uintptr_t sink = 0;
+
+    for (size_t i = 0; i < t->ops; ++i) {
+        uint64_t r = _rand_next(&rng);
+        const char *key = t->keys[(r >> 8) % t->n];
+        if ((r & 0xff) % 100 < BENCH_GET_PERCENT) {
+            sink += (uintptr_t) (
+                t->d != NULL ? dict_get(t->d, key) :
+                sharded_dict_get(t->sd, key));
+        } else if (t->d != NULL) {
+            dict_set(t->d, key, key);
+        } else {
+            sharded_dict_set(t->sd, key, key);
+        }
+    }
+    bench_sink += sink;
+
+    return NULL;
+}
+
+
+/**
+ * Run workload on `threads' threads and return operations per second. `d'
+ * is used instead of `sd' if not NULL.
+ */
+static double
+_run(
+    struct sharded_dict *sd,
+    struct dict *d,
+    char **keys,
+    size_t n,
+    size_t threads,
+    size_t ops)
+{
+    struct bench_thread *t = safe_malloc(sizeof(*t) * threads);
+
+    uint64_t start = _now_ns();
+    for (size_t i = 0; i < threads; ++i) {
+        t[i].sd = sd;
+        t[i].d = d;
+        t[i].keys = keys;
+        t[i].n = n;
+        t[i].ops = ops;
+        t[i].seed = 0x9E3779B97F4A7C15ULL * (i + 1);
+        if (pthread_create(&t[i].thread, NULL, _run_thread, &t[i]) != 0) {
+            printf("fatal: Thread creation failed\n");
+            exit(1);
+        }
+    }
+    for (size_t i = 0; i < threads; ++i) {
+        pthread_join(t[i].thread, NULL);
+    }
+    uint64_t elapsed = _now_ns() - start;
+
+    free(t);
+
+    return (double) ops * threads * 1e9 / elapsed;
+}
+
+
+/**
+ * Print usage and exit.
+ */
+static void
+_usage(const char *prog)
+{
+    fprintf(
+        stderr,
+        "usage: %s [-n KEYS] [-t MAX_THREADS] [-s SHARDS] [-o OPS] [-H]\n"
+        "  -n  number of keys (default 1000000)\n"
+        "  -t  largest number of threads (default: online CPUs)\n"
+        "  -s  number of shards (default 256)\n"
+        "  -o  operations per thread (default 1000000)\n"
+        "  -H  do not print header\n",
+        prog);
+    exit(2);
+}
+
+
+int main(int argc, char **argv)
+{
+    size_t n = 1000000;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t max_threads = cpus > 0 ? (size_t) cpus : 1;
+    size_t shards = 256;
+    size_t ops = 1000000;
+    bool header = true;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:t:s:o:H")) != -1) {
+        switch (opt) {
+        case 'n':
+            n = strtoull(optarg, NULL, 10);
+            break;
+        case 't':
+            max_threads = strtoull(optarg, NULL, 10);
+            break;
+        case 's':
+            shards = strtoull(optarg, NULL, 10);
+            break;
+        case 'o':
+            ops = strtoull(optarg, NULL, 10);
+            break;
+        case 'H':
+            header = false;
+            break;
+        default:
+            _usage(argv[0]);
+        }
+    }
+    if (n == 0 || max_threads == 0 || shards == 0) {
+        _usage(argv[0]);
+    }
+
+    char tmp[32];
+    size_t stride = snprintf(tmp, sizeof(tmp), "%zu", n) + 2;
+    char *buffer = safe_malloc(n * stride);
+    char **keys = safe_malloc(sizeof(char *) * n);
+    for (size_t i = 0; i < n; ++i) {
+        keys[i] = buffer + i * stride;
+        snprintf(keys[i], stride, "k%zu", i);
+    }
+
+    if (header) {
+        printf(
+            "%-22s %7s %7s %12s %8s\n",
+            "backend", "shards", "threads", "Mops/s", "speedup");
+        fflush(stdout);
+    }
+
+    size_t shard_counts[] = {1, shards};
+    for (size_t s = 0; s < 2; ++s) {
+        struct sharded_dict *sd = sharded_dict_init(
+            &dict_hash, 0, shard_counts[s]);
+        for (size_t i = 0; i < n; ++i) {
+            sharded_dict_set(sd, keys[i], keys[i]);
+        }
+
+        double base = 0.0;
+        for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+            double rate = _run(sd, NULL, keys, n, threads, ops);
+            if (threads == 1) {
+                base = rate;
+            }
+            printf(
+                "%-22s %7zu %7zu %12.2f %8.2f\n",
+                BENCH_BACKEND, sd->shards_count, threads, rate / 1e6,
+                rate / base);
+            fflush(stdout);
+
+            if (threads < max_threads && threads * 2 > max_threads) {
+                threads = max_threads / 2;
+            }
+        }
+
+        sharded_dict_destroy(sd);
+    }
+
+#ifdef BENCH_UNSHARDED_FLAGS
+    struct dict *d = dict_init_flags(&dict_hash, BENCH_UNSHARDED_FLAGS);
+    for (size_t i = 0; i < n; ++i) {
+        dict_set(d, keys[i], keys[i]);
+    }
+
+    double base = 0.0;
+    for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+        double rate = _run(NULL, d, keys, n, threads, ops);
+        if (threads == 1) {
+            base = rate;
+        }
+        printf(
+            "%-22s %7d %7zu %12.2f %8.2f\n",
+            BENCH_BACKEND, 0, threads, rate / 1e6, rate / base);
+        fflush(stdout);
+
+        if (threads < max_threads && threads * 2 > max_threads) {
+            threads = max_threads / 2;
+        }
+    }
+
+    dict_destroy(d);
+#endif
+
+    free(keys);
+    free(buffer);
+
+    return 0;
+}
@@ -3,8 +3,20 @@
 #include <string.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "compact_dict.h"
+#include "dict_arena.h"
+#include "dict_bulk.h"
+#include "dict_epoch.h"
+#include "dict_instr.h"
+#include "dict_log.h"
+#include "dict_pool.h"
+#include "dict_stream.h"
 
 
 /**
@@ -48,25 +60,79 @@ safe_realloc(void *mem, size_t size)
 #define ENTRY_EMPTY -1
 
 
+// `DICT_INCREMENTAL' dictionary moves up to `DICT_REHASH_STEP' alive entries
+// per operation, skipping at most `DICT_REHASH_STEP' * 10 deleted ones.
+#define DICT_REHASH_STEP 16
+
+
+// `dict_get_many' interleaves lookups of this many keys.
+#define DICT_GET_BATCH 16
+
+
+// `dict_build' indexes keys by regions of this many index slots, one task
+// per region, so every task writes to a cache-sized part of the index.
+#define DICT_BUILD_REGION_SIZE 65536
+
+
+// Dictionary with a pool rebuilds index of at least this many entries on
+// pool threads; smaller ones are not worth waking them.
+#define DICT_POOL_REBUILD_MIN 65536
+
+
+// `dict_rewrite_log' copies this many entries per writer lock taken.
+#define DICT_LOG_REWRITE_BATCH 4096
+
+
+// `dict_scan' cursor holds entries array position in the low bits and
+// generation of the array (see `entries_generation') in the high ones.
+#define DICT_SCAN_GENERATION_SHIFT 48
+#define DICT_SCAN_POSITION_MASK \
+    ((UINT64_C(1) << DICT_SCAN_GENERATION_SHIFT) - 1)
+// `dict_scan' visits up to this many times `count' positions, deleted
+// entries included.
+#define DICT_SCAN_MAX_VISITS 10
+
+
+// Snapshot file written by `dict_save': header, index array, index tags,
+// entries (`struct dict_file_entry') and heap of zero-terminated keys and
+// values. Sections start at multiples of `DICT_FILE_ALIGN' bytes. Numbers
+// are stored in byte order of the writer, which is checked by reader along
+// with version and hash function (by hash of `DICT_FILE_HASH_PROBE').
+#define DICT_FILE_MAGIC "CDICTSNP"
+#define DICT_FILE_VERSION 1
+#define DICT_FILE_BYTE_ORDER 0x01020304
+#define DICT_FILE_ALIGN 64
+#define DICT_FILE_HASH_PROBE "compact_dict"
+// `value_offset' of entry without value.
+#define DICT_FILE_NO_VALUE UINT64_MAX
+
+
 /**
  * Return value of Nth item from given index array.
+ *
+ * Switches on item size, so it is only used outside of probe loops. Probe
+ * loops are specialized per item type by `DEFINE_INDEX_OPS'.
+ *
+ * Slots are read with acquire and written with release ordering: lookups of
+ * `DICT_CONCURRENT' dictionary must see the tag and the entry of a slot
+ * once they see the slot filled. Both are plain moves on x86.
  */
-static inline int
-_index_array_get(void *arr, size_t item_size, int idx)
+static inline int64_t
+_index_array_get(void *arr, size_t item_size, size_t idx)
 {
-    int res;
+    int64_t res;
     switch (item_size) {
     case sizeof(int8_t):
-        res = ((int8_t *) arr)[idx];
+        res = __atomic_load_n((int8_t *) arr + idx, __ATOMIC_ACQUIRE);
         break;
     case sizeof(int16_t):
-        res = ((int16_t *) arr)[idx];
+        res = __atomic_load_n((int16_t *) arr + idx, __ATOMIC_ACQUIRE);
         break;
     case sizeof(int32_t):
-        res = ((int32_t *) arr)[idx];
+        res = __atomic_load_n((int32_t *) arr + idx, __ATOMIC_ACQUIRE);
         break;
     default:
-        res = ((int64_t *) arr)[idx];
+        res = __atomic_load_n((int64_t *) arr + idx, __ATOMIC_ACQUIRE);
     }
 
     return res;
@@ -77,20 +143,20 @@ _index_array_get(void *arr, size_t item_size, int idx)
  * Set value of Nth item of given index array.
  */
 static inline void
-_index_array_set(void *arr, size_t item_size, int idx, int value)
+_index_array_set(void *arr, size_t item_size, size_t idx, int64_t value)
 {
     switch (item_size) {
     case sizeof(int8_t):
-        ((int8_t *) arr)[idx] = value;
+        __atomic_store_n((int8_t *) arr + idx, value, __ATOMIC_RELEASE);
         break;
     case sizeof(int16_t):
-        ((int16_t *) arr)[idx] = value;
+        __atomic_store_n((int16_t *) arr + idx, value, __ATOMIC_RELEASE);
         break;
     case sizeof(int32_t):
-        ((int32_t *) arr)[idx] = value;
+        __atomic_store_n((int32_t *) arr + idx, value, __ATOMIC_RELEASE);
         break;
     default:
-        ((int64_t *) arr)[idx] = value;
+        __atomic_store_n((int64_t *) arr + idx, value, __ATOMIC_RELEASE);
     }
 }
 
@@ -103,10 +169,8 @@ _index_array_init(size_t size, size_t item_size)
 {
     void *arr = safe_malloc(size * item_size);
 
-    // TODO: Rewrite using _Generic or #define.
-    for (size_t i = 0; i < size; ++i) {
-        _index_array_set(arr, item_size, i, ENTRY_EMPTY);
-    }
+    // `ENTRY_EMPTY' is -1, i.e. all bits set for every item size.
+    memset(arr, 0xff, size * item_size);
 
     return arr;
 }
@@ -122,6 +186,16 @@ _index_array_destroy(void *arr)
 }
 
 
+/**
+ * Index tag for given hash.
+ */
+static inline uint8_t
+_hash_tag(uint64_t hash)
+{
+    return hash >> (sizeof(hash) * 8 - 8);
+}
+
+
 /**
  * Allocate entries array.
  */
@@ -146,322 +220,2668 @@ _entries_array_destroy(struct dict_entry *arr)
  * Is entry matches.
  */
 static inline bool
-_is_entry_matches(struct dict_entry entry, unsigned int hash, const char *key)
+_is_entry_matches(
+    struct dict_entry *entry, uint64_t hash, const char *key, size_t key_len)
 {
-    return (entry.hash == hash && strcmp(entry.key, key) == 0);
+    return (
+        entry->hash == hash &&
+        entry->key_len == key_len &&
+        // Key of deleted entry may be replaced by concurrent `_set'.
+        DICT_INSTR_MEMCMP(
+            __atomic_load_n(&entry->key, __ATOMIC_RELAXED), key, key_len)
+                == 0
+    );
+}
+
+
+// Define index operations for index array of `T' items:
+//   _lookup_T(entries, index, tags, size, hash, key, key_len, &index_pos) -
+//       see `_lookup_index';
+//   _find_empty_slot_T(d, hash) - first empty slot on probe path of `hash';
+//   _index_entries_T(d) - add all alive entries to empty index.
+#define DEFINE_INDEX_OPS(T)                                                 \
+                                                                            \
+static inline struct dict_entry *                                           \
+_lookup_##T(                                                                \
+    struct dict_entry *entries,                                             \
+    const T *index,                                                         \
+    const uint8_t *tags,                                                    \
+    size_t index_size,                                                      \
+    uint64_t hash,                                                          \
+    const char *key,                                                        \
+    size_t key_len,                                                         \
+    size_t *index_pos)                                                      \
+{                                                                           \
+    uint8_t tag = _hash_tag(hash);                                          \
+    size_t pos = hash % index_size;                                         \
+    size_t probes = 1;                                                      \
+                                                                            \
+    T index_val;                                                            \
+    while ((index_val = __atomic_load_n(                                    \
+            &index[pos], __ATOMIC_ACQUIRE)) != ENTRY_EMPTY) {               \
+        if (tags[pos] == tag) {                                             \
+            struct dict_entry *entry = &entries[index_val];                 \
+            if (_is_entry_matches(entry, hash, key, key_len)) {             \
+                *index_pos = pos;                                           \
+                DICT_INSTR_LOOKUP(key, key_len, probes);                    \
+                                                                            \
+                return entry;                                               \
+            }                                                               \
+        }                                                                   \
+                                                                            \
+        pos = (pos + 1) % index_size;                                       \
+        ++probes;                                                           \
+    }                                                                       \
+                                                                            \
+    *index_pos = pos;                                                       \
+    DICT_INSTR_LOOKUP(key, key_len, probes);                                \
+                                                                            \
+    return NULL;                                                            \
+}                                                                           \
+                                                                            \
+static inline size_t                                                        \
+_find_empty_slot_##T(struct dict *d, uint64_t hash)                         \
+{                                                                           \
+    const T *index = d->index_array;                                        \
+    size_t pos = hash % d->index_array_size;                                \
+    while (index[pos] != ENTRY_EMPTY) {                                     \
+        pos = (pos + 1) % d->index_array_size;                              \
+    }                                                                       \
+                                                                            \
+    return pos;                                                             \
+}                                                                           \
+                                                                            \
+static void                                                                 \
+_index_entries_##T(struct dict *d)                                          \
+{                                                                           \
+    T *index = d->index_array;                                              \
+    for (size_t i = 0; i < d->entries_array_size; ++i) {                    \
+        struct dict_entry *entry = &d->entries_array[i];                    \
+        if (entry->is_alive) {                                              \
+            size_t pos = _find_empty_slot_##T(d, entry->hash);              \
+            index[pos] = i;                                                 \
+            d->index_tags[pos] = _hash_tag(entry->hash);                    \
+        }                                                                   \
+    }                                                                       \
 }
 
 
+DEFINE_INDEX_OPS(int8_t)
+DEFINE_INDEX_OPS(int16_t)
+DEFINE_INDEX_OPS(int32_t)
+DEFINE_INDEX_OPS(int64_t)
+
+
 /**
- * Return size of index array item by entries array size.
+ * Find key in given index of `entries'. Return its entry (alive or not), or
+ * NULL if the key is not indexed. `*index_pos' is set to the slot of the
+ * entry, or to the empty slot which ended probing.
+ *
+ * Slots which tag does not match are skipped without loading the entry.
  */
-static inline size_t
-_get_index_array_item_size_by_entries_array_size(size_t size)
+static inline struct dict_entry *
+_lookup_index(
+    struct dict_entry *entries,
+    void *index,
+    const uint8_t *tags,
+    size_t index_size,
+    size_t index_item_size,
+    uint64_t hash,
+    const char *key,
+    size_t key_len,
+    size_t *index_pos)
 {
-    size_t index_array_item_size;
-    if (size <= INT8_MAX) {
-        index_array_item_size = sizeof(int8_t);
-    } else if (size <= INT16_MAX) {
-        index_array_item_size = sizeof(int16_t);
-    } else if (size <= INT32_MAX) {
-        index_array_item_size = sizeof(int32_t);
-    } else {
-        index_array_item_size = sizeof(int64_t);
+    switch (index_item_size) {
+    case sizeof(int8_t):
+        return _lookup_int8_t(
+            entries, index, tags, index_size, hash, key, key_len, index_pos);
+    case sizeof(int16_t):
+        return _lookup_int16_t(
+            entries, index, tags, index_size, hash, key, key_len, index_pos);
+    case sizeof(int32_t):
+        return _lookup_int32_t(
+            entries, index, tags, index_size, hash, key, key_len, index_pos);
+    default:
+        return _lookup_int64_t(
+            entries, index, tags, index_size, hash, key, key_len, index_pos);
     }
+}
 
-    return index_array_item_size;
+
+/**
+ * Find key in dictionary index, see `_lookup_index'.
+ */
+static inline struct dict_entry *
+_lookup(
+    struct dict *d,
+    uint64_t hash,
+    const char *key,
+    size_t key_len,
+    size_t *index_pos)
+{
+    return _lookup_index(
+        d->entries_array,
+        d->index_array,
+        d->index_tags,
+        d->index_array_size,
+        d->index_array_item_size,
+        hash,
+        key,
+        key_len,
+        index_pos);
 }
 
 
 /**
- * Rebuild index array. May change array size and item sizes.
+ * Find alive key among entries not yet moved by rehash. Return NULL if there
+ * is no such entry.
  */
-static void
-_rebuild_index_array(struct dict *d)
+static inline struct dict_entry *
+_lookup_old(struct dict *d, uint64_t hash, const char *key, size_t key_len)
 {
-    size_t index_array_item_size = \
-        _get_index_array_item_size_by_entries_array_size(
-            d->entries_array_size);
+    size_t index_pos;
+    struct dict_entry *entry = _lookup_index(
+        d->old_entries_array,
+        d->old_index_array,
+        d->old_index_tags,
+        d->old_index_array_size,
+        d->old_index_array_item_size,
+        hash,
+        key,
+        key_len,
+        &index_pos);
+
+    if (entry == NULL || !entry->is_alive ||
+            (size_t) (entry - d->old_entries_array) < d->rehash_pos) {
+        return NULL;
+    }
 
-    _index_array_destroy(d->index_array);
-    d->index_array_item_size = index_array_item_size;
-    d->index_array_size = d->entries_array_size * 2;
-    d->index_array = _index_array_init(
-        d->index_array_size, d->index_array_item_size);
+    return entry;
+}
 
-    for (size_t i = 0; i < d->entries_array_size; ++i) {
-        struct dict_entry *entry = &d->entries_array[i];
-        if (entry->is_alive) {
-            size_t index_pos = entry->hash % d->index_array_size;
-            int index_val = _index_array_get(
-                d->index_array, d->index_array_item_size, index_pos);
-            while (index_val != ENTRY_EMPTY) {
-                index_pos = (index_pos + 1) % d->index_array_size;
-                index_val = _index_array_get(
-                    d->index_array, d->index_array_item_size, index_pos);
-            }
 
-            _index_array_set(
-                d->index_array, d->index_array_item_size, index_pos, i);
-        }
+/**
+ * Return first empty index slot on probe path of `hash'.
+ */
+static inline size_t
+_find_empty_slot(struct dict *d, uint64_t hash)
+{
+    switch (d->index_array_item_size) {
+    case sizeof(int8_t):
+        return _find_empty_slot_int8_t(d, hash);
+    case sizeof(int16_t):
+        return _find_empty_slot_int16_t(d, hash);
+    case sizeof(int32_t):
+        return _find_empty_slot_int32_t(d, hash);
+    default:
+        return _find_empty_slot_int64_t(d, hash);
     }
 }
 
 
 /**
- * Recreate entries array. Useful when there are a lot of deleted items.
+ * Add all alive entries to empty index in the calling thread.
  */
 static void
-_recreate_entries_array(struct dict *d)
+_index_entries_serial(struct dict *d)
 {
-    // TODO: Optimize: compress without recreation and copying.
+    switch (d->index_array_item_size) {
+    case sizeof(int8_t):
+        _index_entries_int8_t(d);
+        break;
+    case sizeof(int16_t):
+        _index_entries_int16_t(d);
+        break;
+    case sizeof(int32_t):
+        _index_entries_int32_t(d);
+        break;
+    default:
+        _index_entries_int64_t(d);
+    }
+}
 
-    struct dict_entry *arr = d->entries_array;
 
-    size_t new_size = d->len * 2;
-    if (new_size < DICT_MIN_ARRAY_SIZE) {
-        new_size = DICT_MIN_ARRAY_SIZE;
-    }
-    struct dict_entry *new_arr = _entries_array_init(new_size);
-    struct dict_entry *new_arr_p = new_arr;
+/**
+ * State shared by tasks of `_index_entries'.
+ */
+struct dict_index_job
+{
+    struct dict *d;
+    struct dict_bulk bulk;
+    // Number of entries of every region which did not fit into it.
+    size_t *overflows;
+};
 
-    for (size_t i = 0; i < d->entries_array_size; ++i) {
-        if (arr[i].is_alive) {
-            *new_arr_p++ = arr[i];
-        }
-    }
 
-    _entries_array_destroy(arr);
-    d->entries_array = new_arr;
-    d->entries_array_size = d->len;
-    d->entries_array_allocated = new_size;
+/**
+ * Give hash of entry `i' to `dict_bulk_init_hashed', skipping dead entries.
+ */
+static bool
+_get_entry_hash(void *arg, size_t i, uint64_t *hash)
+{
+    struct dict *d = arg;
+    *hash = d->entries_array[i].hash;
 
-    _rebuild_index_array(d);
+    return d->entries_array[i].is_alive;
 }
 
 
 /**
- * Check is time to rebuild index array.
+ * Index entry `i' at the first empty slot on its probe path. Probing stops
+ * at slot `end': return false if the entry is not indexed because of that.
  */
 static inline bool
-_is_time_to_rebuild_index(struct dict *d)
+_index_region_entry(struct dict *d, size_t i, size_t end)
 {
-    size_t index_array_item_size = \
-        _get_index_array_item_size_by_entries_array_size(
-            d->entries_array_size);
-
-    size_t min_size = d->entries_array_size * 3 / 2;
-    size_t max_size = d->entries_array_size * 3;
+    uint64_t hash = d->entries_array[i].hash;
+    size_t pos = hash % d->index_array_size;
+    while (_index_array_get(
+            d->index_array, d->index_array_item_size, pos) != ENTRY_EMPTY) {
+        if (++pos == end) {
+            return false;
+        }
+    }
+    _index_array_set(d->index_array, d->index_array_item_size, pos, i);
+    d->index_tags[pos] = _hash_tag(hash);
 
-    return (
-        index_array_item_size != d->index_array_item_size ||
-        d->index_array_size < min_size ||
-        d->index_array_size > max_size
-    ) && d->entries_array_size * 2 > DICT_MIN_ARRAY_SIZE;
+    return true;
 }
 
 
 /**
- * Check is time to shrink entries array.
+ * Index entries of region. Entries probing past the region end are left for
+ * `_index_entries' at the start of the region's part of `order'.
  */
-static inline bool
-_is_time_to_shrink_entries_array(struct dict *d)
+static void
+_index_region(void *arg, size_t region)
 {
-    return (
-        d->entries_array_size > (d->len * 3) ||
-        d->entries_array_allocated > (d->entries_array_size * 3)
-    ) && d->len > DICT_MIN_ARRAY_SIZE;
+    struct dict_index_job *job = arg;
+    struct dict_bulk *bulk = &job->bulk;
+    size_t start = bulk->region_starts[region];
+    size_t end = bulk->region_starts[region + 1];
+    size_t region_end = (region + 1) * bulk->region_size;
+    if (region_end > bulk->table_size) {
+        region_end = bulk->table_size;
+    }
+
+    size_t overflows = 0;
+    for (size_t k = start; k < end; ++k) {
+        size_t i = bulk->order[k];
+        if (!_index_region_entry(job->d, i, region_end)) {
+            bulk->order[start + overflows++] = i;
+        }
+    }
+    job->overflows[region] = overflows;
 }
 
 
 /**
- * Grow `entries_array'.
+ * Add all alive entries to empty index. Large index of dictionary with a
+ * pool is filled by regions on pool threads, like in `dict_build'; entries
+ * which do not fit into their region are indexed afterwards.
  */
-static inline void
-_grow_entries_array(struct dict *d)
+static void
+_index_entries(struct dict *d)
 {
-    size_t new_size;
-    if (d->entries_array_size > 4096) {
-        new_size = d->entries_array_size + 1024;
-    } else {
-        new_size = d->entries_array_size * 2;
-    }
+    if (d->thread_pool == NULL ||
+            d->entries_array_size < DICT_POOL_REBUILD_MIN) {
+        _index_entries_serial(d);
 
-    d->entries_array = safe_realloc(
-        d->entries_array, sizeof(struct dict_entry) * new_size);
-    d->entries_array_allocated = new_size;
+        return;
+    }
 
-    if (_is_time_to_rebuild_index(d)) {
-        _rebuild_index_array(d);
+    struct dict_index_job job = {.d = d};
+    dict_bulk_init_hashed(
+        &job.bulk, _get_entry_hash, d, d->entries_array_size,
+        d->index_array_size, DICT_BUILD_REGION_SIZE, d->thread_pool);
+    job.overflows = safe_malloc(sizeof(size_t) * job.bulk.regions);
+
+    dict_pool_run(d->thread_pool, job.bulk.regions, _index_region, &job);
+    for (size_t region = 0; region < job.bulk.regions; ++region) {
+        size_t start = job.bulk.region_starts[region];
+        for (size_t k = 0; k < job.overflows[region]; ++k) {
+            size_t i = job.bulk.order[start + k];
+            size_t pos = _find_empty_slot(d, d->entries_array[i].hash);
+            _index_array_set(
+                d->index_array, d->index_array_item_size, pos, i);
+            d->index_tags[pos] = _hash_tag(d->entries_array[i].hash);
+        }
     }
+
+    free(job.overflows);
+    dict_bulk_destroy(&job.bulk);
 }
 
 
 /**
- * Return pointer to entry (or NULL) by position in index.
+ * Entry of the first index slot with tag of `hash' on its probe path, NULL
+ * if an empty slot comes first.
  */
 static inline struct dict_entry *
-_get_entry_by_index_pos(struct dict *d, int index_pos)
+_first_candidate(struct dict_view *view, uint64_t hash)
 {
-    struct dict_entry *entry = NULL;
-    int index_val = _index_array_get(
-        d->index_array, d->index_array_item_size, index_pos);
-    if (index_val == ENTRY_EMPTY) {
-        entry = NULL;
-    } else {
-        entry = &d->entries_array[index_val];
+    uint8_t tag = _hash_tag(hash);
+    size_t pos = hash % view->index_array_size;
+
+    int64_t index_val;
+    while ((index_val = _index_array_get(
+            view->index_array, view->index_array_item_size, pos)) !=
+            ENTRY_EMPTY) {
+        if (view->index_tags[pos] == tag) {
+            return &view->entries_array[index_val];
+        }
+
+        pos = (pos + 1) % view->index_array_size;
     }
 
-    return entry;
+    return NULL;
 }
 
 
 /**
- * Create new dictionary object.
+ * Copy key into arena if dictionary owns its strings.
  */
-struct dict *
-dict_init(unsigned int (*hash_function)(const char *))
+static inline const char *
+_own_key(struct dict *d, const char *key, size_t key_len)
 {
-    struct dict *d = safe_malloc(sizeof(struct dict));
-    d->len = 0;
+    if (!(d->flags & DICT_OWNED)) {
+        return key;
+    }
 
-    d->entries_array = _entries_array_init(DICT_MIN_ARRAY_SIZE);
-    d->entries_array_allocated = DICT_MIN_ARRAY_SIZE;
-    d->entries_array_size = 0;
+    return dict_arena_copy(&d->arena, key, key_len);
+}
 
-    d->index_array = _index_array_init(DICT_MIN_ARRAY_SIZE, sizeof(int8_t));
-    d->index_array_size = DICT_MIN_ARRAY_SIZE;
-    d->index_array_item_size = sizeof(int8_t);
 
-    d->hash_function = hash_function;
+/**
+ * Copy value into arena if dictionary owns its strings.
+ */
+static inline const char *
+_own_value(struct dict *d, const char *value)
+{
+    if (!(d->flags & DICT_OWNED) || value == NULL) {
+        return value;
+    }
 
-    return d;
+    return dict_arena_copy(&d->arena, value, strlen(value));
 }
 
 
 /**
- * Destroy dictionary object.
+ * Arena bytes taken by owned value.
  */
-void
-dict_destroy(struct dict *d)
+static inline size_t
+_owned_value_size(const char *value)
 {
-    _entries_array_destroy(d->entries_array);
-    _index_array_destroy(d->index_array);
-    free(d);
+    return value == NULL ? 0 : strlen(value) + 1;
 }
 
 
 /**
- * Get value by key.
+ * Copy key and value of entry into `arena'.
  */
-const char *
-dict_get(struct dict *d, const char *key)
+static inline void
+_copy_entry_strings(struct dict_arena *arena, struct dict_entry *entry)
 {
-    unsigned int hash = d->hash_function(key);
-    unsigned int index_pos = hash % d->index_array_size;
-
-    struct dict_entry *entry = _get_entry_by_index_pos(d, index_pos);
-    while (entry != NULL && !_is_entry_matches(*entry, hash, key)) {
-        index_pos = (index_pos + 1) % d->index_array_size;
-        entry = _get_entry_by_index_pos(d, index_pos);
+    entry->key = dict_arena_copy(arena, entry->key, entry->key_len);
+    if (entry->value != NULL) {
+        entry->value = dict_arena_copy(
+            arena, entry->value, strlen(entry->value));
     }
-
-    return (entry != NULL && entry->is_alive) ? entry->value : NULL;
 }
 
 
 /**
- * Set value by key.
+ * Is it worth copying live strings into new arena. During compaction every
+ * entry is copied anyway, so a smaller share of garbage is enough.
  */
-void
-dict_set(struct dict *d, const char *key, const char *value)
+static inline bool
+_is_time_to_repack_arena(struct dict *d, bool is_compaction)
 {
-    unsigned int hash = d->hash_function(key);
-    unsigned int index_pos = hash % d->index_array_size;
-    struct dict_entry *entry = _get_entry_by_index_pos(d, index_pos);
+    size_t garbage = d->arena_garbage * (is_compaction ? 4 : 2);
 
-    while (entry != NULL && !_is_entry_matches(*entry, hash, key)) {
-        index_pos = (index_pos + 1) % d->index_array_size;
-        entry = _get_entry_by_index_pos(d, index_pos);
-    }
+    return (d->flags & DICT_OWNED) && garbage > d->arena.used;
+}
 
-    if (entry == NULL) {
-        // Entry is not found, so we should add new entry into entries array.
-        // Make sure there is empty slot.
-        if (d->entries_array_size == d->entries_array_allocated) {
-            // No empty places. We must increase entries array. Index may be
-            // rebuilt, so we should recalculate index position.
-            _grow_entries_array(d);
 
-            index_pos = hash % d->index_array_size;
-            int index_val = _index_array_get(
-                d->index_array, d->index_array_item_size, index_pos);
-            while (index_val != ENTRY_EMPTY) {
-                index_pos = (index_pos + 1) % d->index_array_size;
-                index_val = _index_array_get(
-                    d->index_array, d->index_array_item_size, index_pos);
-            }
-        }
+/**
+ * Destroy arena retired by `_retire_arena'.
+ */
+static void
+_free_arena(void *arg)
+{
+    struct dict_arena *arena = arg;
+    dict_arena_destroy(arena);
+    free(arena);
+}
 
-        int new_entry_pos = d->entries_array_size++;
-        entry = &d->entries_array[new_entry_pos];
-        entry->is_alive = true;
-        ++d->len;
 
-        _index_array_set(
-            d->index_array,
-            d->index_array_item_size,
-            index_pos,
-            new_entry_pos);
-    } else if (!entry->is_alive) {
-        ++d->len;
-        entry->is_alive = true;
-    }
+/**
+ * Free chunks of arena replaced in `DICT_CONCURRENT' dictionary once
+ * lookups which may read its strings are done.
+ */
+static inline void
+_retire_arena(struct dict_arena *arena)
+{
+    struct dict_arena *retired = safe_malloc(sizeof(struct dict_arena));
+    *retired = *arena;
+    dict_epoch_retire(retired, _free_arena);
+}
 
-    entry->hash = hash;
-    entry->key = key;
-    entry->value = value;
 
-    if (_is_time_to_rebuild_index(d)) {
-        _rebuild_index_array(d);
+/**
+ * Publish current arrays of `DICT_CONCURRENT' dictionary for lookups. Arrays
+ * replaced by writer are retired only after that, so lookups which did not
+ * get the new view yet can still use them.
+ */
+static void
+_publish_view(struct dict *d)
+{
+    struct dict_view *view = safe_malloc(sizeof(struct dict_view));
+    view->entries_array = d->entries_array;
+    view->index_array = d->index_array;
+    view->index_tags = d->index_tags;
+    view->index_array_size = d->index_array_size;
+    view->index_array_item_size = d->index_array_item_size;
+
+    struct dict_view *old_view = __atomic_exchange_n(
+        &d->view, view, __ATOMIC_ACQ_REL);
+    if (old_view != NULL) {
+        dict_epoch_retire(old_view, free);
     }
 }
 
 
 /**
- * Remove item by key.
+ * Return size of index array item by entries array size.
  */
-void
-dict_del(struct dict *d, const char *key)
+static inline size_t
+_get_index_array_item_size_by_entries_array_size(size_t size)
 {
-    unsigned int hash = d->hash_function(key);
-    unsigned int index_pos = hash % d->index_array_size;
-
-    struct dict_entry *entry = _get_entry_by_index_pos(d, index_pos);
-    while (entry != NULL && !_is_entry_matches(*entry, hash, key)) {
-        index_pos = (index_pos + 1) % d->index_array_size;
-        entry = _get_entry_by_index_pos(d, index_pos);
+    size_t index_array_item_size;
+    if (size <= INT8_MAX) {
+        index_array_item_size = sizeof(int8_t);
+    } else if (size <= INT16_MAX) {
+        index_array_item_size = sizeof(int16_t);
+    } else if (size <= INT32_MAX) {
+        index_array_item_size = sizeof(int32_t);
+    } else {
+        index_array_item_size = sizeof(int64_t);
     }
 
-    if (entry != NULL && entry->is_alive) {
-        --d->len;
-        entry->is_alive = false;
-
-        if (_is_time_to_shrink_entries_array(d)) {
-            _recreate_entries_array(d);
-        } else if (_is_time_to_rebuild_index(d)) {
-            _rebuild_index_array(d);
-        }
-    }
+    return index_array_item_size;
 }
 
 
 /**
- * Draw dict contents for debugging.
+ * Number of entries index array is sized for: entries array size, or more
+ * if room is reserved.
  */
-void
-dict_draw(struct dict *d)
+static inline size_t
+_get_index_capacity(struct dict *d)
 {
+    return (
+        d->reserved > d->entries_array_size ?
+        d->reserved : d->entries_array_size);
+}
+
+
+/**
+ * Rebuild index array. May change array size and item sizes.
+ */
+static void
+_rebuild_index_array(struct dict *d)
+{
+    ++d->rebuilds;
+    DICT_INSTR_REBUILD_BEGIN();
+    size_t capacity = _get_index_capacity(d);
+    size_t index_array_item_size = \
+        _get_index_array_item_size_by_entries_array_size(capacity);
+
+    void *old_index_array = d->index_array;
+    uint8_t *old_index_tags = d->index_tags;
+    if (!(d->flags & DICT_CONCURRENT)) {
+        // Freed first, so the new index may take its memory.
+        _index_array_destroy(old_index_array);
+        free(old_index_tags);
+    }
+    d->index_array_item_size = index_array_item_size;
+    d->index_array_size = capacity * 2;
+    if (d->index_array_size < DICT_MIN_ARRAY_SIZE) {
+        // Dictionary emptied by deletes.
+        d->index_array_size = DICT_MIN_ARRAY_SIZE;
+    }
+    d->index_array = _index_array_init(
+        d->index_array_size, d->index_array_item_size);
+    d->index_tags = safe_malloc(d->index_array_size);
+
+    _index_entries(d);
+
+    if (d->flags & DICT_CONCURRENT) {
+        _publish_view(d);
+        dict_epoch_retire(old_index_array, free);
+        dict_epoch_retire(old_index_tags, free);
+    }
+    DICT_INSTR_REBUILD_END();
+}
+
+
+/**
+ * Start new generation of entries array, moved from the current one of
+ * `old_size' entries. `dict_scan' cursors of the current array are mapped
+ * by `scan_remap', filled by `_note_scan_remap' as entries are moved.
+ */
+static inline void
+_start_scan_remap(struct dict *d, size_t old_size)
+{
+    ++d->entries_generation;
+    d->scan_remap_size = old_size + 1;
+    d->scan_remap = safe_realloc(
+        d->scan_remap, d->scan_remap_size * sizeof(size_t));
+}
+
+
+/**
+ * Note that entry at position `old_pos' of the previous entries array (or
+ * its end) is moved to position `new_pos' (or would be, if alive). Entries
+ * are moved in order, so every position is noted once.
+ */
+static inline void
+_note_scan_remap(struct dict *d, size_t old_pos, size_t new_pos)
+{
+    d->scan_remap[old_pos] = new_pos;
+}
+
+
+/**
+ * Recreate entries array. Useful when there are a lot of deleted items.
+ */
+static void
+_recreate_entries_array(struct dict *d)
+{
+    // TODO: Optimize: compress without recreation and copying.
+
+    ++d->compactions;
+    struct dict_entry *arr = d->entries_array;
+
+    size_t new_size = d->len * 2;
+    if (new_size < d->reserved) {
+        new_size = d->reserved;
+    }
+    if (new_size < DICT_MIN_ARRAY_SIZE) {
+        new_size = DICT_MIN_ARRAY_SIZE;
+    }
+    struct dict_entry *new_arr = _entries_array_init(new_size);
+    struct dict_entry *new_arr_p = new_arr;
+
+    // Live strings of owned dictionary may be moved to new arena on the way.
+    bool repack_arena = _is_time_to_repack_arena(d, true);
+    struct dict_arena new_arena;
+    dict_arena_init(&new_arena);
+
+    // Copying is timed apart from the index rebuild below.
+    DICT_INSTR_REBUILD_BEGIN();
+    _start_scan_remap(d, d->entries_array_size);
+    for (size_t i = 0; i < d->entries_array_size; ++i) {
+        _note_scan_remap(d, i, new_arr_p - new_arr);
+        if (arr[i].is_alive) {
+            *new_arr_p = arr[i];
+            if (repack_arena) {
+                _copy_entry_strings(&new_arena, new_arr_p);
+            }
+            ++new_arr_p;
+        }
+    }
+    _note_scan_remap(d, d->entries_array_size, d->len);
+    DICT_INSTR_REBUILD_END();
+
+    struct dict_arena old_arena = d->arena;
+    if (repack_arena) {
+        d->arena = new_arena;
+        d->arena_garbage = 0;
+    }
+
+    d->entries_array = new_arr;
+    d->entries_array_size = d->len;
+    d->entries_array_allocated = new_size;
+
+    if (!(d->flags & DICT_CONCURRENT)) {
+        if (repack_arena) {
+            dict_arena_destroy(&old_arena);
+        }
+        _entries_array_destroy(arr);
+        _rebuild_index_array(d);
+
+        return;
+    }
+
+    _rebuild_index_array(d);
+    dict_epoch_retire(arr, free);
+    if (repack_arena) {
+        _retire_arena(&old_arena);
+    }
+}
+
+
+/**
+ * Check is time to rebuild index array.
+ */
+static inline bool
+_is_time_to_rebuild_index(struct dict *d)
+{
+    size_t capacity = _get_index_capacity(d);
+    size_t index_array_item_size = \
+        _get_index_array_item_size_by_entries_array_size(capacity);
+
+    size_t min_size = capacity * 3 / 2;
+    size_t max_size = capacity * 3;
+
+    return (
+        index_array_item_size != d->index_array_item_size ||
+        d->index_array_size < min_size ||
+        d->index_array_size > max_size
+    ) && capacity * 2 > DICT_MIN_ARRAY_SIZE;
+}
+
+
+/**
+ * Check is time to shrink entries array.
+ */
+static inline bool
+_is_time_to_shrink_entries_array(struct dict *d)
+{
+    return (
+        d->entries_array_size > (d->len * 3) || (
+            d->entries_array_allocated > (d->entries_array_size * 3) &&
+            d->entries_array_allocated > d->reserved)
+    ) && d->len > DICT_MIN_ARRAY_SIZE;
+}
+
+
+/**
+ * Resize `entries_array' to `new_size' entries, not less than its size.
+ */
+static inline void
+_resize_entries_array(struct dict *d, size_t new_size)
+{
+    ++d->resizes;
+    if (!(d->flags & DICT_CONCURRENT)) {
+        d->entries_array = safe_realloc(
+            d->entries_array, sizeof(struct dict_entry) * new_size);
+        d->entries_array_allocated = new_size;
+
+        if (_is_time_to_rebuild_index(d)) {
+            _rebuild_index_array(d);
+        }
+
+        return;
+    }
+
+    // Lookups may be reading the array, so it is copied, not reallocated.
+    // Index is always rebuilt with it: slots added later point past the end
+    // of the old array, so lookups still using it must not see them.
+    struct dict_entry *old_entries_array = d->entries_array;
+    d->entries_array = _entries_array_init(new_size);
+    memcpy(
+        d->entries_array,
+        old_entries_array,
+        sizeof(struct dict_entry) * d->entries_array_size);
+    d->entries_array_allocated = new_size;
+
+    _rebuild_index_array(d);
+    dict_epoch_retire(old_entries_array, free);
+}
+
+
+/**
+ * Grow `entries_array'. Size is doubled, so filling the dictionary copies
+ * every entry only a few times.
+ */
+static inline void
+_grow_entries_array(struct dict *d)
+{
+    _resize_entries_array(d, d->entries_array_allocated * 2);
+}
+
+
+/**
+ * Is incremental rehash in progress.
+ */
+static inline bool
+_is_rehashing(struct dict *d)
+{
+    return d->old_entries_array != NULL;
+}
+
+
+/**
+ * Start incremental rehash: current arrays become old ones, and new entries
+ * array and index sized for alive entries are created.
+ */
+static void
+_start_rehash(struct dict *d)
+{
+    ++d->compactions;
+
+    // Every operation moves at least `DICT_REHASH_STEP' old slots and adds
+    // at most one entry, so this is enough room until rehash ends.
+    size_t new_size = d->len * 2;
+    size_t min_size = (
+        d->len + d->entries_array_size / DICT_REHASH_STEP + 1);
+    if (new_size < min_size) {
+        new_size = min_size;
+    }
+    if (new_size < d->reserved) {
+        new_size = d->reserved;
+    }
+    if (new_size < DICT_MIN_ARRAY_SIZE) {
+        new_size = DICT_MIN_ARRAY_SIZE;
+    }
+
+    // Live strings of owned dictionary may be moved to new arena on the way.
+    d->rehash_repacks_arena = _is_time_to_repack_arena(d, true);
+    if (d->rehash_repacks_arena) {
+        d->old_arena = d->arena;
+        dict_arena_init(&d->arena);
+        d->arena_garbage = 0;
+    }
+
+    d->old_entries_array = d->entries_array;
+    d->old_entries_array_size = d->entries_array_size;
+    d->old_index_array = d->index_array;
+    d->old_index_tags = d->index_tags;
+    d->old_index_array_size = d->index_array_size;
+    d->old_index_array_item_size = d->index_array_item_size;
+    d->rehash_pos = 0;
+    _start_scan_remap(d, d->old_entries_array_size);
+
+    d->entries_array = _entries_array_init(new_size);
+    d->entries_array_size = 0;
+    d->entries_array_allocated = new_size;
+
+    // Index is sized for the whole new array, so it is not rebuilt until
+    // the next rehash.
+    d->index_array_item_size = \
+        _get_index_array_item_size_by_entries_array_size(new_size);
+    d->index_array_size = new_size * 2;
+    d->index_array = _index_array_init(
+        d->index_array_size, d->index_array_item_size);
+    d->index_tags = safe_malloc(d->index_array_size);
+}
+
+
+/**
+ * Move old entry to the end of entries array and index it.
+ */
+static void
+_rehash_entry(struct dict *d, struct dict_entry *old_entry)
+{
+    size_t new_entry_pos = d->entries_array_size++;
+    struct dict_entry *entry = &d->entries_array[new_entry_pos];
+    *entry = *old_entry;
+    old_entry->is_alive = false;
+
+    if (d->rehash_repacks_arena) {
+        _copy_entry_strings(&d->arena, entry);
+    }
+
+    size_t index_pos = _find_empty_slot(d, entry->hash);
+    _index_array_set(
+        d->index_array, d->index_array_item_size, index_pos, new_entry_pos);
+    d->index_tags[index_pos] = _hash_tag(entry->hash);
+}
+
+
+/**
+ * Free old arrays once all entries are moved.
+ */
+static void
+_end_rehash(struct dict *d)
+{
+    _entries_array_destroy(d->old_entries_array);
+    _index_array_destroy(d->old_index_array);
+    free(d->old_index_tags);
+    d->old_entries_array = NULL;
+    d->old_index_array = NULL;
+    d->old_index_tags = NULL;
+
+    if (d->rehash_repacks_arena) {
+        dict_arena_destroy(&d->old_arena);
+        d->rehash_repacks_arena = false;
+    }
+}
+
+
+/**
+ * Move next `DICT_REHASH_STEP' alive old entries.
+ */
+static void
+_rehash_step(struct dict *d)
+{
+    size_t moved = 0;
+    size_t skipped = 0;
+    while (d->rehash_pos < d->old_entries_array_size &&
+            moved < DICT_REHASH_STEP &&
+            skipped < DICT_REHASH_STEP * 10) {
+        _note_scan_remap(d, d->rehash_pos, d->entries_array_size);
+        struct dict_entry *entry = &d->old_entries_array[d->rehash_pos++];
+        if (entry->is_alive) {
+            _rehash_entry(d, entry);
+            ++moved;
+        } else {
+            ++skipped;
+        }
+    }
+
+    if (d->rehash_pos == d->old_entries_array_size) {
+        _note_scan_remap(d, d->rehash_pos, d->entries_array_size);
+        _end_rehash(d);
+    }
+}
+
+
+/**
+ * Replace value of entry not moved by rehash yet. It is changed in the old
+ * array rather than moved ahead of its turn, so entries keep their order
+ * and `dict_scan' cursors are mapped exactly.
+ */
+static inline void
+_set_old_entry(struct dict *d, struct dict_entry *entry, const char *value)
+{
+    if (d->flags & DICT_OWNED) {
+        // Strings of old arena go with it, but the new value is copied once
+        // more when the entry is moved.
+        d->arena_garbage += _owned_value_size(
+            d->rehash_repacks_arena ? value : entry->value);
+    }
+    entry->value = _own_value(d, value);
+}
+
+
+/**
+ * Delete entry not moved by rehash yet, see `_set_old_entry'.
+ */
+static inline void
+_del_old_entry(struct dict *d, struct dict_entry *entry)
+{
+    --d->len;
+    entry->is_alive = false;
+    if ((d->flags & DICT_OWNED) && !d->rehash_repacks_arena) {
+        d->arena_garbage += (
+            entry->key_len + 1 + _owned_value_size(entry->value));
+    }
+}
+
+
+/**
+ * Start rehash of `DICT_INCREMENTAL' dictionary if entries array is worth
+ * compacting.
+ */
+static inline void
+_start_rehash_if_needed(struct dict *d)
+{
+    if (!_is_rehashing(d) && (
+            _is_time_to_shrink_entries_array(d) ||
+            _is_time_to_repack_arena(d, false))) {
+        _start_rehash(d);
+    }
+}
+
+
+/**
+ * Value of entry of mapped snapshot.
+ */
+static inline const char *
+_mapped_value(struct dict *d, const struct dict_file_entry *entry)
+{
+    if (entry->value_offset == DICT_FILE_NO_VALUE) {
+        return NULL;
+    }
+
+    return d->mapped_strings + entry->value_offset;
+}
+
+
+/**
+ * Copy entries and index of mapped snapshot into memory, so the dictionary
+ * can be changed. Keys and values stay in the mapping.
+ */
+static void
+_load_mapped_entries(struct dict *d)
+{
+    size_t size = d->len > DICT_MIN_ARRAY_SIZE ? d->len : DICT_MIN_ARRAY_SIZE;
+    struct dict_entry *entries = _entries_array_init(size);
+    for (size_t i = 0; i < d->len; ++i) {
+        const struct dict_file_entry *file_entry = &d->mapped_entries[i];
+        entries[i].hash = file_entry->hash;
+        entries[i].key = d->mapped_strings + file_entry->key_offset;
+        entries[i].key_len = file_entry->key_len;
+        entries[i].value = _mapped_value(d, file_entry);
+        entries[i].is_alive = true;
+    }
+
+    // Entries keep their numbers, so the index is copied as is.
+    size_t index_bytes = d->index_array_size * d->index_array_item_size;
+    void *index_array = safe_malloc(index_bytes);
+    memcpy(index_array, d->index_array, index_bytes);
+    uint8_t *index_tags = safe_malloc(d->index_array_size);
+    memcpy(index_tags, d->index_tags, d->index_array_size);
+
+    d->entries_array = entries;
+    d->entries_array_size = d->len;
+    d->entries_array_allocated = size;
+    d->index_array = index_array;
+    d->index_tags = index_tags;
+    d->mapped_entries = NULL;
+}
+
+
+/**
+ * Get value by key from mapped snapshot.
+ */
+static const char *
+_get_mapped(struct dict *d, const char *key, size_t key_len)
+{
+    uint64_t hash = d->hash_function(key, key_len);
+    uint8_t tag = _hash_tag(hash);
+    size_t pos = hash % d->index_array_size;
+    size_t probes = 1;
+
+    int64_t i;
+    while ((i = _index_array_get(
+            d->index_array, d->index_array_item_size, pos)) != ENTRY_EMPTY) {
+        const struct dict_file_entry *entry = &d->mapped_entries[i];
+        if (d->index_tags[pos] == tag &&
+                entry->hash == hash &&
+                entry->key_len == key_len &&
+                DICT_INSTR_MEMCMP(
+                    d->mapped_strings + entry->key_offset, key, key_len)
+                    == 0) {
+            DICT_INSTR_LOOKUP(key, key_len, probes);
+
+            return _mapped_value(d, entry);
+        }
+
+        pos = (pos + 1) % d->index_array_size;
+        ++probes;
+    }
+    DICT_INSTR_LOOKUP(key, key_len, probes);
+
+    return NULL;
+}
+
+
+/**
+ * Create new dictionary object.
+ */
+struct dict *
+dict_init(uint64_t (*hash_function)(const char *, size_t))
+{
+    return dict_init_flags(hash_function, 0);
+}
+
+
+/**
+ * Create new dictionary object with given `DICT_*' flags.
+ */
+struct dict *
+dict_init_flags(
+    uint64_t (*hash_function)(const char *, size_t), int flags)
+{
+    struct dict *d = safe_malloc(sizeof(struct dict));
+    d->len = 0;
+
+    if (flags & DICT_CONCURRENT) {
+        flags &= ~DICT_INCREMENTAL;
+    }
+
+    d->entries_array = _entries_array_init(DICT_MIN_ARRAY_SIZE);
+    d->entries_array_allocated = DICT_MIN_ARRAY_SIZE;
+    d->entries_array_size = 0;
+    d->reserved = 0;
+
+    // Index of `DICT_INCREMENTAL' dictionary must have free slots when the
+    // entries array is full.
+    size_t index_array_size = DICT_MIN_ARRAY_SIZE;
+    if (flags & DICT_INCREMENTAL) {
+        index_array_size *= 2;
+    }
+    d->index_array = _index_array_init(index_array_size, sizeof(int8_t));
+    d->index_tags = safe_malloc(index_array_size);
+    d->index_array_size = index_array_size;
+    d->index_array_item_size = sizeof(int8_t);
+
+    d->hash_function = hash_function;
+    d->thread_pool = NULL;
+
+    d->flags = flags;
+    dict_arena_init(&d->arena);
+    d->arena_garbage = 0;
+
+    d->old_entries_array = NULL;
+    d->old_index_array = NULL;
+    d->old_index_tags = NULL;
+    d->rehash_repacks_arena = false;
+
+    d->view = NULL;
+    if (flags & DICT_CONCURRENT) {
+        pthread_mutex_init(&d->write_lock, NULL);
+        _publish_view(d);
+    }
+
+    d->mapping = NULL;
+    d->mapped_entries = NULL;
+
+    d->log = NULL;
+    d->is_rewriting_log = false;
+
+    d->entries_generation = 0;
+    d->scan_remap = NULL;
+    d->scan_remap_size = 0;
+
+    d->resizes = 0;
+    d->rebuilds = 0;
+    d->compactions = 0;
+
+    return d;
+}
+
+
+/**
+ * Destroy dictionary object.
+ */
+void
+dict_destroy(struct dict *d)
+{
+    if (d->mapped_entries == NULL) {
+        _entries_array_destroy(d->entries_array);
+        _index_array_destroy(d->index_array);
+        free(d->index_tags);
+    }
+    if (_is_rehashing(d)) {
+        _end_rehash(d);
+    }
+    dict_arena_destroy(&d->arena);
+    if (d->flags & DICT_CONCURRENT) {
+        // No lookups may run any more, so the view is freed at once.
+        free(d->view);
+        pthread_mutex_destroy(&d->write_lock);
+    }
+    if (d->mapping != NULL) {
+        munmap(d->mapping, d->mapping_size);
+    }
+    free(d->scan_remap);
+    free(d);
+}
+
+
+/**
+ * Take writer lock of `DICT_CONCURRENT' dictionary.
+ */
+static inline void
+_lock_writer(struct dict *d)
+{
+    if (d->flags & DICT_CONCURRENT) {
+        pthread_mutex_lock(&d->write_lock);
+    }
+}
+
+
+/**
+ * Release writer lock of `DICT_CONCURRENT' dictionary.
+ */
+static inline void
+_unlock_writer(struct dict *d)
+{
+    if (d->flags & DICT_CONCURRENT) {
+        pthread_mutex_unlock(&d->write_lock);
+    }
+}
+
+
+/**
+ * Get arrays for lookups. Lookups of `DICT_CONCURRENT' dictionary enter
+ * epoch critical section and use the published view, others fill `view'
+ * from the dictionary. Must be paired with `_exit_view'.
+ */
+static inline struct dict_view *
+_enter_view(struct dict *d, struct dict_view *view)
+{
+    if (d->flags & DICT_CONCURRENT) {
+        dict_epoch_enter();
+
+        return __atomic_load_n(&d->view, __ATOMIC_ACQUIRE);
+    }
+
+    view->entries_array = d->entries_array;
+    view->index_array = d->index_array;
+    view->index_tags = d->index_tags;
+    view->index_array_size = d->index_array_size;
+    view->index_array_item_size = d->index_array_item_size;
+
+    return view;
+}
+
+
+/**
+ * Finish lookups started by `_enter_view'.
+ */
+static inline void
+_exit_view(struct dict *d)
+{
+    if (d->flags & DICT_CONCURRENT) {
+        dict_epoch_exit();
+    }
+}
+
+
+/**
+ * Find key in index of view, see `_lookup_index'.
+ */
+static inline struct dict_entry *
+_lookup_view(
+    struct dict_view *view, uint64_t hash, const char *key, size_t key_len)
+{
+    size_t index_pos;
+
+    return _lookup_index(
+        view->entries_array,
+        view->index_array,
+        view->index_tags,
+        view->index_array_size,
+        view->index_array_item_size,
+        hash,
+        key,
+        key_len,
+        &index_pos);
+}
+
+
+/**
+ * Value of found entry, NULL if there is none or it is deleted. Writers
+ * may change the entry concurrently, so fields are read atomically.
+ */
+static inline const char *
+_entry_value(struct dict_entry *entry)
+{
+    if (entry == NULL ||
+            !__atomic_load_n(&entry->is_alive, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+
+    return __atomic_load_n(&entry->value, __ATOMIC_ACQUIRE);
+}
+
+
+/**
+ * Make room for `n' entries.
+ */
+void
+dict_reserve(struct dict *d, size_t n)
+{
+    if (d->mapped_entries != NULL) {
+        _load_mapped_entries(d);
+    }
+    // Reserving is done up front, so it does not need to be incremental.
+    while (_is_rehashing(d)) {
+        _rehash_step(d);
+    }
+
+    _lock_writer(d);
+    d->reserved = n;
+    if (n > d->entries_array_allocated) {
+        _resize_entries_array(d, n);
+    } else if (!(d->flags & DICT_INCREMENTAL) &&
+            _is_time_to_rebuild_index(d)) {
+        _rebuild_index_array(d);
+    }
+    _unlock_writer(d);
+}
+
+
+/**
+ * Set pool to rebuild large index on, see header.
+ */
+void
+dict_set_pool(struct dict *d, struct dict_pool *pool)
+{
+    _lock_writer(d);
+    d->thread_pool = pool;
+    _unlock_writer(d);
+}
+
+
+/**
+ * Get value by key.
+ */
+const char *
+dict_get(struct dict *d, const char *key)
+{
+    return dict_get_n(d, key, strlen(key));
+}
+
+
+/**
+ * Get value by key of `key_len' bytes.
+ */
+const char *
+dict_get_n(struct dict *d, const char *key, size_t key_len)
+{
+    DICT_INSTR_OP(gets);
+    if (d->mapped_entries != NULL) {
+        return _get_mapped(d, key, key_len);
+    }
+
+    if (d->flags & DICT_CONCURRENT) {
+        uint64_t hash = d->hash_function(key, key_len);
+        struct dict_view *view = _enter_view(d, NULL);
+        const char *value = _entry_value(
+            _lookup_view(view, hash, key, key_len));
+        _exit_view(d);
+
+        return value;
+    }
+
+    if (_is_rehashing(d)) {
+        _rehash_step(d);
+    }
+
+    uint64_t hash = d->hash_function(key, key_len);
+    size_t index_pos;
+    struct dict_entry *entry = _lookup(d, hash, key, key_len, &index_pos);
+
+    if (entry == NULL && _is_rehashing(d)) {
+        // Entry found in new index is the actual one, even if deleted.
+        entry = _lookup_old(d, hash, key, key_len);
+    }
+
+    return (entry != NULL && entry->is_alive) ? entry->value : NULL;
+}
+
+
+/**
+ * `dict_set_n' for `DICT_INCREMENTAL' dictionary.
+ */
+static void
+_set_incremental(
+    struct dict *d,
+    uint64_t hash,
+    const char *key,
+    size_t key_len,
+    const char *value)
+{
+    if (_is_rehashing(d)) {
+        _rehash_step(d);
+    }
+
+    size_t index_pos;
+    struct dict_entry *entry = _lookup(d, hash, key, key_len, &index_pos);
+    if (entry == NULL && _is_rehashing(d)) {
+        struct dict_entry *old_entry = _lookup_old(d, hash, key, key_len);
+        if (old_entry != NULL) {
+            _set_old_entry(d, old_entry, value);
+
+            return;
+        }
+    }
+
+    if (entry != NULL && entry->is_alive) {
+        if (d->flags & DICT_OWNED) {
+            d->arena_garbage += _owned_value_size(entry->value);
+        }
+        entry->value = _own_value(d, value);
+    } else {
+        if (entry == NULL) {
+            if (d->entries_array_size == d->entries_array_allocated) {
+                // New array of rehash does not fill up until the rehash
+                // ends, so this is only reached with no rehash running.
+                _start_rehash(d);
+                index_pos = _find_empty_slot(d, hash);
+            }
+
+            size_t new_entry_pos = d->entries_array_size++;
+            entry = &d->entries_array[new_entry_pos];
+            _index_array_set(
+                d->index_array,
+                d->index_array_item_size,
+                index_pos,
+                new_entry_pos);
+            d->index_tags[index_pos] = _hash_tag(hash);
+        }
+
+        entry->is_alive = true;
+        entry->hash = hash;
+        entry->key = _own_key(d, key, key_len);
+        entry->key_len = key_len;
+        entry->value = _own_value(d, value);
+        ++d->len;
+    }
+
+    _start_rehash_if_needed(d);
+}
+
+
+/**
+ * Get values of `n' keys, see header.
+ *
+ * Keys go in batches of `DICT_GET_BATCH', every stage being done for the
+ * whole batch before the next one: hash keys and prefetch their home index
+ * slots, prefetch entries of the first tag matches, prefetch keys of those
+ * entries, then probe. Each stage only touches memory prefetched by the
+ * previous one, so misses of a batch are waited for about once.
+ */
+void
+dict_get_many(
+    struct dict *d, const char *const *keys, size_t n, const char **values)
+{
+    if (_is_rehashing(d) || d->mapped_entries != NULL) {
+        // Lookups go to both tables and move entries (or to the mapped
+        // snapshot), one by one.
+        for (size_t i = 0; i < n; ++i) {
+            values[i] = dict_get(d, keys[i]);
+        }
+
+        return;
+    }
+
+    uint64_t hashes[DICT_GET_BATCH];
+    size_t key_lens[DICT_GET_BATCH];
+    struct dict_entry *candidates[DICT_GET_BATCH];
+    struct dict_view local_view;
+    struct dict_view *view = _enter_view(d, &local_view);
+
+    for (size_t start = 0; start < n; start += DICT_GET_BATCH) {
+        const char *const *batch = keys + start;
+        size_t count = n - start < DICT_GET_BATCH ? n - start : DICT_GET_BATCH;
+
+        for (size_t i = 0; i < count; ++i) {
+            key_lens[i] = strlen(batch[i]);
+            hashes[i] = d->hash_function(batch[i], key_lens[i]);
+            size_t pos = hashes[i] % view->index_array_size;
+            __builtin_prefetch(&view->index_tags[pos]);
+            __builtin_prefetch(
+                (char *) view->index_array +
+                pos * view->index_array_item_size);
+        }
+
+        for (size_t i = 0; i < count; ++i) {
+            candidates[i] = _first_candidate(view, hashes[i]);
+            if (candidates[i] != NULL) {
+                __builtin_prefetch(candidates[i]);
+            }
+        }
+
+        for (size_t i = 0; i < count; ++i) {
+            if (candidates[i] != NULL) {
+                __builtin_prefetch(candidates[i]->key);
+            }
+        }
+
+        for (size_t i = 0; i < count; ++i) {
+            values[start + i] = _entry_value(
+                _lookup_view(view, hashes[i], batch[i], key_lens[i]));
+        }
+    }
+
+    _exit_view(d);
+}
+
+
+/**
+ * `dict_set_n' for dictionary which is not `DICT_INCREMENTAL'.
+ *
+ * Lookups of `DICT_CONCURRENT' dictionary may run meanwhile. An entry is
+ * filled before its index slot, and an indexed entry only changes its value,
+ * liveness and key pointer (to an equal key), so they never see a
+ * half-written entry.
+ */
+static void
+_set(
+    struct dict *d,
+    uint64_t hash,
+    const char *key,
+    size_t key_len,
+    const char *value)
+{
+    size_t index_pos;
+    struct dict_entry *entry = _lookup(d, hash, key, key_len, &index_pos);
+
+    if (entry == NULL) {
+        // Entry is not found, so we should add new entry into entries array.
+        // Make sure there is empty slot.
+        if (d->entries_array_size == d->entries_array_allocated) {
+            // No empty places. We must increase entries array. Index may be
+            // rebuilt, so we should recalculate index position.
+            _grow_entries_array(d);
+
+            index_pos = _find_empty_slot(d, hash);
+        }
+
+        size_t new_entry_pos = d->entries_array_size++;
+        entry = &d->entries_array[new_entry_pos];
+        entry->hash = hash;
+        entry->key = _own_key(d, key, key_len);
+        entry->key_len = key_len;
+        entry->value = _own_value(d, value);
+        entry->is_alive = true;
+        ++d->len;
+
+        d->index_tags[index_pos] = _hash_tag(hash);
+        _index_array_set(
+            d->index_array,
+            d->index_array_item_size,
+            index_pos,
+            new_entry_pos);
+    } else if (!entry->is_alive) {
+        // Key of deleted entry may be freed by its owner, so it is replaced
+        // by the equal one.
+        __atomic_store_n(
+            &entry->key, _own_key(d, key, key_len), __ATOMIC_RELAXED);
+        __atomic_store_n(
+            &entry->value, _own_value(d, value), __ATOMIC_RELEASE);
+        __atomic_store_n(&entry->is_alive, true, __ATOMIC_RELEASE);
+        ++d->len;
+    } else {
+        // Alive entry keeps its key, only the value is replaced.
+        if (d->flags & DICT_OWNED) {
+            d->arena_garbage += _owned_value_size(entry->value);
+        }
+        __atomic_store_n(
+            &entry->value, _own_value(d, value), __ATOMIC_RELEASE);
+
+        if (!d->is_rewriting_log && _is_time_to_repack_arena(d, false)) {
+            _recreate_entries_array(d);
+        }
+
+        return;
+    }
+
+    if (_is_time_to_rebuild_index(d)) {
+        _rebuild_index_array(d);
+    }
+}
+
+
+/**
+ * Set value by key.
+ */
+void
+dict_set(struct dict *d, const char *key, const char *value)
+{
+    dict_set_n(d, key, strlen(key), value);
+}
+
+
+/**
+ * Set value by key of `key_len' bytes.
+ */
+void
+dict_set_n(
+    struct dict *d, const char *key, size_t key_len, const char *value)
+{
+    DICT_INSTR_OP(sets);
+    if (d->mapped_entries != NULL) {
+        _load_mapped_entries(d);
+    }
+
+    uint64_t hash = d->hash_function(key, key_len);
+    _lock_writer(d);
+    // Records are appended in the order changes are made, and committed
+    // after the lock is released, so commits of many writers are grouped.
+    struct dict_log *log = d->log;
+    uint64_t log_seq = (
+        log != NULL ? dict_log_set(log, key, key_len, value) : 0);
+    if (d->flags & DICT_INCREMENTAL) {
+        _set_incremental(d, hash, key, key_len, value);
+    } else {
+        _set(d, hash, key, key_len, value);
+    }
+    _unlock_writer(d);
+
+    if (log != NULL) {
+        dict_log_commit(log, log_seq);
+    }
+}
+
+
+/**
+ * `dict_del_n' for `DICT_INCREMENTAL' dictionary.
+ */
+static void
+_del_incremental(
+    struct dict *d, uint64_t hash, const char *key, size_t key_len)
+{
+    if (_is_rehashing(d)) {
+        _rehash_step(d);
+    }
+
+    size_t index_pos;
+    struct dict_entry *entry = _lookup(d, hash, key, key_len, &index_pos);
+    if (entry == NULL && _is_rehashing(d)) {
+        struct dict_entry *old_entry = _lookup_old(d, hash, key, key_len);
+        if (old_entry != NULL) {
+            _del_old_entry(d, old_entry);
+        }
+
+        return;
+    }
+
+    if (entry != NULL && entry->is_alive) {
+        --d->len;
+        entry->is_alive = false;
+        if (d->flags & DICT_OWNED) {
+            d->arena_garbage += (
+                entry->key_len + 1 + _owned_value_size(entry->value));
+        }
+
+        _start_rehash_if_needed(d);
+    }
+}
+
+
+/**
+ * `dict_del_n' for dictionary which is not `DICT_INCREMENTAL', see `_set'.
+ */
+static void
+_del(struct dict *d, uint64_t hash, const char *key, size_t key_len)
+{
+    size_t index_pos;
+    struct dict_entry *entry = _lookup(d, hash, key, key_len, &index_pos);
+
+    if (entry != NULL && entry->is_alive) {
+        --d->len;
+        __atomic_store_n(&entry->is_alive, false, __ATOMIC_RELEASE);
+        if (d->flags & DICT_OWNED) {
+            d->arena_garbage += (
+                entry->key_len + 1 + _owned_value_size(entry->value));
+        }
+
+        // Entries keep their positions while log is rewritten.
+        if (!d->is_rewriting_log && (
+                _is_time_to_shrink_entries_array(d) ||
+                _is_time_to_repack_arena(d, false))) {
+            _recreate_entries_array(d);
+        } else if (_is_time_to_rebuild_index(d)) {
+            _rebuild_index_array(d);
+        }
+    }
+}
+
+
+/**
+ * Remove item by key.
+ */
+void
+dict_del(struct dict *d, const char *key)
+{
+    dict_del_n(d, key, strlen(key));
+}
+
+
+/**
+ * Remove item by key of `key_len' bytes.
+ */
+void
+dict_del_n(struct dict *d, const char *key, size_t key_len)
+{
+    DICT_INSTR_OP(dels);
+    if (d->mapped_entries != NULL) {
+        _load_mapped_entries(d);
+    }
+
+    uint64_t hash = d->hash_function(key, key_len);
+    _lock_writer(d);
+    struct dict_log *log = d->log;
+    uint64_t log_seq = log != NULL ? dict_log_del(log, key, key_len) : 0;
+    if (d->flags & DICT_INCREMENTAL) {
+        _del_incremental(d, hash, key, key_len);
+    } else {
+        _del(d, hash, key, key_len);
+    }
+    _unlock_writer(d);
+
+    if (log != NULL) {
+        dict_log_commit(log, log_seq);
+    }
+}
+
+
+/**
+ * Start iteration over dictionary entries, see header.
+ */
+void
+dict_iter_init(struct dict_iter *it, struct dict *d)
+{
+    while (_is_rehashing(d)) {
+        _rehash_step(d);
+    }
+    it->d = d;
+    it->pos = 0;
+}
+
+
+/**
+ * Get next entry of iteration, see header.
+ */
+bool
+dict_iter_next(
+    struct dict_iter *it,
+    const char **key,
+    size_t *key_len,
+    const char **value)
+{
+    struct dict *d = it->d;
+    if (d->mapped_entries != NULL) {
+        if (it->pos == d->len) {
+            return false;
+        }
+        const struct dict_file_entry *entry = &d->mapped_entries[it->pos++];
+        *key = d->mapped_strings + entry->key_offset;
+        *key_len = entry->key_len;
+        *value = _mapped_value(d, entry);
+
+        return true;
+    }
+
+    while (it->pos < d->entries_array_size) {
+        struct dict_entry *entry = &d->entries_array[it->pos++];
+        if (entry->is_alive) {
+            *key = entry->key;
+            *key_len = entry->key_len;
+            *value = entry->value;
+
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+/**
+ * Get entries array position of `dict_scan' cursor. Cursors of the
+ * previous array are mapped by `scan_remap', older ones start over.
+ */
+static inline size_t
+_scan_position(struct dict *d, uint64_t cursor)
+{
+    uint64_t generation = cursor >> DICT_SCAN_GENERATION_SHIFT;
+    size_t pos = cursor & DICT_SCAN_POSITION_MASK;
+    uint64_t current = d->entries_generation & (
+        UINT64_MAX >> DICT_SCAN_GENERATION_SHIFT);
+    if (generation == current) {
+        return pos;
+    }
+
+    uint64_t previous = (d->entries_generation - 1) & (
+        UINT64_MAX >> DICT_SCAN_GENERATION_SHIFT);
+    if (generation == previous && pos < d->scan_remap_size) {
+        return d->scan_remap[pos];
+    }
+
+    return 0;
+}
+
+
+/**
+ * Scan dictionary entries by cursor, see header.
+ */
+uint64_t
+dict_scan(
+    struct dict *d,
+    uint64_t cursor,
+    size_t count,
+    void (*fn)(void *arg, const char *key, size_t key_len, const char *value),
+    void *arg)
+{
+    // Entries are moved in order, so a rehash in progress is finished
+    // rather than walked in both arrays.
+    while (_is_rehashing(d)) {
+        _rehash_step(d);
+    }
+    if (count == 0) {
+        count = 1;
+    }
+
+    _lock_writer(d);
+    size_t pos = _scan_position(d, cursor);
+    size_t passed = 0;
+    size_t visited = 0;
+    if (d->mapped_entries != NULL) {
+        for (; pos < d->len && passed < count; ++pos, ++passed) {
+            const struct dict_file_entry *entry = &d->mapped_entries[pos];
+            fn(arg,
+                d->mapped_strings + entry->key_offset,
+                entry->key_len,
+                _mapped_value(d, entry));
+        }
+    } else {
+        while (pos < d->entries_array_size &&
+                passed < count &&
+                visited < count * DICT_SCAN_MAX_VISITS) {
+            struct dict_entry *entry = &d->entries_array[pos++];
+            if (entry->is_alive) {
+                fn(arg, entry->key, entry->key_len, entry->value);
+                ++passed;
+            }
+            ++visited;
+        }
+    }
+
+    size_t size = (
+        d->mapped_entries != NULL ? d->len : d->entries_array_size);
+    uint64_t next = 0;
+    if (pos < size) {
+        next = (
+            d->entries_generation << DICT_SCAN_GENERATION_SHIFT | pos);
+    }
+    _unlock_writer(d);
+
+    return next;
+}
+
+
+/**
+ * State shared by tasks of `dict_build'.
+ */
+struct dict_build_job
+{
+    struct dict *d;
+    const char *const *keys;
+    const char *const *values;
+    size_t n;
+    struct dict_bulk bulk;
+    // Per key: for the first of equal keys, number of the last one (whose
+    // value wins); `SIZE_MAX' for the rest. Once entries are filled, first
+    // keys map to their entry numbers instead.
+    size_t *links;
+    // Number of keys of every region which did not fit into it.
+    size_t *overflows;
+    // Per chunk: number of distinct keys, then number of chunk's first entry.
+    size_t *chunk_entries;
+    // Per chunk arenas of `DICT_OWNED' dictionary.
+    struct dict_arena *arenas;
+};
+
+
+/**
+ * Index key `i' of bulk build. While building, index slots hold key numbers
+ * instead of entry numbers. A key equal to an indexed one links to it.
+ * Probing stops at slot `end' (`SIZE_MAX' for none): return false if the
+ * key is not indexed because of that.
+ */
+static inline bool
+_build_index_key(struct dict_build_job *job, size_t i, size_t end)
+{
+    struct dict *d = job->d;
+    uint64_t hash = job->bulk.hashes[i];
+    size_t key_len = job->bulk.key_lens[i];
+    uint8_t tag = _hash_tag(hash);
+    size_t pos = hash % d->index_array_size;
+
+    while (true) {
+        int64_t first = _index_array_get(
+            d->index_array, d->index_array_item_size, pos);
+        if (first == ENTRY_EMPTY) {
+            _index_array_set(
+                d->index_array, d->index_array_item_size, pos, i);
+            d->index_tags[pos] = tag;
+            job->links[i] = i;
+
+            return true;
+        }
+        if (d->index_tags[pos] == tag &&
+                job->bulk.hashes[first] == hash &&
+                job->bulk.key_lens[first] == key_len &&
+                memcmp(job->keys[first], job->keys[i], key_len) == 0) {
+            job->links[first] = i;
+            job->links[i] = SIZE_MAX;
+
+            return true;
+        }
+
+        if (++pos == end) {
+            return false;
+        }
+        if (pos == d->index_array_size) {
+            pos = 0;
+        }
+    }
+}
+
+
+/**
+ * Index keys of region. Keys probing past the region end are left for
+ * `dict_build' at the start of the region's part of `order'.
+ */
+static void
+_build_index_region(void *arg, size_t region)
+{
+    struct dict_build_job *job = arg;
+    struct dict_bulk *bulk = &job->bulk;
+    size_t start = bulk->region_starts[region];
+    size_t end = bulk->region_starts[region + 1];
+    size_t region_end = (region + 1) * bulk->region_size;
+    if (region_end > bulk->table_size) {
+        region_end = bulk->table_size;
+    }
+
+    size_t overflows = 0;
+    for (size_t k = start; k < end; ++k) {
+        size_t i = bulk->order[k];
+        if (!_build_index_key(job, i, region_end)) {
+            bulk->order[start + overflows++] = i;
+        }
+    }
+    job->overflows[region] = overflows;
+}
+
+
+/**
+ * Get range of keys of chunk.
+ */
+static inline void
+_get_build_chunk(
+    struct dict_build_job *job, size_t chunk, size_t *start, size_t *end)
+{
+    *start = chunk * DICT_BULK_CHUNK_SIZE;
+    *end = *start + DICT_BULK_CHUNK_SIZE;
+    if (*end > job->n) {
+        *end = job->n;
+    }
+}
+
+
+/**
+ * Count distinct keys of chunk.
+ */
+static void
+_build_count_entries(void *arg, size_t chunk)
+{
+    struct dict_build_job *job = arg;
+    size_t start, end;
+    _get_build_chunk(job, chunk, &start, &end);
+
+    size_t count = 0;
+    for (size_t i = start; i < end; ++i) {
+        count += job->links[i] != SIZE_MAX;
+    }
+    job->chunk_entries[chunk] = count;
+}
+
+
+/**
+ * Fill entries of distinct keys of chunk, in input order.
+ */
+static void
+_build_fill_entries(void *arg, size_t chunk)
+{
+    struct dict_build_job *job = arg;
+    struct dict *d = job->d;
+    size_t start, end;
+    _get_build_chunk(job, chunk, &start, &end);
+
+    size_t entry_pos = job->chunk_entries[chunk];
+    for (size_t i = start; i < end; ++i) {
+        if (job->links[i] == SIZE_MAX) {
+            continue;
+        }
+
+        struct dict_entry *entry = &d->entries_array[entry_pos];
+        entry->hash = job->bulk.hashes[i];
+        entry->key = job->keys[i];
+        entry->key_len = job->bulk.key_lens[i];
+        entry->value = job->values[job->links[i]];
+        entry->is_alive = true;
+        if (d->flags & DICT_OWNED) {
+            _copy_entry_strings(&job->arenas[chunk], entry);
+        }
+        job->links[i] = entry_pos++;
+    }
+}
+
+
+/**
+ * Replace key numbers in index region by entry numbers.
+ */
+static void
+_build_renumber_region(void *arg, size_t region)
+{
+    struct dict_build_job *job = arg;
+    struct dict *d = job->d;
+    size_t start = region * job->bulk.region_size;
+    size_t end = start + job->bulk.region_size;
+    if (end > d->index_array_size) {
+        end = d->index_array_size;
+    }
+
+    for (size_t pos = start; pos < end; ++pos) {
+        int64_t i = _index_array_get(
+            d->index_array, d->index_array_item_size, pos);
+        if (i != ENTRY_EMPTY) {
+            _index_array_set(
+                d->index_array, d->index_array_item_size, pos,
+                job->links[i]);
+        }
+    }
+}
+
+
+/**
+ * Create dictionary of `n' keys and values, see header.
+ *
+ * Keys are hashed and grouped by index region first. Every region is then
+ * indexed by one task, with key numbers in the index and duplicates linked
+ * to their first key. Keys which do not fit into their region are indexed
+ * afterwards. Entries are filled for first keys in input order, and index
+ * slots are renumbered to point to them.
+ */
+struct dict *
+dict_build(
+    uint64_t (*hash_function)(const char *, size_t),
+    int flags,
+    const char *const *keys,
+    const char *const *values,
+    size_t n,
+    struct dict_pool *pool)
+{
+    struct dict *d = dict_init_flags(hash_function, flags);
+    if (n == 0) {
+        return d;
+    }
+    dict_reserve(d, n);
+
+    struct dict_build_job job = {
+        .d = d,
+        .keys = keys,
+        .values = values,
+        .n = n,
+    };
+    dict_bulk_init(
+        &job.bulk, hash_function, keys, n,
+        d->index_array_size, DICT_BUILD_REGION_SIZE, pool);
+    job.links = safe_malloc(sizeof(size_t) * n);
+    job.overflows = safe_malloc(sizeof(size_t) * job.bulk.regions);
+
+    dict_pool_run(pool, job.bulk.regions, _build_index_region, &job);
+    for (size_t region = 0; region < job.bulk.regions; ++region) {
+        size_t start = job.bulk.region_starts[region];
+        for (size_t k = 0; k < job.overflows[region]; ++k) {
+            _build_index_key(&job, job.bulk.order[start + k], SIZE_MAX);
+        }
+    }
+
+    size_t chunks = dict_bulk_chunks(n);
+    job.chunk_entries = safe_malloc(sizeof(size_t) * chunks);
+    job.arenas = safe_malloc(sizeof(struct dict_arena) * chunks);
+    for (size_t chunk = 0; chunk < chunks; ++chunk) {
+        dict_arena_init(&job.arenas[chunk]);
+    }
+
+    dict_pool_run(pool, chunks, _build_count_entries, &job);
+    size_t entries = 0;
+    for (size_t chunk = 0; chunk < chunks; ++chunk) {
+        size_t count = job.chunk_entries[chunk];
+        job.chunk_entries[chunk] = entries;
+        entries += count;
+    }
+    dict_pool_run(pool, chunks, _build_fill_entries, &job);
+    dict_pool_run(pool, job.bulk.regions, _build_renumber_region, &job);
+
+    for (size_t chunk = 0; chunk < chunks; ++chunk) {
+        dict_arena_merge(&d->arena, &job.arenas[chunk]);
+    }
+    d->len = entries;
+    d->entries_array_size = entries;
+    // Room was reserved for building only.
+    d->reserved = 0;
+
+    free(job.arenas);
+    free(job.chunk_entries);
+    free(job.overflows);
+    free(job.links);
+    dict_bulk_destroy(&job.bulk);
+
+    return d;
+}
+
+
+/**
+ * Header of snapshot file, see `DICT_FILE_MAGIC'.
+ */
+struct dict_file_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t hash_check;
+    uint64_t len;
+    uint64_t index_array_size;
+    uint64_t index_array_item_size;
+    // Offsets of sections from the file start, string heap size and file
+    // size.
+    uint64_t index_offset;
+    uint64_t tags_offset;
+    uint64_t entries_offset;
+    uint64_t strings_offset;
+    uint64_t strings_size;
+    uint64_t file_size;
+};
+
+
+/**
+ * Round snapshot file offset up to section alignment.
+ */
+static inline uint64_t
+_file_align(uint64_t offset)
+{
+    return (offset + DICT_FILE_ALIGN - 1) / DICT_FILE_ALIGN * DICT_FILE_ALIGN;
+}
+
+
+/**
+ * Hash identifying hash function of snapshot file.
+ */
+static inline uint64_t
+_file_hash_check(uint64_t (*hash_function)(const char *, size_t))
+{
+    return hash_function(
+        DICT_FILE_HASH_PROBE, sizeof(DICT_FILE_HASH_PROBE) - 1);
+}
+
+
+/**
+ * Write `size' bytes to snapshot file, advancing `offset'. Return false on
+ * error.
+ */
+static inline bool
+_file_write(FILE *file, const void *data, size_t size, uint64_t *offset)
+{
+    *offset += size;
+
+    return size == 0 || fwrite(data, size, 1, file) == 1;
+}
+
+
+/**
+ * Write zeros to snapshot file up to section start `end'.
+ */
+static inline bool
+_file_pad(FILE *file, uint64_t *offset, uint64_t end)
+{
+    static const char zeros[DICT_FILE_ALIGN];
+
+    return _file_write(file, zeros, end - *offset, offset);
+}
+
+
+/**
+ * Write snapshot of dictionary without deleted entries into `file'.
+ */
+static bool
+_save(struct dict *d, FILE *file)
+{
+    struct dict_file_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, DICT_FILE_MAGIC, sizeof(header.magic));
+    header.version = DICT_FILE_VERSION;
+    header.byte_order = DICT_FILE_BYTE_ORDER;
+    header.hash_check = _file_hash_check(d->hash_function);
+    header.len = d->len;
+    header.index_array_size = d->index_array_size;
+    header.index_array_item_size = d->index_array_item_size;
+
+    size_t index_bytes = d->index_array_size * d->index_array_item_size;
+    header.index_offset = _file_align(sizeof(header));
+    header.tags_offset = _file_align(header.index_offset + index_bytes);
+    header.entries_offset = _file_align(
+        header.tags_offset + d->index_array_size);
+    header.strings_offset = _file_align(
+        header.entries_offset + d->len * sizeof(struct dict_file_entry));
+    for (size_t i = 0; i < d->len; ++i) {
+        struct dict_entry *entry = &d->entries_array[i];
+        header.strings_size += entry->key_len + 1;
+        if (entry->value != NULL) {
+            header.strings_size += strlen(entry->value) + 1;
+        }
+    }
+    header.file_size = header.strings_offset + header.strings_size;
+
+    uint64_t offset = 0;
+    bool ok = (
+        _file_write(file, &header, sizeof(header), &offset) &&
+        _file_pad(file, &offset, header.index_offset) &&
+        _file_write(file, d->index_array, index_bytes, &offset) &&
+        _file_pad(file, &offset, header.tags_offset) &&
+        _file_write(file, d->index_tags, d->index_array_size, &offset) &&
+        _file_pad(file, &offset, header.entries_offset));
+
+    uint64_t string_offset = 0;
+    for (size_t i = 0; ok && i < d->len; ++i) {
+        struct dict_entry *entry = &d->entries_array[i];
+        struct dict_file_entry file_entry = {
+            .hash = entry->hash,
+            .key_offset = string_offset,
+            .key_len = entry->key_len,
+            .value_offset = DICT_FILE_NO_VALUE,
+        };
+        string_offset += entry->key_len + 1;
+        if (entry->value != NULL) {
+            file_entry.value_offset = string_offset;
+            string_offset += strlen(entry->value) + 1;
+        }
+        ok = _file_write(file, &file_entry, sizeof(file_entry), &offset);
+    }
+
+    ok = ok && _file_pad(file, &offset, header.strings_offset);
+    for (size_t i = 0; ok && i < d->len; ++i) {
+        struct dict_entry *entry = &d->entries_array[i];
+        ok = (
+            _file_write(file, entry->key, entry->key_len, &offset) &&
+            _file_write(file, "", 1, &offset));
+        if (ok && entry->value != NULL) {
+            ok = _file_write(
+                file, entry->value, strlen(entry->value) + 1, &offset);
+        }
+    }
+
+    return ok;
+}
+
+
+/**
+ * Sync directory holding `path', so a file renamed there stays after a
+ * crash. Return false on error.
+ */
+static bool
+_sync_dir(const char *path)
+{
+    const char *slash = strrchr(path, '/');
+    size_t dir_len = slash == NULL ? 0 : (size_t) (slash - path + 1);
+    char *dir = safe_malloc(dir_len + 2);
+    if (dir_len == 0) {
+        strcpy(dir, ".");
+    } else {
+        memcpy(dir, path, dir_len);
+        dir[dir_len] = '\0';
+    }
+    int fd = open(dir, O_RDONLY | O_DIRECTORY);
+    free(dir);
+    if (fd < 0) {
+        return false;
+    }
+
+    bool ok = fsync(fd) == 0;
+    int sync_errno = errno;
+    close(fd);
+    errno = sync_errno;
+
+    return ok;
+}
+
+
+/**
+ * Save dictionary into snapshot file, see header.
+ */
+bool
+dict_save(struct dict *d, const char *path)
+{
+    if (d->mapped_entries != NULL) {
+        _load_mapped_entries(d);
+    }
+    while (_is_rehashing(d)) {
+        _rehash_step(d);
+    }
+
+    // The snapshot is written next to `path' and renamed over it, so a
+    // mapping of the old file (this dictionary's keys and values included)
+    // keeps its pages, and a crash never leaves a truncated file.
+    size_t path_len = strlen(path);
+    char *temp_path = safe_malloc(path_len + sizeof(".XXXXXX"));
+    memcpy(temp_path, path, path_len);
+    memcpy(temp_path + path_len, ".XXXXXX", sizeof(".XXXXXX"));
+    int fd = mkstemp(temp_path);
+    if (fd < 0) {
+        free(temp_path);
+
+        return false;
+    }
+    FILE *file = fdopen(fd, "wb");
+    if (file == NULL) {
+        int open_errno = errno;
+        close(fd);
+        unlink(temp_path);
+        free(temp_path);
+        errno = open_errno;
+
+        return false;
+    }
+
+    _lock_writer(d);
+    if (d->entries_array_size != d->len) {
+        // Entries are saved with their numbers in the index, so deleted
+        // ones are dropped first.
+        _recreate_entries_array(d);
+    }
+    bool ok = _save(d, file);
+    _unlock_writer(d);
+
+    ok = ok && fflush(file) == 0 && fsync(fileno(file)) == 0;
+    int write_errno = errno;
+    if (fclose(file) != 0 && ok) {
+        ok = false;
+        write_errno = errno;
+    }
+    if (ok && rename(temp_path, path) != 0) {
+        ok = false;
+        write_errno = errno;
+    }
+    if (!ok) {
+        unlink(temp_path);
+    }
+    free(temp_path);
+    if (ok && !_sync_dir(path)) {
+        return false;
+    }
+    errno = write_errno;
+
+    return ok;
+}
+
+
+/**
+ * Is section of `count' items of `item_size' bytes at `offset' aligned and
+ * within snapshot file part ending at `end'.
+ */
+static inline bool
+_is_file_section_valid(
+    uint64_t offset, uint64_t count, uint64_t item_size, uint64_t end)
+{
+    return (
+        offset % DICT_FILE_ALIGN == 0 &&
+        offset <= end &&
+        count <= (end - offset) / item_size);
+}
+
+
+/**
+ * Check header of snapshot file of `size' bytes. Sections are checked to
+ * fit into the file; their contents are trusted.
+ */
+static bool
+_is_file_valid(
+    const struct dict_file_header *header,
+    size_t size,
+    uint64_t (*hash_function)(const char *, size_t))
+{
+    uint64_t item_size = header->index_array_item_size;
+
+    return (
+        memcmp(header->magic, DICT_FILE_MAGIC, sizeof(header->magic)) == 0 &&
+        header->version == DICT_FILE_VERSION &&
+        header->byte_order == DICT_FILE_BYTE_ORDER &&
+        header->hash_check == _file_hash_check(hash_function) &&
+        (item_size == sizeof(int8_t) || item_size == sizeof(int16_t) ||
+            item_size == sizeof(int32_t) || item_size == sizeof(int64_t)) &&
+        // Lookups stop at empty index slots, so there must be one.
+        header->len < header->index_array_size &&
+        header->file_size == size &&
+        header->index_offset >= sizeof(*header) &&
+        _is_file_section_valid(
+            header->index_offset, header->index_array_size, item_size,
+            header->tags_offset) &&
+        _is_file_section_valid(
+            header->tags_offset, header->index_array_size, 1,
+            header->entries_offset) &&
+        _is_file_section_valid(
+            header->entries_offset, header->len,
+            sizeof(struct dict_file_entry), header->strings_offset) &&
+        _is_file_section_valid(
+            header->strings_offset, header->strings_size, 1, size));
+}
+
+
+/**
+ * Open snapshot file by mapping it into memory, see header.
+ */
+struct dict *
+dict_open_mmap(
+    uint64_t (*hash_function)(const char *, size_t), const char *path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+
+        return NULL;
+    }
+    size_t size = st.st_size;
+    if (size < sizeof(struct dict_file_header)) {
+        close(fd);
+        errno = EINVAL;
+
+        return NULL;
+    }
+
+    void *mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    int map_errno = errno;
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        errno = map_errno;
+
+        return NULL;
+    }
+
+    const struct dict_file_header *header = mapping;
+    if (!_is_file_valid(header, size, hash_function)) {
+        munmap(mapping, size);
+        errno = EINVAL;
+
+        return NULL;
+    }
+
+    // Arrays of a new dictionary are replaced by ones of the mapping.
+    struct dict *d = dict_init_flags(hash_function, 0);
+    _entries_array_destroy(d->entries_array);
+    _index_array_destroy(d->index_array);
+    free(d->index_tags);
+
+    const char *base = mapping;
+    d->entries_array = NULL;
+    d->entries_array_size = 0;
+    d->entries_array_allocated = 0;
+    d->index_array = (void *) (base + header->index_offset);
+    d->index_tags = (uint8_t *) (base + header->tags_offset);
+    d->index_array_size = header->index_array_size;
+    d->index_array_item_size = header->index_array_item_size;
+    d->len = header->len;
+
+    d->mapping = mapping;
+    d->mapping_size = size;
+    d->mapped_entries = (const struct dict_file_entry *) (
+        base + header->entries_offset);
+    d->mapped_strings = base + header->strings_offset;
+
+    return d;
+}
+
+
+/**
+ * Write dictionary contents to `fd', see header.
+ */
+bool
+dict_dump(struct dict *d, int fd)
+{
+    while (_is_rehashing(d)) {
+        _rehash_step(d);
+    }
+
+    struct dict_stream_writer writer;
+    _lock_writer(d);
+    dict_stream_writer_init(&writer, fd, d->len);
+    if (d->mapped_entries != NULL) {
+        for (size_t i = 0; i < d->len; ++i) {
+            const struct dict_file_entry *entry = &d->mapped_entries[i];
+            dict_stream_write(
+                &writer,
+                d->mapped_strings + entry->key_offset,
+                entry->key_len,
+                _mapped_value(d, entry));
+        }
+    } else {
+        for (size_t i = 0; i < d->entries_array_size; ++i) {
+            struct dict_entry *entry = &d->entries_array[i];
+            if (entry->is_alive) {
+                dict_stream_write(
+                    &writer, entry->key, entry->key_len, entry->value);
+            }
+        }
+    }
+    _unlock_writer(d);
+
+    return dict_stream_writer_finish(&writer);
+}
+
+
+/**
+ * Create dictionary from contents written by `dict_dump', see header.
+ */
+struct dict *
+dict_load(
+    uint64_t (*hash_function)(const char *, size_t), int flags, int fd)
+{
+    struct dict_stream_reader reader;
+    if (!dict_stream_reader_init(&reader, fd)) {
+        return NULL;
+    }
+
+    struct dict *d = dict_init_flags(hash_function, flags | DICT_OWNED);
+    dict_reserve(d, reader.len);
+
+    const char *key;
+    size_t key_len;
+    const char *value;
+    while (dict_stream_read(&reader, &key, &key_len, &value)) {
+        dict_set_n(d, key, key_len, value);
+    }
+    if (!dict_stream_reader_finish(&reader)) {
+        int read_errno = errno;
+        dict_destroy(d);
+        errno = read_errno;
+
+        return NULL;
+    }
+    // Room was reserved for loading only.
+    d->reserved = 0;
+
+    return d;
+}
+
+
+/**
+ * Set log of changes, see header.
+ */
+void
+dict_set_log(struct dict *d, struct dict_log *log)
+{
+    _lock_writer(d);
+    d->log = log;
+    _unlock_writer(d);
+}
+
+
+/**
+ * Rewrite log from dictionary entries, see header.
+ */
+bool
+dict_rewrite_log(struct dict *d)
+{
+    if (d->mapped_entries != NULL) {
+        _load_mapped_entries(d);
+    }
+    while (_is_rehashing(d)) {
+        _rehash_step(d);
+    }
+
+    struct dict_log_rewrite rewrite;
+    _lock_writer(d);
+    if (d->log == NULL) {
+        _unlock_writer(d);
+        errno = EINVAL;
+
+        return false;
+    }
+    if (!dict_log_rewrite_begin(d->log, &rewrite, d->len)) {
+        _unlock_writer(d);
+
+        return false;
+    }
+    d->is_rewriting_log = true;
+    _unlock_writer(d);
+
+    // Entries are copied a batch at a time, letting writers in between.
+    // Entries changed meanwhile may be copied either way: records appended
+    // since the start follow them in the new log.
+    size_t pos = 0;
+    bool is_done = false;
+    while (!is_done) {
+        _lock_writer(d);
+        size_t end = pos + DICT_LOG_REWRITE_BATCH;
+        if (end >= d->entries_array_size) {
+            end = d->entries_array_size;
+            is_done = true;
+            d->is_rewriting_log = false;
+        }
+        for (; pos < end; ++pos) {
+            struct dict_entry *entry = &d->entries_array[pos];
+            if (entry->is_alive) {
+                dict_log_rewrite_add(
+                    &rewrite, entry->key, entry->key_len, entry->value);
+            }
+        }
+        _unlock_writer(d);
+
+        dict_log_rewrite_flush(&rewrite);
+    }
+
+    return dict_log_rewrite_end(&rewrite);
+}
+
+
+/**
+ * Create dictionary from log, see header.
+ */
+struct dict *
+dict_replay_log(
+    uint64_t (*hash_function)(const char *, size_t),
+    int flags,
+    const char *path)
+{
+    struct dict_log_reader reader;
+    if (!dict_log_reader_init(&reader, path)) {
+        return NULL;
+    }
+
+    struct dict *d = dict_init_flags(hash_function, flags | DICT_OWNED);
+    dict_reserve(d, reader.len);
+
+    const char *key;
+    size_t key_len;
+    const char *value;
+    bool is_deleted;
+    while (dict_log_read(&reader, &key, &key_len, &value, &is_deleted)) {
+        if (is_deleted) {
+            dict_del_n(d, key, key_len);
+        } else {
+            dict_set_n(d, key, key_len, value);
+        }
+    }
+    if (!dict_log_reader_finish(&reader)) {
+        int read_errno = errno;
+        dict_destroy(d);
+        errno = read_errno;
+
+        return NULL;
+    }
+    // Room was reserved for replay only.
+    d->reserved = 0;
+
+    return d;
+}
+
+
+/**
+ * Fill statistics of dictionary, see header.
+ */
+void
+dict_stats(struct dict *d, struct dict_stats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    _lock_writer(d);
+    stats->len = d->len;
+    stats->index_array_size = d->index_array_size;
+    stats->index_array_item_size = d->index_array_item_size;
+    stats->arena_bytes = d->arena.allocated;
+    stats->is_rehashing = _is_rehashing(d);
+    stats->resizes = d->resizes;
+    stats->rebuilds = d->rebuilds;
+    stats->compactions = d->compactions;
+
+    if (d->mapped_entries != NULL) {
+        stats->capacity = d->len;
+        stats->entries_array_size = d->len;
+        stats->mapped_bytes = d->mapping_size;
+    } else {
+        stats->capacity = d->entries_array_allocated;
+        stats->entries_array_size = d->entries_array_size;
+        stats->entries_bytes = (
+            sizeof(struct dict_entry) * d->entries_array_allocated);
+        stats->index_bytes = d->index_array_size * (
+            d->index_array_item_size + 1);
+    }
+    stats->tombstones = stats->entries_array_size - d->len;
+    if (stats->is_rehashing) {
+        // Old entries not visited yet are either alive or deleted.
+        stats->tombstones += d->old_entries_array_size - d->rehash_pos;
+        stats->entries_bytes += (
+            sizeof(struct dict_entry) * d->old_entries_array_size);
+        stats->index_bytes += d->old_index_array_size * (
+            d->old_index_array_item_size + 1);
+        if (d->rehash_repacks_arena) {
+            stats->arena_bytes += d->old_arena.allocated;
+        }
+    }
+    // Deleted entries keep their index slots too.
+    stats->load_factor = (
+        (double) stats->entries_array_size / d->index_array_size);
+
+    for (size_t i = 0; i < d->index_array_size; ++i) {
+        int64_t val = _index_array_get(
+            d->index_array, d->index_array_item_size, i);
+        if (val == ENTRY_EMPTY) {
+            continue;
+        }
+
+        uint64_t hash;
+        if (d->mapped_entries != NULL) {
+            hash = d->mapped_entries[val].hash;
+        } else if (d->entries_array[val].is_alive) {
+            hash = d->entries_array[val].hash;
+        } else {
+            continue;
+        }
+        size_t length = (
+            (i + d->index_array_size - hash % d->index_array_size) %
+            d->index_array_size);
+        if (length >= DICT_STATS_PROBE_LENGTHS) {
+            length = DICT_STATS_PROBE_LENGTHS - 1;
+        }
+        ++stats->probe_lengths[length];
+    }
+    _unlock_writer(d);
+}
+
+
+/**
+ * Draw dict contents for debugging.
+ */
+void
+dict_draw(struct dict *d)
+{
+    if (d->mapped_entries != NULL) {
+        _load_mapped_entries(d);
+    }
+
+    if (_is_rehashing(d)) {
+        printf(
+            "Rehashing: %ld of %ld old entries visited\n",
+            d->rehash_pos,
+            d->old_entries_array_size);
+    }
+
     printf("Index ");
     switch(d->index_array_item_size) {
     case sizeof(int8_t):
@@ -479,13 +2899,13 @@ dict_draw(struct dict *d)
     printf("\n");
 
     for (size_t i = 0; i < d->index_array_size; ++i) {
-        int val = _index_array_get(
+        int64_t val = _index_array_get(
             d->index_array, d->index_array_item_size, i);
 
         printf("%ld:\t", i);
 
         if (val != ENTRY_EMPTY) {
-            printf("-> %d\n", val);
+            printf("-> %ld\n", (long) val);
         } else {
             printf("-\n");
         }
@@ -499,7 +2919,8 @@ dict_draw(struct dict *d)
         struct dict_entry *entry = &d->entries_array[i];
 
         if (entry->is_alive) {
-            printf("%s:%s\n", entry->key, entry->value);
+            printf(
+                "%.*s:%s\n", (int) entry->key_len, entry->key, entry->value);
         } else {
             printf("-\n");
         }
@@ -1,7 +1,33 @@
 #ifndef COMPACT_DICT_H
 #define COMPACT_DICT_H
 
+#include <pthread.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "dict_arena.h"
+#include "dict_epoch.h"
+#include "dict_log.h"
+#include "dict_pool.h"
+
+
+// `dict_init_flags' flags.
+// Dictionary copies keys and values into its own arena, so callers need not
+// keep them alive. Values must be zero-terminated strings.
+#define DICT_OWNED 0x2
+// Rebuilds are spread over later operations instead of being done at once:
+// live entries are moved to a new entries array and index a few per call,
+// and lookups check both until the move is done.
+#define DICT_INCREMENTAL 0x4
+// Lookups run without locks and never wait, while writers (serialized by a
+// lock of the dictionary) publish replaced arrays for them. Replaced arrays
+// are freed once no lookup can use them (see dict_epoch.h). Values of
+// `DICT_OWNED' dictionary returned by `dict_get' stay valid only until the
+// caller's `dict_epoch_exit'; strings of other dictionaries must outlive the
+// lookups which may see them. Not combined with `DICT_INCREMENTAL', which is
+// ignored.
+#define DICT_CONCURRENT 0x8
 
 
 /**
@@ -9,13 +35,43 @@
  */
 struct dict_entry
 {
-    unsigned int hash;
+    uint64_t hash;
     const char *key;
+    // Key length, keys need not be zero-terminated.
+    size_t key_len;
     const char *value;
     bool is_alive;
 };
 
 
+/**
+ * Arrays of `DICT_CONCURRENT' dictionary used by lookups. Writers replace
+ * the whole view, so lookups never see an index of different arrays.
+ */
+struct dict_view
+{
+    struct dict_entry *entries_array;
+    void *index_array;
+    uint8_t *index_tags;
+    size_t index_array_size;
+    size_t index_array_item_size;
+};
+
+
+/**
+ * Entry of snapshot file written by `dict_save'. Keys and values are given
+ * by offsets into the file's string heap.
+ */
+struct dict_file_entry
+{
+    uint64_t hash;
+    uint64_t key_offset;
+    uint64_t key_len;
+    // `UINT64_MAX' for NULL value.
+    uint64_t value_offset;
+};
+
+
 /**
  * Dictionary object.
  */
@@ -23,6 +79,9 @@ struct dict
 {
     struct dict_entry *entries_array;
     void *index_array;
+    // Hash tag (8 high bits of entry hash) for every `index_array' slot.
+    // Probing compares tags first and loads entries only on tag match.
+    uint8_t *index_tags;
     size_t index_array_size;
     size_t index_array_item_size;
 
@@ -33,9 +92,123 @@ struct dict
     size_t entries_array_size;
     // `entries_array' full size (icluding free slots).
     size_t entries_array_allocated;
+    // Number of entries `dict_reserve' made room for. Arrays are not shrunk
+    // below this size.
+    size_t reserved;
+
+    // Hash function, called with key and key length.
+    uint64_t (*hash_function)(const char *, size_t);
+    // Pool to rebuild large index on, NULL to rebuild in the calling thread.
+    struct dict_pool *thread_pool;
+
+    // `DICT_*' flags given to `dict_init_flags'.
+    int flags;
+    // Storage for keys and values of `DICT_OWNED' dictionary.
+    struct dict_arena arena;
+    // Bytes of `arena' taken by deleted keys and replaced values. They are
+    // reclaimed by copying live strings into a new arena.
+    size_t arena_garbage;
+
+    // Arrays being rehashed by `DICT_INCREMENTAL' dictionary, NULL if there
+    // is no rehash in progress. Alive entries before `rehash_pos' have been
+    // moved to `entries_array'.
+    struct dict_entry *old_entries_array;
+    size_t old_entries_array_size;
+    void *old_index_array;
+    uint8_t *old_index_tags;
+    size_t old_index_array_size;
+    size_t old_index_array_item_size;
+    size_t rehash_pos;
+    // Whether moved entries get their strings copied from `old_arena' into
+    // `arena'. `old_arena' is freed when rehash ends.
+    bool rehash_repacks_arena;
+    struct dict_arena old_arena;
+
+    // Arrays published for lookups of `DICT_CONCURRENT' dictionary (NULL
+    // for other ones), and lock taken by its writers.
+    struct dict_view *view;
+    pthread_mutex_t write_lock;
+
+    // Snapshot file mapped by `dict_open_mmap' (NULL for other
+    // dictionaries). Until the first change, lookups go to its entries and
+    // the index arrays point into it; keys and values stay there for good.
+    void *mapping;
+    size_t mapping_size;
+    const struct dict_file_entry *mapped_entries;
+    const char *mapped_strings;
+
+    // Log changes are appended to, NULL if none. While `dict_rewrite_log'
+    // copies entries, `entries_array' is not recreated, so entries keep
+    // their positions.
+    struct dict_log *log;
+    bool is_rewriting_log;
+
+    // Bumped whenever entries are moved into a new `entries_array', so
+    // `dict_scan' cursors of older arrays are told apart. `scan_remap' maps
+    // every position of the previous array (and its end) to the position
+    // its entry was moved to, or the next entry was if it was deleted.
+    uint64_t entries_generation;
+    size_t *scan_remap;
+    size_t scan_remap_size;
 
-    // Hash function
-    unsigned int (*hash_function)(const char *);
+    // Number of times entries array was resized, index rebuilt and deleted
+    // entries dropped (by recreating entries array or incremental rehash),
+    // for `dict_stats'.
+    uint64_t resizes;
+    uint64_t rebuilds;
+    uint64_t compactions;
+};
+
+
+// Size of `dict_stats' probe length histogram.
+#define DICT_STATS_PROBE_LENGTHS 16
+
+
+/**
+ * Statistics of dictionary, see `dict_stats'.
+ */
+struct dict_stats
+{
+    // Number of entries.
+    size_t len;
+    // Entries array room, and entries in it including deleted ones.
+    size_t capacity;
+    size_t entries_array_size;
+    // Deleted entries still taking entries array and index slots (in both
+    // arrays during a rehash).
+    size_t tombstones;
+    // Index slots, share of them taken, and bytes per index item.
+    size_t index_array_size;
+    double load_factor;
+    size_t index_array_item_size;
+    // Bytes allocated for entries arrays, index arrays with their tags, and
+    // arena of `DICT_OWNED' dictionary; bytes of mapped snapshot file.
+    size_t entries_bytes;
+    size_t index_bytes;
+    size_t arena_bytes;
+    size_t mapped_bytes;
+    // Whether `DICT_INCREMENTAL' rehash is in progress. Its old arrays are
+    // counted in the bytes above.
+    bool is_rehashing;
+    // Number of entries of the current index found `i' slots after their
+    // home slot, the last item counts longer probes too.
+    size_t probe_lengths[DICT_STATS_PROBE_LENGTHS];
+    // Cumulative counts since the dictionary was created.
+    uint64_t resizes;
+    uint64_t rebuilds;
+    uint64_t compactions;
+};
+
+
+/**
+ * Iterator over dictionary entries, in insertion order. A deleted entry
+ * keeps its place until the entries array is compacted, and takes it again
+ * if its key is set meanwhile; set after that, it goes to the end.
+ */
+struct dict_iter
+{
+    struct dict *d;
+    size_t pos;
 };
 
 
@@ -43,7 +216,116 @@ struct dict
  * Create new dictionary object.
  */
 struct dict *
-dict_init(unsigned int (*hash_function)(const char *));
+dict_init(uint64_t (*hash_function)(const char *, size_t));
+
+
+/**
+ * Create new dictionary object with given `DICT_*' flags.
+ */
+struct dict *
+dict_init_flags(
+    uint64_t (*hash_function)(const char *, size_t), int flags);
+
+
+/**
+ * Create dictionary of `n' keys and values in one pass, as if they were set
+ * one by one (the last value of equal keys wins). Keys are zero-terminated.
+ * Work is spread over `pool' threads, NULL builds in the calling thread.
+ */
+struct dict *
+dict_build(
+    uint64_t (*hash_function)(const char *, size_t),
+    int flags,
+    const char *const *keys,
+    const char *const *values,
+    size_t n,
+    struct dict_pool *pool);
+
+
+/**
+ * Open snapshot file written by `dict_save' with the same hash function, by
+ * mapping it into memory. Lookups are served from the mapping at once,
+ * without reading or indexing entries. The first change copies entries and
+ * index into memory; keys and values are kept in the mapping. The file must
+ * not be changed while mapped. The dictionary has no flags. Return NULL on
+ * error, with `errno' set (`EINVAL' for files of other format, version or
+ * hash function).
+ */
+struct dict *
+dict_open_mmap(
+    uint64_t (*hash_function)(const char *, size_t), const char *path);
+
+
+/**
+ * Save dictionary into snapshot file at `path', see `dict_open_mmap'.
+ * Values must be zero-terminated strings. Deleted entries are dropped from
+ * the dictionary on the way. The file is written under a temporary name and
+ * renamed over `path', so re-saving over a file that is mapped (by this or
+ * any other dictionary) is supported, and a crash leaves either the old or
+ * the new file. Return false on error, with `errno' set.
+ */
+bool
+dict_save(struct dict *, const char *path);
+
+
+/**
+ * Write dictionary contents to file descriptor `fd' as a stream of
+ * checksummed blocks (see dict_stream.h), one block in memory at a time.
+ * Values must be zero-terminated strings. Writers of `DICT_CONCURRENT'
+ * dictionary wait until the dump is done. Return false on error, with
+ * `errno' set.
+ */
+bool
+dict_dump(struct dict *, int fd);
+
+
+/**
+ * Create dictionary with given `DICT_*' flags from stream written by
+ * `dict_dump' of any backend to `fd', read a block at a time. The
+ * dictionary is sized for the recorded number of entries up front.
+ * `DICT_OWNED' is added to the flags, as keys and values are copied out of
+ * the read buffer. Return NULL on error, with `errno' set (`EINVAL' for
+ * malformed or corrupted data).
+ */
+struct dict *
+dict_load(
+    uint64_t (*hash_function)(const char *, size_t), int flags, int fd);
+
+
+/**
+ * Append every change by `dict_set' and `dict_del' to `log' (see
+ * dict_log.h) before it is made, and commit it after, as the log's sync
+ * policy asks; NULL (the default) stops logging. Values must be
+ * zero-terminated strings. The log is not closed with the dictionary.
+ */
+void
+dict_set_log(struct dict *, struct dict_log *);
+
+
+/**
+ * Replace log with a new one holding records of current entries followed
+ * by changes made meanwhile. Entries are copied a few thousand at a time
+ * under writer lock, so writers of `DICT_CONCURRENT' dictionary running on
+ * other threads wait only briefly; `dict_save' must not run meanwhile.
+ * Return false on error, with `errno' set; the log stays in use then.
+ */
+bool
+dict_rewrite_log(struct dict *);
+
+
+/**
+ * Create dictionary with given `DICT_*' flags by replaying log at `path'
+ * written through `dict_set_log', sized up front for the entries of its
+ * last rewrite. A block torn by a crash at the end of log is cut off.
+ * `DICT_OWNED' is added to the flags, as keys and values are copied out of
+ * the read buffer. Return NULL on error, with `errno' set (`ENOENT' if
+ * there is no log).
+ */
+struct dict *
+dict_replay_log(
+    uint64_t (*hash_function)(const char *, size_t),
+    int flags,
+    const char *path);
 
 
 /**
@@ -53,6 +335,25 @@ void
 dict_destroy(struct dict *);
 
 
+/**
+ * Make room for given number of entries, so the dictionary is not resized
+ * until it holds more. The room is kept when entries are deleted; reserving
+ * 0 entries drops it.
+ */
+void
+dict_reserve(struct dict *, size_t);
+
+
+/**
+ * Rebuild large index on `pool' threads; NULL (the default) rebuilds in the
+ * calling thread. Incremental rehash steps are not affected. A pool runs
+ * one job at a time, so dictionaries sharing it must not be rebuilt from
+ * different threads at once.
+ */
+void
+dict_set_pool(struct dict *, struct dict_pool *);
+
+
 /**
  * Get value by key.
  */
@@ -60,6 +361,22 @@ const char *
 dict_get(struct dict *, const char *);
 
 
+/**
+ * Get value by key of given length.
+ */
+const char *
+dict_get_n(struct dict *, const char *, size_t);
+
+
+/**
+ * Get values of `n' zero-terminated keys into `values' (NULL for missing
+ * keys). Lookups are interleaved, so their cache misses overlap.
+ */
+void
+dict_get_many(
+    struct dict *, const char *const *keys, size_t n, const char **values);
+
+
 /**
  * Set value by key.
  */
@@ -67,6 +384,14 @@ void
 dict_set(struct dict *, const char *, const char *);
 
 
+/**
+ * Set value by key of given length. The key is stored by pointer, so it must
+ * outlive the entry.
+ */
+void
+dict_set_n(struct dict *, const char *, size_t, const char *);
+
+
 /**
  * Remove item by key.
  */
@@ -74,6 +399,60 @@ void
 dict_del(struct dict *, const char *);
 
 
+/**
+ * Remove item by key of given length.
+ */
+void
+dict_del_n(struct dict *, const char *, size_t);
+
+
+/**
+ * Start iteration over dictionary entries. The dictionary must not be
+ * changed until the iteration is done; see `dict_scan' otherwise.
+ */
+void
+dict_iter_init(struct dict_iter *, struct dict *);
+
+
+/**
+ * Get next entry of iteration into `key', `key_len' and `value'. Return
+ * false when there are no more entries.
+ */
+bool
+dict_iter_next(
+    struct dict_iter *, const char **key, size_t *key_len, const char **value);
+
+
+/**
+ * Call `fn' with `arg', key, key length and value for about `count' entries
+ * from `cursor' on (0 to start) and return cursor to continue from, 0 when
+ * the scan is done. The dictionary may be changed between calls, so large
+ * dictionaries are scanned in bounded steps. Entries are walked in
+ * insertion order; ones present during the whole scan are passed at least
+ * once, and other ones may be passed or not. A cursor is mapped exactly
+ * across one rebuild of the entries array (compaction, arena repack or
+ * `DICT_INCREMENTAL' rehash) between calls; after two or more the scan
+ * starts over, passing entries again, so it only makes progress while calls
+ * come more often than rebuilds. Writers of `DICT_CONCURRENT' dictionary
+ * wait during the call only. `fn' must not change the dictionary.
+ */
+uint64_t
+dict_scan(
+    struct dict *,
+    uint64_t cursor,
+    size_t count,
+    void (*fn)(void *arg, const char *key, size_t key_len, const char *value),
+    void *arg);
+
+
+/**
+ * Fill `stats' of dictionary, for monitoring. Takes time linear in index
+ * size. Writers of `DICT_CONCURRENT' dictionary wait meanwhile.
+ */
+void
+dict_stats(struct dict *, struct dict_stats *);
+
+
 /**
  * Draw dict contents for debugging.
  */
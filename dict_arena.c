@@ -0,0 +1,137 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dict_arena.h"
+
+
+// First chunk size. Every next chunk is twice bigger, up to
+// `DICT_ARENA_MAX_CHUNK_SIZE'.
+#define DICT_ARENA_MIN_CHUNK_SIZE 4096
+#define DICT_ARENA_MAX_CHUNK_SIZE (64 * 1024 * 1024)
+
+
+/**
+ * Malloc. Exit on failure.
+ */
+static inline void *
+safe_malloc(size_t size)
+{
+    void *ptr = malloc(size);
+    if (ptr == NULL) {
+        printf("fatal: Memory allocation failed\n");
+        exit(1);
+    }
+
+    return ptr;
+}
+
+
+/**
+ * Add new chunk with at least `min_size' free bytes.
+ */
+static void
+_add_chunk(struct dict_arena *arena, size_t min_size)
+{
+    size_t size = arena->next_chunk_size;
+    if (size < min_size) {
+        size = min_size;
+    }
+
+    struct dict_arena_chunk *chunk = safe_malloc(
+        sizeof(struct dict_arena_chunk) + size);
+    chunk->size = size;
+    chunk->used = 0;
+    chunk->next = arena->head;
+    arena->head = chunk;
+    arena->allocated += size;
+
+    if (arena->next_chunk_size < DICT_ARENA_MAX_CHUNK_SIZE) {
+        arena->next_chunk_size *= 2;
+    }
+}
+
+
+/**
+ * Initialize empty arena.
+ */
+void
+dict_arena_init(struct dict_arena *arena)
+{
+    arena->head = NULL;
+    arena->next_chunk_size = DICT_ARENA_MIN_CHUNK_SIZE;
+    arena->used = 0;
+    arena->allocated = 0;
+}
+
+
+/**
+ * Copy `len' bytes into arena and add terminating zero.
+ */
+char *
+dict_arena_copy(struct dict_arena *arena, const char *data, size_t len)
+{
+    size_t size = len + 1;
+    struct dict_arena_chunk *chunk = arena->head;
+    if (chunk == NULL || chunk->size - chunk->used < size) {
+        _add_chunk(arena, size);
+        chunk = arena->head;
+    }
+
+    char *ptr = chunk->data + chunk->used;
+    memcpy(ptr, data, len);
+    ptr[len] = '\0';
+    chunk->used += size;
+    arena->used += size;
+
+    return ptr;
+}
+
+
+/**
+ * Move all chunks of `src' into `arena', leaving `src' empty. Chunks of
+ * `src' are linked after the head of `arena', so it keeps filling its
+ * current chunk.
+ */
+void
+dict_arena_merge(struct dict_arena *arena, struct dict_arena *src)
+{
+    if (src->head == NULL) {
+        return;
+    }
+
+    if (arena->head == NULL) {
+        arena->head = src->head;
+        if (arena->next_chunk_size < src->next_chunk_size) {
+            arena->next_chunk_size = src->next_chunk_size;
+        }
+    } else {
+        struct dict_arena_chunk *tail = src->head;
+        while (tail->next != NULL) {
+            tail = tail->next;
+        }
+        tail->next = arena->head->next;
+        arena->head->next = src->head;
+    }
+    arena->used += src->used;
+    arena->allocated += src->allocated;
+
+    dict_arena_init(src);
+}
+
+
+/**
+ * Free all arena chunks.
+ */
+void
+dict_arena_destroy(struct dict_arena *arena)
+{
+    struct dict_arena_chunk *chunk = arena->head;
+    while (chunk != NULL) {
+        struct dict_arena_chunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+
+    dict_arena_init(arena);
+}
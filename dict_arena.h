@@ -0,0 +1,66 @@
+#ifndef DICT_ARENA_H
+#define DICT_ARENA_H
+
+#include <stddef.h>
+
+
+/**
+ * Arena chunk. Strings are bump-allocated from `data'.
+ */
+struct dict_arena_chunk
+{
+    struct dict_arena_chunk *next;
+    size_t size;
+    size_t used;
+    char data[];
+};
+
+
+/**
+ * Bump allocator for dictionary-owned keys and values. Nothing is freed
+ * individually: dictionaries count bytes of dead strings and copy the live
+ * ones into a fresh arena when there are too many dead bytes.
+ */
+struct dict_arena
+{
+    // Chunk being filled; older chunks follow by `next'.
+    struct dict_arena_chunk *head;
+    // Size of the next chunk.
+    size_t next_chunk_size;
+    // Bytes handed out by `dict_arena_copy'.
+    size_t used;
+    // Bytes allocated for chunks.
+    size_t allocated;
+};
+
+
+/**
+ * Initialize empty arena.
+ */
+void
+dict_arena_init(struct dict_arena *);
+
+
+/**
+ * Copy `len' bytes into arena and add terminating zero.
+ */
+char *
+dict_arena_copy(struct dict_arena *, const char *, size_t);
+
+
+/**
+ * Move all chunks of `src' into `arena', leaving `src' empty. Strings
+ * copied into `src' stay where they are.
+ */
+void
+dict_arena_merge(struct dict_arena *arena, struct dict_arena *src);
+
+
+/**
+ * Free all arena chunks.
+ */
+void
+dict_arena_destroy(struct dict_arena *);
+
+
+#endif
@@ -0,0 +1,234 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dict_bulk.h"
+
+
+/**
+ * Malloc. Exit on failure.
+ */
+static inline void *
+safe_malloc(size_t size)
+{
+    void *ptr = malloc(size);
+    if (ptr == NULL) {
+        printf("fatal: Memory allocation failed\n");
+        exit(1);
+    }
+
+    return ptr;
+}
+
+
+/**
+ * State shared by tasks of `dict_bulk_init'.
+ */
+struct dict_bulk_job
+{
+    struct dict_bulk *bulk;
+    // Keys are hashed by `hash_function', or items of known hashes are
+    // asked for them by `get_hash'.
+    uint64_t (*hash_function)(const char *, size_t);
+    const char *const *keys;
+    bool (*get_hash)(void *, size_t, uint64_t *);
+    void *arg;
+    size_t n;
+    // Per chunk: keys of every region, then where the chunk writes keys of
+    // every region into `order'. Row `chunk' starts at `chunk * regions'.
+    size_t *counts;
+};
+
+
+/**
+ * Get region of key's home slot.
+ */
+static inline size_t
+_get_region(struct dict_bulk *bulk, uint64_t hash)
+{
+    return hash % bulk->table_size / bulk->region_size;
+}
+
+
+/**
+ * Hash keys of chunk and count them per region.
+ */
+static void
+_hash_chunk(void *arg, size_t chunk)
+{
+    struct dict_bulk_job *job = arg;
+    struct dict_bulk *bulk = job->bulk;
+    size_t *counts = job->counts + chunk * bulk->regions;
+    size_t start = chunk * DICT_BULK_CHUNK_SIZE;
+    size_t end = start + DICT_BULK_CHUNK_SIZE;
+    if (end > job->n) {
+        end = job->n;
+    }
+
+    for (size_t i = start; i < end; ++i) {
+        uint64_t hash;
+        if (job->get_hash != NULL) {
+            if (!job->get_hash(job->arg, i, &hash)) {
+                continue;
+            }
+        } else {
+            size_t key_len = strlen(job->keys[i]);
+            hash = job->hash_function(job->keys[i], key_len);
+            bulk->key_lens[i] = key_len;
+        }
+        bulk->hashes[i] = hash;
+        ++counts[_get_region(bulk, hash)];
+    }
+}
+
+
+/**
+ * Scatter key numbers of chunk to their regions in `order'.
+ */
+static void
+_scatter_chunk(void *arg, size_t chunk)
+{
+    struct dict_bulk_job *job = arg;
+    struct dict_bulk *bulk = job->bulk;
+    size_t *offsets = job->counts + chunk * bulk->regions;
+    size_t start = chunk * DICT_BULK_CHUNK_SIZE;
+    size_t end = start + DICT_BULK_CHUNK_SIZE;
+    if (end > job->n) {
+        end = job->n;
+    }
+
+    for (size_t i = start; i < end; ++i) {
+        uint64_t hash;
+        if (job->get_hash != NULL && !job->get_hash(job->arg, i, &hash)) {
+            continue;
+        }
+        bulk->order[offsets[_get_region(bulk, bulk->hashes[i])]++] = i;
+    }
+}
+
+
+/**
+ * Number of chunks `n' keys are processed in.
+ */
+size_t
+dict_bulk_chunks(size_t n)
+{
+    return (n + DICT_BULK_CHUNK_SIZE - 1) / DICT_BULK_CHUNK_SIZE;
+}
+
+
+/**
+ * Group items of `job' by region of a table of `table_size' slots split into
+ * regions of `region_size' slots. Items are hashed and counted per chunk and
+ * region, then every chunk scatters its items to offsets given by prefix
+ * sums of the counts (a one-pass radix partition, stable because chunks come
+ * in input order).
+ */
+static void
+_partition(
+    struct dict_bulk *bulk,
+    struct dict_bulk_job *job,
+    size_t table_size,
+    size_t region_size,
+    struct dict_pool *pool)
+{
+    size_t n = job->n;
+    if (region_size > table_size) {
+        region_size = table_size;
+    }
+
+    bulk->hashes = safe_malloc(sizeof(uint64_t) * (n + 1));
+    bulk->key_lens = NULL;
+    if (job->get_hash == NULL) {
+        bulk->key_lens = safe_malloc(sizeof(size_t) * (n + 1));
+    }
+    bulk->order = safe_malloc(sizeof(size_t) * (n + 1));
+    bulk->table_size = table_size;
+    bulk->region_size = region_size;
+    bulk->regions = (table_size + region_size - 1) / region_size;
+    bulk->region_starts = safe_malloc(sizeof(size_t) * (bulk->regions + 1));
+
+    size_t chunks = dict_bulk_chunks(n);
+    job->bulk = bulk;
+    job->counts = calloc(chunks * bulk->regions + 1, sizeof(size_t));
+    if (job->counts == NULL) {
+        printf("fatal: Memory allocation failed\n");
+        exit(1);
+    }
+
+    dict_pool_run(pool, chunks, _hash_chunk, job);
+
+    size_t offset = 0;
+    for (size_t region = 0; region < bulk->regions; ++region) {
+        bulk->region_starts[region] = offset;
+        for (size_t chunk = 0; chunk < chunks; ++chunk) {
+            size_t *count = &job->counts[chunk * bulk->regions + region];
+            size_t chunk_items = *count;
+            *count = offset;
+            offset += chunk_items;
+        }
+    }
+    bulk->region_starts[bulk->regions] = offset;
+
+    dict_pool_run(pool, chunks, _scatter_chunk, job);
+
+    free(job->counts);
+}
+
+
+/**
+ * Hash `n' zero-terminated keys and group them by region, see header.
+ */
+void
+dict_bulk_init(
+    struct dict_bulk *bulk,
+    uint64_t (*hash_function)(const char *, size_t),
+    const char *const *keys,
+    size_t n,
+    size_t table_size,
+    size_t region_size,
+    struct dict_pool *pool)
+{
+    struct dict_bulk_job job = {
+        .hash_function = hash_function,
+        .keys = keys,
+        .n = n,
+    };
+    _partition(bulk, &job, table_size, region_size, pool);
+}
+
+
+/**
+ * Group `n' items of known hashes by region, see header.
+ */
+void
+dict_bulk_init_hashed(
+    struct dict_bulk *bulk,
+    bool (*get_hash)(void *, size_t, uint64_t *),
+    void *arg,
+    size_t n,
+    size_t table_size,
+    size_t region_size,
+    struct dict_pool *pool)
+{
+    struct dict_bulk_job job = {
+        .get_hash = get_hash,
+        .arg = arg,
+        .n = n,
+    };
+    _partition(bulk, &job, table_size, region_size, pool);
+}
+
+
+/**
+ * Free bulk build arrays.
+ */
+void
+dict_bulk_destroy(struct dict_bulk *bulk)
+{
+    free(bulk->region_starts);
+    free(bulk->order);
+    free(bulk->key_lens);
+    free(bulk->hashes);
+}
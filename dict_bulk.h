@@ -0,0 +1,90 @@
+#ifndef DICT_BULK_H
+#define DICT_BULK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "dict_pool.h"
+
+
+// Input keys are hashed and partitioned in chunks of this many keys, one
+// pool task per chunk.
+#define DICT_BULK_CHUNK_SIZE 65536
+
+
+/**
+ * Keys of a bulk build (or entries of a table being rebuilt): hashed once,
+ * and grouped by the table region their home slot falls into, so every
+ * region can be filled by one thread with writes confined to a cache-sized
+ * part of the table.
+ */
+struct dict_bulk
+{
+    // Hash and length of every input key. Lengths are not known for items
+    // grouped by `dict_bulk_init_hashed', `key_lens' is NULL then.
+    uint64_t *hashes;
+    size_t *key_lens;
+
+    // Input key numbers grouped by region, in input order within a region.
+    // Keys of region `r' are `order[region_starts[r]]' up to (not including)
+    // `order[region_starts[r + 1]]'.
+    size_t *order;
+    size_t *region_starts;
+    size_t regions;
+
+    // Home slot of a key is its hash modulo `table_size'. Region `r' takes
+    // slots from `r * region_size', the last region may be shorter.
+    size_t table_size;
+    size_t region_size;
+};
+
+
+/**
+ * Hash `n' zero-terminated keys and group them by region of a table of
+ * `table_size' slots split into regions of `region_size' slots. Work is
+ * spread over `pool' threads (NULL runs it in the calling thread).
+ */
+void
+dict_bulk_init(
+    struct dict_bulk *,
+    uint64_t (*hash_function)(const char *, size_t),
+    const char *const *keys,
+    size_t n,
+    size_t table_size,
+    size_t region_size,
+    struct dict_pool *pool);
+
+
+/**
+ * Group `n' items of known hashes by region, like `dict_bulk_init'.
+ * `get_hash(arg, i, &hash)' gives hash of item `i', or returns false for
+ * items left out of `order'; it is called twice for every item, from pool
+ * threads.
+ */
+void
+dict_bulk_init_hashed(
+    struct dict_bulk *,
+    bool (*get_hash)(void *, size_t, uint64_t *),
+    void *arg,
+    size_t n,
+    size_t table_size,
+    size_t region_size,
+    struct dict_pool *pool);
+
+
+/**
+ * Number of chunks `n' keys are processed in.
+ */
+size_t
+dict_bulk_chunks(size_t n);
+
+
+/**
+ * Free bulk build arrays.
+ */
+void
+dict_bulk_destroy(struct dict_bulk *);
+
+
+#endif
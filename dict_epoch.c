@@ -0,0 +1,219 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "dict_epoch.h"
+
+
+/**
+ * Memory waiting for readers to leave.
+ */
+struct dict_epoch_retired
+{
+    void *ptr;
+    void (*free_function)(void *);
+    // Global epoch when the memory was retired.
+    uint64_t epoch;
+    struct dict_epoch_retired *next;
+};
+
+
+// Global epoch. Starts from 1, as 0 marks records outside critical section.
+static uint64_t epoch_global = 1;
+
+// All reader records ever created. Records are reused, never freed.
+static struct dict_epoch_record *epoch_records;
+
+// Retired memory, newest first.
+static pthread_mutex_t epoch_retired_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct dict_epoch_retired *epoch_retired;
+
+// Record of current thread, released when the thread exits.
+static __thread struct dict_epoch_record *epoch_local;
+static pthread_key_t epoch_key;
+static pthread_once_t epoch_key_once = PTHREAD_ONCE_INIT;
+
+
+/**
+ * Malloc. Exit on failure.
+ */
+static inline void *
+safe_malloc(size_t size)
+{
+    void *ptr = malloc(size);
+    if (ptr == NULL) {
+        printf("fatal: Memory allocation failed\n");
+        exit(1);
+    }
+
+    return ptr;
+}
+
+
+/**
+ * Release record of exiting thread.
+ */
+static void
+_release_record(void *arg)
+{
+    struct dict_epoch_record *record = arg;
+    __atomic_store_n(&record->in_use, false, __ATOMIC_RELEASE);
+}
+
+
+/**
+ * Create key releasing records of exiting threads.
+ */
+static void
+_create_key(void)
+{
+    pthread_key_create(&epoch_key, _release_record);
+}
+
+
+/**
+ * Take free record or add new one for current thread.
+ */
+static struct dict_epoch_record *
+_acquire_record(void)
+{
+    pthread_once(&epoch_key_once, _create_key);
+
+    struct dict_epoch_record *record = __atomic_load_n(
+        &epoch_records, __ATOMIC_ACQUIRE);
+    for (; record != NULL; record = record->next) {
+        bool expected = false;
+        if (!__atomic_load_n(&record->in_use, __ATOMIC_RELAXED) &&
+                __atomic_compare_exchange_n(
+                    &record->in_use, &expected, true, false,
+                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+
+    if (record == NULL) {
+        if (posix_memalign(
+                (void **) &record,
+                _Alignof(struct dict_epoch_record),
+                sizeof(struct dict_epoch_record)) != 0) {
+            printf("fatal: Memory allocation failed\n");
+            exit(1);
+        }
+        record->epoch = 0;
+        record->nesting = 0;
+        record->in_use = true;
+        record->next = __atomic_load_n(&epoch_records, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(
+                &epoch_records, &record->next, record, true,
+                __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+        }
+    }
+
+    pthread_setspecific(epoch_key, record);
+
+    return record;
+}
+
+
+/**
+ * Enter critical section.
+ */
+void
+dict_epoch_enter(void)
+{
+    struct dict_epoch_record *record = epoch_local;
+    if (record == NULL) {
+        record = epoch_local = _acquire_record();
+    }
+
+    if (record->nesting++ == 0) {
+        // Sequentially consistent store: a writer scanning records after
+        // this store sees the reader, or the reader sees what the writer
+        // unlinked before the scan.
+        __atomic_store_n(
+            &record->epoch,
+            __atomic_load_n(&epoch_global, __ATOMIC_ACQUIRE),
+            __ATOMIC_SEQ_CST);
+    }
+}
+
+
+/**
+ * Leave critical section.
+ */
+void
+dict_epoch_exit(void)
+{
+    struct dict_epoch_record *record = epoch_local;
+    if (--record->nesting == 0) {
+        __atomic_store_n(&record->epoch, 0, __ATOMIC_RELEASE);
+    }
+}
+
+
+/**
+ * Free retired memory no reader can reach.
+ *
+ * Memory retired at epoch E may be used by readers which entered at E or
+ * before, so it is freed once every active reader entered after E. Memory
+ * retired by other threads during the scan of records is newer than the
+ * epoch read before it, so it is left for later.
+ */
+void
+dict_epoch_reclaim(void)
+{
+    uint64_t min_epoch = __atomic_load_n(&epoch_global, __ATOMIC_SEQ_CST);
+    struct dict_epoch_record *record = __atomic_load_n(
+        &epoch_records, __ATOMIC_ACQUIRE);
+    for (; record != NULL; record = record->next) {
+        uint64_t epoch = __atomic_load_n(&record->epoch, __ATOMIC_SEQ_CST);
+        if (epoch != 0 && epoch < min_epoch) {
+            min_epoch = epoch;
+        }
+    }
+
+    pthread_mutex_lock(&epoch_retired_lock);
+    struct dict_epoch_retired **link = &epoch_retired;
+    struct dict_epoch_retired *ready = NULL;
+    while (*link != NULL) {
+        struct dict_epoch_retired *retired = *link;
+        if (retired->epoch < min_epoch) {
+            *link = retired->next;
+            retired->next = ready;
+            ready = retired;
+        } else {
+            link = &retired->next;
+        }
+    }
+    pthread_mutex_unlock(&epoch_retired_lock);
+
+    while (ready != NULL) {
+        struct dict_epoch_retired *next = ready->next;
+        ready->free_function(ready->ptr);
+        free(ready);
+        ready = next;
+    }
+}
+
+
+/**
+ * Free `ptr' once no reader can reach it.
+ */
+void
+dict_epoch_retire(void *ptr, void (*free_function)(void *))
+{
+    struct dict_epoch_retired *retired = safe_malloc(
+        sizeof(struct dict_epoch_retired));
+    retired->ptr = ptr;
+    retired->free_function = free_function;
+    // Readers entering from now on see the epoch after this one, and
+    // cannot reach `ptr'.
+    retired->epoch = __atomic_fetch_add(&epoch_global, 1, __ATOMIC_SEQ_CST);
+
+    pthread_mutex_lock(&epoch_retired_lock);
+    retired->next = epoch_retired;
+    epoch_retired = retired;
+    pthread_mutex_unlock(&epoch_retired_lock);
+
+    dict_epoch_reclaim();
+}
@@ -0,0 +1,70 @@
+#ifndef DICT_EPOCH_H
+#define DICT_EPOCH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+/**
+ * Epoch-based reclamation for dictionaries read without locks.
+ *
+ * Readers wrap lookups in `dict_epoch_enter' / `dict_epoch_exit'. Writers
+ * unlink memory first (so new readers cannot reach it), then hand it to
+ * `dict_epoch_retire'. It is freed once every reader that was inside a
+ * critical section at that time has left it.
+ *
+ * Every thread gets its own record in its own cache line, so readers never
+ * write to memory shared with other threads. There is one epoch domain per
+ * process.
+ */
+
+
+/**
+ * Reader record of one thread.
+ */
+struct dict_epoch_record
+{
+    // Global epoch seen when the thread entered critical section, 0 if it
+    // is not in one. Written by owning thread only.
+    uint64_t epoch;
+    // Critical sections entered and not left, they may be nested.
+    unsigned int nesting;
+    // Whether record is owned by a live thread.
+    bool in_use;
+    struct dict_epoch_record *next;
+} __attribute__((aligned(64)));
+
+
+/**
+ * Enter critical section: memory reachable from now on is not freed until
+ * `dict_epoch_exit'. Wait-free.
+ */
+void
+dict_epoch_enter(void);
+
+
+/**
+ * Leave critical section.
+ */
+void
+dict_epoch_exit(void);
+
+
+/**
+ * Free `ptr' with `free_function' once no reader can reach it. It must be
+ * unlinked already.
+ */
+void
+dict_epoch_retire(void *ptr, void (*free_function)(void *));
+
+
+/**
+ * Free retired memory no reader can reach any more. Called by
+ * `dict_epoch_retire', so it is only needed to release memory early.
+ */
+void
+dict_epoch_reclaim(void);
+
+
+#endif
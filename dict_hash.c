@@ -0,0 +1,186 @@
+#include <string.h>
+#include <stdint.h>
+
+#include "dict_hash.h"
+
+
+uint64_t dict_hash_seed = DICT_HASH_DEFAULT_SEED;
+
+
+// Mixing constants (odd, with balanced bits).
+#define SECRET_0 0x2d358dccaa6c78a5ULL
+#define SECRET_1 0x8bb84b93962eacc9ULL
+#define SECRET_2 0x4b33a62ed433d4a3ULL
+#define SECRET_3 0x4d5a2da51de1aa47ULL
+
+
+/**
+ * Multiply `*a' by `*b', put low half of 128-bit product into `*a' and high
+ * half into `*b'.
+ */
+static inline void
+_mum(uint64_t *a, uint64_t *b)
+{
+#ifdef __SIZEOF_INT128__
+    __uint128_t r = (__uint128_t) *a * *b;
+    *a = (uint64_t) r;
+    *b = (uint64_t) (r >> 64);
+#else
+    uint64_t ha = *a >> 32, hb = *b >> 32;
+    uint64_t la = (uint32_t) *a, lb = (uint32_t) *b;
+    uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    uint64_t t = rl + (rm0 << 32);
+    uint64_t c = t < rl;
+    uint64_t lo = t + (rm1 << 32);
+    c += lo < t;
+    uint64_t hi = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+    *a = lo;
+    *b = hi;
+#endif
+}
+
+
+/**
+ * Multiply and fold 128-bit product into 64 bits.
+ */
+static inline uint64_t
+_mix(uint64_t a, uint64_t b)
+{
+    _mum(&a, &b);
+
+    return a ^ b;
+}
+
+
+/**
+ * Read little-endian 64-bit word.
+ */
+static inline uint64_t
+_read64(const uint8_t *p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+
+    return v;
+}
+
+
+/**
+ * Read little-endian 32-bit word.
+ */
+static inline uint64_t
+_read32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap32(v);
+#endif
+
+    return v;
+}
+
+
+/**
+ * Hash `len' bytes with given seed.
+ */
+uint64_t
+dict_hash_bytes(const void *data, size_t len, uint64_t seed)
+{
+    const uint8_t *p = data;
+    uint64_t a;
+    uint64_t b;
+
+    seed ^= _mix(seed ^ SECRET_0, SECRET_1);
+
+    if (len <= 16) {
+        if (len >= 4) {
+            // Two overlapping pairs of 32-bit reads cover 4..16 bytes.
+            size_t shift = (len >> 3) << 2;
+            a = (_read32(p) << 32) | _read32(p + shift);
+            b = (_read32(p + len - 4) << 32) | _read32(p + len - 4 - shift);
+        } else if (len > 0) {
+            a = ((uint64_t) p[0] << 16) | ((uint64_t) p[len >> 1] << 8) |
+                p[len - 1];
+            b = 0;
+        } else {
+            a = 0;
+            b = 0;
+        }
+    } else {
+        size_t i = len;
+        if (i > 48) {
+            uint64_t seed1 = seed;
+            uint64_t seed2 = seed;
+            do {
+                seed = _mix(_read64(p) ^ SECRET_1, _read64(p + 8) ^ seed);
+                seed1 = _mix(
+                    _read64(p + 16) ^ SECRET_2, _read64(p + 24) ^ seed1);
+                seed2 = _mix(
+                    _read64(p + 32) ^ SECRET_3, _read64(p + 40) ^ seed2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= seed1 ^ seed2;
+        }
+
+        while (i > 16) {
+            seed = _mix(_read64(p) ^ SECRET_1, _read64(p + 8) ^ seed);
+            i -= 16;
+            p += 16;
+        }
+
+        // Last 16 bytes, possibly overlapping with already hashed ones.
+        a = _read64(p + i - 16);
+        b = _read64(p + i - 8);
+    }
+
+    a ^= SECRET_1;
+    b ^= seed;
+    _mum(&a, &b);
+
+    return _mix(a ^ SECRET_0 ^ len, b ^ SECRET_1);
+}
+
+
+/**
+ * Hash key of `len' bytes with `dict_hash_seed'.
+ */
+uint64_t
+dict_hash(const char *key, size_t len)
+{
+    return dict_hash_bytes(key, len, dict_hash_seed);
+}
+
+
+/**
+ * Reverse bit order of `v'.
+ */
+static inline uint64_t
+_reverse_bits(uint64_t v)
+{
+    const uint64_t m1 = 0x5555555555555555ULL;
+    const uint64_t m2 = 0x3333333333333333ULL;
+    const uint64_t m4 = 0x0F0F0F0F0F0F0F0FULL;
+    v = ((v >> 1) & m1) | ((v & m1) << 1);
+    v = ((v >> 2) & m2) | ((v & m2) << 2);
+    v = ((v >> 4) & m4) | ((v & m4) << 4);
+
+    return __builtin_bswap64(v);
+}
+
+
+/**
+ * Advance table cursor in reverse binary order, see header.
+ */
+uint64_t
+dict_scan_next_cursor(uint64_t cursor, uint64_t mask)
+{
+    // Set bits above the mask, so the increment carries past them to 0.
+    cursor |= ~mask;
+
+    return _reverse_bits(_reverse_bits(cursor) + 1);
+}
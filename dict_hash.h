@@ -0,0 +1,50 @@
+#ifndef DICT_HASH_H
+#define DICT_HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+// Seed used by `dict_hash' until `dict_hash_seed' is changed.
+#define DICT_HASH_DEFAULT_SEED 0x9E3779B97F4A7C15ULL
+
+
+/**
+ * Seed for `dict_hash'. Set it (e.g. to a random value at startup)
+ * before any dictionary using `dict_hash' is filled.
+ */
+extern uint64_t dict_hash_seed;
+
+
+/**
+ * Hash `len' bytes with given seed.
+ *
+ * wyhash-style: 48 bytes per step in three independent lanes, mixed with
+ * 64x64->128 bit multiplication.
+ */
+uint64_t
+dict_hash_bytes(const void *data, size_t len, uint64_t seed);
+
+
+/**
+ * Hash key of `len' bytes with `dict_hash_seed'. Can be given to `dict_init'
+ * as hash function.
+ */
+uint64_t
+dict_hash(const char *key, size_t len);
+
+
+/**
+ * Advance cursor over home slots of power-of-two table of `mask' + 1 slots
+ * (slot is hash & `mask') in reverse binary order: the high bits of the
+ * slot number are incremented first. Slots visited before cursor stay
+ * visited after table is resized to another power of two: slots of a grown
+ * table before the cursor are those split from visited ones, and of a
+ * shrunk table those all of whose parts were visited. Return 0 when every
+ * slot is visited.
+ */
+uint64_t
+dict_scan_next_cursor(uint64_t cursor, uint64_t mask);
+
+
+#endif
@@ -0,0 +1,201 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Slow paths of the macros are built in any case, for programs built with
+// `DICT_INSTRUMENT' to link against this module as it is.
+#ifndef DICT_INSTRUMENT
+#define DICT_INSTRUMENT
+#endif
+#include "dict_instr.h"
+
+
+// All thread records ever created. Records are reused, never freed, so
+// counters of exited threads are kept.
+static struct dict_instr_record *instr_records;
+
+// Hooks, with threshold read by lookups on their own.
+static struct dict_instr_hooks instr_hooks;
+size_t dict_instr_long_probe_threshold = DICT_INSTR_LONG_PROBE;
+
+// Record of current thread, released when the thread exits.
+__thread struct dict_instr_record *dict_instr_local;
+static pthread_key_t instr_key;
+static pthread_once_t instr_key_once = PTHREAD_ONCE_INIT;
+
+
+/**
+ * Release record of exiting thread.
+ */
+static void
+_release_record(void *arg)
+{
+    struct dict_instr_record *record = arg;
+    __atomic_store_n(&record->in_use, false, __ATOMIC_RELEASE);
+}
+
+
+/**
+ * Create key releasing records of exiting threads.
+ */
+static void
+_create_key(void)
+{
+    pthread_key_create(&instr_key, _release_record);
+}
+
+
+/**
+ * Add counters of record to `sum'.
+ */
+static void
+_add_counters(
+    struct dict_instr_counters *sum, struct dict_instr_record *record)
+{
+    struct dict_instr_counters *counters = &record->counters;
+    sum->gets += __atomic_load_n(&counters->gets, __ATOMIC_RELAXED);
+    sum->sets += __atomic_load_n(&counters->sets, __ATOMIC_RELAXED);
+    sum->dels += __atomic_load_n(&counters->dels, __ATOMIC_RELAXED);
+    sum->lookups += __atomic_load_n(&counters->lookups, __ATOMIC_RELAXED);
+    sum->probes += __atomic_load_n(&counters->probes, __ATOMIC_RELAXED);
+    sum->key_compares += __atomic_load_n(
+        &counters->key_compares, __ATOMIC_RELAXED);
+    sum->long_probes += __atomic_load_n(
+        &counters->long_probes, __ATOMIC_RELAXED);
+    sum->rebuilds += __atomic_load_n(&counters->rebuilds, __ATOMIC_RELAXED);
+    sum->rebuild_ns += __atomic_load_n(
+        &counters->rebuild_ns, __ATOMIC_RELAXED);
+}
+
+
+/**
+ * Set hooks, see header.
+ */
+void
+dict_instr_set_hooks(const struct dict_instr_hooks *hooks)
+{
+    instr_hooks = *hooks;
+    if (instr_hooks.long_probe_threshold == 0) {
+        instr_hooks.long_probe_threshold = DICT_INSTR_LONG_PROBE;
+    }
+    __atomic_store_n(
+        &dict_instr_long_probe_threshold,
+        instr_hooks.long_probe_threshold,
+        __ATOMIC_RELAXED);
+}
+
+
+/**
+ * Get counters of calling thread, see header.
+ */
+void
+dict_instr_thread_counters(struct dict_instr_counters *counters)
+{
+    *counters = (struct dict_instr_counters) {0};
+    if (dict_instr_local != NULL) {
+        _add_counters(counters, dict_instr_local);
+    }
+}
+
+
+/**
+ * Get counters summed over all threads, see header.
+ */
+void
+dict_instr_counters(struct dict_instr_counters *counters)
+{
+    *counters = (struct dict_instr_counters) {0};
+    struct dict_instr_record *record = __atomic_load_n(
+        &instr_records, __ATOMIC_ACQUIRE);
+    for (; record != NULL; record = record->next) {
+        _add_counters(counters, record);
+    }
+}
+
+
+/**
+ * Take free record or add new one for current thread. Counters of a reused
+ * record are kept and go on growing.
+ */
+struct dict_instr_record *
+dict_instr_acquire(void)
+{
+    pthread_once(&instr_key_once, _create_key);
+
+    struct dict_instr_record *record = __atomic_load_n(
+        &instr_records, __ATOMIC_ACQUIRE);
+    for (; record != NULL; record = record->next) {
+        bool expected = false;
+        if (!__atomic_load_n(&record->in_use, __ATOMIC_RELAXED) &&
+                __atomic_compare_exchange_n(
+                    &record->in_use, &expected, true, false,
+                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+
+    if (record == NULL) {
+        if (posix_memalign(
+                (void **) &record,
+                _Alignof(struct dict_instr_record),
+                sizeof(struct dict_instr_record)) != 0) {
+            printf("fatal: Memory allocation failed\n");
+            exit(1);
+        }
+        record->counters = (struct dict_instr_counters) {0};
+        record->in_use = true;
+        record->next = __atomic_load_n(&instr_records, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(
+                &instr_records, &record->next, record, true,
+                __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+        }
+    }
+
+    pthread_setspecific(instr_key, record);
+    dict_instr_local = record;
+
+    return record;
+}
+
+
+/**
+ * Count long lookup and call its hook, see header.
+ */
+void
+dict_instr_long_probe(const char *key, size_t key_len, size_t probes)
+{
+    _dict_instr_add(&_dict_instr_counters()->long_probes, 1);
+    if (instr_hooks.long_probe != NULL) {
+        instr_hooks.long_probe(key, key_len, probes);
+    }
+}
+
+
+/**
+ * Count rebuild and call its hook, see header.
+ */
+void
+dict_instr_rebuild(uint64_t start)
+{
+    uint64_t ns = dict_instr_now() - start;
+    struct dict_instr_counters *counters = _dict_instr_counters();
+    _dict_instr_add(&counters->rebuilds, 1);
+    _dict_instr_add(&counters->rebuild_ns, ns);
+    if (instr_hooks.rebuild != NULL) {
+        instr_hooks.rebuild(ns);
+    }
+}
+
+
+/**
+ * Monotonic clock in nanoseconds, see header.
+ */
+uint64_t
+dict_instr_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
@@ -0,0 +1,226 @@
+#ifndef DICT_INSTR_H
+#define DICT_INSTR_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+
+/**
+ * Optional instrumentation of dictionary hot paths.
+ *
+ * Backends call the `DICT_INSTR_*' macros below in their operations, probe
+ * loops and rebuilds. Unless the program is built with `DICT_INSTRUMENT'
+ * defined (e.g. `make CFLAGS="-O2 -DDICT_INSTRUMENT"'), the macros expand
+ * to nothing and the counters stay zero.
+ *
+ * Counters are kept per thread, in records of their own cache line, and
+ * only the owning thread writes them, with plain (relaxed) stores and no
+ * read-modify-write atomics. Readers sum the records of all threads.
+ */
+
+
+// Lookups probing at least this many slots count as long by default, see
+// `dict_instr_set_hooks'.
+#define DICT_INSTR_LONG_PROBE 8
+
+
+/**
+ * Counters of dictionary operations.
+ */
+struct dict_instr_counters
+{
+    // Calls of `dict_get', `dict_set' and `dict_del' (and their `_n'
+    // variants; `dict_set_if_absent' counts as set).
+    uint64_t gets;
+    uint64_t sets;
+    uint64_t dels;
+    // Probe loops run by dictionary operations (an operation may run a few,
+    // e.g. in old and new tables during rehash), and slots they read:
+    // index slots for compact_dict, control byte groups for
+    // open_addressing_dict, bucket and chain links for linked_list_dict and
+    // table slots for lock_free_dict.
+    uint64_t lookups;
+    uint64_t probes;
+    // Full key comparisons, done for entries of equal hash and length.
+    uint64_t key_compares;
+    // Lookups which probed at least the long probe threshold.
+    uint64_t long_probes;
+    // Rebuilds and resizes done at once (chunks of lock_free_dict resizes),
+    // and nanoseconds spent in them. Steps of incremental rehash, bounded
+    // by design, are not counted.
+    uint64_t rebuilds;
+    uint64_t rebuild_ns;
+};
+
+
+/**
+ * Counters of one thread. Records are reused by new threads, never freed.
+ */
+struct dict_instr_record
+{
+    struct dict_instr_counters counters;
+    // Whether record is owned by a live thread.
+    bool in_use;
+    struct dict_instr_record *next;
+} __attribute__((aligned(64)));
+
+
+/**
+ * Callbacks for instrumented builds. They are called in the thread doing
+ * the operation, with dictionary locks held, so they must not use the
+ * dictionary.
+ */
+struct dict_instr_hooks
+{
+    // Called after lookup of key of `key_len' bytes probed `probes' slots,
+    // at least `long_probe_threshold'; e.g. to record the caller's stack
+    // and find call sites hitting long probe chains. NULL for none.
+    void (*long_probe)(const char *key, size_t key_len, size_t probes);
+    // 0 for `DICT_INSTR_LONG_PROBE'.
+    size_t long_probe_threshold;
+    // Called after a rebuild which took `ns' nanoseconds. NULL for none.
+    void (*rebuild)(uint64_t ns);
+};
+
+
+/**
+ * Set hooks (copied). Should be called before dictionaries are used by
+ * other threads.
+ */
+void
+dict_instr_set_hooks(const struct dict_instr_hooks *);
+
+
+/**
+ * Get counters of the calling thread.
+ */
+void
+dict_instr_thread_counters(struct dict_instr_counters *);
+
+
+/**
+ * Get counters summed over all threads, including exited ones. Counters of
+ * running threads are read as they are, not as a snapshot.
+ */
+void
+dict_instr_counters(struct dict_instr_counters *);
+
+
+#ifdef DICT_INSTRUMENT
+
+
+// Record of current thread, NULL until its first counted event.
+extern __thread struct dict_instr_record *dict_instr_local;
+
+// Long probe threshold of hooks.
+extern size_t dict_instr_long_probe_threshold;
+
+
+/**
+ * Take record for current thread. Slow path of `_dict_instr_counters'.
+ */
+struct dict_instr_record *
+dict_instr_acquire(void);
+
+
+/**
+ * Count long lookup and call its hook. Slow path of `_dict_instr_lookup'.
+ */
+void
+dict_instr_long_probe(const char *key, size_t key_len, size_t probes);
+
+
+/**
+ * Count rebuild started at `start' (see `dict_instr_now') and call its hook.
+ */
+void
+dict_instr_rebuild(uint64_t start);
+
+
+/**
+ * Monotonic clock in nanoseconds.
+ */
+uint64_t
+dict_instr_now(void);
+
+
+/**
+ * Counters of current thread.
+ */
+static inline struct dict_instr_counters *
+_dict_instr_counters(void)
+{
+    struct dict_instr_record *record = dict_instr_local;
+    if (__builtin_expect(record == NULL, 0)) {
+        record = dict_instr_acquire();
+    }
+
+    return &record->counters;
+}
+
+
+/**
+ * Add to counter of current thread. Only this thread writes it, so a plain
+ * load and a relaxed store are enough; the store keeps readers of other
+ * threads free of data races.
+ */
+static inline void
+_dict_instr_add(uint64_t *counter, uint64_t n)
+{
+    __atomic_store_n(counter, *counter + n, __ATOMIC_RELAXED);
+}
+
+
+/**
+ * Count lookup of key which probed `probes' slots.
+ */
+static inline void
+_dict_instr_lookup(const char *key, size_t key_len, size_t probes)
+{
+    struct dict_instr_counters *counters = _dict_instr_counters();
+    _dict_instr_add(&counters->lookups, 1);
+    _dict_instr_add(&counters->probes, probes);
+    if (__builtin_expect(
+            probes >= __atomic_load_n(
+                &dict_instr_long_probe_threshold, __ATOMIC_RELAXED), 0)) {
+        dict_instr_long_probe(key, key_len, probes);
+    }
+}
+
+
+// Count call of operation, `field' of `struct dict_instr_counters'.
+#define DICT_INSTR_OP(field) \
+    _dict_instr_add(&_dict_instr_counters()->field, 1)
+// Count lookup of key which probed `probes' slots.
+#define DICT_INSTR_LOOKUP(key, key_len, probes) \
+    _dict_instr_lookup((key), (key_len), (probes))
+// `memcmp' of keys, counted as full key comparison.
+#define DICT_INSTR_MEMCMP(a, b, n) \
+    (_dict_instr_add(&_dict_instr_counters()->key_compares, 1), \
+        memcmp((a), (b), (n)))
+// Time rebuild from `DICT_INSTR_REBUILD_BEGIN' to `DICT_INSTR_REBUILD_END'
+// in the same block.
+#define DICT_INSTR_REBUILD_BEGIN() \
+    uint64_t dict_instr_rebuild_start = dict_instr_now()
+#define DICT_INSTR_REBUILD_END() \
+    dict_instr_rebuild(dict_instr_rebuild_start)
+
+
+#else
+
+
+#define DICT_INSTR_OP(field) ((void) 0)
+// Probe count is still used, so counting loops raise no warnings; the
+// compiler drops them.
+#define DICT_INSTR_LOOKUP(key, key_len, probes) ((void) (probes))
+#define DICT_INSTR_MEMCMP(a, b, n) memcmp((a), (b), (n))
+#define DICT_INSTR_REBUILD_BEGIN() ((void) 0)
+#define DICT_INSTR_REBUILD_END() ((void) 0)
+
+
+#endif
+
+
+#endif
@@ -0,0 +1,1050 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "dict_log.h"
+#include "dict_stream.h"
+
+
+// Log header fields, see dict_log.h.
+#define DICT_LOG_MAGIC "DICTLOG1"
+#define DICT_LOG_VERSION 1
+#define DICT_LOG_BYTE_ORDER 0x01020304
+
+// Value size of deletion record.
+#define DICT_LOG_DELETED UINT32_MAX
+
+// Appended records are written out by `dict_log_commit' once they take this
+// many bytes, whatever the sync policy.
+#define DICT_LOG_BLOCK_SIZE (1 << 20)
+
+// Suffix of the file a log is rewritten into. New logs are created under
+// it too, so a log is either complete or missing after a crash.
+#define DICT_LOG_REWRITE_SUFFIX ".rewrite"
+
+
+/**
+ * Log file header.
+ */
+struct dict_log_header
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t len;
+    // Of the fields above.
+    uint32_t crc;
+    uint32_t zero;
+};
+
+
+/**
+ * Block header. The checksum covers `size', `records' and the payload.
+ */
+struct dict_log_block_header
+{
+    uint32_t size;
+    uint32_t records;
+    uint32_t crc;
+};
+
+
+/**
+ * Record header, followed by key and value bytes.
+ */
+struct dict_log_record_header
+{
+    uint32_t key_len;
+    uint32_t value_size;
+};
+
+
+/**
+ * Malloc. Exit on failure.
+ */
+static inline void *
+safe_malloc(size_t size)
+{
+    void *ptr = malloc(size);
+    if (ptr == NULL) {
+        printf("fatal: Memory allocation failed\n");
+        exit(1);
+    }
+
+    return ptr;
+}
+
+
+/**
+ * Realloc. Exit on failure.
+ */
+static inline void *
+safe_realloc(void *mem, size_t size)
+{
+    void *ptr = realloc(mem, size);
+    if (ptr == NULL) {
+        printf("fatal: Memory allocation failed\n");
+        exit(1);
+    }
+
+    return ptr;
+}
+
+
+/**
+ * Copy of `len' bytes of `str' with terminating zero.
+ */
+static char *
+_copy_string(const char *str, size_t len)
+{
+    char *copy = safe_malloc(len + 1);
+    memcpy(copy, str, len);
+    copy[len] = '\0';
+
+    return copy;
+}
+
+
+/**
+ * Path of the file log at `path' is rewritten into.
+ */
+static char *
+_rewrite_path(const char *path)
+{
+    size_t len = strlen(path);
+    char *rewrite_path = safe_malloc(
+        len + sizeof(DICT_LOG_REWRITE_SUFFIX));
+    memcpy(rewrite_path, path, len);
+    memcpy(
+        rewrite_path + len,
+        DICT_LOG_REWRITE_SUFFIX,
+        sizeof(DICT_LOG_REWRITE_SUFFIX));
+
+    return rewrite_path;
+}
+
+
+/**
+ * Write all `size' bytes to `fd'. Return false on error.
+ */
+static bool
+_write_all(int fd, const char *data, size_t size)
+{
+    while (size > 0) {
+        ssize_t written = write(fd, data, size);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            return false;
+        }
+        data += written;
+        size -= written;
+    }
+
+    return true;
+}
+
+
+/**
+ * Read `size' bytes at `offset' of `fd'. Return false on error or if the
+ * file ends first (with `errno' set to `EINVAL').
+ */
+static bool
+_pread_all(int fd, char *data, size_t size, uint64_t offset)
+{
+    while (size > 0) {
+        ssize_t count = pread(fd, data, size, offset);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            return false;
+        }
+        if (count == 0) {
+            errno = EINVAL;
+
+            return false;
+        }
+        data += count;
+        size -= count;
+        offset += count;
+    }
+
+    return true;
+}
+
+
+/**
+ * Sync directory holding `path', so a file renamed there stays after a
+ * crash. Return false on error.
+ */
+static bool
+_sync_dir(const char *path)
+{
+    const char *slash = strrchr(path, '/');
+    char *dir = (
+        slash == NULL ? _copy_string(".", 1) :
+        _copy_string(path, slash - path + 1));
+    int fd = open(dir, O_RDONLY | O_DIRECTORY);
+    free(dir);
+    if (fd < 0) {
+        return false;
+    }
+
+    bool ok = fsync(fd) == 0;
+    int sync_errno = errno;
+    close(fd);
+    errno = sync_errno;
+
+    return ok;
+}
+
+
+/**
+ * Fill log header for `len' entries.
+ */
+static void
+_init_header(struct dict_log_header *header, uint64_t len)
+{
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, DICT_LOG_MAGIC, sizeof(header->magic));
+    header->version = DICT_LOG_VERSION;
+    header->byte_order = DICT_LOG_BYTE_ORDER;
+    header->len = len;
+    header->crc = dict_crc32c(
+        0, header, offsetof(struct dict_log_header, crc));
+}
+
+
+/**
+ * Check log header.
+ */
+static bool
+_is_header_valid(const struct dict_log_header *header)
+{
+    return (
+        memcmp(header->magic, DICT_LOG_MAGIC, sizeof(header->magic)) == 0 &&
+        header->version == DICT_LOG_VERSION &&
+        header->byte_order == DICT_LOG_BYTE_ORDER &&
+        header->crc == dict_crc32c(
+            0, header, offsetof(struct dict_log_header, crc)));
+}
+
+
+/**
+ * Create log file at `path' holding header for `len' entries. Return its
+ * descriptor, or -1 on error.
+ */
+static int
+_create_file(const char *path, uint64_t len)
+{
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    if (fd < 0) {
+        return -1;
+    }
+
+    struct dict_log_header header;
+    _init_header(&header, len);
+    if (!_write_all(fd, (const char *) &header, sizeof(header))) {
+        int write_errno = errno;
+        close(fd);
+        unlink(path);
+        errno = write_errno;
+
+        return -1;
+    }
+
+    return fd;
+}
+
+
+/**
+ * Open existing log at `path' for appending, or create an empty one.
+ * Return its descriptor, or -1 on error.
+ */
+static int
+_open_file(const char *path)
+{
+    int fd = open(path, O_RDWR | O_APPEND);
+    if (fd >= 0) {
+        struct dict_log_header header;
+        if (!_pread_all(fd, (char *) &header, sizeof(header), 0) ||
+                !_is_header_valid(&header)) {
+            close(fd);
+            errno = EINVAL;
+
+            return -1;
+        }
+
+        return fd;
+    }
+    if (errno != ENOENT) {
+        return -1;
+    }
+
+    char *rewrite_path = _rewrite_path(path);
+    fd = _create_file(rewrite_path, 0);
+    if (fd >= 0 && (
+            fdatasync(fd) != 0 ||
+            rename(rewrite_path, path) != 0 ||
+            !_sync_dir(path))) {
+        int create_errno = errno;
+        close(fd);
+        unlink(rewrite_path);
+        errno = create_errno;
+        fd = -1;
+    }
+    free(rewrite_path);
+
+    return fd;
+}
+
+
+/**
+ * Make room for block payload of `size' bytes after block header, keeping
+ * the block contents.
+ */
+static void
+_reserve_block(char **block, size_t *allocated, size_t size)
+{
+    if (size <= *allocated) {
+        return;
+    }
+
+    size_t new_allocated = *allocated > 0 ? *allocated : DICT_LOG_BLOCK_SIZE;
+    while (new_allocated < size) {
+        new_allocated *= 2;
+    }
+    *block = safe_realloc(
+        *block, sizeof(struct dict_log_block_header) + new_allocated);
+    *allocated = new_allocated;
+}
+
+
+/**
+ * Add record of setting `value' (unless `is_deleted') to block payload of
+ * `used' bytes. Return false if the record does not fit into a block.
+ */
+static bool
+_add_record(
+    char **block,
+    size_t *allocated,
+    size_t *used,
+    const char *key,
+    size_t key_len,
+    bool is_deleted,
+    const char *value)
+{
+    size_t value_size = value != NULL ? strlen(value) + 1 : 0;
+    size_t size = sizeof(struct dict_log_record_header) + key_len + value_size;
+    if (key_len >= UINT32_MAX || value_size >= UINT32_MAX ||
+            size > UINT32_MAX - *used) {
+        return false;
+    }
+
+    _reserve_block(block, allocated, *used + size);
+    struct dict_log_record_header header = {
+        .key_len = key_len,
+        .value_size = is_deleted ? DICT_LOG_DELETED : value_size,
+    };
+    char *p = *block + sizeof(struct dict_log_block_header) + *used;
+    memcpy(p, &header, sizeof(header));
+    p += sizeof(header);
+    memcpy(p, key, key_len);
+    if (value != NULL) {
+        memcpy(p + key_len, value, value_size);
+    }
+    *used += size;
+
+    return true;
+}
+
+
+/**
+ * Checksum of block of given payload. The payload follows block header in
+ * memory.
+ */
+static inline uint32_t
+_block_crc(const char *block, size_t size)
+{
+    uint32_t crc = dict_crc32c(
+        0, block, offsetof(struct dict_log_block_header, crc));
+
+    return dict_crc32c(
+        crc, block + sizeof(struct dict_log_block_header), size);
+}
+
+
+/**
+ * Fill header of block of records. Return size of the whole block.
+ */
+static size_t
+_seal_block(char *block, size_t size, size_t records)
+{
+    struct dict_log_block_header header = {
+        .size = size,
+        .records = records,
+    };
+    memcpy(block, &header, sizeof(header));
+    header.crc = _block_crc(block, size);
+    memcpy(block, &header, sizeof(header));
+
+    return sizeof(header) + size;
+}
+
+
+/**
+ * Keep written block for the log being rewritten.
+ */
+static void
+_add_rewrite_tail(struct dict_log *log, const char *block, size_t size)
+{
+    size_t used = log->rewrite_tail_used + size;
+    if (used > log->rewrite_tail_allocated) {
+        size_t allocated = log->rewrite_tail_allocated * 2;
+        if (allocated < used) {
+            allocated = used;
+        }
+        log->rewrite_tail = safe_realloc(log->rewrite_tail, allocated);
+        log->rewrite_tail_allocated = allocated;
+    }
+    memcpy(log->rewrite_tail + log->rewrite_tail_used, block, size);
+    log->rewrite_tail_used = used;
+}
+
+
+/**
+ * Write records appended so far as a block, and sync the file if asked.
+ * Called with the lock taken and no other thread writing; the lock is
+ * released during the write, and appends go to the spare block meanwhile.
+ */
+static void
+_write_pending(struct dict_log *log, bool sync)
+{
+    log->is_writing = true;
+    char *block = log->block;
+    size_t allocated = log->allocated;
+    size_t used = log->used;
+    size_t records = log->records;
+    uint64_t seq = log->appended;
+    log->block = log->spare_block;
+    log->allocated = log->spare_allocated;
+    log->used = 0;
+    log->records = 0;
+    pthread_mutex_unlock(&log->lock);
+
+    size_t size = 0;
+    bool ok = true;
+    if (records > 0) {
+        size = _seal_block(block, used, records);
+        ok = _write_all(log->fd, block, size);
+    }
+    if (ok && sync) {
+        ok = fdatasync(log->fd) == 0;
+    }
+    int write_errno = errno;
+
+    pthread_mutex_lock(&log->lock);
+    if (!ok && log->error == 0) {
+        log->error = write_errno;
+    }
+    if (log->rewrite_tail != NULL && size > 0) {
+        _add_rewrite_tail(log, block, size);
+    }
+    log->spare_block = block;
+    log->spare_allocated = allocated;
+    log->written = seq;
+    if (ok && sync) {
+        log->synced = seq;
+    }
+    log->is_writing = false;
+    pthread_cond_broadcast(&log->written_cond);
+}
+
+
+/**
+ * Wait until record `seq' is synced, writing blocks when no other thread
+ * does. Called with the lock taken.
+ */
+static void
+_wait_synced(struct dict_log *log, uint64_t seq)
+{
+    while (log->synced < seq && log->error == 0) {
+        if (log->is_writing) {
+            pthread_cond_wait(&log->written_cond, &log->lock);
+        } else {
+            _write_pending(log, true);
+        }
+    }
+}
+
+
+/**
+ * Write and sync `DICT_LOG_SYNC_INTERVAL' log every `interval_ms'.
+ */
+static void *
+_sync_thread(void *arg)
+{
+    struct dict_log *log = arg;
+
+    pthread_mutex_lock(&log->lock);
+    while (!log->is_closing) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        uint64_t nsec = (
+            deadline.tv_nsec + (uint64_t) log->interval_ms * 1000000);
+        deadline.tv_sec += nsec / 1000000000;
+        deadline.tv_nsec = nsec % 1000000000;
+        pthread_cond_timedwait(&log->closing_cond, &log->lock, &deadline);
+
+        // A block being written now is synced on the next tick.
+        if (!log->is_closing && !log->is_writing && log->error == 0 &&
+                log->synced < log->appended) {
+            _write_pending(log, true);
+        }
+    }
+    pthread_mutex_unlock(&log->lock);
+
+    return NULL;
+}
+
+
+/**
+ * Open log, see header.
+ */
+struct dict_log *
+dict_log_open(const char *path, int sync, unsigned interval_ms)
+{
+    int fd = _open_file(path);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    struct dict_log *log = safe_malloc(sizeof(struct dict_log));
+    log->path = _copy_string(path, strlen(path));
+    log->fd = fd;
+    log->sync = sync;
+    log->interval_ms = interval_ms;
+    pthread_mutex_init(&log->lock, NULL);
+    pthread_cond_init(&log->written_cond, NULL);
+
+    log->block = NULL;
+    log->allocated = 0;
+    _reserve_block(&log->block, &log->allocated, DICT_LOG_BLOCK_SIZE);
+    log->used = 0;
+    log->records = 0;
+    log->spare_block = NULL;
+    log->spare_allocated = 0;
+    _reserve_block(
+        &log->spare_block, &log->spare_allocated, DICT_LOG_BLOCK_SIZE);
+    log->appended = 0;
+    log->written = 0;
+    log->synced = 0;
+    log->is_writing = false;
+    log->error = 0;
+
+    log->rewrite_tail = NULL;
+    log->rewrite_tail_allocated = 0;
+    log->rewrite_tail_used = 0;
+
+    pthread_cond_init(&log->closing_cond, NULL);
+    log->is_closing = false;
+    if (sync == DICT_LOG_SYNC_INTERVAL) {
+        pthread_create(&log->sync_thread, NULL, _sync_thread, log);
+    }
+
+    return log;
+}
+
+
+/**
+ * Close log, see header.
+ */
+bool
+dict_log_close(struct dict_log *log)
+{
+    if (log->sync == DICT_LOG_SYNC_INTERVAL) {
+        pthread_mutex_lock(&log->lock);
+        log->is_closing = true;
+        pthread_cond_signal(&log->closing_cond);
+        pthread_mutex_unlock(&log->lock);
+        pthread_join(log->sync_thread, NULL);
+    }
+
+    bool ok = dict_log_flush(log);
+    int close_errno = errno;
+    if (close(log->fd) != 0 && ok) {
+        ok = false;
+        close_errno = errno;
+    }
+
+    pthread_mutex_destroy(&log->lock);
+    pthread_cond_destroy(&log->written_cond);
+    pthread_cond_destroy(&log->closing_cond);
+    free(log->block);
+    free(log->spare_block);
+    free(log->rewrite_tail);
+    free(log->path);
+    free(log);
+    errno = close_errno;
+
+    return ok;
+}
+
+
+/**
+ * Append record of setting or deleting key.
+ */
+static uint64_t
+_append(
+    struct dict_log *log,
+    const char *key,
+    size_t key_len,
+    bool is_deleted,
+    const char *value)
+{
+    pthread_mutex_lock(&log->lock);
+    if (log->error == 0) {
+        if (_add_record(
+                &log->block, &log->allocated, &log->used,
+                key, key_len, is_deleted, value)) {
+            ++log->records;
+        } else {
+            log->error = EINVAL;
+        }
+    }
+    uint64_t seq = ++log->appended;
+    pthread_mutex_unlock(&log->lock);
+
+    return seq;
+}
+
+
+/**
+ * Append record of setting value, see header.
+ */
+uint64_t
+dict_log_set(
+    struct dict_log *log, const char *key, size_t key_len, const char *value)
+{
+    return _append(log, key, key_len, false, value);
+}
+
+
+/**
+ * Append record of deleting key, see header.
+ */
+uint64_t
+dict_log_del(struct dict_log *log, const char *key, size_t key_len)
+{
+    return _append(log, key, key_len, true, NULL);
+}
+
+
+/**
+ * Make record durable as policy asks, see header.
+ */
+void
+dict_log_commit(struct dict_log *log, uint64_t seq)
+{
+    pthread_mutex_lock(&log->lock);
+    if (log->sync == DICT_LOG_SYNC_ALWAYS) {
+        _wait_synced(log, seq);
+    } else if (log->used >= DICT_LOG_BLOCK_SIZE && !log->is_writing &&
+            log->error == 0) {
+        _write_pending(log, false);
+    }
+    pthread_mutex_unlock(&log->lock);
+}
+
+
+/**
+ * Write and sync all appended records, see header.
+ */
+bool
+dict_log_flush(struct dict_log *log)
+{
+    pthread_mutex_lock(&log->lock);
+    _wait_synced(log, log->appended);
+    int error = log->error;
+    pthread_mutex_unlock(&log->lock);
+
+    if (error != 0) {
+        errno = error;
+
+        return false;
+    }
+
+    return true;
+}
+
+
+/**
+ * Start rewriting log, see header.
+ */
+bool
+dict_log_rewrite_begin(
+    struct dict_log *log, struct dict_log_rewrite *rewrite, uint64_t len)
+{
+    pthread_mutex_lock(&log->lock);
+    int error = log->error;
+    if (error == 0 && log->rewrite_tail != NULL) {
+        error = EBUSY;
+    }
+    if (error != 0) {
+        pthread_mutex_unlock(&log->lock);
+        errno = error;
+
+        return false;
+    }
+
+    rewrite->log = log;
+    rewrite->path = _rewrite_path(log->path);
+    rewrite->fd = _create_file(rewrite->path, len);
+    if (rewrite->fd < 0) {
+        int create_errno = errno;
+        pthread_mutex_unlock(&log->lock);
+        free(rewrite->path);
+        errno = create_errno;
+
+        return false;
+    }
+
+    log->rewrite_tail_allocated = DICT_LOG_BLOCK_SIZE;
+    log->rewrite_tail = safe_malloc(log->rewrite_tail_allocated);
+    log->rewrite_tail_used = 0;
+    pthread_mutex_unlock(&log->lock);
+
+    rewrite->block = NULL;
+    rewrite->allocated = 0;
+    _reserve_block(
+        &rewrite->block, &rewrite->allocated, DICT_LOG_BLOCK_SIZE);
+    rewrite->used = 0;
+    rewrite->records = 0;
+    rewrite->error = 0;
+
+    return true;
+}
+
+
+/**
+ * Add entry to rewritten log, see header.
+ */
+void
+dict_log_rewrite_add(
+    struct dict_log_rewrite *rewrite,
+    const char *key,
+    size_t key_len,
+    const char *value)
+{
+    if (rewrite->error != 0) {
+        return;
+    }
+
+    if (_add_record(
+            &rewrite->block, &rewrite->allocated, &rewrite->used,
+            key, key_len, false, value)) {
+        ++rewrite->records;
+    } else {
+        rewrite->error = EINVAL;
+    }
+}
+
+
+/**
+ * Write records of rewritten log as a block, see header.
+ */
+void
+dict_log_rewrite_flush(struct dict_log_rewrite *rewrite)
+{
+    if (rewrite->error == 0 && rewrite->records > 0) {
+        size_t size = _seal_block(
+            rewrite->block, rewrite->used, rewrite->records);
+        if (!_write_all(rewrite->fd, rewrite->block, size)) {
+            rewrite->error = errno;
+        }
+    }
+    rewrite->used = 0;
+    rewrite->records = 0;
+}
+
+
+/**
+ * Finish rewrite, see header.
+ */
+bool
+dict_log_rewrite_end(struct dict_log_rewrite *rewrite)
+{
+    struct dict_log *log = rewrite->log;
+
+    // Most of the new file is synced before appends are held up.
+    dict_log_rewrite_flush(rewrite);
+    if (rewrite->error == 0 && fdatasync(rewrite->fd) != 0) {
+        rewrite->error = errno;
+    }
+
+    pthread_mutex_lock(&log->lock);
+    while (log->is_writing) {
+        pthread_cond_wait(&log->written_cond, &log->lock);
+    }
+    if (rewrite->error == 0) {
+        rewrite->error = log->error;
+    }
+
+    // Records not written to the old file yet go to the new one, but stay
+    // pending until it replaces the old one, so on failure they are still
+    // written to the old file.
+    size_t pending_size = 0;
+    if (log->records > 0) {
+        pending_size = _seal_block(log->block, log->used, log->records);
+    }
+    bool is_renamed = false;
+    if (rewrite->error == 0) {
+        if (_write_all(
+                rewrite->fd, log->rewrite_tail, log->rewrite_tail_used) &&
+                _write_all(rewrite->fd, log->block, pending_size) &&
+                fdatasync(rewrite->fd) == 0 &&
+                rename(rewrite->path, log->path) == 0) {
+            is_renamed = true;
+        } else {
+            rewrite->error = errno;
+        }
+    }
+
+    if (is_renamed) {
+        log->used = 0;
+        log->records = 0;
+        close(log->fd);
+        log->fd = rewrite->fd;
+        log->written = log->appended;
+        log->synced = log->appended;
+        if (!_sync_dir(log->path)) {
+            rewrite->error = errno;
+        }
+        pthread_cond_broadcast(&log->written_cond);
+    } else {
+        close(rewrite->fd);
+        unlink(rewrite->path);
+    }
+    free(log->rewrite_tail);
+    log->rewrite_tail = NULL;
+    log->rewrite_tail_allocated = 0;
+    log->rewrite_tail_used = 0;
+    pthread_mutex_unlock(&log->lock);
+
+    free(rewrite->path);
+    free(rewrite->block);
+    if (rewrite->error != 0) {
+        errno = rewrite->error;
+
+        return false;
+    }
+
+    return true;
+}
+
+
+/**
+ * Open log for replay, see header.
+ */
+bool
+dict_log_reader_init(struct dict_log_reader *reader, const char *path)
+{
+    int fd = open(path, O_RDWR);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    struct dict_log_header header;
+    if (fstat(fd, &st) != 0) {
+        int stat_errno = errno;
+        close(fd);
+        errno = stat_errno;
+
+        return false;
+    }
+    if ((uint64_t) st.st_size < sizeof(header) ||
+            !_pread_all(fd, (char *) &header, sizeof(header), 0) ||
+            !_is_header_valid(&header)) {
+        close(fd);
+        errno = EINVAL;
+
+        return false;
+    }
+
+    reader->fd = fd;
+    // Damaged or crafted header must not make callers presize for more
+    // entries than the file can hold.
+    uint64_t max_len = (
+        (st.st_size - sizeof(header)) /
+        sizeof(struct dict_log_record_header));
+    reader->len = header.len < max_len ? header.len : max_len;
+    reader->file_size = st.st_size;
+    reader->valid_size = sizeof(header);
+    reader->block = NULL;
+    reader->allocated = 0;
+    reader->size = 0;
+    reader->pos = 0;
+    reader->records_left = 0;
+    reader->is_done = false;
+    reader->error = 0;
+
+    return true;
+}
+
+
+/**
+ * Read next block. Return false at the end of log, which is the first
+ * block cut short or failing its checksum, or on error.
+ */
+static bool
+_read_block(struct dict_log_reader *reader)
+{
+    struct dict_log_block_header header;
+    uint64_t left = reader->file_size - reader->valid_size;
+    if (left < sizeof(header)) {
+        reader->is_done = true;
+
+        return false;
+    }
+    if (!_pread_all(
+            reader->fd, (char *) &header, sizeof(header),
+            reader->valid_size)) {
+        reader->error = errno;
+
+        return false;
+    }
+    if (header.size > left - sizeof(header) || header.records == 0) {
+        reader->is_done = true;
+
+        return false;
+    }
+
+    _reserve_block(&reader->block, &reader->allocated, header.size);
+    memcpy(reader->block, &header, sizeof(header));
+    if (!_pread_all(
+            reader->fd, reader->block + sizeof(header), header.size,
+            reader->valid_size + sizeof(header))) {
+        reader->error = errno;
+
+        return false;
+    }
+    if (header.crc != _block_crc(reader->block, header.size)) {
+        reader->is_done = true;
+
+        return false;
+    }
+
+    reader->valid_size += sizeof(header) + header.size;
+    reader->size = header.size;
+    reader->pos = 0;
+    reader->records_left = header.records;
+
+    return true;
+}
+
+
+/**
+ * Read next record, see header.
+ */
+bool
+dict_log_read(
+    struct dict_log_reader *reader,
+    const char **key,
+    size_t *key_len,
+    const char **value,
+    bool *is_deleted)
+{
+    if (reader->error != 0 || reader->is_done) {
+        return false;
+    }
+
+    if (reader->records_left == 0) {
+        if (reader->pos != reader->size) {
+            reader->error = EINVAL;
+
+            return false;
+        }
+        if (!_read_block(reader)) {
+            return false;
+        }
+    }
+
+    struct dict_log_record_header header;
+    const char *p = reader->block + sizeof(struct dict_log_block_header);
+    p += reader->pos;
+    size_t left = reader->size - reader->pos;
+    if (left < sizeof(header)) {
+        reader->error = EINVAL;
+
+        return false;
+    }
+    memcpy(&header, p, sizeof(header));
+    size_t value_size = (
+        header.value_size != DICT_LOG_DELETED ? header.value_size : 0);
+    left -= sizeof(header);
+    if (header.key_len > left || value_size > left - header.key_len) {
+        reader->error = EINVAL;
+
+        return false;
+    }
+
+    p += sizeof(header);
+    *key = p;
+    *key_len = header.key_len;
+    *value = NULL;
+    *is_deleted = header.value_size == DICT_LOG_DELETED;
+    if (value_size > 0) {
+        *value = p + header.key_len;
+        if ((*value)[value_size - 1] != '\0') {
+            reader->error = EINVAL;
+
+            return false;
+        }
+    }
+
+    reader->pos += sizeof(header) + header.key_len + value_size;
+    --reader->records_left;
+
+    return true;
+}
+
+
+/**
+ * Free reader, see header.
+ */
+bool
+dict_log_reader_finish(struct dict_log_reader *reader)
+{
+    if (reader->error == 0 && reader->is_done &&
+            reader->valid_size < reader->file_size) {
+        // Torn block of a crash is cut off, so appends follow valid ones.
+        if (ftruncate(reader->fd, reader->valid_size) != 0 ||
+                fdatasync(reader->fd) != 0) {
+            reader->error = errno;
+        }
+    }
+
+    close(reader->fd);
+    free(reader->block);
+    reader->block = NULL;
+    if (reader->error != 0) {
+        errno = reader->error;
+
+        return false;
+    }
+
+    return true;
+}
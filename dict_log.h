@@ -0,0 +1,254 @@
+#ifndef DICT_LOG_H
+#define DICT_LOG_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+/**
+ * Append-only log of dictionary changes, for recovery between snapshots.
+ *
+ * File format, in native byte order (the log is read back on the machine
+ * which wrote it):
+ *
+ *   header: magic "DICTLOG1", u32 version, u32 byte order mark, u64 number
+ *       of entries at the last rewrite (a hint for pre-sizing), u32 CRC32C
+ *       of the above, u32 zero;
+ *   blocks: u32 payload size, u32 number of records, u32 CRC32C of the two
+ *       numbers and the payload, then the payload: records of u32 key
+ *       length, u32 value size (0 for NULL value, `UINT32_MAX' for deletion,
+ *       otherwise length with terminating zero), key and value bytes.
+ *
+ * Every write is a whole block holding all records appended since the
+ * previous one (group commit). A block cut short by a crash fails its
+ * checksum, and the log is truncated before it on replay.
+ */
+
+
+// `dict_log_open' sync policies.
+// Every commit is synced to disk before it returns. Commits of threads
+// waiting at once are written and synced together.
+#define DICT_LOG_SYNC_ALWAYS 0
+// Records are written and synced by a background thread every given number
+// of milliseconds, so up to that much is lost on crash.
+#define DICT_LOG_SYNC_INTERVAL 1
+// Records are written when a block fills up, and syncing is left to the
+// system.
+#define DICT_LOG_SYNC_NEVER 2
+
+
+/**
+ * Open log. Fields are guarded by `lock'.
+ */
+struct dict_log
+{
+    char *path;
+    int fd;
+    int sync;
+    unsigned interval_ms;
+
+    pthread_mutex_t lock;
+    // Signalled when a thread is done writing a block.
+    pthread_cond_t written_cond;
+
+    // Block header space followed by payload of records appended since the
+    // last write, and the buffer swapped in while it is being written.
+    char *block;
+    size_t allocated;
+    size_t used;
+    size_t records;
+    char *spare_block;
+    size_t spare_allocated;
+    // Number of records appended, written and synced so far. Appends return
+    // the number of their record, for `dict_log_commit'.
+    uint64_t appended;
+    uint64_t written;
+    uint64_t synced;
+    // Whether a thread is writing a block now, with the lock released.
+    bool is_writing;
+    // `errno' of the first error, 0 if none. Nothing is written after it.
+    int error;
+
+    // Blocks written since `dict_log_rewrite_begin', to be added to the
+    // rewritten log, or NULL if no rewrite is in progress.
+    char *rewrite_tail;
+    size_t rewrite_tail_allocated;
+    size_t rewrite_tail_used;
+
+    // Thread syncing `DICT_LOG_SYNC_INTERVAL' log, signalled to stop by
+    // `dict_log_close'.
+    pthread_t sync_thread;
+    pthread_cond_t closing_cond;
+    bool is_closing;
+};
+
+
+/**
+ * Rewrite of log into a new file, see `dict_log_rewrite_begin'. Used by the
+ * rewriting thread only.
+ */
+struct dict_log_rewrite
+{
+    struct dict_log *log;
+    char *path;
+    int fd;
+    char *block;
+    size_t allocated;
+    size_t used;
+    size_t records;
+    int error;
+};
+
+
+/**
+ * Reader of log for replay, one block at a time.
+ */
+struct dict_log_reader
+{
+    int fd;
+    // Number of entries at the last rewrite, recorded in the header, capped
+    // by the number of records the file can hold.
+    uint64_t len;
+    // File size, and end of the last valid block read.
+    uint64_t file_size;
+    uint64_t valid_size;
+    // Payload of the current block, and position of the next record in it.
+    char *block;
+    size_t allocated;
+    size_t size;
+    size_t pos;
+    size_t records_left;
+    bool is_done;
+    // `errno' of the first error, 0 if none.
+    int error;
+};
+
+
+/**
+ * Open log at `path' for appending, creating it if there is none. An
+ * existing log must be replayed first (see `dict_log_reader_init'), so a
+ * torn block at its end is cut off. `interval_ms' is used by
+ * `DICT_LOG_SYNC_INTERVAL' policy. Return NULL on error, with `errno' set.
+ */
+struct dict_log *
+dict_log_open(const char *path, int sync, unsigned interval_ms);
+
+
+/**
+ * Write and sync appended records, then close log. Dictionaries must not
+ * use it anymore. Return false if anything failed, with `errno' set.
+ */
+bool
+dict_log_close(struct dict_log *);
+
+
+/**
+ * Append record of setting value (a zero-terminated string or NULL) by key.
+ * Return number of the record for `dict_log_commit'.
+ */
+uint64_t
+dict_log_set(
+    struct dict_log *, const char *key, size_t key_len, const char *value);
+
+
+/**
+ * Append record of deleting key, see `dict_log_set'.
+ */
+uint64_t
+dict_log_del(struct dict_log *, const char *key, size_t key_len);
+
+
+/**
+ * Make appended record `seq' as durable as the sync policy asks: wait until
+ * it is synced with `DICT_LOG_SYNC_ALWAYS', otherwise only write a full
+ * block out. Called without dictionary locks, so commits of many threads
+ * are grouped.
+ */
+void
+dict_log_commit(struct dict_log *, uint64_t seq);
+
+
+/**
+ * Write and sync all appended records. Return false if the log failed,
+ * with `errno' set.
+ */
+bool
+dict_log_flush(struct dict_log *);
+
+
+/**
+ * Start rewriting log into a new file at `path' with ".rewrite" suffix,
+ * starting with records of `len' entries. Blocks written to the log from now
+ * on are also kept for the new one. Must be called when appended records
+ * and dictionary contents agree (under dictionary writer lock). Return false
+ * on error, with `errno' set.
+ */
+bool
+dict_log_rewrite_begin(
+    struct dict_log *, struct dict_log_rewrite *, uint64_t len);
+
+
+/**
+ * Add entry of dictionary to rewritten log. Records are gathered in memory
+ * until `dict_log_rewrite_flush'.
+ */
+void
+dict_log_rewrite_add(
+    struct dict_log_rewrite *,
+    const char *key,
+    size_t key_len,
+    const char *value);
+
+
+/**
+ * Write records added to rewritten log so far as a block.
+ */
+void
+dict_log_rewrite_flush(struct dict_log_rewrite *);
+
+
+/**
+ * Finish rewrite: add blocks written to the log meanwhile, sync the new file
+ * and put it in place of the log. Appends wait only while these blocks are
+ * written. On failure the log is left as it was and the new file removed.
+ * Return false on error, with `errno' set.
+ */
+bool
+dict_log_rewrite_end(struct dict_log_rewrite *);
+
+
+/**
+ * Open log at `path' for replay. Return false on error, with `errno' set
+ * (`ENOENT' if there is no log, `EINVAL' for malformed header); the reader
+ * needs no finishing then.
+ */
+bool
+dict_log_reader_init(struct dict_log_reader *, const char *path);
+
+
+/**
+ * Read next record. Key and value point into the block buffer and stay
+ * valid until the next call. `is_deleted' is set for deletions. Return
+ * false at the end of log or on error.
+ */
+bool
+dict_log_read(
+    struct dict_log_reader *,
+    const char **key,
+    size_t *key_len,
+    const char **value,
+    bool *is_deleted);
+
+
+/**
+ * Free reader. The end of log after the last valid block, left by a crash,
+ * is cut off. Return false if a valid block had malformed records or the
+ * log could not be read or truncated, with `errno' set.
+ */
+bool
+dict_log_reader_finish(struct dict_log_reader *);
+
+
+#endif
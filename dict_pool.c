@@ -0,0 +1,176 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "dict_pool.h"
+
+
+/**
+ * Malloc. Exit on failure.
+ */
+static inline void *
+safe_malloc(size_t size)
+{
+    void *ptr = malloc(size);
+    if (ptr == NULL) {
+        printf("fatal: Memory allocation failed\n");
+        exit(1);
+    }
+
+    return ptr;
+}
+
+
+/**
+ * Take and run tasks of current job until there are none left. Called with
+ * `pool->lock' held, returns with it held.
+ */
+static void
+_run_tasks(struct dict_pool *pool)
+{
+    void (*function)(void *, size_t) = pool->function;
+    void *arg = pool->arg;
+
+    while (pool->next_task < pool->tasks) {
+        size_t task = pool->next_task++;
+        ++pool->running;
+        pthread_mutex_unlock(&pool->lock);
+
+        function(arg, task);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->running == 0 && pool->next_task == pool->tasks) {
+            pthread_cond_broadcast(&pool->job_done);
+        }
+    }
+}
+
+
+/**
+ * Worker thread: wait for jobs and run their tasks.
+ */
+static void *
+_worker(void *arg)
+{
+    struct dict_pool *pool = arg;
+
+    pthread_mutex_lock(&pool->lock);
+    uint64_t seen_job_id = pool->job_id;
+    while (true) {
+        while (!pool->is_stopping && pool->job_id == seen_job_id) {
+            pthread_cond_wait(&pool->job_started, &pool->lock);
+        }
+        if (pool->is_stopping) {
+            break;
+        }
+
+        seen_job_id = pool->job_id;
+        _run_tasks(pool);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+
+/**
+ * Create pool of `threads' threads.
+ */
+struct dict_pool *
+dict_pool_create(size_t threads)
+{
+    if (threads == 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (size_t) cpus : 1;
+    }
+
+    struct dict_pool *pool = safe_malloc(sizeof(struct dict_pool));
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->job_started, NULL);
+    pthread_cond_init(&pool->job_done, NULL);
+    pool->function = NULL;
+    pool->arg = NULL;
+    pool->tasks = 0;
+    pool->next_task = 0;
+    pool->running = 0;
+    pool->job_id = 0;
+    pool->is_stopping = false;
+
+    pool->workers_count = threads - 1;
+    pool->workers = safe_malloc(sizeof(pthread_t) * threads);
+    for (size_t i = 0; i < pool->workers_count; ++i) {
+        if (pthread_create(&pool->workers[i], NULL, _worker, pool) != 0) {
+            printf("fatal: Thread creation failed\n");
+            exit(1);
+        }
+    }
+
+    return pool;
+}
+
+
+/**
+ * Number of threads working on a job.
+ */
+size_t
+dict_pool_threads(struct dict_pool *pool)
+{
+    return pool == NULL ? 1 : pool->workers_count + 1;
+}
+
+
+/**
+ * Run `tasks' tasks and wait until all of them are done.
+ */
+void
+dict_pool_run(
+    struct dict_pool *pool,
+    size_t tasks,
+    void (*function)(void *, size_t),
+    void *arg)
+{
+    if (pool == NULL || pool->workers_count == 0 || tasks <= 1) {
+        for (size_t task = 0; task < tasks; ++task) {
+            function(arg, task);
+        }
+
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->function = function;
+    pool->arg = arg;
+    pool->tasks = tasks;
+    pool->next_task = 0;
+    ++pool->job_id;
+    pthread_cond_broadcast(&pool->job_started);
+
+    _run_tasks(pool);
+    while (pool->running > 0) {
+        pthread_cond_wait(&pool->job_done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+
+/**
+ * Stop workers and destroy pool.
+ */
+void
+dict_pool_destroy(struct dict_pool *pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->is_stopping = true;
+    pthread_cond_broadcast(&pool->job_started);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (size_t i = 0; i < pool->workers_count; ++i) {
+        pthread_join(pool->workers[i], NULL);
+    }
+
+    pthread_cond_destroy(&pool->job_done);
+    pthread_cond_destroy(&pool->job_started);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->workers);
+    free(pool);
+}
@@ -0,0 +1,74 @@
+#ifndef DICT_POOL_H
+#define DICT_POOL_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+/**
+ * Pool of worker threads running tasks of one job at a time. The thread
+ * calling `dict_pool_run' works on the job too, so a pool of N threads has
+ * N - 1 workers.
+ */
+struct dict_pool
+{
+    pthread_t *workers;
+    size_t workers_count;
+
+    pthread_mutex_t lock;
+    // Signalled when a job is started or the pool is destroyed.
+    pthread_cond_t job_started;
+    // Signalled when the last running task of a job is done.
+    pthread_cond_t job_done;
+
+    // Current job: `function(arg, task)' for every task below `tasks'.
+    void (*function)(void *, size_t);
+    void *arg;
+    size_t tasks;
+    // Next task to be taken and number of tasks being run.
+    size_t next_task;
+    size_t running;
+    // Incremented for every job, so workers notice new ones.
+    uint64_t job_id;
+    bool is_stopping;
+};
+
+
+/**
+ * Create pool of `threads' threads (including the caller of
+ * `dict_pool_run'). 0 means one thread per online CPU.
+ */
+struct dict_pool *
+dict_pool_create(size_t threads);
+
+
+/**
+ * Number of threads working on a job, including the caller.
+ */
+size_t
+dict_pool_threads(struct dict_pool *);
+
+
+/**
+ * Call `function(arg, task)' for every task from 0 to `tasks' - 1 and wait
+ * until all calls return. Tasks are taken by free threads in order. Pool
+ * may be NULL, then tasks are run by the caller.
+ */
+void
+dict_pool_run(
+    struct dict_pool *,
+    size_t tasks,
+    void (*function)(void *, size_t),
+    void *arg);
+
+
+/**
+ * Stop workers and destroy pool.
+ */
+void
+dict_pool_destroy(struct dict_pool *);
+
+
+#endif
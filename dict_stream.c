@@ -0,0 +1,561 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "dict_stream.h"
+
+
+// Stream header: magic, version, zero, number of entries and CRC32C.
+#define DICT_STREAM_MAGIC "DICTSTRM"
+#define DICT_STREAM_VERSION 1
+#define DICT_STREAM_HEADER_SIZE 28
+
+// Block header: payload size, number of records and CRC32C.
+#define DICT_STREAM_BLOCK_HEADER_SIZE 12
+// Record header: key length and value size.
+#define DICT_STREAM_RECORD_HEADER_SIZE 8
+
+// Blocks are written out once their payload reaches this size. A larger
+// record gets a block of its own, up to `DICT_STREAM_MAX_BLOCK' bytes.
+#define DICT_STREAM_BLOCK_SIZE (1 << 20)
+#define DICT_STREAM_MAX_BLOCK (1 << 30)
+
+// Number of entries of stream of unknown size (pipe, socket) is trusted up
+// to as many records as fit into a block; dictionaries grow past it.
+#define DICT_STREAM_MAX_UNSIZED_LEN \
+    (DICT_STREAM_BLOCK_SIZE / DICT_STREAM_RECORD_HEADER_SIZE)
+
+
+/**
+ * Malloc. Exit on failure.
+ */
+static inline void *
+safe_malloc(size_t size)
+{
+    void *ptr = malloc(size);
+    if (ptr == NULL) {
+        printf("fatal: Memory allocation failed\n");
+        exit(1);
+    }
+
+    return ptr;
+}
+
+
+#if defined(__SSE4_2__)
+
+#include <nmmintrin.h>
+
+
+/**
+ * CRC32C of `size' bytes, see header. Uses SSE4.2 instruction, 8 bytes at a
+ * time.
+ */
+uint32_t
+dict_crc32c(uint32_t crc, const void *data, size_t size)
+{
+    const unsigned char *p = data;
+    uint64_t crc64 = ~crc;
+    for (; size >= sizeof(uint64_t); size -= sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, p, sizeof(word));
+        crc64 = _mm_crc32_u64(crc64, word);
+        p += sizeof(uint64_t);
+    }
+
+    uint32_t crc32 = crc64;
+    for (; size > 0; --size) {
+        crc32 = _mm_crc32_u8(crc32, *p++);
+    }
+
+    return ~crc32;
+}
+
+#else
+
+// CRC32C polynomial, bit-reversed.
+#define DICT_CRC32C_POLY 0x82F63B78
+
+static uint32_t crc32c_table[256];
+static pthread_once_t crc32c_table_once = PTHREAD_ONCE_INIT;
+
+
+/**
+ * Fill table of CRC32C of every byte.
+ */
+static void
+_init_crc32c_table(void)
+{
+    for (uint32_t byte = 0; byte < 256; ++byte) {
+        uint32_t crc = byte;
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = (crc >> 1) ^ (crc & 1 ? DICT_CRC32C_POLY : 0);
+        }
+        crc32c_table[byte] = crc;
+    }
+}
+
+
+/**
+ * CRC32C of `size' bytes, see header. Portable version, a byte at a time.
+ */
+uint32_t
+dict_crc32c(uint32_t crc, const void *data, size_t size)
+{
+    pthread_once(&crc32c_table_once, _init_crc32c_table);
+
+    const unsigned char *p = data;
+    crc = ~crc;
+    for (; size > 0; --size) {
+        crc = (crc >> 8) ^ crc32c_table[(crc ^ *p++) & 0xff];
+    }
+
+    return ~crc;
+}
+
+#endif
+
+
+/**
+ * Store little-endian 32-bit number.
+ */
+static inline void
+_put_u32(char *p, uint32_t value)
+{
+    for (int i = 0; i < 4; ++i) {
+        p[i] = value >> (i * 8);
+    }
+}
+
+
+/**
+ * Store little-endian 64-bit number.
+ */
+static inline void
+_put_u64(char *p, uint64_t value)
+{
+    _put_u32(p, value);
+    _put_u32(p + 4, value >> 32);
+}
+
+
+/**
+ * Load little-endian 32-bit number.
+ */
+static inline uint32_t
+_get_u32(const char *p)
+{
+    uint32_t value = 0;
+    for (int i = 0; i < 4; ++i) {
+        value |= (uint32_t) (unsigned char) p[i] << (i * 8);
+    }
+
+    return value;
+}
+
+
+/**
+ * Load little-endian 64-bit number.
+ */
+static inline uint64_t
+_get_u64(const char *p)
+{
+    return _get_u32(p) | (uint64_t) _get_u32(p + 4) << 32;
+}
+
+
+/**
+ * Write all `size' bytes to `fd'. Return false on error.
+ */
+static bool
+_write_all(int fd, const char *data, size_t size)
+{
+    while (size > 0) {
+        ssize_t written = write(fd, data, size);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            return false;
+        }
+        data += written;
+        size -= written;
+    }
+
+    return true;
+}
+
+
+/**
+ * Read `size' bytes from `fd'. Return false on error or if the data ends
+ * first (with `errno' set to `EINVAL').
+ */
+static bool
+_read_all(int fd, char *data, size_t size)
+{
+    while (size > 0) {
+        ssize_t count = read(fd, data, size);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            return false;
+        }
+        if (count == 0) {
+            errno = EINVAL;
+
+            return false;
+        }
+        data += count;
+        size -= count;
+    }
+
+    return true;
+}
+
+
+/**
+ * Make room for block payload of `size' bytes after block header.
+ */
+static void
+_reserve_block(char **block, size_t *allocated, size_t size)
+{
+    if (size <= *allocated) {
+        return;
+    }
+
+    free(*block);
+    *block = safe_malloc(DICT_STREAM_BLOCK_HEADER_SIZE + size);
+    *allocated = size;
+}
+
+
+/**
+ * Checksum of block of given payload. The payload follows block header in
+ * memory.
+ */
+static inline uint32_t
+_block_crc(const char *header, size_t size)
+{
+    uint32_t crc = dict_crc32c(0, header, 8);
+
+    return dict_crc32c(crc, header + DICT_STREAM_BLOCK_HEADER_SIZE, size);
+}
+
+
+/**
+ * Write block of gathered records and start a new one.
+ */
+static void
+_flush_block(struct dict_stream_writer *writer)
+{
+    char *header = writer->block;
+    _put_u32(header, writer->used);
+    _put_u32(header + 4, writer->records);
+    _put_u32(header + 8, _block_crc(header, writer->used));
+    if (!_write_all(
+            writer->fd,
+            writer->block,
+            DICT_STREAM_BLOCK_HEADER_SIZE + writer->used)) {
+        writer->error = errno;
+    }
+
+    writer->used = 0;
+    writer->records = 0;
+}
+
+
+/**
+ * Start stream, see header.
+ */
+void
+dict_stream_writer_init(
+    struct dict_stream_writer *writer, int fd, uint64_t len)
+{
+    writer->fd = fd;
+    writer->block = NULL;
+    writer->allocated = 0;
+    writer->used = 0;
+    writer->records = 0;
+    writer->total = 0;
+    writer->error = 0;
+    _reserve_block(
+        &writer->block, &writer->allocated, DICT_STREAM_BLOCK_SIZE);
+
+    char header[DICT_STREAM_HEADER_SIZE];
+    memcpy(header, DICT_STREAM_MAGIC, 8);
+    _put_u32(header + 8, DICT_STREAM_VERSION);
+    _put_u32(header + 12, 0);
+    _put_u64(header + 16, len);
+    _put_u32(header + 24, dict_crc32c(0, header, 24));
+    if (!_write_all(fd, header, sizeof(header))) {
+        writer->error = errno;
+    }
+}
+
+
+/**
+ * Add entry to stream, see header.
+ */
+void
+dict_stream_write(
+    struct dict_stream_writer *writer,
+    const char *key,
+    size_t key_len,
+    const char *value)
+{
+    if (writer->error != 0) {
+        return;
+    }
+
+    size_t value_size = value != NULL ? strlen(value) + 1 : 0;
+    size_t size = DICT_STREAM_RECORD_HEADER_SIZE + key_len + value_size;
+    if (size > DICT_STREAM_MAX_BLOCK) {
+        writer->error = EINVAL;
+
+        return;
+    }
+
+    if (writer->used + size > writer->allocated) {
+        if (writer->used > 0) {
+            _flush_block(writer);
+        }
+        _reserve_block(&writer->block, &writer->allocated, size);
+    }
+
+    char *p = writer->block + DICT_STREAM_BLOCK_HEADER_SIZE + writer->used;
+    _put_u32(p, key_len);
+    _put_u32(p + 4, value_size);
+    memcpy(p + DICT_STREAM_RECORD_HEADER_SIZE, key, key_len);
+    if (value != NULL) {
+        memcpy(
+            p + DICT_STREAM_RECORD_HEADER_SIZE + key_len, value, value_size);
+    }
+    writer->used += size;
+    ++writer->records;
+    ++writer->total;
+}
+
+
+/**
+ * End stream and free writer, see header.
+ */
+bool
+dict_stream_writer_finish(struct dict_stream_writer *writer)
+{
+    if (writer->error == 0 && writer->used > 0) {
+        _flush_block(writer);
+    }
+    if (writer->error == 0) {
+        _put_u64(
+            writer->block + DICT_STREAM_BLOCK_HEADER_SIZE, writer->total);
+        writer->used = 8;
+        _flush_block(writer);
+    }
+
+    free(writer->block);
+    writer->block = NULL;
+    if (writer->error != 0) {
+        errno = writer->error;
+
+        return false;
+    }
+
+    return true;
+}
+
+
+/**
+ * Read stream header, see header.
+ */
+bool
+dict_stream_reader_init(struct dict_stream_reader *reader, int fd)
+{
+    char header[DICT_STREAM_HEADER_SIZE];
+    if (!_read_all(fd, header, sizeof(header))) {
+        return false;
+    }
+    if (memcmp(header, DICT_STREAM_MAGIC, 8) != 0 ||
+            _get_u32(header + 8) != DICT_STREAM_VERSION ||
+            _get_u32(header + 24) != dict_crc32c(0, header, 24)) {
+        errno = EINVAL;
+
+        return false;
+    }
+
+    reader->fd = fd;
+    reader->len = _get_u64(header + 16);
+    // Damaged or crafted header must not make callers presize for more
+    // entries than the rest of the stream can hold.
+    struct stat st;
+    off_t offset;
+    uint64_t max_len = DICT_STREAM_MAX_UNSIZED_LEN;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) &&
+            (offset = lseek(fd, 0, SEEK_CUR)) >= 0) {
+        max_len = (
+            st.st_size > offset ?
+            (uint64_t) (st.st_size - offset) /
+                DICT_STREAM_RECORD_HEADER_SIZE :
+            0);
+    }
+    if (reader->len > max_len) {
+        reader->len = max_len;
+    }
+    reader->block = NULL;
+    reader->allocated = 0;
+    reader->size = 0;
+    reader->pos = 0;
+    reader->records_left = 0;
+    reader->total = 0;
+    reader->is_done = false;
+    reader->error = 0;
+    _reserve_block(
+        &reader->block, &reader->allocated, DICT_STREAM_BLOCK_SIZE);
+
+    return true;
+}
+
+
+/**
+ * Read and check next block. Return false on error.
+ */
+static bool
+_read_block(struct dict_stream_reader *reader)
+{
+    char header[DICT_STREAM_BLOCK_HEADER_SIZE];
+    if (!_read_all(reader->fd, header, sizeof(header))) {
+        return false;
+    }
+    size_t size = _get_u32(header);
+    if (size > DICT_STREAM_MAX_BLOCK) {
+        errno = EINVAL;
+
+        return false;
+    }
+
+    _reserve_block(&reader->block, &reader->allocated, size);
+    memcpy(reader->block, header, sizeof(header));
+    char *payload = reader->block + DICT_STREAM_BLOCK_HEADER_SIZE;
+    if (!_read_all(reader->fd, payload, size)) {
+        return false;
+    }
+    if (_get_u32(header + 8) != _block_crc(reader->block, size)) {
+        errno = EINVAL;
+
+        return false;
+    }
+
+    reader->size = size;
+    reader->pos = 0;
+    reader->records_left = _get_u32(header + 4);
+    if (reader->records_left == 0) {
+        // End of stream.
+        if (size != 8 || _get_u64(payload) != reader->total) {
+            errno = EINVAL;
+
+            return false;
+        }
+        reader->is_done = true;
+    }
+
+    return true;
+}
+
+
+/**
+ * Read next entry, see header.
+ */
+bool
+dict_stream_read(
+    struct dict_stream_reader *reader,
+    const char **key,
+    size_t *key_len,
+    const char **value)
+{
+    if (reader->error != 0 || reader->is_done) {
+        return false;
+    }
+
+    if (reader->records_left == 0) {
+        if (reader->pos != reader->size) {
+            reader->error = EINVAL;
+
+            return false;
+        }
+        if (!_read_block(reader)) {
+            reader->error = errno;
+
+            return false;
+        }
+        if (reader->is_done) {
+            return false;
+        }
+    }
+
+    const char *payload = reader->block + DICT_STREAM_BLOCK_HEADER_SIZE;
+    const char *p = payload + reader->pos;
+    size_t left = reader->size - reader->pos;
+    if (left < DICT_STREAM_RECORD_HEADER_SIZE) {
+        reader->error = EINVAL;
+
+        return false;
+    }
+    size_t record_key_len = _get_u32(p);
+    size_t value_size = _get_u32(p + 4);
+    left -= DICT_STREAM_RECORD_HEADER_SIZE;
+    if (record_key_len > left || value_size > left - record_key_len) {
+        reader->error = EINVAL;
+
+        return false;
+    }
+
+    p += DICT_STREAM_RECORD_HEADER_SIZE;
+    *key = p;
+    *key_len = record_key_len;
+    *value = NULL;
+    if (value_size > 0) {
+        *value = p + record_key_len;
+        if ((*value)[value_size - 1] != '\0') {
+            reader->error = EINVAL;
+
+            return false;
+        }
+    }
+
+    reader->pos += (
+        DICT_STREAM_RECORD_HEADER_SIZE + record_key_len + value_size);
+    --reader->records_left;
+    ++reader->total;
+
+    return true;
+}
+
+
+/**
+ * Free reader, see header.
+ */
+bool
+dict_stream_reader_finish(struct dict_stream_reader *reader)
+{
+    free(reader->block);
+    reader->block = NULL;
+    if (reader->error != 0) {
+        errno = reader->error;
+
+        return false;
+    }
+    if (!reader->is_done) {
+        errno = EINVAL;
+
+        return false;
+    }
+
+    return true;
+}
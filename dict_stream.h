@@ -0,0 +1,130 @@
+#ifndef DICT_STREAM_H
+#define DICT_STREAM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+/**
+ * Streaming format of `dict_dump' and `dict_load', the same for all
+ * backends. All numbers are little-endian:
+ *
+ *   header: magic "DICTSTRM", u32 version, u32 zero, u64 number of entries
+ *       when dumped (a hint for pre-sizing), u32 CRC32C of the above;
+ *   blocks: u32 payload size, u32 number of records, u32 CRC32C of the two
+ *       numbers and the payload, then the payload: records of u32 key
+ *       length, u32 value size (0 for NULL value, otherwise length with
+ *       terminating zero), key and value bytes;
+ *   end: block of no records, with u64 number of records in the stream as
+ *       payload.
+ *
+ * Blocks are written and read whole, so neither side holds more than one
+ * block of entries in memory.
+ */
+
+
+/**
+ * Writer of a stream into a file descriptor. Records are gathered into a
+ * block buffer, which is written out when full. After the first error
+ * nothing more is written.
+ */
+struct dict_stream_writer
+{
+    int fd;
+    // Block header space followed by payload of `used' bytes.
+    char *block;
+    size_t allocated;
+    size_t used;
+    size_t records;
+    uint64_t total;
+    // `errno' of the first error, 0 if none.
+    int error;
+};
+
+
+/**
+ * Reader of a stream from a file descriptor, one block at a time.
+ */
+struct dict_stream_reader
+{
+    int fd;
+    // Number of entries recorded in the header, capped by the number of
+    // records the rest of the stream can hold (or a block, for streams of
+    // unknown size), so it is safe to presize by.
+    uint64_t len;
+    // Payload of the current block, and position of the next record in it.
+    char *block;
+    size_t allocated;
+    size_t size;
+    size_t pos;
+    size_t records_left;
+    uint64_t total;
+    bool is_done;
+    // `errno' of the first error, 0 if none.
+    int error;
+};
+
+
+/**
+ * CRC32C (Castagnoli) of `size' bytes, continuing `crc' (0 to start).
+ */
+uint32_t
+dict_crc32c(uint32_t crc, const void *data, size_t size);
+
+
+/**
+ * Start stream of dictionary of `len' entries on `fd'.
+ */
+void
+dict_stream_writer_init(struct dict_stream_writer *, int fd, uint64_t len);
+
+
+/**
+ * Add entry to stream. `value' is a zero-terminated string or NULL.
+ */
+void
+dict_stream_write(
+    struct dict_stream_writer *,
+    const char *key,
+    size_t key_len,
+    const char *value);
+
+
+/**
+ * End stream and free writer. Return false if anything failed, with `errno'
+ * set.
+ */
+bool
+dict_stream_writer_finish(struct dict_stream_writer *);
+
+
+/**
+ * Read stream header from `fd'. Return false on error, with `errno' set
+ * (`EINVAL' for malformed data); the reader needs no finishing then.
+ */
+bool
+dict_stream_reader_init(struct dict_stream_reader *, int fd);
+
+
+/**
+ * Read next entry. Key and value point into the block buffer and stay valid
+ * until the next call. Return false at the end of stream or on error.
+ */
+bool
+dict_stream_read(
+    struct dict_stream_reader *,
+    const char **key,
+    size_t *key_len,
+    const char **value);
+
+
+/**
+ * Free reader. Return false if the stream was not read to its end without
+ * errors, with `errno' set (`EINVAL' for malformed or corrupted data).
+ */
+bool
+dict_stream_reader_finish(struct dict_stream_reader *);
+
+
+#endif
@@ -0,0 +1,322 @@
+#ifndef DICT_TYPED_H
+#define DICT_TYPED_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/**
+ * Type-specialized open addressing dictionaries.
+ *
+ *   DEFINE_DICT(prefix, KeyT, ValT, hash_fn, eq_fn)
+ *
+ * defines `struct prefix' mapping `KeyT' keys to `ValT' values, and its
+ * `static inline' functions (listed at the macro). Entries hold keys and
+ * values by value, copied by assignment; memory they point to is not
+ * owned. `hash_fn(key)' returns `uint64_t' and `eq_fn(a, b)' compares two
+ * keys; both are called directly (they may be macros), so the compiler
+ * inlines them, where the backends call the hash through a function
+ * pointer and compare keys as strings.
+ *
+ * The table is laid out as in open_addressing_dict: a control byte per
+ * slot holds a 7-bit hash tag, so keys are compared only for matching
+ * tags; slots are probed linearly, and deleted ones are left as
+ * tombstones. Table size is a power of two, kept between 1.5 and 5 times
+ * the number of entries, and rehashed when tombstones fill it up.
+ *
+ * Example:
+ *
+ *   DEFINE_DICT(u64_dict, uint64_t, double, dict_typed_hash_u64,
+ *       DICT_TYPED_EQ)
+ *
+ *   struct u64_dict *d = u64_dict_init();
+ *   u64_dict_set(d, 42, 0.5);
+ *   double *value = u64_dict_get(d, 42);
+ */
+
+
+// Table of fewer slots is not created.
+#define DICT_TYPED_MIN_SIZE 8
+
+// Control bytes. Used slots hold 7-bit hash tag (high bit is clear).
+#define DICT_TYPED_EMPTY 0x80
+#define DICT_TYPED_DELETED 0xFE
+
+
+// Equality of scalar keys, for `DEFINE_DICT'.
+#define DICT_TYPED_EQ(a, b) ((a) == (b))
+
+
+/**
+ * Hash of integer key, for `DEFINE_DICT': every input bit affects both the
+ * low bits (the slot) and the high ones (the tag).
+ */
+static inline uint64_t
+dict_typed_hash_u64(uint64_t x)
+{
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+
+    return x;
+}
+
+
+/**
+ * Malloc. Exit on failure.
+ */
+static inline void *
+_dict_typed_malloc(size_t size)
+{
+    void *ptr = malloc(size);
+    if (ptr == NULL) {
+        printf("fatal: Memory allocation failed\n");
+        exit(1);
+    }
+
+    return ptr;
+}
+
+
+/**
+ * Tag of hash for control byte.
+ */
+static inline uint8_t
+_dict_typed_tag(uint64_t hash)
+{
+    return hash >> (sizeof(hash) * 8 - 7);
+}
+
+
+/**
+ * Round table size up to a power of two.
+ */
+static inline size_t
+_dict_typed_round_size(size_t size)
+{
+    size_t rounded = DICT_TYPED_MIN_SIZE;
+    while (rounded < size) {
+        rounded *= 2;
+    }
+
+    return rounded;
+}
+
+
+// Define dictionary `struct prefix' of `KeyT' keys and `ValT' values, hashed
+// with `hash_fn' and compared with `eq_fn' (see the top of the file):
+//   struct prefix_entry - key and value;
+//   struct prefix - table: `len' entries, and tombstones among `size' slots;
+//   struct prefix_iter - iterator, see `prefix_iter_next';
+//   prefix_init() - create empty dictionary;
+//   prefix_destroy(d) - free dictionary;
+//   prefix_reserve(d, n) - make room for `n' entries without resizes;
+//   prefix_get(d, key) - pointer to value of key, NULL if missing; valid
+//       until the next change of dictionary;
+//   prefix_set(d, key, value) - set value of key;
+//   prefix_del(d, key) - remove key if present;
+//   prefix_iter_init(it, d) - start iteration over entries, in table order;
+//   prefix_iter_next(it, &key, &value) - copy out next entry (either pointer
+//       may be NULL) and return true, or return false at the end. Dictionary
+//       must not be changed during iteration.
+#define DEFINE_DICT(prefix, KeyT, ValT, hash_fn, eq_fn)                     \
+                                                                            \
+struct prefix##_entry                                                       \
+{                                                                           \
+    KeyT key;                                                               \
+    ValT value;                                                             \
+};                                                                          \
+                                                                            \
+struct prefix                                                               \
+{                                                                           \
+    uint8_t *ctrl;                                                          \
+    struct prefix##_entry *entries;                                         \
+    size_t size;                                                            \
+    size_t len;                                                             \
+    size_t tombstones;                                                      \
+};                                                                          \
+                                                                            \
+struct prefix##_iter                                                        \
+{                                                                           \
+    struct prefix *d;                                                       \
+    size_t pos;                                                             \
+};                                                                          \
+                                                                            \
+static inline void                                                          \
+_##prefix##_init_table(struct prefix *d, size_t size)                       \
+{                                                                           \
+    d->ctrl = _dict_typed_malloc(size);                                     \
+    memset(d->ctrl, DICT_TYPED_EMPTY, size);                                \
+    d->entries = _dict_typed_malloc(size * sizeof(struct prefix##_entry));  \
+    d->size = size;                                                         \
+    d->tombstones = 0;                                                      \
+}                                                                           \
+                                                                            \
+static inline struct prefix *                                               \
+prefix##_init(void)                                                         \
+{                                                                           \
+    struct prefix *d = _dict_typed_malloc(sizeof(struct prefix));           \
+    _##prefix##_init_table(d, DICT_TYPED_MIN_SIZE);                         \
+    d->len = 0;                                                             \
+                                                                            \
+    return d;                                                               \
+}                                                                           \
+                                                                            \
+static inline void                                                          \
+prefix##_destroy(struct prefix *d)                                          \
+{                                                                           \
+    free(d->ctrl);                                                          \
+    free(d->entries);                                                       \
+    free(d);                                                                \
+}                                                                           \
+                                                                            \
+/* Position of key, `d->size' if missing. */                                \
+static inline size_t                                                        \
+_##prefix##_lookup(struct prefix *d, KeyT key, uint64_t hash)               \
+{                                                                           \
+    size_t mask = d->size - 1;                                              \
+    uint8_t tag = _dict_typed_tag(hash);                                    \
+    size_t pos = hash & mask;                                               \
+    uint8_t ctrl;                                                           \
+    while ((ctrl = d->ctrl[pos]) != DICT_TYPED_EMPTY) {                     \
+        if (ctrl == tag && eq_fn(d->entries[pos].key, key)) {               \
+            return pos;                                                     \
+        }                                                                   \
+        pos = (pos + 1) & mask;                                             \
+    }                                                                       \
+                                                                            \
+    return d->size;                                                         \
+}                                                                           \
+                                                                            \
+/* Rehash all entries into new table of `size' slots. */                    \
+static inline void                                                          \
+_##prefix##_resize(struct prefix *d, size_t size)                           \
+{                                                                           \
+    uint8_t *old_ctrl = d->ctrl;                                            \
+    struct prefix##_entry *old_entries = d->entries;                        \
+    size_t old_size = d->size;                                              \
+    _##prefix##_init_table(d, size);                                        \
+                                                                            \
+    size_t mask = size - 1;                                                 \
+    for (size_t i = 0; i < old_size; ++i) {                                 \
+        if (old_ctrl[i] & DICT_TYPED_EMPTY) {                               \
+            continue;                                                       \
+        }                                                                   \
+        size_t pos = hash_fn(old_entries[i].key) & mask;                    \
+        while (d->ctrl[pos] != DICT_TYPED_EMPTY) {                          \
+            pos = (pos + 1) & mask;                                         \
+        }                                                                   \
+        d->ctrl[pos] = old_ctrl[i];                                         \
+        d->entries[pos] = old_entries[i];                                   \
+    }                                                                       \
+                                                                            \
+    free(old_ctrl);                                                         \
+    free(old_entries);                                                      \
+}                                                                           \
+                                                                            \
+static inline void                                                          \
+prefix##_reserve(struct prefix *d, size_t n)                                \
+{                                                                           \
+    size_t size = _dict_typed_round_size(n * 2);                            \
+    if (size > d->size) {                                                   \
+        _##prefix##_resize(d, size);                                        \
+    }                                                                       \
+}                                                                           \
+                                                                            \
+static inline ValT *                                                        \
+prefix##_get(struct prefix *d, KeyT key)                                    \
+{                                                                           \
+    size_t pos = _##prefix##_lookup(d, key, hash_fn(key));                  \
+                                                                            \
+    return pos != d->size ? &d->entries[pos].value : NULL;                  \
+}                                                                           \
+                                                                            \
+static inline void                                                          \
+prefix##_set(struct prefix *d, KeyT key, ValT value)                        \
+{                                                                           \
+    uint64_t hash = hash_fn(key);                                           \
+    size_t pos = _##prefix##_lookup(d, key, hash);                          \
+    if (pos != d->size) {                                                   \
+        d->entries[pos].value = value;                                      \
+                                                                            \
+        return;                                                             \
+    }                                                                       \
+                                                                            \
+    /* Used slots and tombstones stay under 2/3 of table, so probing */     \
+    /* always ends at an empty slot. */                                     \
+    if ((d->len + d->tombstones + 1) * 3 > d->size * 2) {                   \
+        _##prefix##_resize(d, _dict_typed_round_size((d->len + 1) * 2));    \
+    }                                                                       \
+                                                                            \
+    size_t mask = d->size - 1;                                              \
+    pos = hash & mask;                                                      \
+    while (!(d->ctrl[pos] & DICT_TYPED_EMPTY)) {                            \
+        pos = (pos + 1) & mask;                                             \
+    }                                                                       \
+    if (d->ctrl[pos] == DICT_TYPED_DELETED) {                               \
+        --d->tombstones;                                                    \
+    }                                                                       \
+    d->ctrl[pos] = _dict_typed_tag(hash);                                   \
+    d->entries[pos].key = key;                                              \
+    d->entries[pos].value = value;                                          \
+    ++d->len;                                                               \
+}                                                                           \
+                                                                            \
+static inline void                                                          \
+prefix##_del(struct prefix *d, KeyT key)                                    \
+{                                                                           \
+    size_t pos = _##prefix##_lookup(d, key, hash_fn(key));                  \
+    if (pos == d->size) {                                                   \
+        return;                                                             \
+    }                                                                       \
+                                                                            \
+    /* Slot ending a probe run becomes empty at once. */                    \
+    if (d->ctrl[(pos + 1) & (d->size - 1)] == DICT_TYPED_EMPTY) {           \
+        d->ctrl[pos] = DICT_TYPED_EMPTY;                                    \
+    } else {                                                                \
+        d->ctrl[pos] = DICT_TYPED_DELETED;                                  \
+        ++d->tombstones;                                                    \
+    }                                                                       \
+    --d->len;                                                               \
+                                                                            \
+    if (d->size > d->len * 5 && d->size > DICT_TYPED_MIN_SIZE) {            \
+        _##prefix##_resize(d, _dict_typed_round_size(d->len * 2));          \
+    }                                                                       \
+}                                                                           \
+                                                                            \
+static inline void                                                          \
+prefix##_iter_init(struct prefix##_iter *it, struct prefix *d)              \
+{                                                                           \
+    it->d = d;                                                              \
+    it->pos = 0;                                                            \
+}                                                                           \
+                                                                            \
+static inline bool                                                          \
+prefix##_iter_next(struct prefix##_iter *it, KeyT *key, ValT *value)        \
+{                                                                           \
+    struct prefix *d = it->d;                                               \
+    for (; it->pos < d->size; ++it->pos) {                                  \
+        if (!(d->ctrl[it->pos] & DICT_TYPED_EMPTY)) {                       \
+            struct prefix##_entry *entry = &d->entries[it->pos++];          \
+            if (key != NULL) {                                              \
+                *key = entry->key;                                          \
+            }                                                               \
+            if (value != NULL) {                                            \
+                *value = entry->value;                                      \
+            }                                                               \
+                                                                            \
+            return true;                                                    \
+        }                                                                   \
+    }                                                                       \
+                                                                            \
+    return false;                                                           \
+}
+
+
+#endif
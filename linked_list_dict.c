@@ -1,8 +1,17 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdbool.h>
+#include <errno.h>
 
 #include "linked_list_dict.h"
+#include "dict_arena.h"
+#include "dict_bulk.h"
+#include "dict_epoch.h"
+#include "dict_hash.h"
+#include "dict_instr.h"
+#include "dict_pool.h"
+#include "dict_stream.h"
 
 
 /**
@@ -27,66 +36,455 @@ safe_malloc(size_t size)
 #define DICT_MIN_ARRAY_SIZE 8
 
 
+// Entry pool chunks hold from `DICT_MIN_CHUNK_SIZE' entries, twice more for
+// every next chunk, up to `DICT_MAX_CHUNK_SIZE'.
+#define DICT_MIN_CHUNK_SIZE 16
+#define DICT_MAX_CHUNK_SIZE 65536
+
+
+// `DICT_INCREMENTAL' dictionary moves up to `DICT_REHASH_STEP' buckets per
+// operation, skipping at most `DICT_REHASH_STEP' * 10 empty ones.
+#define DICT_REHASH_STEP 16
+
+
+// `DICT_CONCURRENT' dictionary has this many lock stripes. Bucket `i' is
+// guarded by stripe `i % DICT_LOCK_STRIPES', and array sizes are multiples
+// of it, so a key's bucket keeps its stripe across resizes.
+#define DICT_LOCK_STRIPES 64
+
+
+// `dict_scan' visits up to this many times `count' buckets.
+#define DICT_SCAN_MAX_VISITS 10
+
+
+// `dict_get_many' interleaves lookups of this many keys.
+#define DICT_GET_BATCH 16
+
+
+// `dict_build' links entries by regions of this many buckets, one task per
+// region, so every task writes to a cache-sized part of the array.
+#define DICT_BUILD_REGION_SIZE 65536
+
+
+// Dictionary with a pool resizes arrays of at least this many entries on
+// pool threads; smaller ones are not worth waking them.
+#define DICT_POOL_RESIZE_MIN 65536
+
+
 /**
  * Is entry matches.
  */
 static inline int
 _is_entry_matches(
-    struct dict_entry entry, unsigned int hash, const char *key)
+    struct dict_entry entry,
+    uint64_t hash,
+    const char *key,
+    size_t key_len)
 {
-    return entry.hash == hash && strcmp(entry.key, key) == 0;
+    return (
+        entry.hash == hash &&
+        entry.key_len == key_len &&
+        DICT_INSTR_MEMCMP(entry.key, key, key_len) == 0
+    );
 }
 
 
 /**
- * Create array for dictionary entries with given size.
+ * Lock arena of `DICT_CONCURRENT' dictionary, which is shared by stripes.
  */
-static inline struct dict_entry **
-_create_array(size_t size)
+static inline void
+_lock_arena(struct dict *d)
 {
-    struct dict_entry **new_array = safe_malloc(
-        sizeof(struct dict_entry *) * size);
-    for (size_t i = 0; i < size; ++i) {
-        new_array[i] = NULL;
+    if (d->flags & DICT_CONCURRENT) {
+        pthread_mutex_lock(&d->arena_lock);
     }
+}
 
-    return new_array;
+
+/**
+ * Unlock arena of `DICT_CONCURRENT' dictionary.
+ */
+static inline void
+_unlock_arena(struct dict *d)
+{
+    if (d->flags & DICT_CONCURRENT) {
+        pthread_mutex_unlock(&d->arena_lock);
+    }
 }
 
 
 /**
- * Remove array with dictionary entries and free memory.
+ * Copy string into arena.
+ */
+static inline const char *
+_arena_copy(struct dict *d, const char *str, size_t len)
+{
+    _lock_arena(d);
+    const char *copy = dict_arena_copy(&d->arena, str, len);
+    _unlock_arena(d);
+
+    return copy;
+}
+
+
+/**
+ * Account arena bytes taken by deleted key or replaced value.
  */
 static inline void
-_delete_array(struct dict_entry **entries_array, size_t length)
+_add_arena_garbage(struct dict *d, size_t size)
 {
-    for (size_t i = 0; i < length; ++i) {
-        struct dict_entry *entry = entries_array[i];
-        while (entry != NULL) {
-            struct dict_entry *next = entry->neighbour;
-            free(entry);
-            entry = next;
+    _lock_arena(d);
+    d->arena_garbage += size;
+    _unlock_arena(d);
+}
+
+
+/**
+ * Copy key into arena if dictionary owns its strings.
+ */
+static inline const char *
+_own_key(struct dict *d, const char *key, size_t key_len)
+{
+    if (!(d->flags & DICT_OWNED)) {
+        return key;
+    }
+
+    return _arena_copy(d, key, key_len);
+}
+
+
+/**
+ * Copy value into arena if dictionary owns its strings.
+ */
+static inline const char *
+_own_value(struct dict *d, const char *value)
+{
+    if (!(d->flags & DICT_OWNED) || value == NULL) {
+        return value;
+    }
+
+    return _arena_copy(d, value, strlen(value));
+}
+
+
+/**
+ * Arena bytes taken by owned value.
+ */
+static inline size_t
+_owned_value_size(const char *value)
+{
+    return value == NULL ? 0 : strlen(value) + 1;
+}
+
+
+/**
+ * Free arena retired by `_retire_arena'.
+ */
+static void
+_free_arena(void *arg)
+{
+    struct dict_arena *arena = arg;
+    dict_arena_destroy(arena);
+    free(arena);
+}
+
+
+/**
+ * Free chunks of arena replaced in `DICT_CONCURRENT' dictionary once
+ * lookups which may have returned its strings are done.
+ */
+static inline void
+_retire_arena(struct dict_arena *arena)
+{
+    struct dict_arena *retired = safe_malloc(sizeof(struct dict_arena));
+    *retired = *arena;
+    dict_epoch_retire(retired, _free_arena);
+}
+
+
+/**
+ * Add `delta' to `len' or `array_len'. Stripes of `DICT_CONCURRENT'
+ * dictionary change them at once.
+ */
+static inline void
+_add_count(struct dict *d, size_t *counter, size_t delta)
+{
+    if (d->flags & DICT_CONCURRENT) {
+        __atomic_add_fetch(counter, delta, __ATOMIC_RELAXED);
+    } else {
+        *counter += delta;
+    }
+}
+
+
+/**
+ * Stripe guarding bucket of `hash'.
+ */
+static inline struct dict_stripe *
+_get_stripe(struct dict *d, uint64_t hash)
+{
+    return &d->stripes[hash % DICT_LOCK_STRIPES];
+}
+
+
+/**
+ * Pool for entries of bucket of `hash'.
+ */
+static inline struct dict_entry_pool *
+_get_pool(struct dict *d, uint64_t hash)
+{
+    if (d->flags & DICT_CONCURRENT) {
+        return &_get_stripe(d, hash)->pool;
+    }
+
+    return &d->pool;
+}
+
+
+/**
+ * Lock bucket of `hash' in `DICT_CONCURRENT' dictionary. The bucket's
+ * stripe does not depend on array size, so it can be taken before reading
+ * the array.
+ */
+static inline void
+_lock_bucket(struct dict *d, uint64_t hash)
+{
+    if (d->flags & DICT_CONCURRENT) {
+        pthread_mutex_lock(&_get_stripe(d, hash)->lock);
+    }
+}
+
+
+/**
+ * Unlock bucket of `hash' in `DICT_CONCURRENT' dictionary.
+ */
+static inline void
+_unlock_bucket(struct dict *d, uint64_t hash)
+{
+    if (d->flags & DICT_CONCURRENT) {
+        pthread_mutex_unlock(&_get_stripe(d, hash)->lock);
+    }
+}
+
+
+/**
+ * Lock all stripes of `DICT_CONCURRENT' dictionary, in order.
+ */
+static inline void
+_lock_all(struct dict *d)
+{
+    if (d->flags & DICT_CONCURRENT) {
+        for (size_t i = 0; i < DICT_LOCK_STRIPES; ++i) {
+            pthread_mutex_lock(&d->stripes[i].lock);
+        }
+    }
+}
+
+
+/**
+ * Unlock all stripes of `DICT_CONCURRENT' dictionary.
+ */
+static inline void
+_unlock_all(struct dict *d)
+{
+    if (d->flags & DICT_CONCURRENT) {
+        for (size_t i = 0; i < DICT_LOCK_STRIPES; ++i) {
+            pthread_mutex_unlock(&d->stripes[i].lock);
+        }
+    }
+}
+
+
+/**
+ * Round array size up to a power of two, so `dict_scan' cursors stay valid
+ * across resizes. Arrays of `DICT_CONCURRENT' dictionary have at least
+ * `DICT_LOCK_STRIPES' buckets, so their sizes are multiples of it.
+ */
+static inline size_t
+_round_array_size(struct dict *d, size_t size)
+{
+    size_t rounded = DICT_MIN_ARRAY_SIZE;
+    if (d->flags & DICT_CONCURRENT) {
+        rounded = DICT_LOCK_STRIPES;
+    }
+    while (rounded < size) {
+        rounded *= 2;
+    }
+
+    return rounded;
+}
+
+
+/**
+ * Count rehash of `d' into array of `new_size' buckets for `dict_stats'.
+ */
+static inline void
+_count_rehash(struct dict *d, size_t new_size)
+{
+    if (new_size != d->array_allocated) {
+        ++d->resizes;
+    } else {
+        ++d->rebuilds;
+    }
+}
+
+
+/**
+ * Copy key and value of entry into `arena'.
+ */
+static inline void
+_copy_entry_strings(struct dict_arena *arena, struct dict_entry *entry)
+{
+    entry->key = dict_arena_copy(arena, entry->key, entry->key_len);
+    if (entry->value != NULL) {
+        entry->value = dict_arena_copy(
+            arena, entry->value, strlen(entry->value));
+    }
+}
+
+
+/**
+ * Is it worth copying live strings into new arena. During resize every
+ * entry is copied anyway, so a smaller share of garbage is enough.
+ */
+static inline bool
+_is_time_to_repack_arena(struct dict *d, bool is_resize)
+{
+    size_t garbage = d->arena_garbage * (is_resize ? 4 : 2);
+
+    return (d->flags & DICT_OWNED) && garbage > d->arena.used;
+}
+
+
+/**
+ * Initialize empty entry pool. The first chunk will hold `chunk_size'
+ * entries.
+ */
+static inline void
+_pool_init(struct dict_entry_pool *pool, size_t chunk_size)
+{
+    pool->chunks = NULL;
+    pool->free_list = NULL;
+    pool->next_chunk_size = chunk_size;
+}
+
+
+/**
+ * Allocate entry from pool.
+ */
+static inline struct dict_entry *
+_pool_alloc(struct dict_entry_pool *pool)
+{
+    struct dict_entry *entry = pool->free_list;
+    if (entry != NULL) {
+        pool->free_list = entry->neighbour;
+
+        return entry;
+    }
+
+    struct dict_entry_chunk *chunk = pool->chunks;
+    if (chunk == NULL || chunk->used == chunk->size) {
+        size_t size = pool->next_chunk_size;
+        chunk = safe_malloc(
+            sizeof(struct dict_entry_chunk) +
+            sizeof(struct dict_entry) * size);
+        chunk->size = size;
+        chunk->used = 0;
+        chunk->next = pool->chunks;
+        pool->chunks = chunk;
+
+        if (size < DICT_MIN_CHUNK_SIZE) {
+            pool->next_chunk_size = DICT_MIN_CHUNK_SIZE;
+        } else if (size < DICT_MAX_CHUNK_SIZE) {
+            pool->next_chunk_size = size * 2;
         }
     }
 
-    free(entries_array);
+    return &chunk->entries[chunk->used++];
+}
+
+
+/**
+ * Allocate `count' adjacent entries from pool in a chunk of their own.
+ */
+static inline struct dict_entry *
+_pool_alloc_chunk(struct dict_entry_pool *pool, size_t count)
+{
+    struct dict_entry_chunk *chunk = safe_malloc(
+        sizeof(struct dict_entry_chunk) + sizeof(struct dict_entry) * count);
+    chunk->size = count;
+    chunk->used = count;
+    chunk->next = pool->chunks;
+    pool->chunks = chunk;
+
+    return chunk->entries;
+}
+
+
+/**
+ * Return entry to pool.
+ */
+static inline void
+_pool_free(struct dict_entry_pool *pool, struct dict_entry *entry)
+{
+    entry->neighbour = pool->free_list;
+    pool->free_list = entry;
+}
+
+
+/**
+ * Free all pool chunks at once.
+ */
+static inline void
+_pool_destroy(struct dict_entry_pool *pool)
+{
+    struct dict_entry_chunk *chunk = pool->chunks;
+    while (chunk != NULL) {
+        struct dict_entry_chunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+
+    _pool_init(pool, DICT_MIN_CHUNK_SIZE);
+}
+
+
+/**
+ * Create array for dictionary entries with given size.
+ */
+static inline struct dict_entry **
+_create_array(size_t size)
+{
+    struct dict_entry **new_array = safe_malloc(
+        sizeof(struct dict_entry *) * size);
+    for (size_t i = 0; i < size; ++i) {
+        new_array[i] = NULL;
+    }
+
+    return new_array;
 }
 
 
 /**
- * Move dictionary entries from `src_array' to `dst_array'.
+ * Move dictionary entries from `src_array' to `dst_array'. If `arena' is not
+ * NULL, entry strings are copied into it on the way.
  */
 static void
 _move_array(
     struct dict_entry **src_array,
     size_t src_size,
     struct dict_entry **dst_array,
-    size_t dst_size)
+    size_t dst_size,
+    struct dict_arena *arena)
 {
     for (size_t i = 0; i < src_size; ++i) {
         struct dict_entry *entry = src_array[i];
         while (entry != NULL) {
-            unsigned int new_position = entry->hash % dst_size;
+            if (arena != NULL) {
+                _copy_entry_strings(arena, entry);
+            }
+
+            size_t new_position = entry->hash % dst_size;
             struct dict_entry *next = entry->neighbour;
 
             struct dict_entry *maybe_collided_entry = dst_array[new_position];
@@ -95,57 +493,541 @@ _move_array(
             entry->neighbour = maybe_collided_entry;
             dst_array[new_position] = entry;
 
-            entry = next;
+            entry = next;
+        }
+    }
+}
+
+
+/**
+ * State shared by tasks of `_move_array_on_pool'.
+ */
+struct dict_resize_job
+{
+    struct dict_entry **old_array;
+    size_t old_size;
+    struct dict_entry **new_array;
+    size_t new_size;
+    // Per chunk of old buckets: number of entries, then number of chunk's
+    // first entry in `entries'.
+    size_t *chunk_entries;
+    // All entries of the old array, grouped by region of the new one.
+    struct dict_entry **entries;
+    struct dict_bulk bulk;
+    // Entries the chains are copied into (in region order), NULL if they
+    // are not copied.
+    struct dict_entry *copies;
+    // Per region: number of buckets started.
+    size_t *started;
+    // Per region arenas entries are repacked into, NULL if not repacking.
+    struct dict_arena *arenas;
+};
+
+
+/**
+ * Get range of old buckets of chunk.
+ */
+static inline void
+_get_resize_chunk(
+    struct dict_resize_job *job, size_t chunk, size_t *start, size_t *end)
+{
+    *start = chunk * DICT_BULK_CHUNK_SIZE;
+    *end = *start + DICT_BULK_CHUNK_SIZE;
+    if (*end > job->old_size) {
+        *end = job->old_size;
+    }
+}
+
+
+/**
+ * Count entries of chunk of old buckets.
+ */
+static void
+_resize_count_entries(void *arg, size_t chunk)
+{
+    struct dict_resize_job *job = arg;
+    size_t start, end;
+    _get_resize_chunk(job, chunk, &start, &end);
+
+    size_t count = 0;
+    for (size_t i = start; i < end; ++i) {
+        for (struct dict_entry *entry = job->old_array[i];
+                entry != NULL;
+                entry = entry->neighbour) {
+            ++count;
+        }
+    }
+    job->chunk_entries[chunk] = count;
+}
+
+
+/**
+ * Collect entries of chunk of old buckets into `entries'.
+ */
+static void
+_resize_collect_entries(void *arg, size_t chunk)
+{
+    struct dict_resize_job *job = arg;
+    size_t start, end;
+    _get_resize_chunk(job, chunk, &start, &end);
+
+    struct dict_entry **entries = &job->entries[job->chunk_entries[chunk]];
+    for (size_t i = start; i < end; ++i) {
+        for (struct dict_entry *entry = job->old_array[i];
+                entry != NULL;
+                entry = entry->neighbour) {
+            *entries++ = entry;
+        }
+    }
+}
+
+
+/**
+ * Give hash of entry `i' to `dict_bulk_init_hashed'.
+ */
+static bool
+_get_entry_hash(void *arg, size_t i, uint64_t *hash)
+{
+    struct dict_resize_job *job = arg;
+    *hash = job->entries[i]->hash;
+
+    return true;
+}
+
+
+/**
+ * Link entries of new bucket region into their chains, then copy the chains
+ * into the region's part of `copies'.
+ */
+static void
+_resize_region(void *arg, size_t region)
+{
+    struct dict_resize_job *job = arg;
+    struct dict_bulk *bulk = &job->bulk;
+
+    size_t started = 0;
+    for (size_t k = bulk->region_starts[region];
+            k < bulk->region_starts[region + 1];
+            ++k) {
+        struct dict_entry *entry = job->entries[bulk->order[k]];
+        if (job->arenas != NULL) {
+            _copy_entry_strings(&job->arenas[region], entry);
+        }
+
+        size_t position = entry->hash % job->new_size;
+        entry->neighbour = job->new_array[position];
+        if (entry->neighbour == NULL) {
+            ++started;
+        }
+        job->new_array[position] = entry;
+    }
+    job->started[region] = started;
+
+    if (job->copies == NULL) {
+        return;
+    }
+
+    size_t start = region * bulk->region_size;
+    size_t end = start + bulk->region_size;
+    if (end > job->new_size) {
+        end = job->new_size;
+    }
+    struct dict_entry *copy = &job->copies[bulk->region_starts[region]];
+    for (size_t i = start; i < end; ++i) {
+        struct dict_entry **link = &job->new_array[i];
+        while (*link != NULL) {
+            *copy = **link;
+            *link = copy++;
+            link = &(*link)->neighbour;
+        }
+    }
+}
+
+
+/**
+ * Move entries of `d' into `new_array' of `new_size' buckets on pool
+ * threads, and set `array_len'. Entries are collected from old chains and
+ * grouped by region of the new array, then every region is linked by one
+ * task. Unless the dictionary is `DICT_CONCURRENT', chains are copied into
+ * one chunk of a new pool in region order, like by `dict_build'.
+ */
+static void
+_move_array_on_pool(
+    struct dict *d,
+    struct dict_entry **new_array,
+    size_t new_size,
+    struct dict_arena *new_arena)
+{
+    struct dict_resize_job job = {
+        .old_array = d->entries_array,
+        .old_size = d->array_allocated,
+        .new_array = new_array,
+        .new_size = new_size,
+    };
+
+    size_t chunks = dict_bulk_chunks(job.old_size);
+    job.chunk_entries = safe_malloc(sizeof(size_t) * chunks);
+    dict_pool_run(d->thread_pool, chunks, _resize_count_entries, &job);
+    size_t n = 0;
+    for (size_t chunk = 0; chunk < chunks; ++chunk) {
+        size_t count = job.chunk_entries[chunk];
+        job.chunk_entries[chunk] = n;
+        n += count;
+    }
+    job.entries = safe_malloc(sizeof(struct dict_entry *) * (n + 1));
+    dict_pool_run(d->thread_pool, chunks, _resize_collect_entries, &job);
+
+    dict_bulk_init_hashed(
+        &job.bulk, _get_entry_hash, &job, n,
+        new_size, DICT_BUILD_REGION_SIZE, d->thread_pool);
+    size_t regions = job.bulk.regions;
+    job.started = safe_malloc(sizeof(size_t) * regions);
+    if (new_arena != NULL) {
+        job.arenas = safe_malloc(sizeof(struct dict_arena) * regions);
+        for (size_t region = 0; region < regions; ++region) {
+            dict_arena_init(&job.arenas[region]);
+        }
+    }
+    struct dict_entry_pool new_pool;
+    if (!(d->flags & DICT_CONCURRENT)) {
+        _pool_init(&new_pool, DICT_MAX_CHUNK_SIZE);
+        job.copies = _pool_alloc_chunk(&new_pool, n);
+    }
+
+    dict_pool_run(d->thread_pool, regions, _resize_region, &job);
+
+    d->array_len = 0;
+    for (size_t region = 0; region < regions; ++region) {
+        d->array_len += job.started[region];
+    }
+    if (new_arena != NULL) {
+        for (size_t region = 0; region < regions; ++region) {
+            dict_arena_merge(new_arena, &job.arenas[region]);
+        }
+        free(job.arenas);
+    }
+    if (!(d->flags & DICT_CONCURRENT)) {
+        _pool_destroy(&d->pool);
+        d->pool = new_pool;
+    }
+
+    free(job.started);
+    dict_bulk_destroy(&job.bulk);
+    free(job.entries);
+    free(job.chunk_entries);
+}
+
+
+/**
+ * Resize `entries_array' to `new_size' size.
+ */
+static void
+_do_resize_array(struct dict *d, size_t new_size)
+{
+    _count_rehash(d, new_size);
+    DICT_INSTR_REBUILD_BEGIN();
+
+    // Live strings of owned dictionary may be moved to new arena on the way.
+    bool repack_arena = _is_time_to_repack_arena(d, true);
+    struct dict_arena new_arena;
+    dict_arena_init(&new_arena);
+
+    struct dict_entry **new_array = _create_array(new_size);
+    bool on_pool = (
+        d->thread_pool != NULL && d->len >= DICT_POOL_RESIZE_MIN);
+    if (on_pool) {
+        _move_array_on_pool(
+            d, new_array, new_size, repack_arena ? &new_arena : NULL);
+    } else {
+        _move_array(
+            d->entries_array,
+            d->array_allocated,
+            new_array,
+            new_size,
+            repack_arena ? &new_arena : NULL
+        );
+    }
+    free(d->entries_array);
+
+    if (repack_arena) {
+        if (d->flags & DICT_CONCURRENT) {
+            _retire_arena(&d->arena);
+        } else {
+            dict_arena_destroy(&d->arena);
+        }
+        d->arena = new_arena;
+        d->arena_garbage = 0;
+    }
+
+    d->entries_array = new_array;
+    d->array_allocated = new_size;
+
+    if (on_pool) {
+        DICT_INSTR_REBUILD_END();
+
+        return;
+    }
+
+    if (d->flags & DICT_CONCURRENT) {
+        // Entries stay in their stripe pools, so their addresses are kept.
+        d->array_len = 0;
+        for (size_t i = 0; i < new_size; ++i) {
+            if (new_array[i] != NULL) {
+                ++d->array_len;
+            }
+        }
+        DICT_INSTR_REBUILD_END();
+
+        return;
+    }
+
+    // Copy entries into a new pool chain by chain, so entries of one bucket
+    // are neighbours in memory. The old pool is released at once.
+    struct dict_entry_pool new_pool;
+    _pool_init(&new_pool, d->len > 0 ? d->len : DICT_MIN_CHUNK_SIZE);
+
+    size_t array_len = 0;
+    for (size_t i = 0; i < new_size; ++i) {
+        struct dict_entry **link = &new_array[i];
+        if (*link != NULL) {
+            ++array_len;
+        }
+
+        while (*link != NULL) {
+            struct dict_entry *entry = _pool_alloc(&new_pool);
+            *entry = **link;
+            *link = entry;
+            link = &entry->neighbour;
+        }
+    }
+
+    _pool_destroy(&d->pool);
+    d->pool = new_pool;
+    d->array_len = array_len;
+    DICT_INSTR_REBUILD_END();
+}
+
+
+/**
+ * Is incremental rehash in progress.
+ */
+static inline bool
+_is_rehashing(struct dict *d)
+{
+    return d->old_entries_array != NULL;
+}
+
+
+/**
+ * Start incremental rehash into new array of `new_size' buckets.
+ */
+static void
+_start_rehash(struct dict *d, size_t new_size)
+{
+    _count_rehash(d, new_size);
+
+    // Live strings of owned dictionary may be moved to new arena on the way.
+    d->rehash_repacks_arena = _is_time_to_repack_arena(d, true);
+    if (d->rehash_repacks_arena) {
+        d->old_arena = d->arena;
+        dict_arena_init(&d->arena);
+        d->arena_garbage = 0;
+    }
+
+    d->old_entries_array = d->entries_array;
+    d->old_array_allocated = d->array_allocated;
+    d->rehash_pos = 0;
+
+    d->entries_array = _create_array(new_size);
+    d->array_allocated = new_size;
+}
+
+
+/**
+ * Move old bucket at `position' to new array.
+ */
+static void
+_rehash_bucket(struct dict *d, size_t position)
+{
+    struct dict_entry *entry = d->old_entries_array[position];
+    if (entry == NULL) {
+        return;
+    }
+
+    d->old_entries_array[position] = NULL;
+    --d->array_len;
+
+    while (entry != NULL) {
+        if (d->rehash_repacks_arena) {
+            _copy_entry_strings(&d->arena, entry);
+        }
+
+        size_t new_position = entry->hash % d->array_allocated;
+        struct dict_entry *next = entry->neighbour;
+
+        entry->neighbour = d->entries_array[new_position];
+        if (entry->neighbour == NULL) {
+            ++d->array_len;
+        }
+        d->entries_array[new_position] = entry;
+
+        entry = next;
+    }
+}
+
+
+/**
+ * Free old array once all buckets are moved.
+ */
+static void
+_end_rehash(struct dict *d)
+{
+    free(d->old_entries_array);
+    d->old_entries_array = NULL;
+
+    if (d->rehash_repacks_arena) {
+        dict_arena_destroy(&d->old_arena);
+        d->rehash_repacks_arena = false;
+    }
+}
+
+
+/**
+ * Move next `DICT_REHASH_STEP' old buckets, then the bucket of `hash', so
+ * entry with this hash can be found in `entries_array' only.
+ */
+static void
+_rehash_step(struct dict *d, uint64_t hash)
+{
+    size_t moved = 0;
+    size_t skipped = 0;
+    while (d->rehash_pos < d->old_array_allocated &&
+            moved < DICT_REHASH_STEP &&
+            skipped < DICT_REHASH_STEP * 10) {
+        size_t position = d->rehash_pos++;
+        if (d->old_entries_array[position] != NULL) {
+            _rehash_bucket(d, position);
+            ++moved;
+        } else {
+            ++skipped;
+        }
+    }
+
+    if (d->rehash_pos == d->old_array_allocated) {
+        _end_rehash(d);
+    } else {
+        _rehash_bucket(d, hash % d->old_array_allocated);
+    }
+}
+
+
+/**
+ * Move all remaining old buckets.
+ */
+static void
+_finish_rehash(struct dict *d)
+{
+    if (!_is_rehashing(d)) {
+        return;
+    }
+
+    while (d->rehash_pos < d->old_array_allocated) {
+        _rehash_bucket(d, d->rehash_pos++);
+    }
+    _end_rehash(d);
+}
+
+
+/**
+ * Resize `entries_array' to `new_size' size, at once or incrementally.
+ */
+static void
+_resize_array(struct dict *d, size_t new_size)
+{
+    if (d->flags & DICT_INCREMENTAL) {
+        _start_rehash(d, new_size);
+    } else {
+        _do_resize_array(d, new_size);
+    }
+}
+
+
+/**
+ * Size `entries_array' should be resized to for the number of entries, 0 if
+ * its size is fine.
+ */
+static size_t
+_get_new_array_size(struct dict *d)
+{
+    // Reserved room is kept however few entries there are. Entries of
+    // `DICT_CONCURRENT' dictionary may be counted by other stripes meanwhile.
+    size_t len = __atomic_load_n(&d->len, __ATOMIC_RELAXED);
+    if (len < d->reserved) {
+        len = d->reserved;
+    }
+    size_t min_size = len * 3 / 2;
+    size_t max_size = len * 5;
+
+    if (d->array_allocated < min_size || d->array_allocated > max_size) {
+        // Rounding up to a power of two adds up to as much again.
+        size_t optimal_size = _round_array_size(d, len * 2);
+        if (d->array_allocated != optimal_size) {
+            return optimal_size;
         }
     }
+
+    return 0;
 }
 
 
 /**
- * Resize `entries_array' to `new_size' size.
+ * Resize `entries_array' if needed.
  */
 static void
-_do_resize_array(struct dict *d, size_t new_size)
+_resize_array_if_needed(struct dict *d)
 {
-    struct dict_entry **new_array = _create_array(new_size);
-    _move_array(
-        d->entries_array,
-        d->array_allocated,
-        new_array,
-        new_size
-    );
-    free(d->entries_array);
-    d->entries_array = new_array;
-    d->array_allocated = new_size;
-
-    size_t array_len = 0;
-    for (int i = 0; i < new_size; ++i) {
-        if (new_array[i] != NULL) {
-            ++array_len;
-        }
+    if (_is_rehashing(d)) {
+        // Chains only get longer until the rehash in progress ends.
+        return;
     }
 
-    d->array_len = array_len;
+    size_t new_size = _get_new_array_size(d);
+    if (new_size != 0) {
+        _resize_array(d, new_size);
+    } else if (_is_time_to_repack_arena(d, false)) {
+        // Rehash in place to reclaim arena garbage.
+        _resize_array(d, d->array_allocated);
+    }
 }
 
 
 /**
- * Resize `entries_array' if needed.
+ * Finish operation on bucket of `hash': unlock it and resize
+ * `entries_array' if needed. `DICT_CONCURRENT' dictionary checks whether
+ * resize is needed under the bucket lock, and takes all stripes to do it.
  */
 static void
-_resize_array_if_needed(struct dict *d)
+_unlock_bucket_and_resize(struct dict *d, uint64_t hash)
 {
-    size_t min_size = d->len * 3 / 2;
-    size_t max_size = d->len * 5;
+    if (!(d->flags & DICT_CONCURRENT)) {
+        _resize_array_if_needed(d);
 
-    if (d->array_allocated < min_size || d->array_allocated > max_size) {
-        size_t optimal_size = d->len * 3;
-        if (optimal_size < DICT_MIN_ARRAY_SIZE) {
-            optimal_size = DICT_MIN_ARRAY_SIZE;
-        }
-        if (d->array_allocated != optimal_size) {
-            _do_resize_array(d, optimal_size);
-        }
+        return;
+    }
+
+    bool is_resize_needed = _get_new_array_size(d) != 0;
+    if (!is_resize_needed && (d->flags & DICT_OWNED)) {
+        _lock_arena(d);
+        is_resize_needed = _is_time_to_repack_arena(d, false);
+        _unlock_arena(d);
+    }
+    _unlock_bucket(d, hash);
+
+    if (is_resize_needed) {
+        // Another thread may have resized meanwhile, so it is checked again.
+        _lock_all(d);
+        _resize_array_if_needed(d);
+        _unlock_all(d);
     }
 }
 
@@ -154,14 +1036,58 @@ _resize_array_if_needed(struct dict *d)
  * Create new dictionary object.
  */
 struct dict *
-dict_init(unsigned int (*hash_function)(const char *))
+dict_init(uint64_t (*hash_function)(const char *, size_t))
+{
+    return dict_init_flags(hash_function, 0);
+}
+
+
+/**
+ * Create new dictionary object with given `DICT_*' flags.
+ */
+struct dict *
+dict_init_flags(
+    uint64_t (*hash_function)(const char *, size_t), int flags)
 {
     struct dict *d = safe_malloc(sizeof(struct dict));
+
+    if (flags & DICT_CONCURRENT) {
+        flags &= ~DICT_INCREMENTAL;
+    }
+    d->flags = flags;
+
     d->len = 0;
     d->array_len = 0;
-    d->array_allocated = DICT_MIN_ARRAY_SIZE;
+    d->array_allocated = _round_array_size(d, DICT_MIN_ARRAY_SIZE);
     d->entries_array = _create_array(d->array_allocated);
+    _pool_init(&d->pool, DICT_MIN_CHUNK_SIZE);
     d->hash_function = hash_function;
+    d->thread_pool = NULL;
+
+    d->reserved = 0;
+    dict_arena_init(&d->arena);
+    d->arena_garbage = 0;
+    d->resizes = 0;
+    d->rebuilds = 0;
+
+    d->old_entries_array = NULL;
+    d->rehash_repacks_arena = false;
+
+    d->stripes = NULL;
+    if (flags & DICT_CONCURRENT) {
+        d->stripes = aligned_alloc(
+            _Alignof(struct dict_stripe),
+            sizeof(struct dict_stripe) * DICT_LOCK_STRIPES);
+        if (d->stripes == NULL) {
+            printf("fatal: Memory allocation failed\n");
+            exit(1);
+        }
+        for (size_t i = 0; i < DICT_LOCK_STRIPES; ++i) {
+            pthread_mutex_init(&d->stripes[i].lock, NULL);
+            _pool_init(&d->stripes[i].pool, DICT_MIN_CHUNK_SIZE);
+        }
+        pthread_mutex_init(&d->arena_lock, NULL);
+    }
 
     return d;
 }
@@ -173,30 +1099,158 @@ dict_init(unsigned int (*hash_function)(const char *))
 void
 dict_destroy(struct dict *d)
 {
-    _delete_array(d->entries_array, d->array_allocated);
+    // Entries live in pool chunks, so chains need not be walked.
+    free(d->entries_array);
+    _pool_destroy(&d->pool);
+    if (_is_rehashing(d)) {
+        _end_rehash(d);
+    }
+    dict_arena_destroy(&d->arena);
+    if (d->flags & DICT_CONCURRENT) {
+        for (size_t i = 0; i < DICT_LOCK_STRIPES; ++i) {
+            _pool_destroy(&d->stripes[i].pool);
+            pthread_mutex_destroy(&d->stripes[i].lock);
+        }
+        free(d->stripes);
+        pthread_mutex_destroy(&d->arena_lock);
+    }
     free(d);
 }
 
 
+/**
+ * Make room for `n' entries.
+ */
+void
+dict_reserve(struct dict *d, size_t n)
+{
+    // Reserving is done up front, so it does not need to be incremental.
+    _finish_rehash(d);
+
+    _lock_all(d);
+    d->reserved = n;
+    if (d->array_allocated < n * 3 / 2) {
+        _do_resize_array(d, _round_array_size(d, n * 2));
+    }
+    _unlock_all(d);
+}
+
+
+/**
+ * Set pool to resize large array on, see header.
+ */
+void
+dict_set_pool(struct dict *d, struct dict_pool *pool)
+{
+    _lock_all(d);
+    d->thread_pool = pool;
+    _unlock_all(d);
+}
+
+
 /**
  * Get value by key.
  */
 const char *
 dict_get(struct dict *d, const char *key)
 {
-    unsigned int hash = d->hash_function(key);
-    unsigned int position = hash % d->array_allocated;
+    return dict_get_n(d, key, strlen(key));
+}
+
+
+/**
+ * Get value by key of `key_len' bytes.
+ */
+const char *
+dict_get_n(struct dict *d, const char *key, size_t key_len)
+{
+    DICT_INSTR_OP(gets);
+    uint64_t hash = d->hash_function(key, key_len);
+    _lock_bucket(d, hash);
+    if (_is_rehashing(d)) {
+        _rehash_step(d, hash);
+    }
+
+    size_t position = hash % d->array_allocated;
     struct dict_entry *entry = d->entries_array[position];
+    // Bucket and chain links read.
+    size_t probes = 1;
 
-    while (entry != NULL) {
-        if (_is_entry_matches(*entry, hash, key)) {
-            return entry->value;
+    while (entry != NULL &&
+            !_is_entry_matches(*entry, hash, key, key_len)) {
+        entry = entry->neighbour;
+        ++probes;
+    }
+    DICT_INSTR_LOOKUP(key, key_len, probes);
+    const char *value = entry != NULL ? entry->value : NULL;
+
+    _unlock_bucket(d, hash);
+
+    return value;
+}
+
+
+/**
+ * Get values of `n' keys, see header.
+ *
+ * Keys go in batches of `DICT_GET_BATCH', every stage being done for the
+ * whole batch before the next one: hash keys and prefetch their buckets,
+ * prefetch chain heads, prefetch keys of chain heads, then walk chains.
+ * Each stage only touches memory prefetched by the previous one, so misses
+ * of a batch are waited for about once.
+ */
+void
+dict_get_many(
+    struct dict *d, const char *const *keys, size_t n, const char **values)
+{
+    if ((d->flags & DICT_CONCURRENT) || _is_rehashing(d)) {
+        // Lookups lock their buckets, or go to both tables and move
+        // entries, one by one.
+        for (size_t i = 0; i < n; ++i) {
+            values[i] = dict_get(d, keys[i]);
         }
 
-        entry = entry->neighbour;
+        return;
     }
 
-    return NULL;
+    uint64_t hashes[DICT_GET_BATCH];
+    size_t key_lens[DICT_GET_BATCH];
+    struct dict_entry *heads[DICT_GET_BATCH];
+
+    for (size_t start = 0; start < n; start += DICT_GET_BATCH) {
+        const char *const *batch = keys + start;
+        size_t count = n - start < DICT_GET_BATCH ? n - start : DICT_GET_BATCH;
+
+        for (size_t i = 0; i < count; ++i) {
+            key_lens[i] = strlen(batch[i]);
+            hashes[i] = d->hash_function(batch[i], key_lens[i]);
+            __builtin_prefetch(
+                &d->entries_array[hashes[i] % d->array_allocated]);
+        }
+
+        for (size_t i = 0; i < count; ++i) {
+            heads[i] = d->entries_array[hashes[i] % d->array_allocated];
+            if (heads[i] != NULL) {
+                __builtin_prefetch(heads[i]);
+            }
+        }
+
+        for (size_t i = 0; i < count; ++i) {
+            if (heads[i] != NULL) {
+                __builtin_prefetch(heads[i]->key);
+            }
+        }
+
+        for (size_t i = 0; i < count; ++i) {
+            struct dict_entry *entry = heads[i];
+            while (entry != NULL &&
+                    !_is_entry_matches(
+                        *entry, hashes[i], batch[i], key_lens[i])) {
+                entry = entry->neighbour;
+            }
+            values[start + i] = entry != NULL ? entry->value : NULL;
+        }
+    }
 }
 
 
@@ -206,24 +1260,51 @@ dict_get(struct dict *d, const char *key)
 void
 dict_set(struct dict *d, const char *key, const char *value)
 {
-    unsigned int hash = d->hash_function(key);
-    unsigned int position = hash % d->array_allocated;
+    dict_set_n(d, key, strlen(key), value);
+}
+
+
+/**
+ * Set value by key of `key_len' bytes.
+ */
+void
+dict_set_n(
+    struct dict *d, const char *key, size_t key_len, const char *value)
+{
+    DICT_INSTR_OP(sets);
+    uint64_t hash = d->hash_function(key, key_len);
+    _lock_bucket(d, hash);
+    if (_is_rehashing(d)) {
+        _rehash_step(d, hash);
+    }
+
+    size_t position = hash % d->array_allocated;
     struct dict_entry *entry = d->entries_array[position];
+    size_t probes = 1;
 
     while (entry != NULL) {
-        if (_is_entry_matches(*entry, hash, key)) {
-            entry->value = value;
+        if (_is_entry_matches(*entry, hash, key, key_len)) {
+            DICT_INSTR_LOOKUP(key, key_len, probes);
+            if (d->flags & DICT_OWNED) {
+                _add_arena_garbage(d, _owned_value_size(entry->value));
+            }
+            entry->value = _own_value(d, value);
+
+            _unlock_bucket_and_resize(d, hash);
 
             return;
         }
 
         entry = entry->neighbour;
+        ++probes;
     }
+    DICT_INSTR_LOOKUP(key, key_len, probes);
 
-    struct dict_entry *new_entry = safe_malloc(sizeof(struct dict_entry));
+    struct dict_entry *new_entry = _pool_alloc(_get_pool(d, hash));
     new_entry->hash = hash;
-    new_entry->key = key;
-    new_entry->value = value;
+    new_entry->key = _own_key(d, key, key_len);
+    new_entry->key_len = key_len;
+    new_entry->value = _own_value(d, value);
 
     struct dict_entry *existing_entry = d->entries_array[position];
     // There is collision if `existing_entry' is not NULL. Anyway, new entry
@@ -231,12 +1312,12 @@ dict_set(struct dict *d, const char *key, const char *value)
     new_entry->neighbour = existing_entry;
     d->entries_array[position] = new_entry;
 
-    ++d->len;
+    _add_count(d, &d->len, 1);
     if (existing_entry == NULL) {
-        ++d->array_len;
+        _add_count(d, &d->array_len, 1);
     }
 
-    _resize_array_if_needed(d);
+    _unlock_bucket_and_resize(d, hash);
 }
 
 
@@ -246,31 +1327,425 @@ dict_set(struct dict *d, const char *key, const char *value)
 void
 dict_del(struct dict *d, const char *key)
 {
-    unsigned int hash = d->hash_function(key);
-    unsigned int position = hash % d->array_allocated;
+    dict_del_n(d, key, strlen(key));
+}
+
+
+/**
+ * Remove item by key of `key_len' bytes.
+ */
+void
+dict_del_n(struct dict *d, const char *key, size_t key_len)
+{
+    DICT_INSTR_OP(dels);
+    uint64_t hash = d->hash_function(key, key_len);
+    _lock_bucket(d, hash);
+    if (_is_rehashing(d)) {
+        _rehash_step(d, hash);
+    }
+
+    size_t position = hash % d->array_allocated;
     struct dict_entry *entry = d->entries_array[position];
     // After entry deletion we shoud restore liked list. `prev_entry' is
     // left entry's neighbour (or NULL if entry is head of linked list).
     struct dict_entry *prev_entry = NULL;
+    size_t probes = 1;
 
     while (entry != NULL) {
-        if (_is_entry_matches(*entry, hash, key)) {
+        if (_is_entry_matches(*entry, hash, key, key_len)) {
             if (prev_entry == NULL) {
                 d->entries_array[position] = entry->neighbour;
-                --d->array_len;
+                if (entry->neighbour == NULL) {
+                    _add_count(d, &d->array_len, -1);
+                }
             } else {
                 prev_entry->neighbour = entry->neighbour;
             }
 
-            free(entry);
-            --d->len;
+            if (d->flags & DICT_OWNED) {
+                _add_arena_garbage(
+                    d, entry->key_len + 1 + _owned_value_size(entry->value));
+            }
+
+            _pool_free(_get_pool(d, hash), entry);
+            _add_count(d, &d->len, -1);
+            // Keys are unique and `entry' is freed.
+            break;
         }
 
         prev_entry = entry;
         entry = entry->neighbour;
+        ++probes;
+    }
+    DICT_INSTR_LOOKUP(key, key_len, probes);
+
+    _unlock_bucket_and_resize(d, hash);
+}
+
+
+/**
+ * State shared by tasks of `dict_build'.
+ */
+struct dict_build_job
+{
+    struct dict *d;
+    const char *const *keys;
+    const char *const *values;
+    struct dict_bulk bulk;
+    // Entry for every key, in order of `bulk.order'. Entries of duplicate
+    // keys are left unused with NULL key.
+    struct dict_entry *entries;
+    // Per region: number of entries added and of buckets they started.
+    size_t *added;
+    size_t *started;
+    // Per region arenas of `DICT_OWNED' dictionary.
+    struct dict_arena *arenas;
+};
+
+
+/**
+ * Link keys of bucket region into their chains. The last of equal keys
+ * wins, as keys of a region come in input order.
+ */
+static void
+_build_region(void *arg, size_t region)
+{
+    struct dict_build_job *job = arg;
+    struct dict *d = job->d;
+    struct dict_bulk *bulk = &job->bulk;
+
+    size_t added = 0;
+    size_t started = 0;
+    for (size_t k = bulk->region_starts[region];
+            k < bulk->region_starts[region + 1];
+            ++k) {
+        size_t i = bulk->order[k];
+        uint64_t hash = bulk->hashes[i];
+        size_t key_len = bulk->key_lens[i];
+        size_t position = hash % d->array_allocated;
+
+        struct dict_entry *entry = d->entries_array[position];
+        while (entry != NULL &&
+                !_is_entry_matches(*entry, hash, job->keys[i], key_len)) {
+            entry = entry->neighbour;
+        }
+        if (entry != NULL) {
+            entry->value = job->values[i];
+            job->entries[k].key = NULL;
+            continue;
+        }
+
+        entry = &job->entries[k];
+        entry->hash = hash;
+        entry->key = job->keys[i];
+        entry->key_len = key_len;
+        entry->value = job->values[i];
+        entry->neighbour = d->entries_array[position];
+        if (entry->neighbour == NULL) {
+            ++started;
+        }
+        d->entries_array[position] = entry;
+        ++added;
+    }
+    job->added[region] = added;
+    job->started[region] = started;
+
+    if (d->flags & DICT_OWNED) {
+        size_t start = region * bulk->region_size;
+        size_t end = start + bulk->region_size;
+        if (end > d->array_allocated) {
+            end = d->array_allocated;
+        }
+
+        for (size_t position = start; position < end; ++position) {
+            struct dict_entry *entry = d->entries_array[position];
+            while (entry != NULL) {
+                _copy_entry_strings(&job->arenas[region], entry);
+                entry = entry->neighbour;
+            }
+        }
+    }
+}
+
+
+/**
+ * Create dictionary of `n' keys and values, see header.
+ *
+ * Keys are hashed and grouped by bucket region first, then every region is
+ * linked by one task. Entries are taken from one pool chunk in region order,
+ * so chains of a region are close in memory.
+ */
+struct dict *
+dict_build(
+    uint64_t (*hash_function)(const char *, size_t),
+    int flags,
+    const char *const *keys,
+    const char *const *values,
+    size_t n,
+    struct dict_pool *pool)
+{
+    struct dict *d = dict_init_flags(hash_function, flags);
+    if (n == 0) {
+        return d;
+    }
+    dict_reserve(d, n);
+
+    struct dict_build_job job = {
+        .d = d,
+        .keys = keys,
+        .values = values,
+        .entries = _pool_alloc_chunk(&d->pool, n),
+    };
+    dict_bulk_init(
+        &job.bulk, hash_function, keys, n,
+        d->array_allocated, DICT_BUILD_REGION_SIZE, pool);
+    size_t regions = job.bulk.regions;
+    job.added = safe_malloc(sizeof(size_t) * regions);
+    job.started = safe_malloc(sizeof(size_t) * regions);
+    job.arenas = safe_malloc(sizeof(struct dict_arena) * regions);
+    for (size_t region = 0; region < regions; ++region) {
+        dict_arena_init(&job.arenas[region]);
+    }
+
+    dict_pool_run(pool, regions, _build_region, &job);
+
+    for (size_t region = 0; region < regions; ++region) {
+        d->len += job.added[region];
+        d->array_len += job.started[region];
+        dict_arena_merge(&d->arena, &job.arenas[region]);
+    }
+    if (d->len < n) {
+        for (size_t k = 0; k < n; ++k) {
+            if (job.entries[k].key == NULL) {
+                uint64_t hash = job.bulk.hashes[job.bulk.order[k]];
+                _pool_free(_get_pool(d, hash), &job.entries[k]);
+            }
+        }
+    }
+    // Room was reserved for building only.
+    d->reserved = 0;
+
+    free(job.arenas);
+    free(job.started);
+    free(job.added);
+    dict_bulk_destroy(&job.bulk);
+
+    return d;
+}
+
+
+/**
+ * Start iteration over dictionary entries, see header.
+ */
+void
+dict_iter_init(struct dict_iter *it, struct dict *d)
+{
+    _finish_rehash(d);
+    it->d = d;
+    it->pos = 0;
+    it->entry = NULL;
+}
+
+
+/**
+ * Get next entry of iteration, see header.
+ */
+bool
+dict_iter_next(
+    struct dict_iter *it,
+    const char **key,
+    size_t *key_len,
+    const char **value)
+{
+    struct dict *d = it->d;
+    while (it->entry == NULL) {
+        if (it->pos == d->array_allocated) {
+            return false;
+        }
+        it->entry = d->entries_array[it->pos++];
+    }
+
+    *key = it->entry->key;
+    *key_len = it->entry->key_len;
+    *value = it->entry->value;
+    it->entry = it->entry->neighbour;
+
+    return true;
+}
+
+
+/**
+ * Scan dictionary entries by cursor, see header.
+ */
+uint64_t
+dict_scan(
+    struct dict *d,
+    uint64_t cursor,
+    size_t count,
+    void (*fn)(void *arg, const char *key, size_t key_len, const char *value),
+    void *arg)
+{
+    // Entries of a bucket may be in both arrays during a rehash, so it is
+    // finished first.
+    _finish_rehash(d);
+    if (count == 0) {
+        count = 1;
+    }
+
+    size_t passed = 0;
+    size_t visited = 0;
+    do {
+        // Bucket number and cursor agree in the low bits, which choose the
+        // stripe, so the bucket is locked before the array size is read.
+        uint64_t bucket = cursor;
+        _lock_bucket(d, bucket);
+        size_t mask = d->array_allocated - 1;
+        struct dict_entry *entry = d->entries_array[bucket & mask];
+        while (entry != NULL) {
+            fn(arg, entry->key, entry->key_len, entry->value);
+            ++passed;
+            entry = entry->neighbour;
+        }
+        cursor = dict_scan_next_cursor(cursor, mask);
+        _unlock_bucket(d, bucket);
+        ++visited;
+    } while (cursor != 0 &&
+            passed < count &&
+            visited < count * DICT_SCAN_MAX_VISITS);
+
+    return cursor;
+}
+
+
+/**
+ * Write dictionary contents to `fd', see header.
+ */
+bool
+dict_dump(struct dict *d, int fd)
+{
+    _finish_rehash(d);
+
+    struct dict_stream_writer writer;
+    _lock_all(d);
+    dict_stream_writer_init(&writer, fd, d->len);
+    for (size_t i = 0; i < d->array_allocated; ++i) {
+        struct dict_entry *entry = d->entries_array[i];
+        while (entry != NULL) {
+            dict_stream_write(
+                &writer, entry->key, entry->key_len, entry->value);
+            entry = entry->neighbour;
+        }
+    }
+    _unlock_all(d);
+
+    return dict_stream_writer_finish(&writer);
+}
+
+
+/**
+ * Create dictionary from contents written by `dict_dump', see header.
+ */
+struct dict *
+dict_load(
+    uint64_t (*hash_function)(const char *, size_t), int flags, int fd)
+{
+    struct dict_stream_reader reader;
+    if (!dict_stream_reader_init(&reader, fd)) {
+        return NULL;
+    }
+
+    struct dict *d = dict_init_flags(hash_function, flags | DICT_OWNED);
+    dict_reserve(d, reader.len);
+
+    const char *key;
+    size_t key_len;
+    const char *value;
+    while (dict_stream_read(&reader, &key, &key_len, &value)) {
+        dict_set_n(d, key, key_len, value);
     }
+    if (!dict_stream_reader_finish(&reader)) {
+        int read_errno = errno;
+        dict_destroy(d);
+        errno = read_errno;
 
-    _resize_array_if_needed(d);
+        return NULL;
+    }
+    // Room was reserved for loading only.
+    d->reserved = 0;
+
+    return d;
+}
+
+
+/**
+ * Add bytes of entry chunks of `pool' and number of entries on its free
+ * list to `stats'.
+ */
+static void
+_pool_stats(struct dict_entry_pool *pool, struct dict_stats *stats)
+{
+    for (struct dict_entry_chunk *chunk = pool->chunks;
+            chunk != NULL;
+            chunk = chunk->next) {
+        stats->entries_bytes += (
+            sizeof(struct dict_entry_chunk) +
+            sizeof(struct dict_entry) * chunk->size);
+    }
+    for (struct dict_entry *entry = pool->free_list;
+            entry != NULL;
+            entry = entry->neighbour) {
+        ++stats->free_entries;
+    }
+}
+
+
+/**
+ * Fill statistics of dictionary, see header.
+ */
+void
+dict_stats(struct dict *d, struct dict_stats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    _lock_all(d);
+    stats->len = d->len;
+    stats->capacity = d->array_allocated;
+    stats->load_factor = (double) d->len / d->array_allocated;
+    stats->array_bytes = sizeof(struct dict_entry *) * d->array_allocated;
+    stats->arena_bytes = d->arena.allocated;
+    stats->is_rehashing = _is_rehashing(d);
+    stats->resizes = d->resizes;
+    stats->rebuilds = d->rebuilds;
+
+    _pool_stats(&d->pool, stats);
+    if (d->flags & DICT_CONCURRENT) {
+        for (size_t i = 0; i < DICT_LOCK_STRIPES; ++i) {
+            _pool_stats(&d->stripes[i].pool, stats);
+        }
+    }
+    if (stats->is_rehashing) {
+        stats->array_bytes += (
+            sizeof(struct dict_entry *) * d->old_array_allocated);
+        if (d->rehash_repacks_arena) {
+            stats->arena_bytes += d->old_arena.allocated;
+        }
+    }
+
+    for (size_t i = 0; i < d->array_allocated; ++i) {
+        size_t length = 0;
+        for (struct dict_entry *entry = d->entries_array[i];
+                entry != NULL;
+                entry = entry->neighbour) {
+            ++length;
+        }
+        if (length > stats->max_chain_length) {
+            stats->max_chain_length = length;
+        }
+        if (length >= DICT_STATS_CHAIN_LENGTHS) {
+            length = DICT_STATS_CHAIN_LENGTHS - 1;
+        }
+        ++stats->chain_lengths[length];
+    }
+    _unlock_all(d);
 }
 
 
@@ -280,6 +1755,13 @@ dict_del(struct dict *d, const char *key)
 void
 dict_draw(struct dict *d)
 {
+    if (_is_rehashing(d)) {
+        printf(
+            "Rehashing: %ld of %ld old buckets visited\n",
+            d->rehash_pos,
+            d->old_array_allocated);
+    }
+
     for (size_t i = 0; i < d->array_allocated; ++i) {
         struct dict_entry *entry = d->entries_array[i];
 
@@ -289,7 +1771,11 @@ dict_draw(struct dict *d)
             printf("-");
         } else {
             while (entry != NULL) {
-                printf("%s:%s    ", entry->key, entry->value);
+                printf(
+                    "%.*s:%s    ",
+                    (int) entry->key_len,
+                    entry->key,
+                    entry->value);
                 entry = entry->neighbour;
             }
         }
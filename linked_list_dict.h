@@ -1,20 +1,89 @@
 #ifndef LINKED_LIST_DICT_H
 #define LINKED_LIST_DICT_H
 
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "dict_arena.h"
+#include "dict_epoch.h"
+#include "dict_pool.h"
+
+
+// `dict_init_flags' flags.
+// Dictionary copies keys and values into its own arena, so callers need not
+// keep them alive. Values must be zero-terminated strings.
+#define DICT_OWNED 0x2
+// Resizes are spread over later operations instead of being done at once:
+// buckets are moved to a new array a few per call, and lookups check both
+// arrays until the move is done.
+#define DICT_INCREMENTAL 0x4
+// Operations may be called from many threads at once. Buckets are guarded by
+// a fixed set of lock stripes, so operations on buckets of different stripes
+// run in parallel; resizes take all stripes. Entries never move: each stripe
+// allocates entries of its buckets from its own pool. Values of `DICT_OWNED'
+// dictionary returned by `dict_get' stay valid only until the caller's
+// `dict_epoch_exit' (see dict_epoch.h); strings of other dictionaries must
+// outlive the lookups which may see them. Not combined with
+// `DICT_INCREMENTAL', which is ignored.
+#define DICT_CONCURRENT 0x8
+
 
 /**
  * One dict item.
  */
 struct dict_entry
 {
-    unsigned int hash;
+    uint64_t hash;
     const char *key;
+    // Key length, keys need not be zero-terminated.
+    size_t key_len;
     const char *value;
     // For collisions.
     struct dict_entry *neighbour;
 };
 
 
+/**
+ * Chunk of dict entries allocated at once.
+ */
+struct dict_entry_chunk
+{
+    struct dict_entry_chunk *next;
+    // Number of entries in `entries' and number of them handed out.
+    size_t size;
+    size_t used;
+    struct dict_entry entries[];
+};
+
+
+/**
+ * Slab allocator for dict entries. Freed entries are linked through
+ * `neighbour' into free list and reused first.
+ */
+struct dict_entry_pool
+{
+    // Chunk being filled; older chunks follow by `next'.
+    struct dict_entry_chunk *chunks;
+    struct dict_entry *free_list;
+    // Number of entries in the next chunk.
+    size_t next_chunk_size;
+};
+
+
+/**
+ * Lock stripe of `DICT_CONCURRENT' dictionary. Stripes take a cache line
+ * each, so threads locking neighbour stripes do not slow down each other.
+ */
+struct dict_stripe
+{
+    pthread_mutex_t lock;
+    // Allocator for entries of the stripe's buckets.
+    struct dict_entry_pool pool;
+} __attribute__((aligned(64)));
+
+
 /**
  * Dictionary object.
  */
@@ -25,13 +94,99 @@ struct dict
     struct dict_entry **entries_array;
     // Number of dictionary entries.
     size_t len;
-    // `entries_array' full size including dictionary entries and empty cells.
+    // `entries_array' full size including dictionary entries and empty cells,
+    // a power of two (see `dict_scan').
     size_t array_allocated;
     // Number of dictionary entries in `entries_array'.
     size_t array_len;
+    // Allocator for entries. Entries are copied into a new pool bucket by
+    // bucket on every resize done at once, so collided entries are adjacent
+    // in memory. Entries of `DICT_CONCURRENT' dictionary come from stripe
+    // pools and are never copied; this pool only holds `dict_build' ones.
+    struct dict_entry_pool pool;
+
+    // Hash function, called with key and key length.
+    uint64_t (*hash_function)(const char *, size_t);
+    // Pool to resize large array on, NULL to resize in the calling thread.
+    struct dict_pool *thread_pool;
+
+    // Number of entries `dict_reserve' made room for. `entries_array' is
+    // not shrunk below the size for this number of entries.
+    size_t reserved;
+    // `DICT_*' flags given to `dict_init_flags'.
+    int flags;
+    // Storage for keys and values of `DICT_OWNED' dictionary.
+    struct dict_arena arena;
+    // Bytes of `arena' taken by deleted keys and replaced values. They are
+    // reclaimed by copying live strings into a new arena.
+    size_t arena_garbage;
+
+    // Array being rehashed by `DICT_INCREMENTAL' dictionary, NULL if there
+    // is no rehash in progress. Buckets before `rehash_pos' have been moved.
+    struct dict_entry **old_entries_array;
+    size_t old_array_allocated;
+    size_t rehash_pos;
+    // Whether moved entries get their strings copied from `old_arena' into
+    // `arena'. `old_arena' is freed when rehash ends.
+    bool rehash_repacks_arena;
+    struct dict_arena old_arena;
+
+    // Bucket locks of `DICT_CONCURRENT' dictionary, NULL for other ones.
+    // `len' and `array_len' are changed under any of them, so atomically.
+    struct dict_stripe *stripes;
+    // Lock of `arena' and `arena_garbage', shared by all stripes.
+    pthread_mutex_t arena_lock;
+
+    // Number of rehashes into an array of another size and of the same
+    // size (repacking arena), for `dict_stats'.
+    uint64_t resizes;
+    uint64_t rebuilds;
+};
 
-    // Hash function
-    unsigned int (*hash_function)(const char *);
+
+// Size of `dict_stats' chain length histogram.
+#define DICT_STATS_CHAIN_LENGTHS 16
+
+
+/**
+ * Statistics of dictionary, see `dict_stats'.
+ */
+struct dict_stats
+{
+    // Number of entries.
+    size_t len;
+    // Buckets of the current array, and entries per bucket.
+    size_t capacity;
+    double load_factor;
+    // Bytes allocated for bucket arrays, entry pools and arena of
+    // `DICT_OWNED' dictionary.
+    size_t array_bytes;
+    size_t entries_bytes;
+    size_t arena_bytes;
+    // Entries freed by deletes and kept in pools for reuse.
+    size_t free_entries;
+    // Whether `DICT_INCREMENTAL' rehash is in progress. Its old array is
+    // counted in the bytes above.
+    bool is_rehashing;
+    // Number of buckets of the current array with `i' entries, the last
+    // item counts longer chains too, and the longest chain.
+    size_t chain_lengths[DICT_STATS_CHAIN_LENGTHS];
+    size_t max_chain_length;
+    // Cumulative counts since the dictionary was created.
+    uint64_t resizes;
+    uint64_t rebuilds;
+};
+
+
+/**
+ * Iterator over dictionary entries, bucket by bucket.
+ */
+struct dict_iter
+{
+    struct dict *d;
+    size_t pos;
+    // Next entry of the current bucket, NULL at its end.
+    struct dict_entry *entry;
 };
 
 
@@ -39,7 +194,30 @@ struct dict
  * Create new dictionary object.
  */
 struct dict *
-dict_init(unsigned int (*hash_function)(const char *));
+dict_init(uint64_t (*hash_function)(const char *, size_t));
+
+
+/**
+ * Create new dictionary object with given `DICT_*' flags.
+ */
+struct dict *
+dict_init_flags(
+    uint64_t (*hash_function)(const char *, size_t), int flags);
+
+
+/**
+ * Create dictionary of `n' keys and values in one pass, as if they were set
+ * one by one (the last value of equal keys wins). Keys are zero-terminated.
+ * Work is spread over `pool' threads, NULL builds in the calling thread.
+ */
+struct dict *
+dict_build(
+    uint64_t (*hash_function)(const char *, size_t),
+    int flags,
+    const char *const *keys,
+    const char *const *values,
+    size_t n,
+    struct dict_pool *pool);
 
 
 /**
@@ -49,6 +227,25 @@ void
 dict_destroy(struct dict *);
 
 
+/**
+ * Make room for given number of entries, so the dictionary is not resized
+ * until it holds more. The room is kept when entries are deleted; reserving
+ * 0 entries drops it.
+ */
+void
+dict_reserve(struct dict *, size_t);
+
+
+/**
+ * Resize large array on `pool' threads; NULL (the default) resizes in the
+ * calling thread. Incremental rehash steps are not affected. A pool runs
+ * one job at a time, so dictionaries sharing it must not be resized from
+ * different threads at once.
+ */
+void
+dict_set_pool(struct dict *, struct dict_pool *);
+
+
 /**
  * Get value by key.
  */
@@ -56,6 +253,22 @@ const char *
 dict_get(struct dict *, const char *);
 
 
+/**
+ * Get value by key of given length.
+ */
+const char *
+dict_get_n(struct dict *, const char *, size_t);
+
+
+/**
+ * Get values of `n' zero-terminated keys into `values' (NULL for missing
+ * keys). Lookups are interleaved, so their cache misses overlap.
+ */
+void
+dict_get_many(
+    struct dict *, const char *const *keys, size_t n, const char **values);
+
+
 /**
  * Set value by key.
  */
@@ -63,6 +276,14 @@ void
 dict_set(struct dict *, const char *, const char *);
 
 
+/**
+ * Set value by key of given length. The key is stored by pointer, so it must
+ * outlive the entry.
+ */
+void
+dict_set_n(struct dict *, const char *, size_t, const char *);
+
+
 /**
  * Remove item by key.
  */
@@ -70,6 +291,84 @@ void
 dict_del(struct dict *, const char *);
 
 
+/**
+ * Remove item by key of given length.
+ */
+void
+dict_del_n(struct dict *, const char *, size_t);
+
+
+/**
+ * Start iteration over dictionary entries. The dictionary must not be
+ * changed until the iteration is done, by other threads either; see
+ * `dict_scan' otherwise.
+ */
+void
+dict_iter_init(struct dict_iter *, struct dict *);
+
+
+/**
+ * Get next entry of iteration into `key', `key_len' and `value'. Return
+ * false when there are no more entries.
+ */
+bool
+dict_iter_next(
+    struct dict_iter *, const char **key, size_t *key_len, const char **value);
+
+
+/**
+ * Call `fn' with `arg', key, key length and value for entries of buckets
+ * from `cursor' on (0 to start), until about `count' entries are passed,
+ * and return cursor to continue from, 0 when the scan is done. The
+ * dictionary may be changed between calls, so large dictionaries are
+ * scanned in bounded steps. Buckets are visited in reverse binary order
+ * (see `dict_scan_next_cursor'), so entries present during the whole scan
+ * are passed at least once although the array is resized meanwhile (some
+ * may be passed again if it shrinks), and other ones may be passed or not.
+ * `DICT_CONCURRENT' dictionary locks one bucket at a time, so writers keep
+ * running. `fn' must not call functions of the dictionary.
+ */
+uint64_t
+dict_scan(
+    struct dict *,
+    uint64_t cursor,
+    size_t count,
+    void (*fn)(void *arg, const char *key, size_t key_len, const char *value),
+    void *arg);
+
+
+/**
+ * Write dictionary contents to file descriptor `fd' as a stream of
+ * checksummed blocks (see dict_stream.h), one block in memory at a time.
+ * Values must be zero-terminated strings. Operations on `DICT_CONCURRENT'
+ * dictionary wait until the dump is done. Return false on error, with
+ * `errno' set.
+ */
+bool
+dict_dump(struct dict *, int fd);
+
+
+/**
+ * Create dictionary with given `DICT_*' flags from stream written by
+ * `dict_dump' of any backend to `fd', read a block at a time. The
+ * dictionary is sized for the recorded number of entries up front.
+ * `DICT_OWNED' is added to the flags, as keys and values are copied out of
+ * the read buffer. Return NULL on error, with `errno' set (`EINVAL' for
+ * malformed or corrupted data).
+ */
+struct dict *
+dict_load(
+    uint64_t (*hash_function)(const char *, size_t), int flags, int fd);
+
+
+/**
+ * Fill `stats' of dictionary, for monitoring. Takes time linear in size.
+ * Writers of `DICT_CONCURRENT' dictionary wait meanwhile.
+ */
+void
+dict_stats(struct dict *, struct dict_stats *);
+
+
 /**
  * Draw dict contents for debugging.
  */
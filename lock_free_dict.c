@@ -0,0 +1,1165 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+
+#include "lock_free_dict.h"
+#include "dict_arena.h"
+#include "dict_bulk.h"
+#include "dict_epoch.h"
+#include "dict_hash.h"
+#include "dict_instr.h"
+#include "dict_pool.h"
+#include "dict_stream.h"
+
+
+/**
+ * Malloc memory aligned to `alignment' bytes. Exit on failure.
+ */
+static inline void *
+safe_aligned_malloc(size_t alignment, size_t size)
+{
+    void *ptr;
+    if (posix_memalign(&ptr, alignment, size) != 0) {
+        printf("fatal: Memory allocation failed\n");
+        exit(1);
+    }
+
+    return ptr;
+}
+
+
+// Allocate at least `DICT_MIN_ARRAY_SIZE' slots for a table.
+#define DICT_MIN_ARRAY_SIZE 8
+
+
+// Hash of empty slot, and of empty slot closed by resize (keys which would
+// take it go to the next table).
+#define HASH_EMPTY 0
+#define HASH_MOVED 1
+
+
+// Slot values with special meaning. NULL is stored for keys without value
+// (deleted, or being added), so NULL values set by callers are stored as
+// `VALUE_NULL'. `VALUE_MOVED' marks value copied to the next table.
+static const char value_null_mark;
+static const char value_moved_mark;
+#define VALUE_NULL (&value_null_mark)
+#define VALUE_MOVED (&value_moved_mark)
+
+
+// Tables are copied by chunks of this many slots, one writer per chunk.
+#define DICT_COPY_CHUNK 1024
+
+
+// `dict_get_many' interleaves lookups of this many keys.
+#define DICT_GET_BATCH 16
+
+
+// `dict_build' groups keys by table regions of this many slots, one task
+// per region. Equal keys fall into one region, so they are set in order.
+#define DICT_BUILD_REGION_SIZE 16384
+
+
+// Dictionary with a pool copies tables of at least this many slots on pool
+// threads; smaller ones are copied by writers alone.
+#define DICT_POOL_RESIZE_MIN 65536
+
+
+// `dict_scan' visits up to this many times `count' home slots.
+#define DICT_SCAN_MAX_VISITS 10
+
+
+/**
+ * Let other hardware threads run while waiting for another thread.
+ */
+static inline void
+_cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+
+/**
+ * Hash stored in slot for key `hash'. Values of empty slots are taken by
+ * the next ones.
+ */
+static inline uint64_t
+_slot_hash(uint64_t hash)
+{
+    return hash <= HASH_MOVED ? hash + 2 : hash;
+}
+
+
+/**
+ * Allocate empty table of `size' slots.
+ */
+static struct dict_table *
+_table_init(size_t size)
+{
+    size_t bytes = (
+        sizeof(struct dict_table) + sizeof(struct dict_entry) * size);
+    struct dict_table *table = safe_aligned_malloc(
+        _Alignof(struct dict_table), bytes);
+
+    // Zeroed slots are empty, with no value.
+    memset(table, 0, bytes);
+    table->size = size;
+    table->chunks = (size + DICT_COPY_CHUNK - 1) / DICT_COPY_CHUNK;
+
+    return table;
+}
+
+
+/**
+ * Next table of `table', NULL if it is not being resized.
+ */
+static inline struct dict_table *
+_next_table(struct dict_table *table)
+{
+    return __atomic_load_n(&table->next, __ATOMIC_ACQUIRE);
+}
+
+
+static bool
+_help_resize(struct dict *d);
+
+
+/**
+ * Copy chunks of tables being resized until none is left to take. Run on
+ * pool threads by `_start_resize'.
+ */
+static void
+_resize_task(void *arg, size_t task)
+{
+    struct dict *d = arg;
+    (void) task;
+
+    dict_epoch_enter();
+    while (_help_resize(d)) {
+    }
+    dict_epoch_exit();
+}
+
+
+/**
+ * Start resize of `table' unless it is started already. The new table fits
+ * twice the entries there are (or reserved), so it is at most half full
+ * when the copy is done. The thread which starts resize of a large table
+ * copies it on the dictionary's pool, unless the pool is busy copying
+ * another one; writers keep copying chunks alongside.
+ */
+static void
+_start_resize(struct dict *d, struct dict_table *table)
+{
+    if (_next_table(table) != NULL) {
+        return;
+    }
+
+    size_t len = __atomic_load_n(&d->len, __ATOMIC_RELAXED);
+    size_t reserved = __atomic_load_n(&d->reserved, __ATOMIC_RELAXED);
+    if (len < reserved) {
+        len = reserved;
+    }
+    size_t size = DICT_MIN_ARRAY_SIZE;
+    while (size < len * 2) {
+        size *= 2;
+    }
+
+    struct dict_table *next = _table_init(size);
+    struct dict_table *expected = NULL;
+    if (!__atomic_compare_exchange_n(
+            &table->next, &expected, next, false,
+            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        // Another thread started it first.
+        free(next);
+
+        return;
+    }
+    __atomic_add_fetch(&d->resizes, 1, __ATOMIC_RELAXED);
+
+    struct dict_pool *pool = __atomic_load_n(
+        &d->thread_pool, __ATOMIC_ACQUIRE);
+    if (pool != NULL && table->size >= DICT_POOL_RESIZE_MIN &&
+            !__atomic_exchange_n(&d->thread_pool_busy, true,
+                __ATOMIC_ACQUIRE)) {
+        dict_pool_run(pool, dict_pool_threads(pool), _resize_task, d);
+        __atomic_store_n(&d->thread_pool_busy, false, __ATOMIC_RELEASE);
+    }
+}
+
+
+/**
+ * Is slot claimed for given key. If the claiming thread did not publish the
+ * key yet, it is waited for when `wait' is set. Otherwise the slot is taken
+ * for another key: its key has no value yet anyway.
+ */
+static inline bool
+_is_slot_key(
+    struct dict_entry *slot, const char *key, size_t key_len, bool wait)
+{
+    const char *slot_key;
+    while ((slot_key = __atomic_load_n(&slot->key, __ATOMIC_ACQUIRE)) ==
+            NULL) {
+        if (!wait) {
+            return false;
+        }
+        _cpu_relax();
+    }
+
+    return (
+        slot->key_len == key_len &&
+        DICT_INSTR_MEMCMP(slot_key, key, key_len) == 0
+    );
+}
+
+
+/**
+ * Find slot of key in `table'. Return NULL if there is none: `*next' is
+ * then set to the table the key may be in, NULL if it is missing.
+ *
+ * Keys are added to the newest table only, so reaching an empty slot means
+ * the key is not in this table. It may be in the next one, if there is one.
+ */
+static struct dict_entry *
+_find_slot(
+    struct dict_table *table,
+    uint64_t hash,
+    const char *key,
+    size_t key_len,
+    bool wait,
+    struct dict_table **next)
+{
+    size_t mask = table->size - 1;
+    size_t position = hash & mask;
+
+    size_t probes;
+    for (probes = 0; probes < table->size; ++probes) {
+        struct dict_entry *slot = &table->slots[position];
+        uint64_t slot_hash = __atomic_load_n(&slot->hash, __ATOMIC_ACQUIRE);
+        if (slot_hash == HASH_EMPTY || slot_hash == HASH_MOVED) {
+            break;
+        }
+        if (slot_hash == hash && _is_slot_key(slot, key, key_len, wait)) {
+            DICT_INSTR_LOOKUP(key, key_len, probes + 1);
+
+            return slot;
+        }
+
+        position = (position + 1) & mask;
+    }
+    // Tables are resized before filling up, so probing ends at a free slot.
+    DICT_INSTR_LOOKUP(key, key_len, probes + 1);
+
+    *next = _next_table(table);
+
+    return NULL;
+}
+
+
+/**
+ * Find slot of key in `table', or claim an empty one for it if `table' is
+ * the newest. Return NULL if the key goes to the next table, which then
+ * exists.
+ */
+static struct dict_entry *
+_find_or_claim_slot(
+    struct dict *d,
+    struct dict_table *table,
+    uint64_t hash,
+    const char *key,
+    size_t key_len)
+{
+    size_t mask = table->size - 1;
+    size_t position = hash & mask;
+
+    size_t probes;
+    for (probes = 0; probes < table->size; ) {
+        struct dict_entry *slot = &table->slots[position];
+        uint64_t slot_hash = __atomic_load_n(&slot->hash, __ATOMIC_ACQUIRE);
+        if (slot_hash == HASH_EMPTY) {
+            // New keys go to the next table if there is one. The slot is
+            // closed first, so the key cannot be added here by a thread
+            // which has not seen the next table yet.
+            uint64_t claim = (
+                _next_table(table) == NULL ? hash : HASH_MOVED);
+            if (!__atomic_compare_exchange_n(
+                    &slot->hash, &slot_hash, claim, false,
+                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                // Taken by another thread, maybe for the same key.
+                continue;
+            }
+            DICT_INSTR_LOOKUP(key, key_len, probes + 1);
+            if (claim == HASH_MOVED) {
+                return NULL;
+            }
+
+            slot->key_len = key_len;
+            __atomic_store_n(&slot->key, key, __ATOMIC_RELEASE);
+
+            if (__atomic_add_fetch(&table->used, 1, __ATOMIC_RELAXED) >
+                    table->size / 4 * 3) {
+                _start_resize(d, table);
+            }
+
+            return slot;
+        }
+        if (slot_hash == HASH_MOVED) {
+            DICT_INSTR_LOOKUP(key, key_len, probes + 1);
+
+            return NULL;
+        }
+        if (slot_hash == hash && _is_slot_key(slot, key, key_len, true)) {
+            DICT_INSTR_LOOKUP(key, key_len, probes + 1);
+
+            return slot;
+        }
+
+        position = (position + 1) & mask;
+        ++probes;
+    }
+    DICT_INSTR_LOOKUP(key, key_len, probes);
+
+    // Full table.
+    _start_resize(d, table);
+
+    return NULL;
+}
+
+
+/**
+ * Find slot of key in `table' or newer tables, or claim one in the newest.
+ */
+static struct dict_entry *
+_find_or_claim_slot_in_chain(
+    struct dict *d,
+    struct dict_table *table,
+    uint64_t hash,
+    const char *key,
+    size_t key_len)
+{
+    struct dict_entry *slot;
+    while ((slot = _find_or_claim_slot(d, table, hash, key, key_len)) ==
+            NULL) {
+        table = _next_table(table);
+    }
+
+    return slot;
+}
+
+
+/**
+ * Copy slot of table being resized into newer tables.
+ *
+ * Value is copied first and closed with `VALUE_MOVED' after that, so lookups
+ * find it in the old slot until then, and operations which find the slot
+ * closed find the value in the new one. The new slot is not used by others
+ * before that, so it is simply written. If the value is changed in between,
+ * closing fails and the copy is repeated.
+ */
+static void
+_copy_slot(struct dict *d, struct dict_table *table, struct dict_entry *slot)
+{
+    uint64_t hash = __atomic_load_n(&slot->hash, __ATOMIC_ACQUIRE);
+    while (hash == HASH_EMPTY &&
+            !__atomic_compare_exchange_n(
+                &slot->hash, &hash, HASH_MOVED, false,
+                __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+    }
+    if (hash == HASH_EMPTY || hash == HASH_MOVED) {
+        // Closed here, or by a writer which saw the next table.
+        return;
+    }
+
+    const char *key;
+    while ((key = __atomic_load_n(&slot->key, __ATOMIC_ACQUIRE)) == NULL) {
+        _cpu_relax();
+    }
+
+    struct dict_entry *new_slot = NULL;
+    const char *value = __atomic_load_n(&slot->value, __ATOMIC_ACQUIRE);
+    while (true) {
+        if (value != NULL && new_slot == NULL) {
+            new_slot = _find_or_claim_slot_in_chain(
+                d, _next_table(table), hash, key, slot->key_len);
+        }
+        if (new_slot != NULL) {
+            __atomic_store_n(&new_slot->value, value, __ATOMIC_RELEASE);
+        }
+
+        if (__atomic_compare_exchange_n(
+                &slot->value, &value, VALUE_MOVED, false,
+                __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            return;
+        }
+    }
+}
+
+
+/**
+ * Copy a chunk of the oldest table if it is being resized. The thread
+ * copying its last chunk replaces it with the next table. Return false if
+ * there was nothing left to take.
+ */
+static bool
+_help_resize(struct dict *d)
+{
+    struct dict_table *table = __atomic_load_n(&d->table, __ATOMIC_ACQUIRE);
+    if (_next_table(table) == NULL) {
+        return false;
+    }
+
+    size_t chunk = __atomic_fetch_add(
+        &table->copy_claimed, 1, __ATOMIC_RELAXED);
+    if (chunk >= table->chunks) {
+        return false;
+    }
+
+    DICT_INSTR_REBUILD_BEGIN();
+    size_t start = chunk * DICT_COPY_CHUNK;
+    size_t end = start + DICT_COPY_CHUNK;
+    if (end > table->size) {
+        end = table->size;
+    }
+    for (size_t position = start; position < end; ++position) {
+        _copy_slot(d, table, &table->slots[position]);
+    }
+
+    if (__atomic_add_fetch(&table->copy_done, 1, __ATOMIC_ACQ_REL) ==
+            table->chunks) {
+        __atomic_store_n(&d->table, _next_table(table), __ATOMIC_RELEASE);
+        // Threads which got the table before may still be reading it.
+        dict_epoch_retire(table, free);
+    }
+    DICT_INSTR_REBUILD_END();
+
+    return true;
+}
+
+
+/**
+ * Finish resizes in progress.
+ */
+static void
+_finish_resize(struct dict *d)
+{
+    struct dict_table *table;
+    while (_next_table(
+            table = __atomic_load_n(&d->table, __ATOMIC_ACQUIRE)) != NULL) {
+        if (!_help_resize(d)) {
+            // Remaining chunks are being copied by other threads.
+            _cpu_relax();
+        }
+    }
+}
+
+
+/**
+ * Create new dictionary object.
+ */
+struct dict *
+dict_init(uint64_t (*hash_function)(const char *, size_t))
+{
+    return dict_init_flags(hash_function, 0);
+}
+
+
+/**
+ * Create new dictionary object with given `DICT_*' flags.
+ */
+struct dict *
+dict_init_flags(
+    uint64_t (*hash_function)(const char *, size_t), int flags)
+{
+    struct dict *d = safe_aligned_malloc(
+        _Alignof(struct dict), sizeof(struct dict));
+    d->table = _table_init(DICT_MIN_ARRAY_SIZE);
+    d->flags = flags;
+    d->reserved = 0;
+    d->hash_function = hash_function;
+    d->thread_pool = NULL;
+    d->thread_pool_busy = false;
+    dict_arena_init(&d->arena);
+    d->resizes = 0;
+    d->len = 0;
+
+    return d;
+}
+
+
+/**
+ * Destroy dictionary object.
+ */
+void
+dict_destroy(struct dict *d)
+{
+    struct dict_table *table = d->table;
+    while (table != NULL) {
+        struct dict_table *next = table->next;
+        free(table);
+        table = next;
+    }
+    dict_arena_destroy(&d->arena);
+    free(d);
+}
+
+
+/**
+ * Make room for `n' entries.
+ */
+void
+dict_reserve(struct dict *d, size_t n)
+{
+    __atomic_store_n(&d->reserved, n, __ATOMIC_RELAXED);
+
+    dict_epoch_enter();
+    while (true) {
+        _finish_resize(d);
+        struct dict_table *table = __atomic_load_n(
+            &d->table, __ATOMIC_ACQUIRE);
+        if (table->size / 4 * 3 >= n) {
+            break;
+        }
+        _start_resize(d, table);
+    }
+    dict_epoch_exit();
+}
+
+
+/**
+ * Set pool to copy large tables on, see header.
+ */
+void
+dict_set_pool(struct dict *d, struct dict_pool *pool)
+{
+    __atomic_store_n(&d->thread_pool, pool, __ATOMIC_RELEASE);
+}
+
+
+/**
+ * Get value of key starting from `table'. Must be called in epoch critical
+ * section.
+ */
+static const char *
+_get(
+    struct dict_table *table, uint64_t hash, const char *key, size_t key_len)
+{
+    while (table != NULL) {
+        struct dict_table *next;
+        struct dict_entry *slot = _find_slot(
+            table, hash, key, key_len, false, &next);
+        if (slot != NULL) {
+            const char *value = __atomic_load_n(
+                &slot->value, __ATOMIC_ACQUIRE);
+            if (value != VALUE_MOVED) {
+                return value == VALUE_NULL ? NULL : value;
+            }
+            next = _next_table(table);
+        }
+        table = next;
+    }
+
+    return NULL;
+}
+
+
+/**
+ * Get key and value of `slot' of `table', whose hash `hash' is loaded
+ * already. Return false if the slot holds no entry. A value moved by resize
+ * is looked up in newer tables. Must be called in epoch critical section.
+ */
+static bool
+_read_slot(
+    struct dict_table *table,
+    struct dict_entry *slot,
+    uint64_t hash,
+    const char **key,
+    const char **value)
+{
+    *key = __atomic_load_n(&slot->key, __ATOMIC_ACQUIRE);
+    if (hash == HASH_EMPTY || hash == HASH_MOVED || *key == NULL) {
+        return false;
+    }
+
+    *value = __atomic_load_n(&slot->value, __ATOMIC_ACQUIRE);
+    if (*value == VALUE_MOVED) {
+        // A resize started meanwhile, the value is in a newer table.
+        *value = _get(_next_table(table), hash, *key, slot->key_len);
+    } else if (*value == NULL) {
+        return false;
+    } else if (*value == VALUE_NULL) {
+        *value = NULL;
+    }
+
+    return true;
+}
+
+
+/**
+ * Get value by key.
+ */
+const char *
+dict_get(struct dict *d, const char *key)
+{
+    return dict_get_n(d, key, strlen(key));
+}
+
+
+/**
+ * Get value by key of `key_len' bytes.
+ */
+const char *
+dict_get_n(struct dict *d, const char *key, size_t key_len)
+{
+    DICT_INSTR_OP(gets);
+    uint64_t hash = _slot_hash(d->hash_function(key, key_len));
+
+    dict_epoch_enter();
+    const char *value = _get(
+        __atomic_load_n(&d->table, __ATOMIC_ACQUIRE), hash, key, key_len);
+    dict_epoch_exit();
+
+    return value;
+}
+
+
+/**
+ * Get values of `n' keys, see header.
+ *
+ * Keys go in batches of `DICT_GET_BATCH': all keys of a batch are hashed and
+ * their home slots prefetched before the first one is probed.
+ */
+void
+dict_get_many(
+    struct dict *d, const char *const *keys, size_t n, const char **values)
+{
+    uint64_t hashes[DICT_GET_BATCH];
+    size_t key_lens[DICT_GET_BATCH];
+
+    dict_epoch_enter();
+    struct dict_table *table = __atomic_load_n(&d->table, __ATOMIC_ACQUIRE);
+
+    for (size_t start = 0; start < n; start += DICT_GET_BATCH) {
+        const char *const *batch = keys + start;
+        size_t count = n - start < DICT_GET_BATCH ? n - start : DICT_GET_BATCH;
+
+        for (size_t i = 0; i < count; ++i) {
+            key_lens[i] = strlen(batch[i]);
+            hashes[i] = _slot_hash(d->hash_function(batch[i], key_lens[i]));
+            __builtin_prefetch(
+                &table->slots[hashes[i] & (table->size - 1)]);
+        }
+
+        for (size_t i = 0; i < count; ++i) {
+            values[start + i] = _get(table, hashes[i], batch[i], key_lens[i]);
+        }
+    }
+
+    dict_epoch_exit();
+}
+
+
+/**
+ * Replace value of slot, unless it has one and `only_if_absent' is set.
+ * Return false if the value was moved to the next table, otherwise set
+ * `*is_set' to whether the value was replaced.
+ */
+static bool
+_set_slot_value(
+    struct dict *d,
+    struct dict_entry *slot,
+    const char *value,
+    bool only_if_absent,
+    bool *is_set)
+{
+    const char *old_value = __atomic_load_n(&slot->value, __ATOMIC_ACQUIRE);
+    while (old_value != VALUE_MOVED) {
+        if (only_if_absent && old_value != NULL) {
+            *is_set = false;
+            return true;
+        }
+        if (__atomic_compare_exchange_n(
+                &slot->value, &old_value, value, false,
+                __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            if (old_value == NULL) {
+                __atomic_add_fetch(&d->len, 1, __ATOMIC_RELAXED);
+            }
+            *is_set = true;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+/**
+ * Set value of key, or only add it if `only_if_absent' is set. Return
+ * whether the value was set.
+ */
+static bool
+_set(
+    struct dict *d,
+    uint64_t hash,
+    const char *key,
+    size_t key_len,
+    const char *value,
+    bool only_if_absent)
+{
+    if (value == NULL) {
+        value = VALUE_NULL;
+    }
+
+    dict_epoch_enter();
+    _help_resize(d);
+
+    bool is_set;
+    struct dict_table *table = __atomic_load_n(&d->table, __ATOMIC_ACQUIRE);
+    while (true) {
+        struct dict_entry *slot = _find_or_claim_slot(
+            d, table, hash, key, key_len);
+        if (slot != NULL &&
+                _set_slot_value(d, slot, value, only_if_absent, &is_set)) {
+            break;
+        }
+        // The key goes to the next table, or its value was moved there. The
+        // next table is linked before the copy starts, so it is seen here.
+        table = _next_table(table);
+    }
+
+    dict_epoch_exit();
+
+    return is_set;
+}
+
+
+/**
+ * Set value by key.
+ */
+void
+dict_set(struct dict *d, const char *key, const char *value)
+{
+    dict_set_n(d, key, strlen(key), value);
+}
+
+
+/**
+ * Set value by key of `key_len' bytes.
+ */
+void
+dict_set_n(
+    struct dict *d, const char *key, size_t key_len, const char *value)
+{
+    DICT_INSTR_OP(sets);
+    uint64_t hash = _slot_hash(d->hash_function(key, key_len));
+    _set(d, hash, key, key_len, value, false);
+}
+
+
+/**
+ * Set value by key unless it has one.
+ */
+bool
+dict_set_if_absent(struct dict *d, const char *key, const char *value)
+{
+    return dict_set_if_absent_n(d, key, strlen(key), value);
+}
+
+
+/**
+ * Set value by key of `key_len' bytes unless it has one.
+ */
+bool
+dict_set_if_absent_n(
+    struct dict *d, const char *key, size_t key_len, const char *value)
+{
+    DICT_INSTR_OP(sets);
+    uint64_t hash = _slot_hash(d->hash_function(key, key_len));
+
+    return _set(d, hash, key, key_len, value, true);
+}
+
+
+/**
+ * Clear value of slot. Return false if it was moved to the next table.
+ */
+static bool
+_clear_slot_value(struct dict *d, struct dict_entry *slot)
+{
+    const char *old_value = __atomic_load_n(&slot->value, __ATOMIC_ACQUIRE);
+    while (old_value != VALUE_MOVED) {
+        if (old_value == NULL) {
+            return true;
+        }
+        if (__atomic_compare_exchange_n(
+                &slot->value, &old_value, NULL, false,
+                __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            __atomic_sub_fetch(&d->len, 1, __ATOMIC_RELAXED);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+/**
+ * Remove item by key.
+ */
+void
+dict_del(struct dict *d, const char *key)
+{
+    dict_del_n(d, key, strlen(key));
+}
+
+
+/**
+ * Remove item by key of `key_len' bytes. The key keeps its slot, without
+ * value, until the table is resized.
+ */
+void
+dict_del_n(struct dict *d, const char *key, size_t key_len)
+{
+    DICT_INSTR_OP(dels);
+    uint64_t hash = _slot_hash(d->hash_function(key, key_len));
+
+    dict_epoch_enter();
+    _help_resize(d);
+
+    struct dict_table *table = __atomic_load_n(&d->table, __ATOMIC_ACQUIRE);
+    while (table != NULL) {
+        struct dict_table *next;
+        struct dict_entry *slot = _find_slot(
+            table, hash, key, key_len, true, &next);
+        if (slot != NULL && _clear_slot_value(d, slot)) {
+            break;
+        }
+        table = slot != NULL ? _next_table(table) : next;
+    }
+
+    dict_epoch_exit();
+}
+
+
+/**
+ * Start iteration over dictionary entries, see header.
+ */
+void
+dict_iter_init(struct dict_iter *it, struct dict *d)
+{
+    _finish_resize(d);
+    it->table = __atomic_load_n(&d->table, __ATOMIC_ACQUIRE);
+    it->pos = 0;
+}
+
+
+/**
+ * Get next entry of iteration, see header.
+ */
+bool
+dict_iter_next(
+    struct dict_iter *it,
+    const char **key,
+    size_t *key_len,
+    const char **value)
+{
+    struct dict_table *table = it->table;
+    while (it->pos < table->size) {
+        struct dict_entry *slot = &table->slots[it->pos++];
+        uint64_t hash = __atomic_load_n(&slot->hash, __ATOMIC_ACQUIRE);
+        if (_read_slot(table, slot, hash, key, value)) {
+            *key_len = slot->key_len;
+
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+/**
+ * Scan dictionary entries by cursor, see header.
+ */
+uint64_t
+dict_scan(
+    struct dict *d,
+    uint64_t cursor,
+    size_t count,
+    void (*fn)(void *arg, const char *key, size_t key_len, const char *value),
+    void *arg)
+{
+    if (count == 0) {
+        count = 1;
+    }
+
+    // Keys added since a resize started are in the new table only, so the
+    // resize is finished first. A later one only moves values, which are
+    // followed into newer tables.
+    dict_epoch_enter();
+    _finish_resize(d);
+    struct dict_table *table = __atomic_load_n(&d->table, __ATOMIC_ACQUIRE);
+    size_t mask = table->size - 1;
+    size_t passed = 0;
+    size_t visited = 0;
+    do {
+        // Keys of the home slot are in its probe run, which ends at an
+        // empty slot.
+        size_t home = cursor & mask;
+        for (size_t probes = 0; probes < table->size; ++probes) {
+            struct dict_entry *slot = &table->slots[(home + probes) & mask];
+            uint64_t hash = __atomic_load_n(&slot->hash, __ATOMIC_ACQUIRE);
+            if (hash == HASH_EMPTY || hash == HASH_MOVED) {
+                break;
+            }
+            const char *key;
+            const char *value;
+            if ((hash & mask) == home &&
+                    _read_slot(table, slot, hash, &key, &value)) {
+                fn(arg, key, slot->key_len, value);
+                ++passed;
+            }
+        }
+        cursor = dict_scan_next_cursor(cursor, mask);
+        ++visited;
+    } while (cursor != 0 &&
+            passed < count &&
+            visited < count * DICT_SCAN_MAX_VISITS);
+    dict_epoch_exit();
+
+    return cursor;
+}
+
+
+/**
+ * State shared by tasks of `dict_build'.
+ */
+struct dict_build_job
+{
+    struct dict *d;
+    const char *const *keys;
+    const char *const *values;
+    struct dict_bulk bulk;
+};
+
+
+/**
+ * Set keys of region in input order. Regions are set by tasks at once.
+ */
+static void
+_build_region(void *arg, size_t region)
+{
+    struct dict_build_job *job = arg;
+    struct dict_bulk *bulk = &job->bulk;
+
+    for (size_t k = bulk->region_starts[region];
+            k < bulk->region_starts[region + 1];
+            ++k) {
+        size_t i = bulk->order[k];
+        _set(
+            job->d, _slot_hash(bulk->hashes[i]), job->keys[i],
+            bulk->key_lens[i], job->values[i], false);
+    }
+}
+
+
+/**
+ * Create dictionary of `n' keys and values, see header.
+ *
+ * Keys are hashed and grouped by table region, then regions are set by pool
+ * threads at once. Room is reserved first, so no resize happens meanwhile.
+ */
+struct dict *
+dict_build(
+    uint64_t (*hash_function)(const char *, size_t),
+    int flags,
+    const char *const *keys,
+    const char *const *values,
+    size_t n,
+    struct dict_pool *pool)
+{
+    struct dict *d = dict_init_flags(hash_function, flags);
+    if (n == 0) {
+        return d;
+    }
+    dict_reserve(d, n);
+
+    struct dict_build_job job = {
+        .d = d,
+        .keys = keys,
+        .values = values,
+    };
+    dict_bulk_init(
+        &job.bulk, hash_function, keys, n,
+        d->table->size, DICT_BUILD_REGION_SIZE, pool);
+    dict_pool_run(pool, job.bulk.regions, _build_region, &job);
+    // Room was reserved for building only.
+    d->reserved = 0;
+
+    dict_bulk_destroy(&job.bulk);
+
+    return d;
+}
+
+
+/**
+ * Write dictionary contents to `fd', see header.
+ */
+bool
+dict_dump(struct dict *d, int fd)
+{
+    struct dict_stream_writer writer;
+    dict_stream_writer_init(
+        &writer, fd, __atomic_load_n(&d->len, __ATOMIC_RELAXED));
+
+    dict_epoch_enter();
+    _finish_resize(d);
+    struct dict_table *table = __atomic_load_n(&d->table, __ATOMIC_ACQUIRE);
+    for (size_t i = 0; i < table->size; ++i) {
+        struct dict_entry *slot = &table->slots[i];
+        uint64_t hash = __atomic_load_n(&slot->hash, __ATOMIC_ACQUIRE);
+        const char *key;
+        const char *value;
+        if (_read_slot(table, slot, hash, &key, &value)) {
+            dict_stream_write(&writer, key, slot->key_len, value);
+        }
+    }
+    dict_epoch_exit();
+
+    return dict_stream_writer_finish(&writer);
+}
+
+
+/**
+ * Create dictionary from contents written by `dict_dump', see header.
+ */
+struct dict *
+dict_load(
+    uint64_t (*hash_function)(const char *, size_t), int flags, int fd)
+{
+    struct dict_stream_reader reader;
+    if (!dict_stream_reader_init(&reader, fd)) {
+        return NULL;
+    }
+
+    struct dict *d = dict_init_flags(hash_function, flags);
+    dict_reserve(d, reader.len);
+
+    const char *key;
+    size_t key_len;
+    const char *value;
+    while (dict_stream_read(&reader, &key, &key_len, &value)) {
+        // Read strings are kept for the dictionary's lifetime, even if they
+        // are replaced later.
+        key = dict_arena_copy(&d->arena, key, key_len);
+        if (value != NULL) {
+            value = dict_arena_copy(&d->arena, value, strlen(value));
+        }
+        dict_set_n(d, key, key_len, value);
+    }
+    if (!dict_stream_reader_finish(&reader)) {
+        int read_errno = errno;
+        dict_destroy(d);
+        errno = read_errno;
+
+        return NULL;
+    }
+    // Room was reserved for loading only.
+    d->reserved = 0;
+
+    return d;
+}
+
+
+/**
+ * Fill statistics of dictionary, see header.
+ */
+void
+dict_stats(struct dict *d, struct dict_stats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    stats->len = __atomic_load_n(&d->len, __ATOMIC_RELAXED);
+    stats->arena_bytes = d->arena.allocated;
+    stats->resizes = __atomic_load_n(&d->resizes, __ATOMIC_RELAXED);
+
+    dict_epoch_enter();
+    struct dict_table *table = __atomic_load_n(&d->table, __ATOMIC_ACQUIRE);
+    stats->capacity = table->size;
+    stats->load_factor = (
+        (double) __atomic_load_n(&table->used, __ATOMIC_RELAXED) /
+        table->size);
+    stats->is_resizing = _next_table(table) != NULL;
+    for (struct dict_table *t = table; t != NULL; t = _next_table(t)) {
+        stats->table_bytes += (
+            sizeof(struct dict_table) + sizeof(struct dict_entry) * t->size);
+    }
+
+    size_t mask = table->size - 1;
+    for (size_t i = 0; i < table->size; ++i) {
+        struct dict_entry *slot = &table->slots[i];
+        uint64_t hash = __atomic_load_n(&slot->hash, __ATOMIC_ACQUIRE);
+        if (hash == HASH_EMPTY || hash == HASH_MOVED) {
+            continue;
+        }
+
+        const char *value = __atomic_load_n(&slot->value, __ATOMIC_ACQUIRE);
+        if (value == NULL) {
+            ++stats->tombstones;
+        } else if (value != VALUE_MOVED) {
+            size_t length = (i - hash) & mask;
+            if (length >= DICT_STATS_PROBE_LENGTHS) {
+                length = DICT_STATS_PROBE_LENGTHS - 1;
+            }
+            ++stats->probe_lengths[length];
+        }
+    }
+    dict_epoch_exit();
+}
+
+
+/**
+ * Draw dict contents for debugging.
+ */
+void
+dict_draw(struct dict *d)
+{
+    for (struct dict_table *table = d->table;
+            table != NULL;
+            table = table->next) {
+        printf("Table of %zu slots:\n", table->size);
+
+        for (size_t i = 0; i < table->size; ++i) {
+            struct dict_entry *slot = &table->slots[i];
+
+            printf("%zu:\t", i);
+
+            if (slot->hash == HASH_EMPTY) {
+                printf("-");
+            } else if (slot->hash == HASH_MOVED) {
+                printf("(moved)");
+            } else {
+                printf("%.*s:", (int) slot->key_len, slot->key);
+                if (slot->value == NULL) {
+                    printf("(deleted)");
+                } else if (slot->value == VALUE_MOVED) {
+                    printf("(moved)");
+                } else if (slot->value == VALUE_NULL) {
+                    printf("(null)");
+                } else {
+                    printf("%s", slot->value);
+                }
+                if ((slot->hash & (table->size - 1)) != i) {
+                    printf(
+                        "    (must be %zu)",
+                        (size_t) (slot->hash & (table->size - 1)));
+                }
+            }
+
+            printf("\n");
+        }
+    }
+}
@@ -0,0 +1,345 @@
+#ifndef LOCK_FREE_DICT_H
+#define LOCK_FREE_DICT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "dict_arena.h"
+#include "dict_epoch.h"
+#include "dict_pool.h"
+
+
+// All operations may be called from any number of threads at once, without
+// external locking.
+#define DICT_THREAD_SAFE 1
+
+// Resizes are always spread over writers, so the flag changes nothing. It is
+// accepted for code written for other backends.
+#define DICT_INCREMENTAL 0x4
+
+
+/**
+ * One slot of a table.
+ *
+ * A slot is claimed for a key by compare-and-swap of its hash, and keeps the
+ * key for the table's lifetime: deleting only clears the value. So lookups
+ * never see a key move or change under them.
+ */
+struct dict_entry
+{
+    // 0 for an empty slot, 1 for an empty slot closed by resize, otherwise
+    // hash of the key (see `_slot_hash' in lock_free_dict.c).
+    uint64_t hash;
+    // Published after `hash' is claimed, NULL until then.
+    const char *key;
+    // Key length, keys need not be zero-terminated.
+    size_t key_len;
+    // NULL if the key has no value, see lock_free_dict.c for marks.
+    const char *value;
+};
+
+
+/**
+ * Table of `size' slots, a power of two. When it fills up, a bigger table is
+ * linked as `next' and entries are copied into it by chunks, each writer
+ * copying a chunk before its own operation. Until the copy is done,
+ * operations go through both tables.
+ */
+struct dict_table
+{
+    size_t size;
+    struct dict_table *next;
+    // Number of chunks of `DICT_COPY_CHUNK' slots.
+    size_t chunks;
+
+    // Written by many threads, so each counter takes its own cache line.
+    // Next chunk to be copied, and number of chunks copied.
+    size_t copy_claimed __attribute__((aligned(64)));
+    size_t copy_done __attribute__((aligned(64)));
+    // Number of slots claimed for keys, including ones of deleted keys.
+    size_t used __attribute__((aligned(64)));
+
+    struct dict_entry slots[] __attribute__((aligned(64)));
+};
+
+
+/**
+ * Dictionary object.
+ */
+struct dict
+{
+    // Oldest table still in use. Newer ones are linked through `next'.
+    struct dict_table *table;
+    // `DICT_*' flags given to `dict_init_flags'.
+    int flags;
+    // Number of entries `dict_reserve' made room for. Tables are not made
+    // smaller than needed for this number of entries.
+    size_t reserved;
+
+    // Hash function, called with key and key length.
+    uint64_t (*hash_function)(const char *, size_t);
+    // Pool to copy large tables on, NULL to leave copying to writers, and
+    // whether it is copying one now.
+    struct dict_pool *thread_pool;
+    bool thread_pool_busy;
+    // Storage for keys and values read by `dict_load'.
+    struct dict_arena arena;
+    // Number of resizes started, for `dict_stats'.
+    uint64_t resizes;
+
+    // Number of dictionary entries. Changed by inserts and deletes only, on
+    // a cache line of its own.
+    size_t len __attribute__((aligned(64)));
+};
+
+
+// Size of `dict_stats' probe length histogram.
+#define DICT_STATS_PROBE_LENGTHS 16
+
+
+/**
+ * Statistics of dictionary, see `dict_stats'.
+ */
+struct dict_stats
+{
+    // Number of entries.
+    size_t len;
+    // Slots of the oldest table in use, and share of them claimed by keys.
+    size_t capacity;
+    double load_factor;
+    // Slots of the oldest table holding deleted keys, which are dropped by
+    // the next resize.
+    size_t tombstones;
+    // Bytes allocated for tables and storage of `dict_load'.
+    size_t table_bytes;
+    size_t arena_bytes;
+    // Whether a resize is in progress. Its newer tables are counted in the
+    // bytes above.
+    bool is_resizing;
+    // Number of entries of the oldest table `i' slots after their home
+    // slot, the last item counts longer probes too.
+    size_t probe_lengths[DICT_STATS_PROBE_LENGTHS];
+    // Cumulative count since the dictionary was created.
+    uint64_t resizes;
+};
+
+
+/**
+ * Iterator over dictionary entries, in order of slots of the table current
+ * when it was started.
+ */
+struct dict_iter
+{
+    struct dict_table *table;
+    size_t pos;
+};
+
+
+/**
+ * Create new dictionary object.
+ */
+struct dict *
+dict_init(uint64_t (*hash_function)(const char *, size_t));
+
+
+/**
+ * Create new dictionary object with given `DICT_*' flags. Keys and values
+ * are always stored by pointer, `DICT_OWNED' is not supported.
+ */
+struct dict *
+dict_init_flags(
+    uint64_t (*hash_function)(const char *, size_t), int flags);
+
+
+/**
+ * Create dictionary of `n' keys and values in one pass, as if they were set
+ * one by one (the last value of equal keys wins). Keys are zero-terminated.
+ * Work is spread over `pool' threads, NULL builds in the calling thread.
+ */
+struct dict *
+dict_build(
+    uint64_t (*hash_function)(const char *, size_t),
+    int flags,
+    const char *const *keys,
+    const char *const *values,
+    size_t n,
+    struct dict_pool *pool);
+
+
+/**
+ * Destroy dictionary object. No other thread may be using it.
+ */
+void
+dict_destroy(struct dict *);
+
+
+/**
+ * Make room for given number of entries, so the dictionary is not resized
+ * until it holds more. Reserving less does not shrink the dictionary.
+ */
+void
+dict_reserve(struct dict *, size_t);
+
+
+/**
+ * Copy large tables being resized on `pool' threads, driven by the thread
+ * which starts the resize; NULL (the default) leaves copying to writers.
+ * While the pool copies one table, resizes of other ones are copied by
+ * writers alone, so the pool is never run from two threads by one
+ * dictionary. Dictionaries sharing a pool must not be resized from
+ * different threads at once.
+ */
+void
+dict_set_pool(struct dict *, struct dict_pool *);
+
+
+/**
+ * Get value by key. Keys and values are stored by pointer, so they must stay
+ * valid while other threads may look them up.
+ */
+const char *
+dict_get(struct dict *, const char *);
+
+
+/**
+ * Get value by key of given length.
+ */
+const char *
+dict_get_n(struct dict *, const char *, size_t);
+
+
+/**
+ * Get values of `n' zero-terminated keys into `values' (NULL for missing
+ * keys). Lookups are interleaved, so their cache misses overlap.
+ */
+void
+dict_get_many(
+    struct dict *, const char *const *keys, size_t n, const char **values);
+
+
+/**
+ * Set value by key.
+ */
+void
+dict_set(struct dict *, const char *, const char *);
+
+
+/**
+ * Set value by key of given length. The key is stored by pointer, so it must
+ * outlive the dictionary.
+ */
+void
+dict_set_n(struct dict *, const char *, size_t, const char *);
+
+
+/**
+ * Set value by key unless the key has one already. Return whether the value
+ * was set. Of threads setting the same key at once, exactly one succeeds.
+ */
+bool
+dict_set_if_absent(struct dict *, const char *, const char *);
+
+
+/**
+ * Set value by key of given length unless the key has one already, see
+ * `dict_set_if_absent'.
+ */
+bool
+dict_set_if_absent_n(struct dict *, const char *, size_t, const char *);
+
+
+/**
+ * Remove item by key.
+ */
+void
+dict_del(struct dict *, const char *);
+
+
+/**
+ * Remove item by key of given length.
+ */
+void
+dict_del_n(struct dict *, const char *, size_t);
+
+
+/**
+ * Start iteration over dictionary entries. Must be called in epoch critical
+ * section (see dict_epoch.h), which keeps the table alive until the
+ * iteration is done. Writers are not stopped: entries set or deleted
+ * meanwhile may or may not be seen; see `dict_scan' for a walk which
+ * spans critical sections.
+ */
+void
+dict_iter_init(struct dict_iter *, struct dict *);
+
+
+/**
+ * Get next entry of iteration into `key', `key_len' and `value'. Return
+ * false when there are no more entries.
+ */
+bool
+dict_iter_next(
+    struct dict_iter *, const char **key, size_t *key_len, const char **value);
+
+
+/**
+ * Call `fn' with `arg', key, key length and value for entries of home slots
+ * from `cursor' on (0 to start), until about `count' entries are passed,
+ * and return cursor to continue from, 0 when the scan is done. Every call
+ * is a critical section of its own, so large dictionaries are scanned in
+ * bounded steps while writers keep running. Home slots are visited in
+ * reverse binary order (see `dict_scan_next_cursor'), so entries present
+ * during the whole scan are passed at least once although the table is
+ * resized meanwhile (some may be passed again if it shrinks), and other
+ * ones may be passed or not. `fn' is called in epoch critical section.
+ */
+uint64_t
+dict_scan(
+    struct dict *,
+    uint64_t cursor,
+    size_t count,
+    void (*fn)(void *arg, const char *key, size_t key_len, const char *value),
+    void *arg);
+
+
+/**
+ * Write dictionary contents to file descriptor `fd' as a stream of
+ * checksummed blocks (see dict_stream.h), one block in memory at a time.
+ * Values must be zero-terminated strings. Writers are not stopped: entries
+ * set or deleted during the dump may or may not be written. Return false on
+ * error, with `errno' set.
+ */
+bool
+dict_dump(struct dict *, int fd);
+
+
+/**
+ * Create dictionary with given `DICT_*' flags from stream written by
+ * `dict_dump' of any backend to `fd', read a block at a time. The
+ * dictionary is sized for the recorded number of entries up front. Keys and
+ * values are copied into storage freed by `dict_destroy'. Return NULL on
+ * error, with `errno' set (`EINVAL' for malformed or corrupted data).
+ */
+struct dict *
+dict_load(
+    uint64_t (*hash_function)(const char *, size_t), int flags, int fd);
+
+
+/**
+ * Fill `stats' of dictionary, for monitoring. Takes time linear in table
+ * size. Writers are not stopped, so counts changed meanwhile need not add
+ * up.
+ */
+void
+dict_stats(struct dict *, struct dict_stats *);
+
+
+/**
+ * Draw dict contents for debugging.
+ */
+void
+dict_draw(struct dict *);
+
+
+#endif
@@ -1,3 +1,4 @@
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -5,24 +6,12 @@
 // #include "linked_list_dict.h"
 // #include "open_addressing_dict.h"
 #include "compact_dict.h"
+#include "dict_hash.h"
+#include "dict_typed.h"
 
 
-/**
- * Simple hash function for strings.
- */
-static inline unsigned int
-hash_function(const char *str)
-{
-    unsigned int result = 42;
-    char p;
-    unsigned int n = 0;
-    while ((p = *str++)) {
-        result += ((unsigned int) p) << (n++ % 48);
-        result += (unsigned int) p;
-    }
-
-    return result;
-}
+// Dictionary of integers, with hash and equality inlined.
+DEFINE_DICT(int_dict, uint64_t, uint64_t, dict_typed_hash_u64, DICT_TYPED_EQ)
 
 
 int main()
@@ -37,7 +26,7 @@ int main()
         sprintf(vals_buffer[i], "value%d", i);
     }
 
-    struct dict *d = dict_init(&hash_function);
+    struct dict *d = dict_init(&dict_hash);
 
     for (int i = 0; i < iters; ++i) {
         dict_set(d, keys_buffer[i], vals_buffer[i]);
@@ -73,5 +62,16 @@ int main()
 
     dict_destroy(d);
 
+    struct int_dict *squares = int_dict_init();
+    for (uint64_t i = 0; i < iters; ++i) {
+        int_dict_set(squares, i, i * i);
+    }
+    int_dict_del(squares, 0);
+    printf(
+        "\nSquares: %zu, 7*7=%" PRIu64 "\n",
+        squares->len,
+        *int_dict_get(squares, 7));
+    int_dict_destroy(squares);
+
     return 0;
 }
@@ -1,8 +1,17 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
 
 #include "open_addressing_dict.h"
+#include "dict_arena.h"
+#include "dict_bulk.h"
+#include "dict_hash.h"
+#include "dict_instr.h"
+#include "dict_pool.h"
+#include "dict_stream.h"
 
 
 /**
@@ -27,56 +36,896 @@ safe_malloc(size_t size)
 #define DICT_MIN_ARRAY_SIZE 8
 
 
-#define ENTRY_EMPTY 0
-#define ENTRY_OK 1
-#define ENTRY_DELETED 2
+// Control bytes. Used slots hold 7-bit hash tag (high bit is clear).
+#define ENTRY_EMPTY 0x80
+#define ENTRY_DELETED 0xFE
+
+
+// `DICT_INCREMENTAL' dictionary moves up to `DICT_REHASH_STEP' entries per
+// operation, skipping at most `DICT_REHASH_STEP' * 10 free slots.
+#define DICT_REHASH_STEP 16
+
+
+// `dict_get_many' interleaves lookups of this many keys.
+#define DICT_GET_BATCH 16
+
+
+// `dict_build' fills the table by regions of this many slots, one task per
+// region, so every task writes to a cache-sized part of the table.
+#define DICT_BUILD_REGION_SIZE 16384
+
+
+// Dictionary with a pool resizes tables of at least this many entries on
+// pool threads; smaller ones are not worth waking them.
+#define DICT_POOL_RESIZE_MIN 65536
+
+
+// `dict_scan' visits up to this many times `count' home slots.
+#define DICT_SCAN_MAX_VISITS 10
+
+
+// Group of control bytes checked at once: 32 with AVX2, 16 with SSE2, 8 with
+// portable SWAR on 64-bit words. `group_mask_t' has a bit set for every
+// matching slot; `_group_mask_lowest' returns its lowest slot.
+#if defined(__AVX2__)
+
+#include <immintrin.h>
+
+#define DICT_GROUP_WIDTH 32
+
+typedef uint32_t group_mask_t;
+
+
+/**
+ * Mask of slots in group which control bytes are equal to `ctrl'.
+ */
+static inline group_mask_t
+_group_match(const uint8_t *group, uint8_t ctrl)
+{
+    __m256i g = _mm256_loadu_si256((const __m256i *) group);
+
+    return _mm256_movemask_epi8(_mm256_cmpeq_epi8(g, _mm256_set1_epi8(ctrl)));
+}
+
+
+/**
+ * Mask of empty and deleted slots in group.
+ */
+static inline group_mask_t
+_group_match_free(const uint8_t *group)
+{
+    return _mm256_movemask_epi8(
+        _mm256_loadu_si256((const __m256i *) group));
+}
+
+
+/**
+ * Lowest slot in mask.
+ */
+static inline size_t
+_group_mask_lowest(group_mask_t mask)
+{
+    return __builtin_ctz(mask);
+}
+
+#elif defined(__SSE2__)
+
+#include <emmintrin.h>
+
+#define DICT_GROUP_WIDTH 16
+
+typedef uint32_t group_mask_t;
+
+
+/**
+ * Mask of slots in group which control bytes are equal to `ctrl'.
+ */
+static inline group_mask_t
+_group_match(const uint8_t *group, uint8_t ctrl)
+{
+    __m128i g = _mm_loadu_si128((const __m128i *) group);
+
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8(ctrl)));
+}
+
+
+/**
+ * Mask of empty and deleted slots in group.
+ */
+static inline group_mask_t
+_group_match_free(const uint8_t *group)
+{
+    return _mm_movemask_epi8(_mm_loadu_si128((const __m128i *) group));
+}
+
+
+/**
+ * Lowest slot in mask.
+ */
+static inline size_t
+_group_mask_lowest(group_mask_t mask)
+{
+    return __builtin_ctz(mask);
+}
+
+#else
+
+#define DICT_GROUP_WIDTH 8
+
+// High bit of every byte is set for matching slot.
+typedef uint64_t group_mask_t;
+
+#define SWAR_LSB 0x0101010101010101ULL
+#define SWAR_MSB 0x8080808080808080ULL
+
+
+/**
+ * Load group as little-endian word, so byte N is slot N.
+ */
+static inline uint64_t
+_group_load(const uint8_t *group)
+{
+    uint64_t word = 0;
+    for (int i = DICT_GROUP_WIDTH - 1; i >= 0; --i) {
+        word = (word << 8) | group[i];
+    }
+
+    return word;
+}
+
+
+/**
+ * Mask of slots in group which control bytes are equal to `ctrl'.
+ *
+ * May report false positives in slots above a real match, which are rejected
+ * by hash comparison. The lowest reported slot is always a real match.
+ */
+static inline group_mask_t
+_group_match(const uint8_t *group, uint8_t ctrl)
+{
+    uint64_t x = _group_load(group) ^ (SWAR_LSB * ctrl);
+
+    return (x - SWAR_LSB) & ~x & SWAR_MSB;
+}
+
+
+/**
+ * Mask of empty and deleted slots in group.
+ */
+static inline group_mask_t
+_group_match_free(const uint8_t *group)
+{
+    return _group_load(group) & SWAR_MSB;
+}
+
+
+/**
+ * Lowest slot in mask.
+ */
+static inline size_t
+_group_mask_lowest(group_mask_t mask)
+{
+    return __builtin_ctzll(mask) / 8;
+}
+
+#endif
+
+
+/**
+ * Is slot with given control byte used.
+ */
+static inline bool
+_is_ctrl_full(uint8_t ctrl)
+{
+    return (ctrl & 0x80) == 0;
+}
+
+
+/**
+ * Control byte (7 high bits of hash) for used slot. Home slot is taken from
+ * low bits, so the tag adds information.
+ */
+static inline uint8_t
+_hash_tag(uint64_t hash)
+{
+    return (hash >> (sizeof(hash) * 8 - 7)) & 0x7f;
+}
+
+
+/**
+ * Is entry matches.
+ */
+static inline int
+_is_entry_matches(
+    struct dict_entry entry,
+    uint64_t hash,
+    const char *key,
+    size_t key_len)
+{
+    return (
+        entry.hash == hash &&
+        entry.key_len == key_len &&
+        DICT_INSTR_MEMCMP(entry.key, key, key_len) == 0
+    );
+}
+
+
+/**
+ * Distance from position `pos' to home slot of `hash' in array of
+ * `mask' + 1 slots.
+ */
+static inline size_t
+_displacement(uint64_t hash, size_t pos, size_t mask)
+{
+    return (pos - hash) & mask;
+}
+
+
+/**
+ * Copy key into arena if dictionary owns its strings.
+ */
+static inline const char *
+_own_key(struct dict *d, const char *key, size_t key_len)
+{
+    if (!(d->flags & DICT_OWNED)) {
+        return key;
+    }
+
+    return dict_arena_copy(&d->arena, key, key_len);
+}
+
+
+/**
+ * Copy value into arena if dictionary owns its strings.
+ */
+static inline const char *
+_own_value(struct dict *d, const char *value)
+{
+    if (!(d->flags & DICT_OWNED) || value == NULL) {
+        return value;
+    }
+
+    return dict_arena_copy(&d->arena, value, strlen(value));
+}
+
+
+/**
+ * Arena bytes taken by owned value.
+ */
+static inline size_t
+_owned_value_size(const char *value)
+{
+    return value == NULL ? 0 : strlen(value) + 1;
+}
+
+
+/**
+ * Copy key and value of entry into `arena'.
+ */
+static inline void
+_copy_entry_strings(struct dict_arena *arena, struct dict_entry *entry)
+{
+    entry->key = dict_arena_copy(arena, entry->key, entry->key_len);
+    if (entry->value != NULL) {
+        entry->value = dict_arena_copy(
+            arena, entry->value, strlen(entry->value));
+    }
+}
+
+
+/**
+ * Is it worth copying live strings into new arena. During resize every
+ * entry is copied anyway, so a smaller share of garbage is enough.
+ */
+static inline bool
+_is_time_to_repack_arena(struct dict *d, bool is_resize)
+{
+    size_t garbage = d->arena_garbage * (is_resize ? 4 : 2);
+
+    return (d->flags & DICT_OWNED) && garbage > d->arena.used;
+}
+
+
+/**
+ * Round table size up to a power of two, so `dict_scan' cursors stay valid
+ * across resizes.
+ */
+static inline size_t
+_round_array_size(size_t size)
+{
+    size_t rounded = DICT_MIN_ARRAY_SIZE;
+    while (rounded < size) {
+        rounded *= 2;
+    }
+
+    return rounded;
+}
+
+
+/**
+ * Count rehash of `d' into table of `new_size' slots for `dict_stats'.
+ */
+static inline void
+_count_rehash(struct dict *d, size_t new_size)
+{
+    if (new_size != d->array_allocated) {
+        ++d->resizes;
+    } else {
+        ++d->rebuilds;
+    }
+}
+
+
+/**
+ * Allocate entries and control arrays of `size' slots for `d'.
+ */
+static void
+_init_arrays(struct dict *d, size_t size)
+{
+    d->entries_array = safe_malloc(sizeof(struct dict_entry) * size);
+    d->ctrl_array = safe_malloc(size + DICT_GROUP_WIDTH);
+    memset(d->ctrl_array, ENTRY_EMPTY, size + DICT_GROUP_WIDTH);
+    d->array_allocated = size;
+}
+
+
+/**
+ * Set control byte of slot `pos' of control array with `size' slots, and its
+ * mirrors after the last slot.
+ */
+static inline void
+_set_ctrl_array(uint8_t *ctrl_array, size_t size, size_t pos, uint8_t ctrl)
+{
+    ctrl_array[pos] = ctrl;
+    for (size_t i = pos + size; i < size + DICT_GROUP_WIDTH; i += size) {
+        ctrl_array[i] = ctrl;
+    }
+}
+
+
+/**
+ * Set control byte of slot `pos' and its mirrors after the last slot.
+ */
+static inline void
+_set_ctrl(struct dict *d, size_t pos, uint8_t ctrl)
+{
+    _set_ctrl_array(d->ctrl_array, d->array_allocated, pos, ctrl);
+}
+
+
+/**
+ * Put new entry into `d' without resizing. Key must not be in dictionary and
+ * there must be an empty slot. Updates `max_displacement'.
+ */
+static void
+_place_entry(struct dict *d, struct dict_entry new_entry)
+{
+    // Array size is a power of two.
+    size_t mask = d->array_allocated - 1;
+    size_t position = new_entry.hash & mask;
+    size_t distance = 0;
+
+    if (!(d->flags & DICT_ROBIN_HOOD)) {
+        // Take first empty or deleted slot.
+        group_mask_t free_slots = _group_match_free(&d->ctrl_array[position]);
+        while (free_slots == 0) {
+            position = (position + DICT_GROUP_WIDTH) & mask;
+            distance += DICT_GROUP_WIDTH;
+            free_slots = _group_match_free(&d->ctrl_array[position]);
+        }
+
+        size_t offset = _group_mask_lowest(free_slots);
+        position = (position + offset) & mask;
+        distance += offset;
+    } else {
+        while (_is_ctrl_full(d->ctrl_array[position])) {
+            struct dict_entry *entry = &d->entries_array[position];
+            size_t entry_distance = _displacement(entry->hash, position, mask);
+            if (entry_distance < distance) {
+                // Entry is closer to its home slot than the new one: take its
+                // place and carry it further.
+                struct dict_entry tmp = *entry;
+                *entry = new_entry;
+                _set_ctrl(d, position, _hash_tag(new_entry.hash));
+                new_entry = tmp;
+                if (distance > d->max_displacement) {
+                    d->max_displacement = distance;
+                }
+                distance = entry_distance;
+            }
+
+            position = (position + 1) & mask;
+            ++distance;
+        }
+    }
+
+    d->entries_array[position] = new_entry;
+    _set_ctrl(d, position, _hash_tag(new_entry.hash));
+    if (distance > d->max_displacement) {
+        d->max_displacement = distance;
+    }
+}
+
+
+/**
+ * Return position of entry with given key in table of `size' slots (`size'
+ * if missing).
+ *
+ * Scans control bytes a group at a time starting from the home slot, loading
+ * entries only for matching tags. Stops at a group with an empty slot, or
+ * after `max_displacement' slots.
+ */
+static size_t
+_lookup_array(
+    struct dict_entry *entries_array,
+    const uint8_t *ctrl_array,
+    size_t size,
+    size_t max_displacement,
+    uint64_t hash,
+    const char *key,
+    size_t key_len)
+{
+    // Array size is a power of two; mirrored control bytes let groups run
+    // past the last slot.
+    size_t size_mask = size - 1;
+    size_t position = hash & size_mask;
+    uint8_t tag = _hash_tag(hash);
+    size_t probes = 0;
+
+    for (size_t distance = 0;
+            distance <= max_displacement;
+            distance += DICT_GROUP_WIDTH) {
+        const uint8_t *group = &ctrl_array[position];
+        ++probes;
+        group_mask_t mask = _group_match(group, tag);
+        while (mask != 0) {
+            size_t candidate = (
+                (position + _group_mask_lowest(mask)) & size_mask);
+            struct dict_entry *entry = &entries_array[candidate];
+            if (_is_entry_matches(*entry, hash, key, key_len)) {
+                DICT_INSTR_LOOKUP(key, key_len, probes);
+
+                return candidate;
+            }
+            mask &= mask - 1;
+        }
+
+        if (_group_match(group, ENTRY_EMPTY) != 0) {
+            break;
+        }
+
+        position = (position + DICT_GROUP_WIDTH) & size_mask;
+    }
+    DICT_INSTR_LOOKUP(key, key_len, probes);
+
+    return size;
+}
+
+
+/**
+ * Return position of entry with given key (`array_allocated' if missing).
+ */
+static inline size_t
+_lookup(struct dict *d, uint64_t hash, const char *key, size_t key_len)
+{
+    return _lookup_array(
+        d->entries_array,
+        d->ctrl_array,
+        d->array_allocated,
+        d->max_displacement,
+        hash,
+        key,
+        key_len);
+}
+
+
+/**
+ * Return position of not yet moved entry with given key in old table
+ * (`old_array_allocated' if missing).
+ */
+static inline size_t
+_lookup_old(struct dict *d, uint64_t hash, const char *key, size_t key_len)
+{
+    return _lookup_array(
+        d->old_entries_array,
+        d->old_ctrl_array,
+        d->old_array_allocated,
+        d->old_max_displacement,
+        hash,
+        key,
+        key_len);
+}
+
+
+/**
+ * Remove entry at `position' shifting following entries back, so no
+ * tombstone is left.
+ */
+static void
+_backward_shift_delete(struct dict *d, size_t position)
+{
+    size_t mask = d->array_allocated - 1;
+    size_t next = (position + 1) & mask;
+
+    while (_is_ctrl_full(d->ctrl_array[next]) &&
+            _displacement(d->entries_array[next].hash, next, mask) > 0) {
+        d->entries_array[position] = d->entries_array[next];
+        _set_ctrl(d, position, d->ctrl_array[next]);
+        position = next;
+        next = (next + 1) & mask;
+    }
+
+    _set_ctrl(d, position, ENTRY_EMPTY);
+}
+
+
+/**
+ * Sort items of bulk region into `sorted' by their home slots (counting
+ * sort, stable). Runs filled in this order need no Robin Hood swaps.
+ */
+static void
+_sort_by_home_slot(struct dict_bulk *bulk, size_t region, size_t *sorted)
+{
+    size_t start = bulk->region_starts[region];
+    size_t end = bulk->region_starts[region + 1];
+    size_t region_start = region * bulk->region_size;
+    size_t region_end = region_start + bulk->region_size;
+    if (region_end > bulk->table_size) {
+        region_end = bulk->table_size;
+    }
+
+    size_t *offsets = calloc(region_end - region_start + 1, sizeof(size_t));
+    if (offsets == NULL) {
+        printf("fatal: Memory allocation failed\n");
+        exit(1);
+    }
+    for (size_t k = start; k < end; ++k) {
+        uint64_t hash = bulk->hashes[bulk->order[k]];
+        ++offsets[hash % bulk->table_size - region_start + 1];
+    }
+    for (size_t slot = region_start; slot < region_end; ++slot) {
+        offsets[slot - region_start + 1] += offsets[slot - region_start];
+    }
+    for (size_t k = start; k < end; ++k) {
+        size_t i = bulk->order[k];
+        size_t home = bulk->hashes[i] % bulk->table_size;
+        sorted[offsets[home - region_start]++] = i;
+    }
+
+    free(offsets);
+}
+
+
+/**
+ * State shared by tasks of `_do_resize_array'.
+ */
+struct dict_resize_job
+{
+    struct dict *d;
+    // Old table; its full slots are grouped by region of the new one.
+    struct dict_entry *old_entries;
+    uint8_t *old_ctrl;
+    struct dict_bulk bulk;
+    // Per region: number of entries which did not fit into it, and largest
+    // displacement.
+    size_t *overflows;
+    size_t *max_displacements;
+    // Per region arenas entries are repacked into, NULL if not repacking.
+    struct dict_arena *arenas;
+};
+
+
+/**
+ * Give hash of old slot `i' to `dict_bulk_init_hashed', skipping free ones.
+ */
+static bool
+_get_old_slot_hash(void *arg, size_t i, uint64_t *hash)
+{
+    struct dict_resize_job *job = arg;
+    *hash = job->old_entries[i].hash;
+
+    return _is_ctrl_full(job->old_ctrl[i]);
+}
+
+
+/**
+ * Place old entries of new table region in order of their home slots.
+ * Entries running past the region end are left for `_do_resize_array' at
+ * the start of the region's part of `order'.
+ */
+static void
+_resize_region(void *arg, size_t region)
+{
+    struct dict_resize_job *job = arg;
+    struct dict *d = job->d;
+    struct dict_bulk *bulk = &job->bulk;
+    size_t start = bulk->region_starts[region];
+    size_t end = bulk->region_starts[region + 1];
+    size_t region_end = (region + 1) * bulk->region_size;
+    if (region_end > bulk->table_size) {
+        region_end = bulk->table_size;
+    }
+
+    size_t *sorted = safe_malloc(sizeof(size_t) * (end - start + 1));
+    _sort_by_home_slot(bulk, region, sorted);
+
+    size_t overflows = 0;
+    size_t max_displacement = 0;
+    for (size_t k = 0; k < end - start; ++k) {
+        size_t i = sorted[k];
+        struct dict_entry *entry = &job->old_entries[i];
+        if (job->arenas != NULL) {
+            _copy_entry_strings(&job->arenas[region], entry);
+        }
+
+        size_t position = entry->hash & (d->array_allocated - 1);
+        size_t distance = 0;
+        while (_is_ctrl_full(d->ctrl_array[position]) &&
+                ++position < region_end) {
+            ++distance;
+        }
+        if (position == region_end) {
+            bulk->order[start + overflows++] = i;
+            continue;
+        }
+
+        d->entries_array[position] = *entry;
+        _set_ctrl(d, position, _hash_tag(entry->hash));
+        if (distance > max_displacement) {
+            max_displacement = distance;
+        }
+    }
+    job->overflows[region] = overflows;
+    job->max_displacements[region] = max_displacement;
+
+    free(sorted);
+}
+
+
+/**
+ * Move entries of old table into new arrays of `d' on pool threads: entries
+ * are grouped by region of the new table, every region is filled by one
+ * task, and entries which do not fit into their region are placed
+ * afterwards. Repacked strings go to per region arenas.
+ */
+static void
+_move_entries_on_pool(
+    struct dict *d,
+    struct dict_entry *old_entries,
+    uint8_t *old_ctrl,
+    size_t old_size,
+    struct dict_arena *new_arena)
+{
+    struct dict_resize_job job = {
+        .d = d,
+        .old_entries = old_entries,
+        .old_ctrl = old_ctrl,
+    };
+    dict_bulk_init_hashed(
+        &job.bulk, _get_old_slot_hash, &job, old_size,
+        d->array_allocated, DICT_BUILD_REGION_SIZE, d->thread_pool);
+    size_t regions = job.bulk.regions;
+    job.overflows = safe_malloc(sizeof(size_t) * regions);
+    job.max_displacements = safe_malloc(sizeof(size_t) * regions);
+    if (new_arena != NULL) {
+        job.arenas = safe_malloc(sizeof(struct dict_arena) * regions);
+        for (size_t region = 0; region < regions; ++region) {
+            dict_arena_init(&job.arenas[region]);
+        }
+    }
+
+    dict_pool_run(d->thread_pool, regions, _resize_region, &job);
+    for (size_t region = 0; region < regions; ++region) {
+        if (job.max_displacements[region] > d->max_displacement) {
+            d->max_displacement = job.max_displacements[region];
+        }
+    }
+    for (size_t region = 0; region < regions; ++region) {
+        size_t start = job.bulk.region_starts[region];
+        for (size_t k = 0; k < job.overflows[region]; ++k) {
+            _place_entry(d, old_entries[job.bulk.order[start + k]]);
+        }
+    }
+
+    if (new_arena != NULL) {
+        for (size_t region = 0; region < regions; ++region) {
+            dict_arena_merge(new_arena, &job.arenas[region]);
+        }
+        free(job.arenas);
+    }
+    free(job.max_displacements);
+    free(job.overflows);
+    dict_bulk_destroy(&job.bulk);
+}
+
+
+/**
+ * Resize `entries_array' to `new_size' size.
+ */
+static void
+_do_resize_array(struct dict *d, size_t new_size)
+{
+    struct dict_entry *old_entries = d->entries_array;
+    uint8_t *old_ctrl = d->ctrl_array;
+    size_t old_size = d->array_allocated;
+
+    _count_rehash(d, new_size);
+    DICT_INSTR_REBUILD_BEGIN();
+    _init_arrays(d, new_size);
+    d->max_displacement = 0;
+
+    // Live strings of owned dictionary may be moved to new arena on the way.
+    bool repack_arena = _is_time_to_repack_arena(d, true);
+    struct dict_arena new_arena;
+    dict_arena_init(&new_arena);
+
+    if (d->thread_pool != NULL && d->len >= DICT_POOL_RESIZE_MIN) {
+        _move_entries_on_pool(
+            d, old_entries, old_ctrl, old_size,
+            repack_arena ? &new_arena : NULL);
+    } else {
+        for (size_t i = 0; i < old_size; ++i) {
+            if (_is_ctrl_full(old_ctrl[i])) {
+                if (repack_arena) {
+                    _copy_entry_strings(&new_arena, &old_entries[i]);
+                }
+                _place_entry(d, old_entries[i]);
+            }
+        }
+    }
+
+    if (repack_arena) {
+        dict_arena_destroy(&d->arena);
+        d->arena = new_arena;
+        d->arena_garbage = 0;
+    }
+
+    free(old_entries);
+    free(old_ctrl);
+    DICT_INSTR_REBUILD_END();
+}
+
+
+/**
+ * Is incremental rehash in progress.
+ */
+static inline bool
+_is_rehashing(struct dict *d)
+{
+    return d->old_entries_array != NULL;
+}
+
+
+/**
+ * Start incremental rehash into new table of `new_size' slots.
+ */
+static void
+_start_rehash(struct dict *d, size_t new_size)
+{
+    // Live strings of owned dictionary may be moved to new arena on the way.
+    d->rehash_repacks_arena = _is_time_to_repack_arena(d, true);
+    if (d->rehash_repacks_arena) {
+        d->old_arena = d->arena;
+        dict_arena_init(&d->arena);
+        d->arena_garbage = 0;
+    }
+
+    d->old_entries_array = d->entries_array;
+    d->old_ctrl_array = d->ctrl_array;
+    d->old_array_allocated = d->array_allocated;
+    d->old_max_displacement = d->max_displacement;
+    d->rehash_pos = 0;
+
+    _count_rehash(d, new_size);
+    _init_arrays(d, new_size);
+    d->max_displacement = 0;
+}
+
+
+/**
+ * Move old entry at `position' to new table.
+ */
+static void
+_rehash_entry(struct dict *d, size_t position)
+{
+    // Old slot is dead after the move, so strings are copied in place.
+    struct dict_entry *entry = &d->old_entries_array[position];
+    _set_ctrl_array(
+        d->old_ctrl_array, d->old_array_allocated, position, ENTRY_DELETED);
+
+    if (d->rehash_repacks_arena) {
+        _copy_entry_strings(&d->arena, entry);
+    }
+    _place_entry(d, *entry);
+}
+
+
+/**
+ * Free old table once all entries are moved.
+ */
+static void
+_end_rehash(struct dict *d)
+{
+    free(d->old_entries_array);
+    free(d->old_ctrl_array);
+    d->old_entries_array = NULL;
+    d->old_ctrl_array = NULL;
+
+    if (d->rehash_repacks_arena) {
+        dict_arena_destroy(&d->old_arena);
+        d->rehash_repacks_arena = false;
+    }
+}
+
+
+/**
+ * Move next `DICT_REHASH_STEP' old entries.
+ */
+static void
+_rehash_step(struct dict *d)
+{
+    size_t moved = 0;
+    size_t skipped = 0;
+    while (d->rehash_pos < d->old_array_allocated &&
+            moved < DICT_REHASH_STEP &&
+            skipped < DICT_REHASH_STEP * 10) {
+        size_t position = d->rehash_pos++;
+        if (_is_ctrl_full(d->old_ctrl_array[position])) {
+            _rehash_entry(d, position);
+            ++moved;
+        } else {
+            ++skipped;
+        }
+    }
+
+    if (d->rehash_pos == d->old_array_allocated) {
+        _end_rehash(d);
+    }
+}
 
 
 /**
- * Is entry matches.
+ * Move all remaining old entries.
  */
-static inline int
-_is_entry_matches(
-    struct dict_entry entry, unsigned int hash, const char *key)
+static void
+_finish_rehash(struct dict *d)
 {
-    return (
-        (entry.kind == ENTRY_OK || entry.kind == ENTRY_DELETED) &&
-        entry.hash == hash &&
-        strcmp(entry.key, key) == 0
-    );
+    while (_is_rehashing(d)) {
+        _rehash_step(d);
+    }
 }
 
 
 /**
- * Resize `entries_array' to `new_size' size.
+ * Make sure entry with given key, if any, is not left in old table, so it
+ * can be changed in place.
  */
-static void
-_do_resize_array(struct dict *d, size_t new_size)
+static inline void
+_rehash_key(struct dict *d, uint64_t hash, const char *key, size_t key_len)
 {
-    struct dict_entry *new_array = safe_malloc(
-        sizeof(struct dict_entry) * new_size);
-    for (size_t i = 0; i < new_size; ++i) {
-        new_array[i].kind = ENTRY_EMPTY;
+    size_t position = _lookup_old(d, hash, key, key_len);
+    if (position != d->old_array_allocated) {
+        _rehash_entry(d, position);
     }
+}
 
-    for (size_t i = 0; i < d->array_allocated; ++i) {
-        struct dict_entry *entry = &d->entries_array[i];
-        if (entry->kind == ENTRY_OK) {
-            unsigned int new_expected_position = entry->hash % new_size;
 
-            struct dict_entry *new_entry = &new_array[new_expected_position];
-            while (new_entry->kind != ENTRY_EMPTY) {
-                new_expected_position = (new_expected_position + 1) % new_size;
-                new_entry = &new_array[new_expected_position];
-            }
+/**
+ * Resize `entries_array' to `new_size' size, at once or incrementally.
+ */
+static void
+_resize_array(struct dict *d, size_t new_size)
+{
+    if (!(d->flags & DICT_INCREMENTAL)) {
+        _do_resize_array(d, new_size);
 
-            *new_entry = *entry;
-        }
+        return;
     }
 
-    free(d->entries_array);
-    d->entries_array = new_array;
-    d->array_allocated = new_size;
+    // New table is sized for all entries, so it is rarely outgrown before
+    // the rehash ends.
+    _finish_rehash(d);
+    _start_rehash(d, new_size);
 }
 
 
@@ -86,19 +935,24 @@ _do_resize_array(struct dict *d, size_t new_size)
 static void
 _resize_array_if_needed(struct dict *d)
 {
-    size_t min_size = d->len * 3 / 2;
-    size_t max_size = d->len * 5;
+    // Reserved room is kept however few entries there are.
+    size_t len = d->len > d->reserved ? d->len : d->reserved;
+    size_t min_size = len * 3 / 2;
+    size_t max_size = len * 5;
 
-    if (d->array_allocated < min_size || d->array_allocated > max_size) {
-        size_t optimal_size = d->len * 2;
-        if (optimal_size < DICT_MIN_ARRAY_SIZE) {
-            optimal_size = DICT_MIN_ARRAY_SIZE;
-        }
+    if (d->array_allocated < min_size ||
+            (d->array_allocated > max_size && !_is_rehashing(d))) {
+        size_t optimal_size = _round_array_size(len * 2);
         if (d->array_allocated != optimal_size) {
-            _do_resize_array(d, optimal_size);
+            _resize_array(d, optimal_size);
 
         }
     }
+
+    if (!_is_rehashing(d) && _is_time_to_repack_arena(d, false)) {
+        // Rehash in place to reclaim arena garbage (and tombstones).
+        _resize_array(d, d->array_allocated);
+    }
 }
 
 
@@ -106,18 +960,37 @@ _resize_array_if_needed(struct dict *d)
  * Create new dictionary object.
  */
 struct dict *
-dict_init(unsigned int (*hash_function)(const char *))
+dict_init(uint64_t (*hash_function)(const char *, size_t))
+{
+    return dict_init_flags(hash_function, 0);
+}
+
+
+/**
+ * Create new dictionary object with given `DICT_*' flags.
+ */
+struct dict *
+dict_init_flags(
+    uint64_t (*hash_function)(const char *, size_t), int flags)
 {
     struct dict *d = safe_malloc(sizeof(struct dict));
     d->len = 0;
-    d->array_allocated = DICT_MIN_ARRAY_SIZE;
-    d->entries_array = safe_malloc(
-        sizeof(struct dict_entry) * d->array_allocated);
-    for (size_t i = 0; i < d->array_allocated; ++i) {
-        d->entries_array[i].kind = ENTRY_EMPTY;
-    }
+    d->max_displacement = 0;
+    d->reserved = 0;
+    d->flags = flags;
+    d->resizes = 0;
+    d->rebuilds = 0;
+    _init_arrays(d, DICT_MIN_ARRAY_SIZE);
 
     d->hash_function = hash_function;
+    d->thread_pool = NULL;
+
+    dict_arena_init(&d->arena);
+    d->arena_garbage = 0;
+
+    d->old_entries_array = NULL;
+    d->old_ctrl_array = NULL;
+    d->rehash_repacks_arena = false;
 
     return d;
 }
@@ -130,31 +1003,135 @@ void
 dict_destroy(struct dict *d)
 {
     free(d->entries_array);
+    free(d->ctrl_array);
+    if (_is_rehashing(d)) {
+        _end_rehash(d);
+    }
+    dict_arena_destroy(&d->arena);
     free(d);
 }
 
 
+/**
+ * Make room for `n' entries.
+ */
+void
+dict_reserve(struct dict *d, size_t n)
+{
+    // Reserving is done up front, so it does not need to be incremental.
+    _finish_rehash(d);
+
+    d->reserved = n;
+    if (d->array_allocated < n * 3 / 2) {
+        _do_resize_array(d, _round_array_size(n * 2));
+    }
+}
+
+
+/**
+ * Set pool to resize large table on, see header.
+ */
+void
+dict_set_pool(struct dict *d, struct dict_pool *pool)
+{
+    d->thread_pool = pool;
+}
+
+
 /**
  * Get value by key.
  */
 const char *
 dict_get(struct dict *d, const char *key)
 {
-    unsigned int hash = d->hash_function(key);
-    unsigned int expected_position = hash % d->array_allocated;
-    struct dict_entry *entry = &d->entries_array[expected_position];
+    return dict_get_n(d, key, strlen(key));
+}
+
+
+/**
+ * Get value by key of `key_len' bytes.
+ */
+const char *
+dict_get_n(struct dict *d, const char *key, size_t key_len)
+{
+    DICT_INSTR_OP(gets);
+    if (_is_rehashing(d)) {
+        _rehash_step(d);
+    }
 
-    while (!_is_entry_matches(*entry, hash, key) &&
-            entry->kind != ENTRY_EMPTY) {
-        expected_position = (expected_position + 1) % d->array_allocated;
-        entry = &d->entries_array[expected_position];
+    uint64_t hash = d->hash_function(key, key_len);
+    size_t position = _lookup(d, hash, key, key_len);
+
+    if (position != d->array_allocated) {
+        return d->entries_array[position].value;
     }
 
-    if (entry->kind == ENTRY_EMPTY || entry->kind == ENTRY_DELETED) {
-        return NULL;
+    if (_is_rehashing(d)) {
+        position = _lookup_old(d, hash, key, key_len);
+        if (position != d->old_array_allocated) {
+            return d->old_entries_array[position].value;
+        }
+    }
+
+    return NULL;
+}
+
+
+/**
+ * Get values of `n' keys, see header.
+ *
+ * Keys go in batches of `DICT_GET_BATCH', every stage being done for the
+ * whole batch before the next one: hash keys and prefetch their home
+ * control bytes and entries, prefetch keys of the first tag matches, then
+ * probe. Each stage only touches memory prefetched by the previous one, so
+ * misses of a batch are waited for about once.
+ */
+void
+dict_get_many(
+    struct dict *d, const char *const *keys, size_t n, const char **values)
+{
+    if (_is_rehashing(d)) {
+        // Lookups go to both tables and move entries, one by one.
+        for (size_t i = 0; i < n; ++i) {
+            values[i] = dict_get(d, keys[i]);
+        }
+
+        return;
     }
 
-    return entry->value;
+    size_t size_mask = d->array_allocated - 1;
+    uint64_t hashes[DICT_GET_BATCH];
+    size_t key_lens[DICT_GET_BATCH];
+
+    for (size_t start = 0; start < n; start += DICT_GET_BATCH) {
+        const char *const *batch = keys + start;
+        size_t count = n - start < DICT_GET_BATCH ? n - start : DICT_GET_BATCH;
+
+        for (size_t i = 0; i < count; ++i) {
+            key_lens[i] = strlen(batch[i]);
+            hashes[i] = d->hash_function(batch[i], key_lens[i]);
+            size_t position = hashes[i] & size_mask;
+            __builtin_prefetch(&d->ctrl_array[position]);
+            __builtin_prefetch(&d->entries_array[position]);
+        }
+
+        for (size_t i = 0; i < count; ++i) {
+            size_t position = hashes[i] & size_mask;
+            group_mask_t mask = _group_match(
+                &d->ctrl_array[position], _hash_tag(hashes[i]));
+            if (mask != 0) {
+                position = (position + _group_mask_lowest(mask)) & size_mask;
+                __builtin_prefetch(d->entries_array[position].key);
+            }
+        }
+
+        for (size_t i = 0; i < count; ++i) {
+            size_t position = _lookup(d, hashes[i], batch[i], key_lens[i]);
+            values[start + i] = (
+                position != d->array_allocated ?
+                d->entries_array[position].value : NULL);
+        }
+    }
 }
 
 
@@ -164,25 +1141,49 @@ dict_get(struct dict *d, const char *key)
 void
 dict_set(struct dict *d, const char *key, const char *value)
 {
-    unsigned int hash = d->hash_function(key);
-    unsigned int expected_position = hash % d->array_allocated;
-    struct dict_entry *entry = &d->entries_array[expected_position];
+    dict_set_n(d, key, strlen(key), value);
+}
 
-    while (!_is_entry_matches(*entry, hash, key) &&
-            entry->kind == ENTRY_OK) {
-        expected_position = (expected_position + 1) % d->array_allocated;
-        entry = &d->entries_array[expected_position];
+
+/**
+ * Set value by key of `key_len' bytes.
+ */
+void
+dict_set_n(
+    struct dict *d, const char *key, size_t key_len, const char *value)
+{
+    DICT_INSTR_OP(sets);
+    uint64_t hash = d->hash_function(key, key_len);
+    if (_is_rehashing(d)) {
+        _rehash_step(d);
+    }
+    if (_is_rehashing(d)) {
+        _rehash_key(d, hash, key, key_len);
     }
 
-    if (entry->kind != ENTRY_OK) {
-        ++d->len;
+    size_t position = _lookup(d, hash, key, key_len);
+
+    if (position != d->array_allocated) {
+        struct dict_entry *entry = &d->entries_array[position];
+        if (d->flags & DICT_OWNED) {
+            d->arena_garbage += _owned_value_size(entry->value);
+        }
+        entry->value = _own_value(d, value);
+
+        _resize_array_if_needed(d);
+
+        return;
     }
 
-    entry->kind = ENTRY_OK;
-    entry->hash = hash;
-    entry->key = key;
-    entry->value = value;
+    struct dict_entry new_entry = {
+        .hash = hash,
+        .key = _own_key(d, key, key_len),
+        .key_len = key_len,
+        .value = _own_value(d, value),
+    };
+    _place_entry(d, new_entry);
 
+    ++d->len;
     _resize_array_if_needed(d);
 }
 
@@ -193,18 +1194,39 @@ dict_set(struct dict *d, const char *key, const char *value)
 void
 dict_del(struct dict *d, const char *key)
 {
-    unsigned int hash = d->hash_function(key);
-    unsigned int expected_position = hash % d->array_allocated;
+    dict_del_n(d, key, strlen(key));
+}
 
-    struct dict_entry *entry = &d->entries_array[expected_position];
-    while (!_is_entry_matches(*entry, hash, key) &&
-            entry->kind != ENTRY_EMPTY) {
-        expected_position = (expected_position + 1) % d->array_allocated;
-        entry = &d->entries_array[expected_position];
+
+/**
+ * Remove item by key of `key_len' bytes.
+ */
+void
+dict_del_n(struct dict *d, const char *key, size_t key_len)
+{
+    DICT_INSTR_OP(dels);
+    uint64_t hash = d->hash_function(key, key_len);
+    if (_is_rehashing(d)) {
+        _rehash_step(d);
+    }
+    if (_is_rehashing(d)) {
+        _rehash_key(d, hash, key, key_len);
     }
 
-    if (entry->kind == ENTRY_OK) {
-        entry->kind = ENTRY_DELETED;
+    size_t position = _lookup(d, hash, key, key_len);
+
+    if (position != d->array_allocated) {
+        if (d->flags & DICT_OWNED) {
+            struct dict_entry *entry = &d->entries_array[position];
+            d->arena_garbage += (
+                entry->key_len + 1 + _owned_value_size(entry->value));
+        }
+
+        if (d->flags & DICT_ROBIN_HOOD) {
+            _backward_shift_delete(d, position);
+        } else {
+            _set_ctrl(d, position, ENTRY_DELETED);
+        }
         --d->len;
 
         _resize_array_if_needed(d);
@@ -212,21 +1234,439 @@ dict_del(struct dict *d, const char *key)
 }
 
 
+/**
+ * Start iteration over dictionary entries, see header.
+ */
+void
+dict_iter_init(struct dict_iter *it, struct dict *d)
+{
+    _finish_rehash(d);
+    it->d = d;
+    it->pos = 0;
+}
+
+
+/**
+ * Get next entry of iteration, see header.
+ */
+bool
+dict_iter_next(
+    struct dict_iter *it,
+    const char **key,
+    size_t *key_len,
+    const char **value)
+{
+    struct dict *d = it->d;
+    while (it->pos < d->array_allocated) {
+        size_t pos = it->pos++;
+        if (_is_ctrl_full(d->ctrl_array[pos])) {
+            struct dict_entry *entry = &d->entries_array[pos];
+            *key = entry->key;
+            *key_len = entry->key_len;
+            *value = entry->value;
+
+            return true;
+        }
+    }
+
+    return false;
+}
+
+
+/**
+ * Scan dictionary entries by cursor, see header.
+ */
+uint64_t
+dict_scan(
+    struct dict *d,
+    uint64_t cursor,
+    size_t count,
+    void (*fn)(void *arg, const char *key, size_t key_len, const char *value),
+    void *arg)
+{
+    // Entries of a home slot may be in both tables during a rehash, so it
+    // is finished first.
+    _finish_rehash(d);
+    if (count == 0) {
+        count = 1;
+    }
+
+    size_t mask = d->array_allocated - 1;
+    size_t passed = 0;
+    size_t visited = 0;
+    do {
+        // Entries of the home slot are in its probe run, which ends at an
+        // empty slot.
+        size_t home = cursor & mask;
+        for (size_t distance = 0;
+                distance <= d->max_displacement;
+                ++distance) {
+            size_t pos = (home + distance) & mask;
+            uint8_t ctrl = d->ctrl_array[pos];
+            if (ctrl == ENTRY_EMPTY) {
+                break;
+            }
+            struct dict_entry *entry = &d->entries_array[pos];
+            if (_is_ctrl_full(ctrl) && (entry->hash & mask) == home) {
+                fn(arg, entry->key, entry->key_len, entry->value);
+                ++passed;
+            }
+        }
+        cursor = dict_scan_next_cursor(cursor, mask);
+        ++visited;
+    } while (cursor != 0 &&
+            passed < count &&
+            visited < count * DICT_SCAN_MAX_VISITS);
+
+    return cursor;
+}
+
+
+/**
+ * State shared by tasks of `dict_build'.
+ */
+struct dict_build_job
+{
+    struct dict *d;
+    const char *const *keys;
+    const char *const *values;
+    struct dict_bulk bulk;
+    // Per region: number of keys which did not fit into it, number of
+    // entries placed and largest displacement.
+    size_t *overflows;
+    size_t *placed;
+    size_t *max_displacements;
+    // Per region arenas of `DICT_OWNED' dictionary.
+    struct dict_arena *arenas;
+};
+
+
+/**
+ * Place key `i' of bulk build into its probe run, or replace value of equal
+ * key found on the way. Return false if the run reaches slot `end'.
+ */
+static inline bool
+_build_place_key(
+    struct dict_build_job *job,
+    size_t i,
+    size_t end,
+    size_t *placed,
+    size_t *max_displacement)
+{
+    struct dict *d = job->d;
+    uint64_t hash = job->bulk.hashes[i];
+    size_t key_len = job->bulk.key_lens[i];
+    uint8_t tag = _hash_tag(hash);
+    size_t position = hash & (d->array_allocated - 1);
+    size_t distance = 0;
+
+    while (_is_ctrl_full(d->ctrl_array[position])) {
+        struct dict_entry *entry = &d->entries_array[position];
+        if (d->ctrl_array[position] == tag &&
+                _is_entry_matches(*entry, hash, job->keys[i], key_len)) {
+            entry->value = job->values[i];
+
+            return true;
+        }
+
+        ++distance;
+        if (++position == end) {
+            return false;
+        }
+    }
+
+    struct dict_entry new_entry = {
+        .hash = hash,
+        .key = job->keys[i],
+        .key_len = key_len,
+        .value = job->values[i],
+    };
+    d->entries_array[position] = new_entry;
+    _set_ctrl(d, position, tag);
+    ++*placed;
+    if (distance > *max_displacement) {
+        *max_displacement = distance;
+    }
+
+    return true;
+}
+
+
+/**
+ * Place keys of region in order of their home slots (stable, so the last
+ * of equal keys is placed last). Runs then need no Robin Hood swaps, and
+ * keys running past the region end are left for `dict_build' at the start
+ * of the region's part of `order'.
+ */
+static void
+_build_region(void *arg, size_t region)
+{
+    struct dict_build_job *job = arg;
+    struct dict_bulk *bulk = &job->bulk;
+    size_t start = bulk->region_starts[region];
+    size_t end = bulk->region_starts[region + 1];
+    size_t region_end = (region + 1) * bulk->region_size;
+    if (region_end > bulk->table_size) {
+        region_end = bulk->table_size;
+    }
+
+    size_t *sorted = safe_malloc(sizeof(size_t) * (end - start + 1));
+    _sort_by_home_slot(bulk, region, sorted);
+
+    size_t overflows = 0;
+    size_t placed = 0;
+    size_t max_displacement = 0;
+    for (size_t k = 0; k < end - start; ++k) {
+        size_t i = sorted[k];
+        if (!_build_place_key(
+                job, i, region_end, &placed, &max_displacement)) {
+            bulk->order[start + overflows++] = i;
+        }
+    }
+    job->overflows[region] = overflows;
+    job->placed[region] = placed;
+    job->max_displacements[region] = max_displacement;
+
+    free(sorted);
+}
+
+
+/**
+ * Copy strings of entries of region into region's arena.
+ */
+static void
+_build_own_region(void *arg, size_t region)
+{
+    struct dict_build_job *job = arg;
+    struct dict *d = job->d;
+    size_t start = region * job->bulk.region_size;
+    size_t end = start + job->bulk.region_size;
+    if (end > d->array_allocated) {
+        end = d->array_allocated;
+    }
+
+    for (size_t position = start; position < end; ++position) {
+        if (_is_ctrl_full(d->ctrl_array[position])) {
+            _copy_entry_strings(
+                &job->arenas[region], &d->entries_array[position]);
+        }
+    }
+}
+
+
+/**
+ * Create dictionary of `n' keys and values, see header.
+ *
+ * Keys are hashed and grouped by table region first. Every region is then
+ * filled by one task, and keys which do not fit into their region are
+ * placed afterwards. Owned strings are copied once all values are final.
+ */
+struct dict *
+dict_build(
+    uint64_t (*hash_function)(const char *, size_t),
+    int flags,
+    const char *const *keys,
+    const char *const *values,
+    size_t n,
+    struct dict_pool *pool)
+{
+    struct dict *d = dict_init_flags(hash_function, flags);
+    if (n == 0) {
+        return d;
+    }
+    dict_reserve(d, n);
+
+    struct dict_build_job job = {
+        .d = d,
+        .keys = keys,
+        .values = values,
+    };
+    dict_bulk_init(
+        &job.bulk, hash_function, keys, n,
+        d->array_allocated, DICT_BUILD_REGION_SIZE, pool);
+    size_t regions = job.bulk.regions;
+    job.overflows = safe_malloc(sizeof(size_t) * regions);
+    job.placed = safe_malloc(sizeof(size_t) * regions);
+    job.max_displacements = safe_malloc(sizeof(size_t) * regions);
+    job.arenas = safe_malloc(sizeof(struct dict_arena) * regions);
+
+    dict_pool_run(pool, regions, _build_region, &job);
+    for (size_t region = 0; region < regions; ++region) {
+        d->len += job.placed[region];
+        if (job.max_displacements[region] > d->max_displacement) {
+            d->max_displacement = job.max_displacements[region];
+        }
+    }
+
+    for (size_t region = 0; region < regions; ++region) {
+        size_t start = job.bulk.region_starts[region];
+        for (size_t k = 0; k < job.overflows[region]; ++k) {
+            size_t i = job.bulk.order[start + k];
+            uint64_t hash = job.bulk.hashes[i];
+            size_t position = _lookup(d, hash, keys[i], job.bulk.key_lens[i]);
+            if (position != d->array_allocated) {
+                d->entries_array[position].value = values[i];
+                continue;
+            }
+
+            struct dict_entry new_entry = {
+                .hash = hash,
+                .key = keys[i],
+                .key_len = job.bulk.key_lens[i],
+                .value = values[i],
+            };
+            _place_entry(d, new_entry);
+            ++d->len;
+        }
+    }
+
+    if (flags & DICT_OWNED) {
+        for (size_t region = 0; region < regions; ++region) {
+            dict_arena_init(&job.arenas[region]);
+        }
+        dict_pool_run(pool, regions, _build_own_region, &job);
+        for (size_t region = 0; region < regions; ++region) {
+            dict_arena_merge(&d->arena, &job.arenas[region]);
+        }
+    }
+    // Room was reserved for building only.
+    d->reserved = 0;
+
+    free(job.arenas);
+    free(job.max_displacements);
+    free(job.placed);
+    free(job.overflows);
+    dict_bulk_destroy(&job.bulk);
+
+    return d;
+}
+
+
+/**
+ * Write dictionary contents to `fd', see header.
+ */
+bool
+dict_dump(struct dict *d, int fd)
+{
+    _finish_rehash(d);
+
+    struct dict_stream_writer writer;
+    dict_stream_writer_init(&writer, fd, d->len);
+    for (size_t i = 0; i < d->array_allocated; ++i) {
+        struct dict_entry *entry = &d->entries_array[i];
+        if (_is_ctrl_full(d->ctrl_array[i])) {
+            dict_stream_write(
+                &writer, entry->key, entry->key_len, entry->value);
+        }
+    }
+
+    return dict_stream_writer_finish(&writer);
+}
+
+
+/**
+ * Create dictionary from contents written by `dict_dump', see header.
+ */
+struct dict *
+dict_load(
+    uint64_t (*hash_function)(const char *, size_t), int flags, int fd)
+{
+    struct dict_stream_reader reader;
+    if (!dict_stream_reader_init(&reader, fd)) {
+        return NULL;
+    }
+
+    struct dict *d = dict_init_flags(hash_function, flags | DICT_OWNED);
+    dict_reserve(d, reader.len);
+
+    const char *key;
+    size_t key_len;
+    const char *value;
+    while (dict_stream_read(&reader, &key, &key_len, &value)) {
+        dict_set_n(d, key, key_len, value);
+    }
+    if (!dict_stream_reader_finish(&reader)) {
+        int read_errno = errno;
+        dict_destroy(d);
+        errno = read_errno;
+
+        return NULL;
+    }
+    // Room was reserved for loading only.
+    d->reserved = 0;
+
+    return d;
+}
+
+
+/**
+ * Fill statistics of dictionary, see header.
+ */
+void
+dict_stats(struct dict *d, struct dict_stats *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    stats->len = d->len;
+    stats->capacity = d->array_allocated;
+    stats->max_displacement = d->max_displacement;
+    stats->entries_bytes = sizeof(struct dict_entry) * d->array_allocated;
+    stats->ctrl_bytes = d->array_allocated + DICT_GROUP_WIDTH;
+    stats->arena_bytes = d->arena.allocated;
+    stats->is_rehashing = _is_rehashing(d);
+    stats->resizes = d->resizes;
+    stats->rebuilds = d->rebuilds;
+
+    if (stats->is_rehashing) {
+        stats->entries_bytes += (
+            sizeof(struct dict_entry) * d->old_array_allocated);
+        stats->ctrl_bytes += d->old_array_allocated + DICT_GROUP_WIDTH;
+        if (d->rehash_repacks_arena) {
+            stats->arena_bytes += d->old_arena.allocated;
+        }
+    }
+
+    size_t full = 0;
+    for (size_t i = 0; i < d->array_allocated; ++i) {
+        uint8_t ctrl = d->ctrl_array[i];
+        if (ctrl == ENTRY_DELETED) {
+            ++stats->tombstones;
+        } else if (_is_ctrl_full(ctrl)) {
+            size_t length = _displacement(
+                d->entries_array[i].hash, i, d->array_allocated - 1);
+            if (length >= DICT_STATS_PROBE_LENGTHS) {
+                length = DICT_STATS_PROBE_LENGTHS - 1;
+            }
+            ++stats->probe_lengths[length];
+            ++full;
+        }
+    }
+    stats->load_factor = (double) full / d->array_allocated;
+}
+
+
 /**
  * Draw dict contents for debugging.
  */
 void
 dict_draw(struct dict *d)
 {
+    if (_is_rehashing(d)) {
+        printf(
+            "Rehashing: %ld of %ld old slots visited\n",
+            d->rehash_pos,
+            d->old_array_allocated);
+    }
+
     for (size_t i = 0; i < d->array_allocated; ++i) {
         struct dict_entry *entry = &d->entries_array[i];
 
         printf("%ld:\t", i);
 
-        if (entry->kind != ENTRY_OK) {
+        if (!_is_ctrl_full(d->ctrl_array[i])) {
             printf("-");
         } else {
-            printf("%s:%s", entry->key, entry->value);
+            printf(
+                "%.*s:%s", (int) entry->key_len, entry->key, entry->value);
             if (entry->hash % d->array_allocated != i) {
                 printf("    (must be %ld)", entry->hash % d->array_allocated);
             }
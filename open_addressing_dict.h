@@ -1,17 +1,38 @@
 #ifndef OPEN_ADDRESSING_DICT_H
 #define OPEN_ADDRESSING_DICT_H
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "dict_arena.h"
+#include "dict_pool.h"
+
+
+// `dict_init_flags' flags.
+// Robin Hood insertion with backward-shift deletion. Entries far from their
+// home slot take the place of entries closer to theirs, and deleted entries
+// are filled by shifting their neighbours back, so there are no tombstones.
+#define DICT_ROBIN_HOOD 0x1
+// Dictionary copies keys and values into its own arena, so callers need not
+// keep them alive. Values must be zero-terminated strings.
+#define DICT_OWNED 0x2
+// Resizes are spread over later operations instead of being done at once:
+// entries are moved to a new table a few per call, and lookups check both
+// tables until the move is done.
+#define DICT_INCREMENTAL 0x4
+
 
 /**
  * One dict item.
  */
 struct dict_entry
 {
-    unsigned int hash;
+    uint64_t hash;
     const char *key;
+    // Key length, keys need not be zero-terminated.
+    size_t key_len;
     const char *value;
-    // Kind of item. It can be normal, empty or deleted.
-    int kind;
 };
 
 
@@ -23,13 +44,99 @@ struct dict
     // Array containing entries. Entry position in this array is determined by
     // hash function.
     struct dict_entry *entries_array;
+    // Control byte for every slot of `entries_array': 7-bit hash tag for used
+    // slots, or empty/deleted mark. Probing scans these bytes a group at a
+    // time and loads entries only on tag match. The first group is mirrored
+    // after the last slot, so a group can be loaded from any position.
+    uint8_t *ctrl_array;
     // Number of dictionary entries.
     size_t len;
-    // `entries_array' length.
+    // `entries_array' length, a power of two (see `dict_scan').
     size_t array_allocated;
+    // Largest distance from an entry to its home slot since the last resize.
+    // Lookups never probe further than this.
+    size_t max_displacement;
+    // Number of entries `dict_reserve' made room for. `entries_array' is
+    // not shrunk below the size for this number of entries.
+    size_t reserved;
+    // `DICT_*' flags given to `dict_init_flags'.
+    int flags;
+
+    // Hash function, called with key and key length.
+    uint64_t (*hash_function)(const char *, size_t);
+    // Pool to resize large table on, NULL to resize in the calling thread.
+    struct dict_pool *thread_pool;
+
+    // Storage for keys and values of `DICT_OWNED' dictionary.
+    struct dict_arena arena;
+    // Bytes of `arena' taken by deleted keys and replaced values. They are
+    // reclaimed by copying live strings into a new arena.
+    size_t arena_garbage;
 
-    // Hash function
-    unsigned int (*hash_function)(const char *);
+    // Table being rehashed by `DICT_INCREMENTAL' dictionary, NULL if there
+    // is no rehash in progress. Slots before `rehash_pos' have been moved.
+    // Moved and deleted old entries are marked deleted, so old entries are
+    // never shifted.
+    struct dict_entry *old_entries_array;
+    uint8_t *old_ctrl_array;
+    size_t old_array_allocated;
+    size_t old_max_displacement;
+    size_t rehash_pos;
+    // Whether moved entries get their strings copied from `old_arena' into
+    // `arena'. `old_arena' is freed when rehash ends.
+    bool rehash_repacks_arena;
+    struct dict_arena old_arena;
+
+    // Number of rehashes into a table of another size and of the same size
+    // (dropping deleted slots), for `dict_stats'.
+    uint64_t resizes;
+    uint64_t rebuilds;
+};
+
+
+// Size of `dict_stats' probe length histogram.
+#define DICT_STATS_PROBE_LENGTHS 16
+
+
+/**
+ * Statistics of dictionary, see `dict_stats'.
+ */
+struct dict_stats
+{
+    // Number of entries.
+    size_t len;
+    // Slots of the current table, and share of them taken by entries.
+    size_t capacity;
+    double load_factor;
+    // Deleted slots of the current table.
+    size_t tombstones;
+    // Largest distance from an entry to its home slot since the last
+    // resize.
+    size_t max_displacement;
+    // Bytes allocated for entries arrays, control arrays and arena of
+    // `DICT_OWNED' dictionary.
+    size_t entries_bytes;
+    size_t ctrl_bytes;
+    size_t arena_bytes;
+    // Whether `DICT_INCREMENTAL' rehash is in progress. Its old table is
+    // counted in the bytes above.
+    bool is_rehashing;
+    // Number of entries of the current table `i' slots after their home
+    // slot, the last item counts longer probes too.
+    size_t probe_lengths[DICT_STATS_PROBE_LENGTHS];
+    // Cumulative counts since the dictionary was created.
+    uint64_t resizes;
+    uint64_t rebuilds;
+};
+
+
+/**
+ * Iterator over dictionary entries, in table order.
+ */
+struct dict_iter
+{
+    struct dict *d;
+    size_t pos;
 };
 
 
@@ -37,7 +144,30 @@ struct dict
  * Create new dictionary object.
  */
 struct dict *
-dict_init(unsigned int (*hash_function)(const char *));
+dict_init(uint64_t (*hash_function)(const char *, size_t));
+
+
+/**
+ * Create new dictionary object with given `DICT_*' flags.
+ */
+struct dict *
+dict_init_flags(
+    uint64_t (*hash_function)(const char *, size_t), int flags);
+
+
+/**
+ * Create dictionary of `n' keys and values in one pass, as if they were set
+ * one by one (the last value of equal keys wins). Keys are zero-terminated.
+ * Work is spread over `pool' threads, NULL builds in the calling thread.
+ */
+struct dict *
+dict_build(
+    uint64_t (*hash_function)(const char *, size_t),
+    int flags,
+    const char *const *keys,
+    const char *const *values,
+    size_t n,
+    struct dict_pool *pool);
 
 
 /**
@@ -47,6 +177,25 @@ void
 dict_destroy(struct dict *);
 
 
+/**
+ * Make room for given number of entries, so the dictionary is not resized
+ * until it holds more. The room is kept when entries are deleted; reserving
+ * 0 entries drops it.
+ */
+void
+dict_reserve(struct dict *, size_t);
+
+
+/**
+ * Resize large table on `pool' threads; NULL (the default) resizes in the
+ * calling thread. Incremental rehash steps are not affected. A pool runs
+ * one job at a time, so dictionaries sharing it must not be resized from
+ * different threads at once.
+ */
+void
+dict_set_pool(struct dict *, struct dict_pool *);
+
+
 /**
  * Get value by key.
  */
@@ -54,6 +203,22 @@ const char *
 dict_get(struct dict *, const char *);
 
 
+/**
+ * Get value by key of given length.
+ */
+const char *
+dict_get_n(struct dict *, const char *, size_t);
+
+
+/**
+ * Get values of `n' zero-terminated keys into `values' (NULL for missing
+ * keys). Lookups are interleaved, so their cache misses overlap.
+ */
+void
+dict_get_many(
+    struct dict *, const char *const *keys, size_t n, const char **values);
+
+
 /**
  * Set value by key.
  */
@@ -61,6 +226,14 @@ void
 dict_set(struct dict *, const char *, const char *);
 
 
+/**
+ * Set value by key of given length. The key is stored by pointer, so it must
+ * outlive the entry.
+ */
+void
+dict_set_n(struct dict *, const char *, size_t, const char *);
+
+
 /**
  * Remove item by key.
  */
@@ -68,6 +241,81 @@ void
 dict_del(struct dict *, const char *);
 
 
+/**
+ * Remove item by key of given length.
+ */
+void
+dict_del_n(struct dict *, const char *, size_t);
+
+
+/**
+ * Start iteration over dictionary entries. The dictionary must not be
+ * changed until the iteration is done; see `dict_scan' otherwise.
+ */
+void
+dict_iter_init(struct dict_iter *, struct dict *);
+
+
+/**
+ * Get next entry of iteration into `key', `key_len' and `value'. Return
+ * false when there are no more entries.
+ */
+bool
+dict_iter_next(
+    struct dict_iter *, const char **key, size_t *key_len, const char **value);
+
+
+/**
+ * Call `fn' with `arg', key, key length and value for entries of home slots
+ * from `cursor' on (0 to start), until about `count' entries are passed,
+ * and return cursor to continue from, 0 when the scan is done. The
+ * dictionary may be changed between calls, so large dictionaries are
+ * scanned in bounded steps. Home slots are visited in reverse binary order
+ * (see `dict_scan_next_cursor'), so entries present during the whole scan
+ * are passed at least once although the table is resized meanwhile (some
+ * may be passed again if it shrinks), and other ones may be passed or not.
+ * `fn' must not change the dictionary.
+ */
+uint64_t
+dict_scan(
+    struct dict *,
+    uint64_t cursor,
+    size_t count,
+    void (*fn)(void *arg, const char *key, size_t key_len, const char *value),
+    void *arg);
+
+
+/**
+ * Write dictionary contents to file descriptor `fd' as a stream of
+ * checksummed blocks (see dict_stream.h), one block in memory at a time.
+ * Values must be zero-terminated strings. Return false on error, with
+ * `errno' set.
+ */
+bool
+dict_dump(struct dict *, int fd);
+
+
+/**
+ * Create dictionary with given `DICT_*' flags from stream written by
+ * `dict_dump' of any backend to `fd', read a block at a time. The
+ * dictionary is sized for the recorded number of entries up front.
+ * `DICT_OWNED' is added to the flags, as keys and values are copied out of
+ * the read buffer. Return NULL on error, with `errno' set (`EINVAL' for
+ * malformed or corrupted data).
+ */
+struct dict *
+dict_load(
+    uint64_t (*hash_function)(const char *, size_t), int flags, int fd);
+
+
+/**
+ * Fill `stats' of dictionary, for monitoring. Takes time linear in table
+ * size.
+ */
+void
+dict_stats(struct dict *, struct dict_stats *);
+
+
 /**
  * Draw dict contents for debugging.
  */
@@ -0,0 +1,291 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sharded_dict.h"
+
+// Backend of shard dictionaries. Every backend provides the same `dict_*'
+// API, so the program is linked against exactly one of them.
+#ifndef SHARDED_DICT_BACKEND_HEADER
+#define SHARDED_DICT_BACKEND_HEADER "compact_dict.h"
+#endif
+
+#include SHARDED_DICT_BACKEND_HEADER
+
+
+// Odd 64-bit constant for mixing hash into shard number.
+#define SHARD_MIX 0x9E3779B97F4A7C15ULL
+
+
+/**
+ * Malloc. Exit on failure.
+ */
+static inline void *
+safe_malloc(size_t size)
+{
+    void *ptr = malloc(size);
+    if (ptr == NULL) {
+        printf("fatal: Memory allocation failed\n");
+        exit(1);
+    }
+
+    return ptr;
+}
+
+
+/**
+ * Get shard of key hash.
+ *
+ * Backends take home slots from low hash bits and tags from high ones, so
+ * the shard number is taken from high bits of the hash multiplied by an odd
+ * constant: keys of one shard still differ in all hash bits.
+ */
+static inline struct sharded_dict_shard *
+_get_shard(struct sharded_dict *sd, uint64_t hash)
+{
+    if (sd->shard_bits == 0) {
+        return &sd->shards[0];
+    }
+
+    return &sd->shards[(hash * SHARD_MIX) >> (64 - sd->shard_bits)];
+}
+
+
+/**
+ * Lock shard for reading. Lookups of `DICT_INCREMENTAL' dictionary move
+ * entries, so they lock for writing.
+ */
+static inline void
+_lock_read(struct sharded_dict *sd, struct sharded_dict_shard *shard)
+{
+    if (sd->flags & DICT_INCREMENTAL) {
+        if (pthread_rwlock_trywrlock(&shard->lock) != 0) {
+            __atomic_fetch_add(&shard->contended, 1, __ATOMIC_RELAXED);
+            pthread_rwlock_wrlock(&shard->lock);
+        }
+    } else if (pthread_rwlock_tryrdlock(&shard->lock) != 0) {
+        __atomic_fetch_add(&shard->contended, 1, __ATOMIC_RELAXED);
+        pthread_rwlock_rdlock(&shard->lock);
+    }
+}
+
+
+/**
+ * Lock shard for writing.
+ */
+static inline void
+_lock_write(struct sharded_dict_shard *shard)
+{
+    if (pthread_rwlock_trywrlock(&shard->lock) != 0) {
+        __atomic_fetch_add(&shard->contended, 1, __ATOMIC_RELAXED);
+        pthread_rwlock_wrlock(&shard->lock);
+    }
+}
+
+
+/**
+ * Create sharded dictionary.
+ */
+struct sharded_dict *
+sharded_dict_init(
+    uint64_t (*hash_function)(const char *, size_t),
+    int flags,
+    size_t shards)
+{
+    struct sharded_dict *sd = safe_malloc(sizeof(struct sharded_dict));
+    sd->hash_function = hash_function;
+    sd->flags = flags;
+
+    sd->shard_bits = 0;
+    while (((size_t) 1 << sd->shard_bits) < shards) {
+        ++sd->shard_bits;
+    }
+    sd->shards_count = (size_t) 1 << sd->shard_bits;
+
+    sd->shards = aligned_alloc(
+        _Alignof(struct sharded_dict_shard),
+        sizeof(struct sharded_dict_shard) * sd->shards_count);
+    if (sd->shards == NULL) {
+        printf("fatal: Memory allocation failed\n");
+        exit(1);
+    }
+    for (size_t i = 0; i < sd->shards_count; ++i) {
+        struct sharded_dict_shard *shard = &sd->shards[i];
+        pthread_rwlock_init(&shard->lock, NULL);
+        shard->dict = dict_init_flags(hash_function, flags);
+        shard->contended = 0;
+    }
+
+    return sd;
+}
+
+
+/**
+ * Destroy sharded dictionary.
+ */
+void
+sharded_dict_destroy(struct sharded_dict *sd)
+{
+    for (size_t i = 0; i < sd->shards_count; ++i) {
+        dict_destroy(sd->shards[i].dict);
+        pthread_rwlock_destroy(&sd->shards[i].lock);
+    }
+    free(sd->shards);
+    free(sd);
+}
+
+
+/**
+ * Get value by key.
+ */
+const char *
+sharded_dict_get(struct sharded_dict *sd, const char *key)
+{
+    return sharded_dict_get_n(sd, key, strlen(key));
+}
+
+
+/**
+ * Get value by key of `key_len' bytes.
+ */
+const char *
+sharded_dict_get_n(struct sharded_dict *sd, const char *key, size_t key_len)
+{
+    struct sharded_dict_shard *shard = _get_shard(
+        sd, sd->hash_function(key, key_len));
+
+    _lock_read(sd, shard);
+    const char *value = dict_get_n(shard->dict, key, key_len);
+    pthread_rwlock_unlock(&shard->lock);
+
+    return value;
+}
+
+
+/**
+ * Copy value of key into `buf'.
+ */
+size_t
+sharded_dict_get_copy(
+    struct sharded_dict *sd, const char *key, char *buf, size_t size)
+{
+    size_t key_len = strlen(key);
+    struct sharded_dict_shard *shard = _get_shard(
+        sd, sd->hash_function(key, key_len));
+
+    _lock_read(sd, shard);
+    size_t value_len = SIZE_MAX;
+    const char *value = dict_get_n(shard->dict, key, key_len);
+    if (value != NULL) {
+        value_len = strlen(value);
+        if (size > 0) {
+            size_t copied = value_len < size ? value_len : size - 1;
+            memcpy(buf, value, copied);
+            buf[copied] = '\0';
+        }
+    }
+    pthread_rwlock_unlock(&shard->lock);
+
+    return value_len;
+}
+
+
+/**
+ * Set value by key.
+ */
+void
+sharded_dict_set(struct sharded_dict *sd, const char *key, const char *value)
+{
+    sharded_dict_set_n(sd, key, strlen(key), value);
+}
+
+
+/**
+ * Set value by key of `key_len' bytes.
+ */
+void
+sharded_dict_set_n(
+    struct sharded_dict *sd,
+    const char *key,
+    size_t key_len,
+    const char *value)
+{
+    struct sharded_dict_shard *shard = _get_shard(
+        sd, sd->hash_function(key, key_len));
+
+    _lock_write(shard);
+    dict_set_n(shard->dict, key, key_len, value);
+    pthread_rwlock_unlock(&shard->lock);
+}
+
+
+/**
+ * Remove item by key.
+ */
+void
+sharded_dict_del(struct sharded_dict *sd, const char *key)
+{
+    sharded_dict_del_n(sd, key, strlen(key));
+}
+
+
+/**
+ * Remove item by key of `key_len' bytes.
+ */
+void
+sharded_dict_del_n(struct sharded_dict *sd, const char *key, size_t key_len)
+{
+    struct sharded_dict_shard *shard = _get_shard(
+        sd, sd->hash_function(key, key_len));
+
+    _lock_write(shard);
+    dict_del_n(shard->dict, key, key_len);
+    pthread_rwlock_unlock(&shard->lock);
+}
+
+
+/**
+ * Number of entries in all shards.
+ */
+size_t
+sharded_dict_len(struct sharded_dict *sd)
+{
+    struct sharded_dict_stats stats;
+    sharded_dict_stats(sd, &stats);
+
+    return stats.len;
+}
+
+
+/**
+ * Fill aggregated statistics.
+ */
+void
+sharded_dict_stats(struct sharded_dict *sd, struct sharded_dict_stats *stats)
+{
+    stats->len = 0;
+    stats->shards = sd->shards_count;
+    stats->min_shard_len = SIZE_MAX;
+    stats->max_shard_len = 0;
+    stats->contended = 0;
+
+    for (size_t i = 0; i < sd->shards_count; ++i) {
+        struct sharded_dict_shard *shard = &sd->shards[i];
+
+        // Lookups of `DICT_INCREMENTAL' dictionary write, but `len' is
+        // only read here.
+        pthread_rwlock_rdlock(&shard->lock);
+        size_t len = shard->dict->len;
+        pthread_rwlock_unlock(&shard->lock);
+
+        stats->len += len;
+        if (len < stats->min_shard_len) {
+            stats->min_shard_len = len;
+        }
+        if (len > stats->max_shard_len) {
+            stats->max_shard_len = len;
+        }
+        stats->contended += __atomic_load_n(
+            &shard->contended, __ATOMIC_RELAXED);
+    }
+}
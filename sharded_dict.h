@@ -0,0 +1,149 @@
+#ifndef SHARDED_DICT_H
+#define SHARDED_DICT_H
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+// Sharded dictionary is built on top of one dictionary backend, picked at
+// compile time (see `SHARDED_DICT_BACKEND_HEADER' in sharded_dict.c).
+struct dict;
+
+
+/**
+ * One shard: a dictionary and its lock. Shards take a cache line each, so
+ * locking one shard does not slow down threads using its neighbours.
+ */
+struct sharded_dict_shard
+{
+    pthread_rwlock_t lock;
+    struct dict *dict;
+    // Number of times the lock was busy when taken.
+    uint64_t contended;
+} __attribute__((aligned(64)));
+
+
+/**
+ * Thread-safe dictionary. Keys are spread by hash over independent shards,
+ * so threads working with different shards do not wait for each other.
+ */
+struct sharded_dict
+{
+    struct sharded_dict_shard *shards;
+    // Number of shards is `1 << shard_bits'.
+    size_t shards_count;
+    unsigned int shard_bits;
+
+    // Hash function, called with key and key length.
+    uint64_t (*hash_function)(const char *, size_t);
+    // `DICT_*' flags of shard dictionaries.
+    int flags;
+};
+
+
+/**
+ * Aggregated statistics of sharded dictionary.
+ */
+struct sharded_dict_stats
+{
+    // Number of entries in all shards.
+    size_t len;
+    size_t shards;
+    // Number of entries in the smallest and the biggest shard.
+    size_t min_shard_len;
+    size_t max_shard_len;
+    // Number of times a shard lock was busy when taken.
+    uint64_t contended;
+};
+
+
+/**
+ * Create sharded dictionary of at least `shards' shards (rounded up to a
+ * power of two), each created with given `DICT_*' flags.
+ */
+struct sharded_dict *
+sharded_dict_init(
+    uint64_t (*hash_function)(const char *, size_t),
+    int flags,
+    size_t shards);
+
+
+/**
+ * Destroy sharded dictionary. No other thread may be using it.
+ */
+void
+sharded_dict_destroy(struct sharded_dict *);
+
+
+/**
+ * Get value by key. Value of `DICT_OWNED' dictionary may be freed by any
+ * later change of the same shard, use `sharded_dict_get_copy' instead.
+ */
+const char *
+sharded_dict_get(struct sharded_dict *, const char *);
+
+
+/**
+ * Get value by key of given length, see `sharded_dict_get'.
+ */
+const char *
+sharded_dict_get_n(struct sharded_dict *, const char *, size_t);
+
+
+/**
+ * Copy value of key into `buf' of `size' bytes, truncated if needed and
+ * zero-terminated. Return value length, or `SIZE_MAX' if key is missing
+ * or its value is NULL (`buf' is not changed then).
+ */
+size_t
+sharded_dict_get_copy(
+    struct sharded_dict *, const char *, char *buf, size_t size);
+
+
+/**
+ * Set value by key.
+ */
+void
+sharded_dict_set(struct sharded_dict *, const char *, const char *);
+
+
+/**
+ * Set value by key of given length.
+ */
+void
+sharded_dict_set_n(
+    struct sharded_dict *, const char *, size_t, const char *);
+
+
+/**
+ * Remove item by key.
+ */
+void
+sharded_dict_del(struct sharded_dict *, const char *);
+
+
+/**
+ * Remove item by key of given length.
+ */
+void
+sharded_dict_del_n(struct sharded_dict *, const char *, size_t);
+
+
+/**
+ * Number of entries in all shards. Shards are counted one by one, so the
+ * result is not a snapshot while other threads change the dictionary.
+ */
+size_t
+sharded_dict_len(struct sharded_dict *);
+
+
+/**
+ * Fill aggregated statistics, see `sharded_dict_len' for consistency.
+ */
+void
+sharded_dict_stats(struct sharded_dict *, struct sharded_dict_stats *);
+
+
+#endif